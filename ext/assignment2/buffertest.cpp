@@ -1,5 +1,6 @@
 #include "buffer/BufferManager.h"
 
+#include <chrono>
 #include <iostream>
 #include <vector>
 #include <stdlib.h>
@@ -13,6 +14,7 @@ BufferManager* bm;
 unsigned pagesOnDisk;
 unsigned pagesInRAM;
 unsigned threadCount;
+unsigned partitionCount = DB_PAGE_TABLE_PARTITIONS;
 unsigned* threadSeed;
 volatile bool stop=false;
 
@@ -64,12 +66,14 @@ static void* readWrite(void *arg) {
 }
 
 int main(int argc, char** argv) {
-   if (argc==4) {
+   if (argc==4 || argc==5) {
       pagesOnDisk = atoi(argv[1]);
       pagesInRAM = atoi(argv[2]);
       threadCount = atoi(argv[3]);
+      if (argc==5)
+         partitionCount = atoi(argv[4]);
    } else {
-      cerr << "usage: " << argv[0] << " <pagesOnDisk> <pagesInRAM> <threads>" << endl;
+      cerr << "usage: " << argv[0] << " <pagesOnDisk> <pagesInRAM> <threads> [pageTablePartitions]" << endl;
       exit(1);
    }
 
@@ -77,7 +81,7 @@ int main(int argc, char** argv) {
    for (unsigned i=0; i<threadCount; i++)
       threadSeed[i] = i*97134;
 
-   bm = new BufferManager(pagesInRAM);
+   bm = new BufferManager(pagesInRAM, partitionCount);
 
    vector<pthread_t> threads(threadCount);
    pthread_attr_t pattr;
@@ -96,6 +100,7 @@ int main(int argc, char** argv) {
    pthread_create(&scanThread, &pattr, scan, NULL);
 
    // start read/write threads
+   auto start = chrono::high_resolution_clock::now();
    for (unsigned i=0; i<threadCount; i++)
       pthread_create(&threads[i], &pattr, readWrite, reinterpret_cast<void*>(i));
 
@@ -106,6 +111,11 @@ int main(int argc, char** argv) {
       pthread_join(threads[i], &ret);
       totalCount+=reinterpret_cast<uintptr_t>(ret);
    }
+   chrono::duration<double> elapsed = chrono::high_resolution_clock::now() - start;
+   unsigned fixes = (100000/threadCount)*threadCount;
+   cout << "read/write phase: " << fixes << " fixes with " << threadCount << " threads and "
+        << partitionCount << " page table partitions in " << elapsed.count() << "s ("
+        << static_cast<uint64_t>(fixes/elapsed.count()) << " fixes/s)" << endl;
 
    // wait for scan thread
    stop=true;
@@ -113,7 +123,7 @@ int main(int argc, char** argv) {
 
    // restart buffer manager
    delete bm;
-   bm = new BufferManager(pagesInRAM);
+   bm = new BufferManager(pagesInRAM, partitionCount);
    
    // check counter
    unsigned totalCountOnDisk = 0;
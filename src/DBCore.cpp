@@ -12,9 +12,10 @@
 /// <summary>
 /// Initializes a new instance of the <see cref="DBCore"/> class.
 /// </summary>
-DBCore::DBCore()
+/// <param name="bufferPages">The number of pages in the buffer pool.</param>
+DBCore::DBCore( uint32_t bufferPages ) : mSchemaLock( false, "DBCore::mSchemaLock" ), mBufferPages( bufferPages )
 {
-	mBufferManager = new BufferManager(5000);
+	mBufferManager = new BufferManager( mBufferPages );
 	LoadSchemaFromSeg0();
 }
 
@@ -52,6 +53,10 @@ void DBCore::WipeDatabase()
 		{
 			FileDelete( std::to_string( r.segmentId ) );
 		}
+		if ( FileExists( std::to_string( r.fsiSegmentId ) ) )
+		{
+			FileDelete( std::to_string( r.fsiSegmentId ) );
+		}
 
 		for ( Schema::Relation::Index& i : r.indices )
 		{
@@ -62,7 +67,11 @@ void DBCore::WipeDatabase()
 		}
 	}
 	// Recreate Buffer manager
-	mBufferManager = new BufferManager( 1000 );
+	mBufferManager = new BufferManager( mBufferPages );
+	if ( !mStatsDumpPath.empty() )
+	{
+		mBufferManager->StartStatsDump( mStatsDumpPath, mStatsDumpIntervalMs );
+	}
 	LoadSchemaFromSeg0();
 }
 
@@ -86,6 +95,7 @@ void DBCore::AddRelationsFromFile( const std::string& filename )
 	// Merge into master
 	mSchemaLock.LockWrite();
 	mMasterSchema.MergeSchema( *newSchema );
+	LoadDescriptorsFromSchema( false );
 	mSchemaLock.UnlockWrite();
 }
 
@@ -109,6 +119,7 @@ void DBCore::AddRelationsFromString( const std::string& sql )
 	// Merge into master
 	mSchemaLock.LockWrite();
 	mMasterSchema.MergeSchema( *newSchema );
+	LoadDescriptorsFromSchema( false );
 	mSchemaLock.UnlockWrite();
 }
 
@@ -121,12 +132,57 @@ BufferManager* DBCore::GetBufferManager()
 	return mBufferManager;
 }
 
+/// <summary>
+/// Resizes the buffer pool while the database is running. See BufferManager::Resize.
+/// </summary>
+/// <param name="bufferPages">The number of pages in the buffer pool.</param>
+/// <returns>The number of pages in the buffer pool after resizing.</returns>
+uint32_t DBCore::ResizeBuffer( uint32_t bufferPages )
+{
+	mBufferPages = mBufferManager->Resize( bufferPages );
+	return mBufferPages;
+}
+
+/// <summary>
+/// Gets a snapshot of the buffer manager statistics.
+/// </summary>
+/// <returns></returns>
+BufferManagerStats DBCore::GetBufferStats()
+{
+	return mBufferManager->GetStats();
+}
+
+/// <summary>
+/// Appends the buffer manager statistics to a file periodically. Keeps dumping if the database is wiped.
+/// </summary>
+/// <param name="path">The path of the file.</param>
+/// <param name="intervalMs">The interval in milliseconds.</param>
+void DBCore::StartBufferStatsDump( const std::string& path, uint32_t intervalMs )
+{
+	mStatsDumpPath = path;
+	mStatsDumpIntervalMs = intervalMs;
+	mBufferManager->StartStatsDump( path, intervalMs );
+}
+
+/// <summary>
+/// Stops dumping the buffer manager statistics.
+/// </summary>
+void DBCore::StopBufferStatsDump()
+{
+	mStatsDumpPath.clear();
+	mBufferManager->StopStatsDump();
+}
+
 /// <summary>
 /// Gets the schema. Does not guarantee any threadsafety on reading the schema.
 /// </summary>
 /// <returns></returns>
 const Schema* DBCore::GetSchema()
 {
+	// Page counts and roots are only copied into the schema on request
+	mSchemaLock.LockWrite();
+	StoreDescriptorsInSchema();
+	mSchemaLock.UnlockWrite();
 	return &mMasterSchema;
 }
 
@@ -157,26 +213,13 @@ std::vector<Schema::Relation::Attribute> DBCore::GetRelationAttributes( uint64_t
 }
 
 /// <summary>
-/// Gets the pages of a relation. Threadsafe iteration through schema. But number of pages can increase after return.
-/// Throws on non-existent relation
+/// Gets the pages of a relation. Number of pages can increase after return.
+/// Throws on non-existent relation. Hot paths should resolve the descriptor once instead.
 /// </summary>
 /// <returns></returns>
 uint64_t DBCore::GetPagesOfRelation( uint64_t segmentId )
 {
-	uint64_t pagecount = 0;
-	mSchemaLock.LockRead();
-	try
-	{
-		Schema::Relation& r = mMasterSchema.GetRelationWithSegmentId( segmentId );
-		pagecount = r.pagecount;
-	}
-	catch (std::runtime_error& e)
-	{
-		mSchemaLock.UnlockRead();
-		throw std::runtime_error( e.what() );
-	}
-	mSchemaLock.UnlockRead();
-	return pagecount;
+	return GetRelationDescriptor( segmentId ).pageCount.load();
 }
 
 /// <summary>
@@ -188,45 +231,19 @@ uint64_t DBCore::GetPagesOfRelation( uint64_t segmentId )
 /// <returns>Returns the pageid of the last page added (already containing segmentid)</returns>
 uint64_t DBCore::AddPagesToRelation( uint64_t segmentId, uint64_t numPages )
 {
-	uint64_t pageId = 0;
-	mSchemaLock.LockWrite();
-	try
-	{
-		Schema::Relation& r = mMasterSchema.GetRelationWithSegmentId( segmentId );
-		r.pagecount += numPages;
-		pageId = BufferManager::MergePageId( segmentId, r.pagecount - 1 );
-	}
-	catch ( std::runtime_error& e )
-	{
-		mSchemaLock.UnlockWrite();
-		throw std::runtime_error( e.what() );
-	}
-	mSchemaLock.UnlockWrite();
-	return pageId;
+	uint64_t firstPage = GetRelationDescriptor( segmentId ).AddPages( numPages );
+	return BufferManager::MergePageId( segmentId, firstPage + numPages - 1 );
 }
 
 /// <summary>
-/// Gets the pages of an index. Threadsafe iteration through schema. But number of pages can increase after return.
+/// Gets the pages of an index. Number of pages can increase after return.
 /// Throws on non-existent index
 /// </summary>
 /// <param name="segmentId">The segment identifier.</param>
 /// <returns></returns>
 uint64_t DBCore::GetPagesOfIndex( uint64_t segmentId )
 {
-	uint64_t pagecount = 0;
-	mSchemaLock.LockRead();
-	try
-	{
-		Schema::Relation::Index& i = mMasterSchema.GetIndexWithSegmentId( segmentId );
-		pagecount = i.pagecount;
-	}
-	catch ( std::runtime_error& e )
-	{
-		mSchemaLock.UnlockRead();
-		throw std::runtime_error( e.what() );
-	}
-	mSchemaLock.UnlockRead();
-	return pagecount;
+	return GetIndexDescriptor( segmentId ).pageCount.load();
 }
 
 /// <summary>
@@ -238,21 +255,8 @@ uint64_t DBCore::GetPagesOfIndex( uint64_t segmentId )
 /// <returns>Returns the pageid of the last page added (already containing segmentid)</returns>
 uint64_t DBCore::AddPagesToIndex( uint64_t segmentId, uint64_t numPages )
 {
-	uint64_t pageId = 0;
-	mSchemaLock.LockWrite();
-	try
-	{
-		Schema::Relation::Index& i = mMasterSchema.GetIndexWithSegmentId( segmentId );
-		i.pagecount += numPages;
-		pageId = BufferManager::MergePageId( segmentId, i.pagecount - 1 );
-	}
-	catch ( std::runtime_error& e )
-	{
-		mSchemaLock.UnlockWrite();
-		throw std::runtime_error( e.what() );
-	}
-	mSchemaLock.UnlockWrite();
-	return pageId;
+	uint64_t firstPage = GetIndexDescriptor( segmentId ).AddPages( numPages );
+	return BufferManager::MergePageId( segmentId, firstPage + numPages - 1 );
 }
 
 /// <summary>
@@ -263,43 +267,61 @@ uint64_t DBCore::AddPagesToIndex( uint64_t segmentId, uint64_t numPages )
 /// <returns>Returns the pageid of root page (already containing segmentid)</returns>
 uint64_t DBCore::GetRootOfIndex( uint64_t segmentId )
 {
-	uint64_t rootId = 0;
+	return GetIndexDescriptor( segmentId ).rootId.load();
+}
+
+/// <summary>
+/// Sets the root page of the index specified by segmentid to rootId. Root id has to contain the segmentid already. 
+/// Only set the root if both the old root and the new root are already write fixed pages.
+/// Throws on non-existent index.
+/// </summary>
+/// <param name="segmentId">The segment identifier.</param>
+/// <param name="rootId">The root identifier.</param>
+void DBCore::SetRootOfIndex( uint64_t segmentId, uint64_t rootId )
+{
+	GetIndexDescriptor( segmentId ).rootId.store( rootId );
+}
+
+/// <summary>
+/// Gets the runtime descriptor of a relation, valid as long as the core. Throws on non-existent relation.
+/// </summary>
+/// <param name="segmentId">The segment identifier.</param>
+/// <returns></returns>
+SegmentDescriptor& DBCore::GetRelationDescriptor( uint64_t segmentId )
+{
 	mSchemaLock.LockRead();
 	try
 	{
-		Schema::Relation::Index& i = mMasterSchema.GetIndexWithSegmentId( segmentId );
-		rootId = i.rootId;
+		SegmentDescriptor& descriptor = FindDescriptor( mRelationDescriptors, segmentId, "Error: Getting non-existant relation." );
+		mSchemaLock.UnlockRead();
+		return descriptor;
 	}
 	catch ( std::runtime_error& e )
 	{
 		mSchemaLock.UnlockRead();
 		throw std::runtime_error( e.what() );
 	}
-	mSchemaLock.UnlockRead();
-	return rootId;
 }
 
 /// <summary>
-/// Sets the root page of the index specified by segmentid to rootId. Root id has to contain the segmentid already. 
-/// Only set the root if both the old root and the new root are already write fixed pages.
-/// Throws on non-existent index.
+/// Gets the runtime descriptor of an index, valid as long as the core. Throws on non-existent index.
 /// </summary>
 /// <param name="segmentId">The segment identifier.</param>
-/// <param name="rootId">The root identifier.</param>
-void DBCore::SetRootOfIndex( uint64_t segmentId, uint64_t rootId )
+/// <returns></returns>
+SegmentDescriptor& DBCore::GetIndexDescriptor( uint64_t segmentId )
 {
 	mSchemaLock.LockRead();
 	try
 	{
-		Schema::Relation::Index& i = mMasterSchema.GetIndexWithSegmentId( segmentId );
-		i.rootId = rootId;
+		SegmentDescriptor& descriptor = FindDescriptor( mIndexDescriptors, segmentId, "Error: Getting non-existant index." );
+		mSchemaLock.UnlockRead();
+		return descriptor;
 	}
 	catch ( std::runtime_error& e )
 	{
 		mSchemaLock.UnlockRead();
 		throw std::runtime_error( e.what() );
 	}
-	mSchemaLock.UnlockRead();
 }
 
 /// <summary>
@@ -310,10 +332,14 @@ void DBCore::SetRootOfIndex( uint64_t segmentId, uint64_t rootId )
 /// <returns></returns>
 std::unique_ptr<SPSegment> DBCore::GetSPSegment( uint64_t segmentId )
 {
+	uint64_t fsiSegmentId = 0;
+	SegmentDescriptor* descriptor = nullptr;
 	mSchemaLock.LockRead();
 	try
 	{
 		Schema::Relation& r = mMasterSchema.GetRelationWithSegmentId( segmentId );
+		fsiSegmentId = r.fsiSegmentId;
+		descriptor = &FindDescriptor( mRelationDescriptors, segmentId, "Error: Getting non-existant relation." );
 	}
 	catch ( std::runtime_error& e )
 	{
@@ -321,7 +347,7 @@ std::unique_ptr<SPSegment> DBCore::GetSPSegment( uint64_t segmentId )
 		throw std::runtime_error( e.what() );
 	}
 	mSchemaLock.UnlockRead();
-	return std::move( std::unique_ptr<SPSegment>( new SPSegment( *this, *mBufferManager, segmentId ) ) );
+	return std::move( std::unique_ptr<SPSegment>( new SPSegment( *this, *mBufferManager, *descriptor, fsiSegmentId ) ) );
 }
 
 /// <summary>
@@ -337,7 +363,8 @@ std::unique_ptr<SPSegment> DBCore::GetSPSegment( const std::string& relationName
 	try
 	{
 		Schema::Relation& r = mMasterSchema.GetRelationWithName( relationName );
-		s.reset( new SPSegment( *this, *mBufferManager, r.segmentId ) );
+		SegmentDescriptor& descriptor = FindDescriptor( mRelationDescriptors, r.segmentId, "Error: Getting non-existant relation." );
+		s.reset( new SPSegment( *this, *mBufferManager, descriptor, r.fsiSegmentId ) );
 	}
 	catch ( std::runtime_error& e )
 	{
@@ -437,6 +464,14 @@ void DBCore::LoadSchemaFromSeg0()
 	// Deserialize metadata
 	startdata += 4; // Skip number of segments
 	mMasterSchema.Deserialize( startdata );
+	std::vector<uint64_t> rebuild = mMasterSchema.AssignMissingInventories();
+	LoadDescriptorsFromSchema( true );
+	for ( uint64_t segmentId : rebuild )
+	{
+		// Relations of an old schema, without inventory the free space of their pages would never be reused
+		Schema::Relation& r = mMasterSchema.GetRelationWithSegmentId( segmentId );
+		SPSegment( *this, *mBufferManager, *mRelationDescriptors[segmentId], r.fsiSegmentId ).RebuildInventory();
+	}
 	mSchemaLock.UnlockWrite();
 }
 
@@ -446,6 +481,7 @@ void DBCore::LoadSchemaFromSeg0()
 void DBCore::WriteSchemaToSeg0()
 {
 	mSchemaLock.LockWrite();
+	StoreDescriptorsInSchema();
 	// Serialize metadata/schema
 	std::vector<uint8_t> schemaData;
 	mMasterSchema.Serialize( schemaData );
@@ -481,3 +517,95 @@ void DBCore::WriteSchemaToSeg0()
 	}
 	mSchemaLock.UnlockWrite();
 }
+
+/// <summary>
+/// Creates the descriptors of new relations and indices from the schema. Call with the schema lock held exclusively.
+/// </summary>
+/// <param name="reload">if set to <c>true</c> the schema was loaded, all descriptors are created anew. Otherwise only
+/// new segments get descriptors, existing descriptors are newer than the schema.</param>
+void DBCore::LoadDescriptorsFromSchema( bool reload )
+{
+	if ( reload )
+	{
+		// Descriptors stay valid as long as the core, segments of the old schema keep using theirs
+		for ( auto& entry : mRelationDescriptors )
+		{
+			mRetiredDescriptors.push_back( std::move( entry.second ) );
+		}
+		for ( auto& entry : mIndexDescriptors )
+		{
+			mRetiredDescriptors.push_back( std::move( entry.second ) );
+		}
+		mRelationDescriptors.clear();
+		mIndexDescriptors.clear();
+	}
+	auto load = []( std::unordered_map<uint64_t, std::unique_ptr<SegmentDescriptor>>& descriptors,
+					uint64_t segmentId, uint64_t pageCount, uint64_t rootId )
+	{
+		std::unique_ptr<SegmentDescriptor>& descriptor = descriptors[segmentId];
+		if ( descriptor )
+		{
+			return;
+		}
+		descriptor.reset( new SegmentDescriptor() );
+		descriptor->segmentId = segmentId;
+		descriptor->pageCount.store( pageCount );
+		descriptor->rootId.store( rootId );
+	};
+	for ( Schema::Relation& r : mMasterSchema.relations )
+	{
+		load( mRelationDescriptors, r.segmentId, r.pagecount, 0 );
+		for ( Schema::Relation::Index& i : r.indices )
+		{
+			load( mIndexDescriptors, i.segmentId, i.pagecount, i.rootId );
+		}
+	}
+}
+
+/// <summary>
+/// Copies the page counts and roots of the descriptors into the schema. Call with the schema lock held exclusively.
+/// </summary>
+void DBCore::StoreDescriptorsInSchema()
+{
+	for ( Schema::Relation& r : mMasterSchema.relations )
+	{
+		r.pagecount = FindDescriptor( mRelationDescriptors, r.segmentId, "Error: Getting non-existant relation." ).pageCount.load();
+		for ( Schema::Relation::Index& i : r.indices )
+		{
+			SegmentDescriptor& descriptor = FindDescriptor( mIndexDescriptors, i.segmentId, "Error: Getting non-existant index." );
+			i.pagecount = descriptor.pageCount.load();
+			i.rootId = descriptor.rootId.load();
+		}
+	}
+}
+
+/// <summary>
+/// Finds the descriptor of the segment. Call with the schema lock held. Throws if there is none.
+/// </summary>
+/// <param name="descriptors">The relation or index descriptors.</param>
+/// <param name="segmentId">The segment identifier.</param>
+/// <param name="error">The error if there is no descriptor.</param>
+/// <returns></returns>
+SegmentDescriptor& DBCore::FindDescriptor( std::unordered_map<uint64_t, std::unique_ptr<SegmentDescriptor>>& descriptors,
+										   uint64_t segmentId, const char* error )
+{
+	auto it = descriptors.find( segmentId );
+	if ( it == descriptors.end() )
+	{
+		throw std::runtime_error( error );
+	}
+	return *it->second;
+}
+
+/// <summary>
+/// Adds pages at the end of the segment. Releasing pages at the end waits until the page count is increased.
+/// </summary>
+/// <param name="numPages">The number of pages.</param>
+/// <returns>The first added page in the segment.</returns>
+uint64_t SegmentDescriptor::AddPages( uint64_t numPages )
+{
+	resizeLatch.LockRead(); // <- Lock Read resize
+	uint64_t firstPage = pageCount.fetch_add( numPages );
+	resizeLatch.UnlockRead(); // <- Unlock Read resize
+	return firstPage;
+}
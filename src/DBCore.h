@@ -4,14 +4,34 @@
 
 #include "sql/Schema.h"
 #include "utility/defines.h"
-#include "utility/RWLock.h"
+#include "utility/HybridLatch.h"
+#include <atomic>
 #include <memory>
 #include <stdint.h>
+#include <unordered_map>
 
 // Forwards
 class BufferManager;
 class BufferFrame;
 class SPSegment;
+struct BufferManagerStats;
+
+/// <summary>
+/// Runtime state of a relation or index segment. Resolved once by segment id, afterwards the page count and
+/// the index root are used without the schema lock. The schema copies them when it is written or read.
+/// Descriptors live as long as the core. Pages are only added through AddPages, so a vacuum can release pages at the end.
+/// </summary>
+struct SegmentDescriptor
+{
+	uint64_t segmentId = 0;
+	std::atomic<uint64_t> pageCount;
+	std::atomic<uint64_t> rootId; // Root page of an index (containing the segment id), unused for relations
+	std::atomic<uint64_t> truncations{ 0 }; // Incremented when pages at the end are released, cached page ids might be gone
+	HybridLatch resizeLatch{ false, "SegmentDescriptor::resizeLatch" }; // Shared while adding pages, exclusive while releasing
+	ProfiledMutex vacuumMutex{ "SegmentDescriptor::vacuumMutex" }; // One vacuum of the segment at a time
+
+	uint64_t AddPages( uint64_t numPages );
+};
 
 /// <summary>
 /// Database core class. Starts up all the internal things necessary for the database to function.
@@ -19,7 +39,7 @@ class SPSegment;
 class DBCore
 {
 public:
-	DBCore();
+	DBCore( uint32_t bufferPages = DB_BUFFER_PAGES );
 	~DBCore();
 	
 	void WipeDatabase();
@@ -27,6 +47,10 @@ public:
 	void AddRelationsFromString( const std::string& sql );
 
 	BufferManager* GetBufferManager();
+	uint32_t ResizeBuffer( uint32_t bufferPages );
+	BufferManagerStats GetBufferStats();
+	void StartBufferStatsDump( const std::string& path, uint32_t intervalMs );
+	void StopBufferStatsDump();
 	const Schema* GetSchema();
 	std::vector<Schema::Relation::Attribute> GetRelationAttributes( uint64_t segmentId );
 	uint64_t GetPagesOfRelation( uint64_t segmentId );
@@ -39,16 +63,28 @@ public:
 	std::unique_ptr<SPSegment> GetSPSegment( const std::string& relationName );
 	uint64_t GetSegmentIdOfRelation( const std::string& relationName );
 	uint64_t GetSegmentOfIndex( const std::string& relationName, const std::string& attributeName );
+	SegmentDescriptor& GetRelationDescriptor( uint64_t segmentId );
+	SegmentDescriptor& GetIndexDescriptor( uint64_t segmentId );
 
 private:
-	RWLock mSchemaLock;
+	HybridLatch mSchemaLock; // Only for the schema (DDL) and the descriptor maps, not for page counts and roots
 	Schema mMasterSchema;
+	std::unordered_map<uint64_t, std::unique_ptr<SegmentDescriptor>> mRelationDescriptors;
+	std::unordered_map<uint64_t, std::unique_ptr<SegmentDescriptor>> mIndexDescriptors;
+	std::vector<std::unique_ptr<SegmentDescriptor>> mRetiredDescriptors; // Replaced by reloading the schema
 	BufferManager* mBufferManager;
+	uint32_t mBufferPages; // Pool size, kept when the buffer manager is recreated
 	std::vector<BufferFrame*> mSegment0; // Keeps all our writelocks on segment 0 pages
+	std::string mStatsDumpPath; // Empty if the buffer statistics are not dumped
+	uint32_t mStatsDumpIntervalMs = 0;
 
 	void DeleteBufferManager();
 	void LoadSchemaFromSeg0();
 	void WriteSchemaToSeg0();
+	void LoadDescriptorsFromSchema( bool reload );
+	void StoreDescriptorsInSchema();
+	static SegmentDescriptor& FindDescriptor( std::unordered_map<uint64_t, std::unique_ptr<SegmentDescriptor>>& descriptors,
+											  uint64_t segmentId, const char* error );
 };
 
 #endif
\ No newline at end of file
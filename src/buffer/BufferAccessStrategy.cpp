@@ -0,0 +1,31 @@
+#include "BufferAccessStrategy.h"
+
+#include <assert.h>
+
+/// <summary>
+/// Initializes a new instance of the <see cref="BufferAccessStrategy"/> class.
+/// Frames are taken from the pool lazily, until the ring is full.
+/// </summary>
+/// <param name="ringSize">Number of frames in the ring.</param>
+BufferAccessStrategy::BufferAccessStrategy( uint32_t ringSize ) : mMutex( "BufferAccessStrategy::mMutex" ), mRingSize( ringSize )
+{
+	assert( ringSize != 0 );
+	mRing.reserve( ringSize );
+	mRingPages.reserve( ringSize );
+}
+
+/// <summary>
+/// Finalizes an instance of the <see cref="BufferAccessStrategy"/> class. The frames stay in the pool.
+/// </summary>
+BufferAccessStrategy::~BufferAccessStrategy()
+{
+}
+
+/// <summary>
+/// Gets the size of the ring.
+/// </summary>
+/// <returns></returns>
+uint32_t BufferAccessStrategy::GetRingSize() const
+{
+	return mRingSize;
+}
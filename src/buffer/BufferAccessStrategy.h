@@ -0,0 +1,37 @@
+#pragma once
+#ifndef BUFFER_ACCESS_STRATEGY_H
+#define BUFFER_ACCESS_STRATEGY_H
+
+#include <stdint.h>
+#include <vector>
+#include <mutex>
+
+#include "utility/LatchProfiler.h"
+
+// Forwards
+class BufferFrame;
+class BufferManager;
+
+/// <summary>
+/// Ring buffer access strategy for large sequential scans. Pages missed through the strategy are loaded
+/// into a small private ring of frames, which is reused over and over, instead of evicting pages from the
+/// whole pool. Unfixing through the strategy does not count as an access for the replacement policy.
+/// Can be shared with the prefetcher, but is meant for one scan at a time.
+/// </summary>
+class BufferAccessStrategy
+{
+	friend class BufferManager;
+public:
+	BufferAccessStrategy( uint32_t ringSize );
+	~BufferAccessStrategy();
+
+	uint32_t GetRingSize() const;
+private:
+	ProfiledMutex mMutex; // Protects the ring, taken by the scan and the prefetcher
+	uint32_t mRingSize;
+	uint32_t mNext = 0; // Next ring position to reuse
+	std::vector<BufferFrame*> mRing;
+	std::vector<uint64_t> mRingPages; // Page we loaded into the frame at the same ring position
+};
+
+#endif
@@ -7,7 +7,8 @@
 /// <summary>
 /// Initializes a new instance of the <see cref="BufferFrame"/> class.
 /// </summary>
-BufferFrame::BufferFrame() : mLoaded(false), mDirty(false), mExclusive(false), mSharedBy(0), mEvictionScore( DB_EVICTION_COUNTER_START )
+BufferFrame::BufferFrame() : mLoaded(false), mDirty(false), mExclusive(false), mSharedBy(0), mEvictionScore( DB_EVICTION_COUNTER_START ), mVersion( 0 ), mDisabled( false ),
+	mRWLock( false, "BufferFrame::mRWLock" )
 {
 }
 
@@ -18,7 +19,8 @@ BufferFrame::BufferFrame() : mLoaded(false), mDirty(false), mExclusive(false), m
 BufferFrame::BufferFrame( const BufferFrame& bf ) : 
 	mLoaded( bf.mLoaded.load() ), mDirty( bf.mDirty.load() ), 
 	mExclusive( bf.mExclusive.load() ), mSharedBy( bf.mSharedBy.load() ),
-	mEvictionScore( bf.mEvictionScore.load() )
+	mEvictionScore( bf.mEvictionScore.load() ), mVersion( bf.mVersion.load() ), mDisabled( bf.mDisabled.load() ),
+	mRWLock( false, "BufferFrame::mRWLock" )
 {
 }
 
@@ -102,11 +104,27 @@ bool BufferFrame::TryLockWrite()
 	if (success)
 	{
 		mExclusive.store(true);
+		++mVersion;
 		assert( mSharedBy.load() == 0 );
 	}
 	return success;
 }
 
+/// <summary>
+/// Tries to acquire read lock (now). Returns true if succeeded, false if failed. Also sets necessary state variables on success.
+/// </summary>
+/// <returns></returns>
+bool BufferFrame::TryLockRead()
+{
+	bool success = mRWLock.TryLockRead();
+	if ( success )
+	{
+		++mSharedBy;
+		assert( !mExclusive.load() );
+	}
+	return success;
+}
+
 /// <summary>
 /// Locks for writing if exclusive is true. Locks for reading (shared access among readers) if exclusive is false.
 /// Also sets necessary state variables.
@@ -118,6 +136,7 @@ void BufferFrame::Lock( bool exclusive )
 	{
 		mRWLock.LockWrite();
 		mExclusive.store( true );
+		++mVersion;
 		assert( mSharedBy.load() == 0 );
 	}
 	else
@@ -139,6 +158,7 @@ void BufferFrame::Unlock()
 	{
 		assert( mSharedBy.load() == 0 );
 		mExclusive.store( false );
+		mVersion.fetch_add( 1, std::memory_order_release );
 		mRWLock.UnlockWrite();
 	}
 	else
@@ -150,3 +170,57 @@ void BufferFrame::Unlock()
 	}
 }
 
+
+/// <summary>
+/// Turns the read lock of the calling thread into a write lock, if it is the only reader. The latch changes its
+/// mode atomically, nobody else can write or evict the frame in between. Returns false if there are other readers,
+/// the read lock is still held in that case.
+/// </summary>
+/// <returns></returns>
+bool BufferFrame::TryUpgrade()
+{
+	assert( !mExclusive.load() && mSharedBy.load() > 0 );
+	if ( !mRWLock.TryUpgrade() )
+	{
+		return false;
+	}
+	--mSharedBy;
+	mExclusive.store( true );
+	++mVersion;
+	return true;
+}
+
+/// <summary>
+/// Turns the write lock of the calling thread into a read lock, without letting any writer in between.
+/// </summary>
+void BufferFrame::Downgrade()
+{
+	assert( mExclusive.load() && mSharedBy.load() == 0 );
+	mExclusive.store( false );
+	++mSharedBy;
+	mVersion.fetch_add( 1, std::memory_order_release );
+	mRWLock.Downgrade();
+}
+
+/// <summary>
+/// Reads the version for an optimistic read. Returns false if a writer currently holds the frame.
+/// </summary>
+/// <param name="version">The version.</param>
+/// <returns></returns>
+bool BufferFrame::ReadVersion( uint64_t& version ) const
+{
+	version = mVersion.load( std::memory_order_acquire );
+	return (version & 1) == 0;
+}
+
+/// <summary>
+/// Checks if the frame was not written since the version was read. All reads of the page data
+/// before this call are ordered before the version check.
+/// </summary>
+/// <param name="version">The version.</param>
+/// <returns></returns>
+bool BufferFrame::ValidateVersion( uint64_t version ) const
+{
+	std::atomic_thread_fence( std::memory_order_acquire );
+	return mVersion.load( std::memory_order_relaxed ) == version;
+}
@@ -2,7 +2,7 @@
 #ifndef BUFFER_FRAME_H
 #define BUFFER_FRAME_H
 
-#include "utility/RWLock.h"
+#include "utility/HybridLatch.h"
 
 #include <stdint.h>
 #include <atomic>
@@ -16,6 +16,7 @@ class BufferManager;
 class BufferFrame
 {
 	friend class BufferManager;
+	friend class ReplacementPolicy;
 public:
 	BufferFrame();
 	BufferFrame( const BufferFrame& bf );
@@ -39,16 +40,27 @@ private:
 	std::atomic<bool> mExclusive;
 	std::atomic<uint32_t> mSharedBy;
 	std::atomic<uint64_t> mEvictionScore;
+	// Incremented on acquiring and on releasing the write lock, odd while a writer holds the frame.
+	// Optimistic readers remember the version and validate it after reading, without writing to the frame.
+	std::atomic<uint64_t> mVersion;
+	// Frame is not part of the pool at the moment (shrunk away by BufferManager::Resize), only changed while write locked
+	std::atomic<bool> mDisabled;
 	uint64_t mPageId = 0;
-	RWLock mRWLock;
+	HybridLatch mRWLock;
 
 	void* mData = nullptr;
 
 	bool IsFixedProbably();
 	// Locking/unlocking methods (this is not just a pure mirror, we add functionality)
 	bool TryLockWrite();
+	bool TryLockRead();
 	void Lock(bool exclusive);
 	void Unlock();
+	bool TryUpgrade();
+	void Downgrade();
+	// Optimistic reading
+	bool ReadVersion( uint64_t& version ) const;
+	bool ValidateVersion( uint64_t version ) const;
 };
 
 #endif
\ No newline at end of file
@@ -8,13 +8,92 @@
 #include <assert.h>
 #include <cstring>
 #include <string>
-#include <fstream>
 #include <exception>
+#include <stdexcept>
 #include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <tuple>
+#include <unordered_set>
+#include <ctime>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/mman.h>
 
 //////////////////////////////////////////////////////////////////////////
 // Overview (Thinking things through)
 //////////////////////////////////////////////////////////////////////////
+// Page table:
+// - The page table (page id -> frame) is split into a configurable number of partitions.
+//   Every partition is a hash map with its own read write lock. The partition of a page
+//   is chosen by hashing the merged page id, so hits on different pages almost never
+//   touch the same lock and threads do not serialize on a single cache line anymore.
+// - Whenever the text below talks about locking "the hash map", only the partition
+//   responsible for the page id in question is locked.
+// - Partitions and frames are latched with HybridLatch (one 64 bit word each). Partition latches are fair,
+//   so misses inserting into a partition are not starved by hits. Frame latches prefer readers, a thread may fix
+//   the same page shared more than once. Frame latches can change their mode (UpgradePage/DowngradePage).
+// - Built with LATCH_PROFILING, every latch and mutex reports to a named site (see LatchProfiler.h), the statistics
+//   dump then ranks the sites by total wait time. Without it the latches carry no site and record nothing.
+//////////////////////////////////////////////////////////////////////////
+// Pool memory:
+// - The frames live in one anonymous mapping. With huge pages (default) we first try explicitly reserved
+//   huge pages (MAP_HUGETLB), then a 2MB aligned mapping advised for transparent huge pages, then regular pages.
+//   Random hits on a big pool touch a lot of pages, huge pages keep that within the TLB.
+// - The chosen mode is logged (debug) and can be queried. Optionally the pool is touched by a few threads
+//   on startup, so the first access of every frame does not pay for the page fault.
+// - Mappings are always aligned to the OS page size, so frames can be used for direct I/O as they are.
+//////////////////////////////////////////////////////////////////////////
+// Direct I/O:
+// - Optionally segment files are opened with O_DIRECT. Pages are then only cached in our own pool and
+//   not a second time in the OS page cache. If the file system does not support it we log and fall back to buffered I/O.
+// - Direct I/O needs aligned memory, offsets and lengths. Frames and page offsets are aligned, reads are always
+//   full pages, a short read means the rest of the page is behind the end of the file.
+// - Files are extended in extents of DB_FILE_EXTENT_PAGES pages before writing behind their end. Writes inside
+//   allocated space do not need to change file metadata, which would serialize direct writes on most file systems.
+//////////////////////////////////////////////////////////////////////////
+// I/O backend:
+// - All reads and writes go through an I/O backend (see IOBackend.h). The default is io_uring, which keeps all
+//   requests of a batch in flight at the same time, if it is not available we fall back to pread/pwrite.
+// - Batches are used wherever we know about many pages at once: the prefetcher loads up to DB_IO_BATCH_PAGES
+//   queued pages together, the page cleaner writes back all candidates of a pass together, and FixPages loads
+//   all missing pages together. All frames of a batch are reserved first (exclusively locked, entry in the page table),
+//   then loaded with one submission, so waiting threads see exactly the same states as with single loads.
+// - FixPages looks up all pages in one pass over the page table: the page ids are sorted by partition and every
+//   partition is read locked once for all of its pages. Pages that were found are locked after the misses are
+//   loaded. The replacement algorithm can pick the frame of a found page as victim for a miss of the same batch,
+//   or a found page can move into a frame the batch already holds. A frame the batch holds never contains another
+//   page of the batch, so these pages are fixed again with FixPage instead of waiting for our own lock.
+// - Single page loads and writes use the backend as well, with a batch of one.
+//////////////////////////////////////////////////////////////////////////
+// Resizing:
+// - Frames never move, pointers to them are everywhere. So all frames up to the maximum pool size are created
+//   up front and the pool memory is reserved for all of them (virtual memory only, MAP_NORESERVE; explicit
+//   huge pages have to be reserved for the maximum size).
+//   Frames that are not part of the pool are disabled, the replacement policies never return them as victims.
+// - Growing enables disabled frames, their memory is faulted in when they are used the first time.
+// - Shrinking takes victims from the replacement policy, like a page miss would. The victim is written back if
+//   it is dirty, removed from the page table, disabled (while still exclusively locked) and its memory is given back
+//   to the OS (MADV_DONTNEED). Taking victims instead of the frames at the end means fixed frames (e.g. the schema
+//   pages DBCore keeps fixed) never block shrinking, the pool just ends up with holes.
+//   Explicit huge pages can only be given back as a whole and frames are much smaller, so with MAP_HUGETLB shrinking
+//   releases no memory, the reserved huge pages stay with the pool.
+// - A thread can get a victim from the policy right before it is disabled. AcquireReplacementFrame checks the flag
+//   after locking and takes another victim, ring buffer strategies do the same for their frames.
+//////////////////////////////////////////////////////////////////////////
+// Statistics:
+// - GetStats returns a snapshot of all counters, the current number of fixed and dirty frames, and latency histograms
+//   of fixes (hits and misses separately) and of the I/O calls. Counters are not synchronized with each other,
+//   a snapshot taken under load is only approximately consistent.
+// - Hits are counted in the page table partition of the page, so threads hitting different pages do not
+//   write the same cache line for statistics either. Misses are rare enough for global counters.
+// - Optionally a thread appends a snapshot to a file periodically.
+//////////////////////////////////////////////////////////////////////////
 // Fixing a page:
 // - Acquire read lock on hash map
 // - Search for page
@@ -39,23 +118,26 @@
 // - Else: Start replacement/loading process
 // - Find free page with Page Replacement Algorithm
 // - Acquire exclusive write lock on page
-// - Acquire I/O lock (See Part about simultaneous loads farther down)
-// - Acquire write exclusive lock on hash map
-// - Remove old page entry in hash map
-// - Insert new page entry into hash map
-//   (We do the hash map replacement before loading/writing to disk, so other threads will see earlier that
-//    a page they need is either gone/loaded by a different thread)
-// - Release write exclusive lock on hash map
+// - Acquire write exclusive lock on the partition of the new page. If somebody else already has an entry
+//   for the new page, release everything and fix their frame instead. Else insert the new page entry
+//   (the reservation), release lock. (See Part about simultaneous loads farther down)
 // - Flush page if dirty
+// - Acquire write exclusive lock on the partition of the old page, remove old page entry, release lock
+//   (The old entry is removed only after the flush, see simultaneous loads. We never hold two partition locks at once.)
 // - Load the new page
-// - Release I/O lock
 // - If we just need read lock on page, release write lock and acquire read lock
 //////////////////////////////////////////////////////////////////////////
 // Unfixing a page:
 // - Update needed page atomics
 // - Release lock on page
 //////////////////////////////////////////////////////////////////////////
-// Page Replacement Algorithm: Modified Second Chance
+// Page Replacement Algorithm (see ReplacementPolicy.h)
+// - The policy is chosen at construction, every buffer manager owns its policy and all of its state.
+// - The policy is notified when a page was loaded (frame locked exclusively), on every unfix and on optimistic reads.
+// - The policy only proposes victims, the buffer manager try-locks them and asks again if that fails.
+// - Available: Modified Second Chance (Clock, default), 2Q and LRU-2. The latter two keep pages that are
+//   used repeatedly (e.g. B+ tree nodes) safe from pages that are used once (e.g. scans).
+// Modified Second Chance:
 // - Maintain counter in every BufferFrame. Starting at 0. 
 //   (We could also consider starting at uint64_max, so our first unfixing does not save the page)
 // - Every time a page is unfixed increment counter by 1.
@@ -75,6 +157,49 @@
 //   the same element. This might also mean, that in very very rare cases we throw, even though
 //   there are still a few unfixed pages left over. (Only happens if a lot of concurrent replaces
 //   happen and almost all pages are fixed)
+// - The clock hand belongs to the policy instance.
+//////////////////////////////////////////////////////////////////////////
+// Page cleaner (optional)
+//////////////////////////////////////////////////////////////////////////
+// Without the cleaner a dirty victim is written back inside the replacement, on the critical path
+// of the thread that missed. The cleaner is a background thread that wakes up every interval and
+// asks the replacement policy for the frames it is going to pick next (PeekVictims). It collects
+// dirty frames until the dirty ratio would drop to the target, sorts them by page id (sequential writes per segment), and writes them back:
+// - Frames are only try-locked in shared mode. Fixed frames are skipped. Shared is enough, since
+//   nobody can modify the page while we hold it, and readers can continue using the page.
+// - The replacement algorithm can not pick a frame while the cleaner holds it, since it only try-locks exclusively.
+// - The replacement policy is not notified, the cleaner is not a real user of the page.
+//////////////////////////////////////////////////////////////////////////
+// Prefetching
+//////////////////////////////////////////////////////////////////////////
+// Prefetch() only queues page ids and returns immediately. A background thread (started on the first
+// request) takes page ids from the queue and loads every page that is not in the page table yet
+// with the normal replacement path, but never pins it: the frame is unlocked right after the load.
+// The policy is told that the page was prefetched (the clock gives it an eviction score of 1, so it survives one pass).
+// The queue is bounded by half the page count, requests beyond that are dropped (prefetching is only a hint).
+// Requests of a scan with a ring buffer strategy load into the ring of the scan.
+//////////////////////////////////////////////////////////////////////////
+// Ring buffer access strategy
+//////////////////////////////////////////////////////////////////////////
+// A scan over a relation bigger than the pool would cycle every frame through the replacement policy
+// and push out the pages everybody else needs. A scan can fix pages through a BufferAccessStrategy instead:
+// - Hits are normal hits, but unfixing through the strategy does not tell the replacement policy about the access.
+// - Misses take a frame from the pool only until the ring of the strategy is full. Afterwards the ring frames are
+//   reused in order: the frame is try-locked exclusively and replaced with the normal replacement path.
+// - A ring frame is not reused if it is fixed or if it does not contain the page the strategy loaded into it
+//   anymore (the pool replaced it and somebody else uses it now). Such a ring position gets a new frame from the pool.
+//////////////////////////////////////////////////////////////////////////
+// Optimistic reads
+//////////////////////////////////////////////////////////////////////////
+// A shared fix writes to the frame lock and the shared counter, so a page read by every thread
+// (e.g. a B+ tree root) moves its cache line between all cores. Optimistic reads write nothing:
+// - Every frame has a version, which is incremented when the write lock is acquired and when it is released.
+//   Replacing a page happens under the write lock, so it also changes the version.
+// - FixPageOptimistic returns the frame and its (even) version, ValidatePage checks that the version did not change.
+//   Everything read in between is garbage if validation fails, readers must not trust it before validating
+//   (e.g. a node count has to be bounds checked before using it).
+// - The page table lookup still takes a partition read lock. Callers can skip it with a frame hint
+//   from an earlier read, the hint is checked against the page id under the version.
 //////////////////////////////////////////////////////////////////////////
 // Simultaneous loading/writing (disk IO)
 //////////////////////////////////////////////////////////////////////////
@@ -120,25 +245,73 @@
 //  This is preventing some small scale performance gains if we have multiple disks, 
 //  or if many threads waiting in line, for the mutex even though their page has 
 //  already been loaded.
+// Solution 3: (current solution)
+//  Solution 2 turned out to be the biggest limit for cold caches on SSDs, which serve many
+//  requests in parallel. Every segment file now has one file descriptor, and all reads and writes
+//  use positional I/O (pread/pwrite), so there is no shared file cursor that needs protection.
+//  Both scenarios above are prevented through the page table and the frame latches alone:
+//  - The check for an existing entry and the insertion of the reservation for the new page happen under
+//    the same partition write lock. So only one thread starts loading a page, every other thread
+//    finds the reserved frame and blocks on its latch until the load is done.
+//  - The entry of the evicted page stays in the page table until its dirty data is written back.
+//    Threads missing on the evicted page in the meantime find the frame, block on its latch,
+//    notice that the page id changed and retry. By then the data is on disk, so they never read stale data.
+//  Loads and writes of different pages, in the same or in different segments, run concurrently.
 
 
 /// <summary>
 /// Initializes a new instance of the <see cref="BufferManager" /> class.
 /// </summary>
 /// <param name="pageCount">The page count.</param>
-BufferManager::BufferManager( uint32_t pageCount ) : mPageCount( pageCount ),
-mNotRequestedPages( 0 ), mPageMisses( 0 ), mDirtyWritebacks( 0 ), 
-mPageReplacementRetries( 0 ), mSimulPageLoadTries( 0 )
+/// <param name="partitionCount">The number of independently latched page table partitions.</param>
+/// <param name="policy">The page replacement policy.</param>
+BufferManager::BufferManager( uint32_t pageCount, uint32_t partitionCount, ReplacementPolicyType policy ) :
+	BufferManager( [=]()
+	{
+		BufferManagerConfig config;
+		config.pageCount = pageCount;
+		config.partitionCount = partitionCount;
+		config.policy = policy;
+		return config;
+	}() )
+{
+}
+
+/// <summary>
+/// Initializes a new instance of the <see cref="BufferManager" /> class.
+/// </summary>
+/// <param name="config">The configuration.</param>
+BufferManager::BufferManager( const BufferManagerConfig& config ) : mPageCount( config.pageCount ),
+mMaxPageCount( config.maxPageCount != 0 ? config.maxPageCount : config.pageCount * DB_POOL_MAX_GROWTH ),
+mResizeMutex( "BufferManager::mResizeMutex" ), mDirectIO( config.directIO ), mPartitionCount( config.partitionCount ),
+mSegmentFilesLock( false, "BufferManager::mSegmentFilesLock" ), mNotRequestedPages( 0 ), mPageMisses( 0 ), mDirtyWritebacks( 0 ),
+mPageReplacementRetries( 0 ), mSimulPageLoadTries( 0 ), mCleanerWritebacks( 0 ), mPrefetchedPages( 0 ),
+mEvictions( 0 ), mBytesRead( 0 ), mBytesWritten( 0 ), mWriteErrors( 0 ), mLatencyStats( config.latencyStats )
 {
-	assert( pageCount != 0 );
+	assert( mPageCount != 0 );
+	assert( mPartitionCount != 0 );
+	if ( mMaxPageCount < mPageCount )
+	{
+		throw std::runtime_error( "Error: Maximum buffer pool size is smaller than the pool" );
+	}
+	mPageTable.reset( new PageTablePartition[mPartitionCount] );
 	// Create and allocate huge chunk of consecutive memory
-	mBufferMemory = new uint8_t[pageCount * DB_PAGE_SIZE];
-	// Create buffer frames that divide up the memory
-	mFrames.resize( pageCount );
+	AllocatePoolMemory( config.hugePages );
+	assert( reinterpret_cast<uintptr_t>(mBufferMemory) % DB_DIRECT_IO_ALIGNMENT == 0 );
+	if ( config.prefaultThreads > 0 )
+	{
+		PrefaultPoolMemory( config.prefaultThreads );
+	}
+	// Create buffer frames that divide up the memory, frames above the pool size are disabled until the pool grows
+	mFrames.resize( mMaxPageCount );
 	for ( uint32_t i = 0; i < mFrames.size(); ++i)
 	{
-		mFrames[i].mData = mBufferMemory + i * DB_PAGE_SIZE;
+		mFrames[i].mData = mBufferMemory + static_cast<size_t>(i) * DB_PAGE_SIZE;
+		mFrames[i].mDisabled.store( i >= mPageCount );
 	}
+	mPolicy = ReplacementPolicy::Create( config.policy, mFrames );
+	mIOBackend = IOBackend::Create( config.ioBackend, DB_IO_QUEUE_DEPTH );
+	LogDebug( std::string( "Buffer manager uses I/O backend " ) + IOBackend::GetName( mIOBackend->GetType() ) );
 }
 
 /// <summary>
@@ -146,6 +319,9 @@ mPageReplacementRetries( 0 ), mSimulPageLoadTries( 0 )
 /// </summary>
 BufferManager::~BufferManager()
 {
+	StopStatsDump();
+	StopPrefetcher();
+	StopPageCleaner();
 	// Write all dirty frames back to disk
 	for ( BufferFrame& f : mFrames )
 	{
@@ -172,14 +348,175 @@ BufferManager::~BufferManager()
 		f.Unlock();
 	}
 	mFrames.clear();
-	// Close filestreams
-	for ( std::pair<const uint64_t, std::pair<std::fstream*, uint64_t>>& mf : mFileStreams )
+	// Close segment files
+	for ( std::pair<const uint64_t, std::unique_ptr<SegmentFile>>& sf : mSegmentFiles )
 	{
-		SDELETE( mf.second.first );
+		close( sf.second->mFd );
 	}
-	mFileStreams.clear();
+	mSegmentFiles.clear();
 	// Delete page buffer memory
-	ADELETE( mBufferMemory );
+	FreePoolMemory();
+}
+
+/// <summary>
+/// Maps the pool memory. Tries explicit huge pages, then transparent huge pages, then regular pages.
+/// Throws if no memory could be mapped at all.
+/// </summary>
+/// <param name="hugePages">if set to <c>true</c> huge pages are tried first.</param>
+void BufferManager::AllocatePoolMemory( bool hugePages )
+{
+	const size_t poolSize = static_cast<size_t>(mMaxPageCount) * DB_PAGE_SIZE;
+	const size_t hugeSize = (poolSize + DB_HUGE_PAGE_SIZE - 1) / DB_HUGE_PAGE_SIZE * DB_HUGE_PAGE_SIZE;
+	void* mapping = MAP_FAILED;
+	if ( hugePages )
+	{
+#ifdef MAP_HUGETLB
+		// No MAP_NORESERVE here, huge pages that are not reserved raise SIGBUS when they are touched
+		mapping = mmap( nullptr, hugeSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0 );
+		if ( mapping != MAP_FAILED )
+		{
+			mPoolMapping = mapping;
+			mPoolMappingSize = hugeSize;
+			mBufferMemory = reinterpret_cast<uint8_t*>(mapping);
+			mPoolMemoryMode = PoolMemoryMode::HugeTLB;
+			LogDebug( "Buffer pool uses explicit huge pages" );
+			return;
+		}
+#endif
+		// Map one huge page more, so we can align the pool to a huge page boundary
+		mapping = mmap( nullptr, hugeSize + DB_HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0 );
+		if ( mapping != MAP_FAILED )
+		{
+			mPoolMapping = mapping;
+			mPoolMappingSize = hugeSize + DB_HUGE_PAGE_SIZE;
+			uintptr_t aligned = (reinterpret_cast<uintptr_t>(mapping) + DB_HUGE_PAGE_SIZE - 1) / DB_HUGE_PAGE_SIZE * DB_HUGE_PAGE_SIZE;
+			mBufferMemory = reinterpret_cast<uint8_t*>(aligned);
+			mPoolMemoryMode = PoolMemoryMode::Regular;
+#ifdef MADV_HUGEPAGE
+			// The advice succeeds even if transparent huge pages are disabled, the kernel then keeps using regular pages
+			if ( madvise( mBufferMemory, hugeSize, MADV_HUGEPAGE ) == 0 && TransparentHugePagesEnabled() )
+			{
+				mPoolMemoryMode = PoolMemoryMode::TransparentHugePages;
+			}
+#endif
+			LogDebug( std::string( "Buffer pool uses " ) + GetPoolMemoryModeName( mPoolMemoryMode ) );
+			return;
+		}
+	}
+	mapping = mmap( nullptr, poolSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0 );
+	if ( mapping == MAP_FAILED )
+	{
+		LogError( "Could not map " + std::to_string( poolSize ) + " bytes of buffer pool memory" );
+		throw std::runtime_error( "Error: Allocating buffer pool memory" );
+	}
+	mPoolMapping = mapping;
+	mPoolMappingSize = poolSize;
+	mBufferMemory = reinterpret_cast<uint8_t*>(mapping);
+	mPoolMemoryMode = PoolMemoryMode::Regular;
+	LogDebug( "Buffer pool uses regular pages" );
+}
+
+/// <summary>
+/// Determines whether the kernel backs advised mappings with transparent huge pages.
+/// The selected setting is in brackets, "always" and "madvise" use them for advised mappings, "never" does not.
+/// </summary>
+/// <returns></returns>
+bool BufferManager::TransparentHugePagesEnabled()
+{
+	std::ifstream file( "/sys/kernel/mm/transparent_hugepage/enabled" );
+	std::string setting;
+	std::getline( file, setting );
+	return setting.find( "[always]" ) != std::string::npos || setting.find( "[madvise]" ) != std::string::npos;
+}
+
+/// <summary>
+/// Touches every page of the memory of the frames in the pool, split between the threads.
+/// </summary>
+/// <param name="threads">The number of threads.</param>
+void BufferManager::PrefaultPoolMemory( uint32_t threads )
+{
+	const size_t poolSize = static_cast<size_t>(mPageCount) * DB_PAGE_SIZE;
+	const size_t step = 4096; // Smallest page size, works for every mode
+	const size_t chunk = (poolSize / threads + step - 1) / step * step;
+	std::vector<std::thread> workers;
+	for ( uint32_t t = 0; t < threads; ++t )
+	{
+		size_t begin = t * chunk;
+		size_t end = std::min( poolSize, begin + chunk );
+		workers.push_back( std::thread( [this, begin, end, step]()
+		{
+			for ( size_t pos = begin; pos < end; pos += step )
+			{
+				mBufferMemory[pos] = 0;
+			}
+		} ) );
+	}
+	for ( std::thread& worker : workers )
+	{
+		worker.join();
+	}
+}
+
+/// <summary>
+/// Unmaps the pool memory.
+/// </summary>
+void BufferManager::FreePoolMemory()
+{
+	if ( mPoolMapping )
+	{
+		munmap( mPoolMapping, mPoolMappingSize );
+	}
+	mPoolMapping = nullptr;
+	mPoolMappingSize = 0;
+	mBufferMemory = nullptr;
+}
+
+/// <summary>
+/// Gets the mode the pool memory was mapped with.
+/// </summary>
+/// <returns></returns>
+PoolMemoryMode BufferManager::GetPoolMemoryMode() const
+{
+	return mPoolMemoryMode;
+}
+
+/// <summary>
+/// Determines whether the file of a segment actually uses direct I/O. Opens the file if necessary.
+/// Is false even with direct I/O configured, if the file system of the file does not support direct I/O.
+/// </summary>
+/// <param name="segmentId">The segment identifier.</param>
+/// <returns></returns>
+bool BufferManager::IsDirectIO( uint64_t segmentId )
+{
+	return GetSegmentFile( segmentId ).mDirect;
+}
+
+/// <summary>
+/// Gets the type of the I/O backend in use. Can differ from the configured type, if io_uring was not available.
+/// </summary>
+/// <returns></returns>
+IOBackendType BufferManager::GetIOBackendType() const
+{
+	return mIOBackend->GetType();
+}
+
+/// <summary>
+/// Gets the name of the pool memory mode, for reports.
+/// </summary>
+/// <param name="mode">The mode.</param>
+/// <returns></returns>
+const char* BufferManager::GetPoolMemoryModeName( PoolMemoryMode mode )
+{
+	switch ( mode )
+	{
+	case PoolMemoryMode::HugeTLB:
+		return "explicit huge pages";
+	case PoolMemoryMode::TransparentHugePages:
+		return "transparent huge pages";
+	case PoolMemoryMode::Regular:
+	default:
+		return "regular pages";
+	}
 }
 
 /// <summary>
@@ -193,27 +530,28 @@ BufferManager::~BufferManager()
 BufferFrame& BufferManager::FixPage( uint64_t pageId, bool exclusive )
 {
 	// For a full explanation of the method see overview at the beginning of the file
-	BufferFrame* frame = nullptr;
-	// Compress the lock as much as possible, by releasing as soon as we get
-	// a pointer to our object (if that exists)
-	mHashMapLock.LockRead(); // <- Lock Read Hash Map
-	auto it = mLoadedFrames.find( pageId );
-	if ( it != mLoadedFrames.end() )
-	{
-		frame = it->second;
-	}
-	mHashMapLock.UnlockRead(); // <- Unlock Read Hash Map
-
+	std::chrono::steady_clock::time_point start = StartLatency();
+	BufferFrame* frame = LookupFrame( pageId );
 	if (frame)
 	{
 		// We found the page, try to acquire our desired lock
 		frame->Lock( exclusive );
 		// If our page is not the correct page, we release the lock and do a recursive call to fix page
-		// (Reason is explained in overview)
-		return *CheckSamePage( pageId, exclusive, frame );
+		// (Reason is explained in overview). The recursive call counts the fix itself.
+		BufferFrame* found = frame;
+		frame = CheckSamePage( pageId, exclusive, frame );
+		if ( frame == found )
+		{
+			PageTablePartition& partition = GetPartition( pageId );
+			++partition.mHits;
+			RecordLatency( partition.mHitLatency, start );
+		}
+		return *frame;
 	}
 	
-	return *FixPageReplacement(pageId, exclusive);
+	frame = FixPageReplacement(pageId, exclusive);
+	RecordLatency( mFixMissLatency, start );
+	return *frame;
 }
 
 /// <summary>
@@ -226,292 +564,1519 @@ void BufferManager::UnfixPage( BufferFrame& frame, bool isDirty )
 {
 	assert( frame.mExclusive.load() || frame.mSharedBy > 0 );
 	assert( isDirty ? frame.mExclusive.load() : true ); // Iff dirty then exclusive
-	// Update dirtiness and our eviction score for page replacement alg
+	// Update dirtiness and tell the page replacement alg about the access
 	if ( isDirty )
 	{
-		frame.mEvictionScore += 2;
 		frame.mDirty.store( true );
 	}
-	else
-	{
-		++frame.mEvictionScore;
-	}
+	mPolicy->OnUnfix( frame, isDirty );
 	frame.Unlock();
 }
 
 /// <summary>
-/// The page replacement part of fixing a page
+/// Empties the exclusively fixed page and marks it clean, as if it was never written. It is not written back,
+/// so its segment file can be truncated in front of it. The caller still has to unfix it.
 /// </summary>
-/// <param name="pageId">The page identifier.</param>
-/// <param name="exclusive">if set to <c>true</c> [exclusive].</param>
-/// <returns></returns>
-BufferFrame* BufferManager::FixPageReplacement( uint64_t pageId, bool exclusive )
+/// <param name="frame">The exclusively fixed frame.</param>
+void BufferManager::DiscardPage( BufferFrame& frame )
 {
-	BufferFrame* frame = nullptr;
-	++mPageMisses;
-	// We did not find the page, start replacement algorithm
-	uint32_t pageReplaceTries = 0;
-	do
-	{
-		frame = FindReplacementPage();
-		if ( !frame )
-		{
-			//LogError( "Could not find any free or unfixed pages!" );
-			throw std::runtime_error( "Error: BufferManager ran out of space" );
-		}
-		++pageReplaceTries;
-		// Try to lock, if that fails, we just start with a new page search, since
-		// we do not want to wait until the lock is free again.
-	} while ( !frame->TryLockWrite() ); // <- Lock replacement frame
-	mPageReplacementRetries += pageReplaceTries - 1;
-
-	// Next we have to verify we are the only person reading/writing to both pages on disk
-	uint64_t oldId = frame->mPageId;
-	mFileIOLock.lock(); // <- Lock I/O mutex
-													
-	// Now check if by chance some other thread else got this lock 
-	// on our page before us and the page is already in memory
-	// (even if we had to wait, this does not mean it was exactly for our page)
-	mHashMapLock.LockRead(); // <- Lock Read Hash Map
-	auto it = mLoadedFrames.find( pageId );
-	BufferFrame* altFrame = nullptr;
-	if ( it != mLoadedFrames.end() )
-	{
-		altFrame = it->second;
-	}
-	mHashMapLock.UnlockRead(); // <- Unlock Read Hash Map
-	if ( altFrame )
-	{
-		// Some other thread already loaded the page for us
-		++mSimulPageLoadTries;
-		frame->Unlock(); // <- Unlock replacement frame
-		mFileIOLock.unlock(); // <- Unlock Page based I/O mutex
-		altFrame->Lock( exclusive ); // <- Lock frame loaded by other thread
-		return CheckSamePage( pageId, exclusive, altFrame );
-	}
+	assert( frame.mExclusive.load() );
+	memset( frame.mData, 0, DB_PAGE_SIZE );
+	frame.mDirty.store( false );
+}
 
-	// Replace old frame entry in hash map with new
-	mHashMapLock.LockWrite(); // <- Lock Write Hash Map
-	mLoadedFrames.erase( oldId );
-	if ( mLoadedFrames.find( pageId ) != mLoadedFrames.end() )
+/// <summary>
+/// Shrinks the file of the segment to pageCount pages. The caller guarantees that no page behind pageCount
+/// is dirty or written at the same time, e.g. by discarding them while they are fixed. Throws on errors.
+/// </summary>
+/// <param name="segmentId">The segment identifier.</param>
+/// <param name="pageCount">The page count.</param>
+void BufferManager::TruncateSegmentFile( uint64_t segmentId, uint64_t pageCount )
+{
+	SegmentFile& segment = GetSegmentFile( segmentId );
+	std::lock_guard<ProfiledMutex> lock( segment.mExtendMutex ); // <- Lock extend
+	uint64_t newSize = pageCount * DB_PAGE_SIZE;
+	if ( segment.mSize.load() <= newSize )
 	{
-		// Assert against simultaneous loading
-		// Search should get compiled out in Release build, since if is empty
-		assert( false );
+		return;
 	}
-	mLoadedFrames.insert( std::make_pair( pageId, frame ) );
-	mHashMapLock.UnlockWrite(); // <- Unlock Write Hash Map
-
-	// We got our 2 write locks and nobody loaded before us and we already replaced the page entry
-	// in the hashmap, now we do all the actual replacement work
-	if ( frame->IsDirty() )
+	if ( ftruncate( segment.mFd, static_cast<off_t>(newSize) ) != 0 )
 	{
-		++mDirtyWritebacks;
-		WritePage( *frame ); // Throws on fail
+		LogError( "Failed to truncate segment file to " + std::to_string( newSize ) + " bytes" );
+		throw std::runtime_error( "Error: Truncating File" );
 	}
+	segment.mSize.store( newSize );
+} // <- Unlock extend
 
-	// Replace old id with new id in frame and load
-	frame->mPageId = pageId;
-	LoadPage( *frame ); // Throws on fail 
-
-	mFileIOLock.unlock(); // <- Unlock I/O mutex
+/// <summary>
+/// Turns a shared fix into an exclusive fix, if the caller is the only thread that has the page fixed.
+/// The page stays fixed during the upgrade, so on success it is guaranteed to be unchanged.
+/// Returns false otherwise, the page is still fixed shared in that case and the caller has to unfix and fix it
+/// exclusively (and check for changes in between) itself.
+/// </summary>
+/// <param name="frame">The shared fixed frame.</param>
+/// <returns></returns>
+bool BufferManager::UpgradePage( BufferFrame& frame )
+{
+	return frame.TryUpgrade();
+}
 
-	// Check what kind of lock we need on our page
-	if ( !exclusive )
+/// <summary>
+/// Turns an exclusive fix into a shared fix, without any other writer in between. Other readers can fix the page
+/// afterwards. Dirtiness has to be given here, the shared fix is unfixed as not dirty.
+/// </summary>
+/// <param name="frame">The exclusively fixed frame.</param>
+/// <param name="isDirty">if set to <c>true</c> [is dirty].</param>
+void BufferManager::DowngradePage( BufferFrame& frame, bool isDirty )
+{
+	if ( isDirty )
 	{
-		frame->Unlock(); // <- Swap lock replaced frame
-		frame->Lock( false ); // <- Swap lock replaced frame
-							  
-		// In the extremely extremely unlikely case that the replacement algorithm
-		// chose this page to be evicted before we locked again (alg would need to do full 2 circles,
-		// and by chance end up with this page and acquire the lock, all of this before we get our own lock)
-		// ... 
-		// well we basically have a problem, we could do a recursive FixPage call again:
-		return CheckSamePage( pageId, exclusive, frame );
+		frame.mDirty.store( true );
 	}
-	return frame;
+	frame.Downgrade();
 }
 
 /// <summary>
-/// Finds a replacement/free page and returns it.
+/// Fixes all pages like FixPage and returns the frames in request order. All pages are looked up with one pass
+/// over the page table, pages that are not in the buffer are loaded with one I/O batch. Page ids have to be distinct,
+/// duplicates throw. The frames of missing pages are locked before the frames of pages in the buffer, so exclusive
+/// fixes must not overlap with pages other threads fix in a different order.
+/// Throws like FixPage, no page is fixed in that case.
 /// </summary>
-/// <returns>The found buffer. This returns a nullpointer in case we could not find any free buffer.</returns>
-BufferFrame* BufferManager::FindReplacementPage()
+/// <param name="pageIds">The page identifiers.</param>
+/// <param name="exclusive">if set to <c>true</c> [exclusive].</param>
+/// <param name="frames">The fixed frames, same order as the page ids.</param>
+void BufferManager::FixPages( const std::vector<uint64_t>& pageIds, bool exclusive, std::vector<BufferFrame*>& frames )
 {
-	static std::atomic<uint64_t> sharedVectorPos(0);
-	assert( mFrames.size() == mPageCount );
-	assert( mPageCount != 0 );
-
-	// Cyclic walk over at least 2*page count buffers until we find a buffer with 0 eviction score. 
-	// If we could not find a single unfixed one we stop looking.
-	// If we found atleast one, we continue searching.
-	// If multiple pages are searched simultaneously,
-	// this can also mean we skip some pages and visit some multiple times.
-	bool unfixedPageExisted;
-	do 
+	frames.assign( pageIds.size(), nullptr );
+	std::vector<BufferFrame*> lookedUp; // Frames of the page table pass, only hints until they are locked
+	LookupFrames( pageIds, lookedUp );
+	std::vector<size_t> found; // Pages in the buffer or loaded by another thread
+	std::vector<size_t> reserved; // Pages we load
+	std::vector<BufferFrame*> reservedFrames;
+	try
 	{
-		unfixedPageExisted = false;
-		for ( uint32_t i = 0; i < mPageCount * 2; ++i )
+		for ( size_t i = 0; i < pageIds.size(); ++i )
 		{
-			uint32_t pos = (sharedVectorPos++) % mPageCount; // Atomic post increment, then mod page count
-			BufferFrame& frame = mFrames[pos];
-			if ( !frame.IsFixedProbably() )
+			if ( lookedUp[i] )
 			{
-				if ( frame.mEvictionScore == 0 )
-				{
-					return &frame;
-				}
-
-				unfixedPageExisted = true;
-				// We are forced to do a division, which is a non atomic operation. This is not a real problem.
-				// In rare occasions, a buffer can receive some extra eviction score through this.
-				frame.mEvictionScore.store( frame.mEvictionScore.load() / 2 );
+				found.push_back( i );
+				continue;
 			}
+			++mPageMisses;
+			BufferFrame* frame = AcquireReplacementFrame(); // <- Lock replacement frame
+			if ( !frame )
+			{
+				throw std::runtime_error( "Error: BufferManager ran out of space" );
+			}
+			lookedUp[i] = ReservePage( pageIds[i], *frame );
+			if ( lookedUp[i] )
+			{
+				++mSimulPageLoadTries;
+				found.push_back( i );
+				continue;
+			}
+			reserved.push_back( i );
+			reservedFrames.push_back( frame );
 		}
-	} while (unfixedPageExisted);
-	
-
-	// Returning a nullpointer, since we could not find any valid page
-	return nullptr;
-}
+	}
+	catch ( std::runtime_error& )
+	{
+		for ( BufferFrame* frame : reservedFrames )
+		{
+			AbortReservation( *frame ); // <- Unlock replacement frame
+		}
+		throw;
+	}
 
-/// <summary>
-/// Checks the filestream cache and returns the mutex + fstream pair. Creates a new pair if necessary
-/// </summary>
-/// <param name="segmentId">The segment identifier.</param>
-/// <returns>Pair of filestream and segment</returns>
-std::pair<std::fstream*, uint64_t>& BufferManager::CheckFilestreamCache( uint64_t segmentId )
-{
-	// Check if segment filestream exists already
-	auto fsit = mFileStreams.find( segmentId );
-	
-	// If the fstream does not exist, we create one and store
-	if ( fsit == mFileStreams.end() )
-	{
-		std::fstream* f = new std::fstream();
-		// Open file
-		std::string segmentName = std::to_string( segmentId );
-		MbOpenCreateFile( segmentName, *f );
-		// Find end of file
-		f->seekg( 0, std::ios::end );
-		std::streampos fsize = f->tellg();
-		auto p = std::make_pair( f, static_cast<uint64_t>(fsize) );
-		auto inserted = mFileStreams.insert( std::make_pair( segmentId, p ) );
-		if (inserted.second)
-		{
-			return inserted.first->second;
+	// Load all misses together
+	std::vector<bool> loaded;
+	LoadReservedPages( reservedFrames, false, loaded );
+	bool failed = false;
+	for ( size_t r = 0; r < reserved.size(); ++r )
+	{
+		if ( loaded[r] )
+		{
+			frames[reserved[r]] = reservedFrames[r];
 		}
 		else
 		{
-			throw std::runtime_error( "Error: Filestream already cached. Segment id: " + segmentId );
+			failed = true;
+		}
+	}
+
+	try
+	{
+		if ( failed )
+		{
+			throw std::runtime_error( "Error: Reading File" );
+		}
+		// Swap to the lock we need, same as in FixPageReplacement
+		if ( !exclusive )
+		{
+			for ( size_t r = 0; r < reserved.size(); ++r )
+			{
+				BufferFrame* frame = frames[reserved[r]];
+				frames[reserved[r]] = nullptr;
+				frame->Unlock(); // <- Swap lock replaced frame
+				frame->Lock( false ); // <- Swap lock replaced frame
+				frames[reserved[r]] = CheckSamePage( pageIds[reserved[r]], exclusive, frame );
+			}
+		}
+		// Lock the frames of the lookup, CheckSamePage falls back to FixPage if a frame changed its page meanwhile.
+		// Frames we hold already contain another page of the batch, locking them again would block on ourselves
+		std::unordered_set<BufferFrame*> held;
+		for ( BufferFrame* frame : frames )
+		{
+			if ( frame )
+			{
+				held.insert( frame );
+			}
+		}
+		for ( size_t i : found )
+		{
+			if ( held.count( lookedUp[i] ) )
+			{
+				++mNotRequestedPages;
+				frames[i] = &FixPage( pageIds[i], exclusive );
+				held.insert( frames[i] );
+				continue;
+			}
+			std::chrono::steady_clock::time_point start = StartLatency();
+			lookedUp[i]->Lock( exclusive );
+			frames[i] = CheckSamePage( pageIds[i], exclusive, lookedUp[i] );
+			held.insert( frames[i] );
+			if ( frames[i] == lookedUp[i] ) // FixPage counted the fix otherwise
+			{
+				PageTablePartition& partition = GetPartition( pageIds[i] );
+				++partition.mHits;
+				RecordLatency( partition.mHitLatency, start );
+			}
 		}
 	}
-	else
+	catch ( std::runtime_error& )
 	{
-		return fsit->second;
+		for ( BufferFrame*& frame : frames )
+		{
+			if ( frame )
+			{
+				frame->Unlock();
+				frame = nullptr;
+			}
+		}
+		throw;
 	}
 }
 
 /// <summary>
-/// Opens the file in binary read write mode if the stream is not opened. Also creates the file if necessary.
+/// Unfixes all frames like UnfixPage, e.g. the frames of FixPages.
 /// </summary>
-/// <param name="name">The name.</param>
-/// <param name="stream">The stream.</param>
-void BufferManager::MbOpenCreateFile( std::string& name, std::fstream& stream )
+/// <param name="frames">The frames.</param>
+/// <param name="isDirty">if set to <c>true</c> all frames are dirty.</param>
+void BufferManager::UnfixPages( const std::vector<BufferFrame*>& frames, bool isDirty )
 {
-	if ( !stream.is_open() )
+	for ( BufferFrame* frame : frames )
 	{
-		// Check existance
-		if ( !FileExists( name ) )
-		{
-			// Quickly create an empty file
-			std::ofstream newfile;
-			newfile.open( name, std::ofstream::out | std::ofstream::binary );
-			newfile.close();
-		}
-		// Open in binary mode
-		stream.open( name, std::fstream::in | std::fstream::out | std::fstream::binary );
-		if ( !stream.is_open() )
-		{
-			LogError( "Failed to open segment file " + name );
-			throw std::runtime_error( "Error: Opening File" );
-		}
+		UnfixPage( *frame, isDirty );
 	}
 }
 
 /// <summary>
-/// Loads a page from harddrive. Throws on errors.
+/// Starts an optimistic read of the page, without locking or otherwise writing to the frame.
+/// Returns nullptr if the page is not in the buffer or currently written, in this case the caller has
+/// to fall back to FixPage. Otherwise the page data may be read, but everything that was read is only
+/// valid if ValidatePage succeeds with the returned version afterwards. There is no UnfixPage for optimistic reads.
+/// The hint can be a frame that contained the page earlier, which saves the page table lookup.
 /// </summary>
 /// <param name="pageId">The page identifier.</param>
-void BufferManager::LoadPage( BufferFrame& frame )
+/// <param name="version">The version to validate against.</param>
+/// <param name="hint">The frame that probably contains the page.</param>
+/// <returns></returns>
+BufferFrame* BufferManager::FixPageOptimistic( uint64_t pageId, uint64_t& version, BufferFrame* hint )
 {
-	// Zero out memory
-	memset( frame.mData, 0, DB_PAGE_SIZE );
-
-	// Get a filestream
-	auto ids = SplitPageId( frame.GetPageId() );
-	std::pair<std::fstream*, uint64_t>& segment = CheckFilestreamCache( ids.first );
-	assert( segment.first );
-		
-	// Read data from input file
-	uint64_t pos = ids.second * DB_PAGE_SIZE;
-	if (pos >= segment.second)
-	{
-		// Searched position is bigger than the file, just return empty
-		frame.mLoaded.store( true );
-		frame.mEvictionScore.store( DB_EVICTION_COUNTER_START );
-		return;
-	}
-	segment.first->seekg( pos );
-	segment.first->read( reinterpret_cast<char*>(frame.mData), DB_PAGE_SIZE );
-
-	// Check for any errors reading (ignore eof errors, since these are normal if the page was not even created yet)
-	if ( segment.first->fail() && !segment.first->eof() )
+	BufferFrame* frame = hint;
+	if ( !frame || !frame->ReadVersion( version ) || !frame->mLoaded.load() || frame->mPageId != pageId )
 	{
-		LogError( "Read error in segment " + std::to_string( ids.first ) + " on page " +
-				  std::to_string( ids.second ) );
-		throw std::runtime_error( "Error: Reading File" );
+		frame = LookupFrame( pageId );
+		if ( !frame || !frame->ReadVersion( version ) || !frame->mLoaded.load() || frame->mPageId != pageId )
+		{
+			return nullptr;
+		}
 	}
+	// Keep the page alive for the replacement algorithm, policies only write if necessary
+	mPolicy->OnOptimisticAccess( *frame );
+	return frame;
+}
 
-	// Set loaded bit and reset eviction score
-	frame.mLoaded.store( true );
-	frame.mEvictionScore.store( DB_EVICTION_COUNTER_START );
+/// <summary>
+/// Validates an optimistic read started with FixPageOptimistic.
+/// Returns true if the page was not modified or replaced in the meantime.
+/// </summary>
+/// <param name="frame">The frame.</param>
+/// <param name="version">The version.</param>
+/// <returns></returns>
+bool BufferManager::ValidatePage( const BufferFrame& frame, uint64_t version ) const
+{
+	return frame.ValidateVersion( version );
 }
 
 /// <summary>
-/// Writes a page to harddrive. Throws on errors.
+/// Starts the background page cleaner. The cleaner wakes up every intervalMs milliseconds and writes back
+/// dirty unfixed pages the replacement policy picks next until at most targetDirtyRatio of all frames are dirty.
+/// Restarts the cleaner with the new settings if it is already running.
 /// </summary>
-/// <param name="pageId">The page identifier.</param>
-void BufferManager::WritePage( BufferFrame& frame )
+/// <param name="targetDirtyRatio">The target ratio of dirty frames [0, 1].</param>
+/// <param name="intervalMs">The wake up interval in milliseconds.</param>
+void BufferManager::StartPageCleaner( double targetDirtyRatio, uint32_t intervalMs )
 {
-	// Get a filestream
-	auto ids = SplitPageId( frame.GetPageId() );
-	std::pair<std::fstream*, uint64_t>& segment = CheckFilestreamCache( ids.first );
-	assert( segment.first );
-	
-	// Find position in output file
-	uint64_t pos = ids.second * DB_PAGE_SIZE;
-	segment.first->seekp( pos );
-	segment.first->write( reinterpret_cast<char*>(frame.mData), DB_PAGE_SIZE );
+	StopPageCleaner();
+	mCleanerDirtyRatio = std::min( 1.0, std::max( 0.0, targetDirtyRatio ) );
+	mCleanerIntervalMs = std::max( 1u, intervalMs );
+	mCleanerStop = false;
+	mCleanerThread = std::thread( &BufferManager::PageCleanerLoop, this );
+}
 
-	// Check for any errors reading
-	if ( segment.first->fail() )
+/// <summary>
+/// Stops the background page cleaner and waits for it to finish. Does nothing if it is not running.
+/// </summary>
+void BufferManager::StopPageCleaner()
+{
+	if ( !mCleanerThread.joinable() )
 	{
-		LogError( "Write error in segment " + std::to_string( ids.first ) + " on page " +
-				  std::to_string( ids.second ) );
-		throw std::runtime_error( "Error: Writing File" );
+		return;
 	}
-
-	// If our currently written position was bigger or equal set the new filesize
-	if (pos >= segment.second)
 	{
-		segment.second = pos + DB_PAGE_SIZE;
+		std::lock_guard<std::mutex> lock( mCleanerMutex );
+		mCleanerStop = true;
 	}
+	mCleanerCondition.notify_all();
+	mCleanerThread.join();
+}
 
-	// Remove dirty flag from frame
-	frame.mDirty.store( false );
+/// <summary>
+/// Gets the number of dirty pages written back by threads replacing a page.
+/// </summary>
+/// <returns></returns>
+uint64_t BufferManager::GetDirtyWritebacks() const
+{
+	return mDirtyWritebacks.load();
+}
+
+/// <summary>
+/// Gets the number of dirty pages written back by the page cleaner.
+/// </summary>
+/// <returns></returns>
+uint64_t BufferManager::GetCleanerWritebacks() const
+{
+	return mCleanerWritebacks.load();
 }
 
+/// <summary>
+/// Main loop of the page cleaner thread.
+/// </summary>
+void BufferManager::PageCleanerLoop()
+{
+	std::unique_lock<std::mutex> lock( mCleanerMutex );
+	while ( !mCleanerStop )
+	{
+		mCleanerCondition.wait_for( lock, std::chrono::milliseconds( mCleanerIntervalMs ) );
+		if ( mCleanerStop )
+		{
+			break;
+		}
+		lock.unlock();
+		CleanDirtyPages();
+		lock.lock();
+	}
+}
+
+/// <summary>
+/// Performs one pass of the page cleaner. See overview.
+/// </summary>
+void BufferManager::CleanDirtyPages()
+{
+	// Count dirty frames and compute how many we have to clean to reach the target
+	uint32_t dirtyFrames = 0;
+	for ( BufferFrame& frame : mFrames )
+	{
+		if ( frame.IsDirty() )
+		{
+			++dirtyFrames;
+		}
+	}
+	uint32_t targetFrames = static_cast<uint32_t>(mCleanerDirtyRatio * mPageCount);
+	if ( dirtyFrames <= targetFrames )
+	{
+		return;
+	}
+	uint32_t toClean = dirtyFrames - targetFrames;
+
+	// Collect candidates in the order the replacement policy is going to pick them
+	std::vector<BufferFrame*> victims;
+	mPolicy->PeekVictims( victims, mPageCount );
+	std::vector<std::pair<uint64_t, BufferFrame*>> candidates;
+	for ( size_t i = 0; i < victims.size() && candidates.size() < toClean; ++i )
+	{
+		if ( victims[i]->IsDirty() )
+		{
+			candidates.push_back( std::make_pair( victims[i]->GetPageId(), victims[i] ) );
+		}
+	}
+	std::sort( candidates.begin(), candidates.end() );
+
+	// Lock in page id order, then write back all of them with one I/O batch
+	std::vector<BufferFrame*> frames;
+	for ( std::pair<uint64_t, BufferFrame*>& c : candidates )
+	{
+		BufferFrame& frame = *c.second;
+		if ( !frame.TryLockRead() ) // <- Lock candidate frame
+		{
+			continue;
+		}
+		// The frame may have been replaced or cleaned since we looked at it
+		if ( frame.IsDirty() && frame.mLoaded.load() )
+		{
+			frames.push_back( &frame );
+		}
+		else
+		{
+			frame.Unlock(); // <- Unlock candidate frame
+		}
+	}
+	std::vector<bool> written;
+	WritePages( frames, written );
+	for ( size_t i = 0; i < frames.size(); ++i )
+	{
+		if ( written[i] )
+		{
+			++mCleanerWritebacks;
+		}
+		else
+		{
+			LogError( "Page cleaner failed to write back page " + std::to_string( frames[i]->GetPageId() ) );
+		}
+		frames[i]->Unlock(); // <- Unlock candidate frame
+	}
+}
+
+/// <summary>
+/// Takes a snapshot of the statistics.
+/// </summary>
+/// <returns></returns>
+BufferManagerStats BufferManager::GetStats() const
+{
+	BufferManagerStats stats;
+	for ( uint32_t i = 0; i < mPartitionCount; ++i )
+	{
+		stats.hits += mPageTable[i].mHits.load();
+		stats.fixHitLatency.Merge( mPageTable[i].mHitLatency.GetSnapshot() );
+	}
+	stats.misses = mPageMisses.load();
+	stats.evictions = mEvictions.load();
+	stats.dirtyWritebacks = mDirtyWritebacks.load();
+	stats.cleanerWritebacks = mCleanerWritebacks.load();
+	stats.prefetchedPages = mPrefetchedPages.load();
+	stats.replacementRetries = mPageReplacementRetries.load();
+	stats.notRequestedPages = mNotRequestedPages.load();
+	stats.simulPageLoadTries = mSimulPageLoadTries.load();
+	stats.bytesRead = mBytesRead.load();
+	stats.bytesWritten = mBytesWritten.load();
+	stats.writeErrors = mWriteErrors.load();
+	stats.pageCount = mPageCount;
+	for ( const BufferFrame& frame : mFrames )
+	{
+		if ( frame.mExclusive.load() || frame.mSharedBy.load() > 0 )
+		{
+			++stats.fixedFrames;
+		}
+		if ( frame.IsDirty() )
+		{
+			++stats.dirtyFrames;
+		}
+	}
+	stats.fixMissLatency = mFixMissLatency.GetSnapshot();
+	stats.loadLatency = mLoadLatency.GetSnapshot();
+	stats.writeLatency = mWriteLatency.GetSnapshot();
+	return stats;
+}
+
+/// <summary>
+/// Starts a thread that appends a statistics snapshot to the file every interval.
+/// Restarts the thread if it is already running.
+/// </summary>
+/// <param name="path">The path of the file.</param>
+/// <param name="intervalMs">The interval in milliseconds.</param>
+void BufferManager::StartStatsDump( const std::string& path, uint32_t intervalMs )
+{
+	StopStatsDump();
+	mStatsDumpPath = path;
+	mStatsDumpIntervalMs = std::max( 1u, intervalMs );
+	mStatsDumpStop = false;
+	mStatsDumpThread = std::thread( &BufferManager::StatsDumpLoop, this );
+}
+
+/// <summary>
+/// Stops the statistics dump thread. Does nothing if it is not running.
+/// </summary>
+void BufferManager::StopStatsDump()
+{
+	if ( !mStatsDumpThread.joinable() )
+	{
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock( mStatsDumpMutex );
+		mStatsDumpStop = true;
+	}
+	mStatsDumpCondition.notify_all();
+	mStatsDumpThread.join();
+}
+
+/// <summary>
+/// Main loop of the statistics dump thread.
+/// </summary>
+void BufferManager::StatsDumpLoop()
+{
+	std::unique_lock<std::mutex> lock( mStatsDumpMutex );
+	while ( !mStatsDumpStop )
+	{
+		mStatsDumpCondition.wait_for( lock, std::chrono::milliseconds( mStatsDumpIntervalMs ) );
+		if ( mStatsDumpStop )
+		{
+			break;
+		}
+		lock.unlock();
+		DumpStats();
+		lock.lock();
+	}
+}
+
+/// <summary>
+/// Appends a timestamped snapshot to the dump file, followed by the latch report if latch profiling is compiled in.
+/// </summary>
+void BufferManager::DumpStats()
+{
+	std::ofstream file( mStatsDumpPath, std::ios::app );
+	if ( !file )
+	{
+		LogError( "Could not open statistics file " + mStatsDumpPath );
+		return;
+	}
+	file << "time=" << std::time( nullptr ) << "\n" << GetStats().ToString() << "\n";
+	if ( LatchProfiler::IsEnabled() )
+	{
+		file << "latches by total wait:\n" << LatchProfiler::GetReportString() << "\n";
+	}
+}
+
+/// <summary>
+/// Starts a latency measurement, does not read the clock if latency statistics are disabled.
+/// </summary>
+/// <returns></returns>
+std::chrono::steady_clock::time_point BufferManager::StartLatency() const
+{
+	return mLatencyStats ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+}
+
+/// <summary>
+/// Records the latency since start, if latency statistics are enabled.
+/// </summary>
+/// <param name="histogram">The histogram.</param>
+/// <param name="start">The start.</param>
+void BufferManager::RecordLatency( LatencyHistogram& histogram, std::chrono::steady_clock::time_point start )
+{
+	if ( mLatencyStats )
+	{
+		histogram.Record( start );
+	}
+}
+
+/// <summary>
+/// Gets the ratio of hits to all fixes.
+/// </summary>
+/// <returns></returns>
+double BufferManagerStats::GetHitRatio() const
+{
+	uint64_t fixes = hits + misses;
+	return fixes == 0 ? 0.0 : static_cast<double>(hits) / fixes;
+}
+
+/// <summary>
+/// Formats the snapshot, one line per group of values.
+/// </summary>
+/// <returns></returns>
+std::string BufferManagerStats::ToString() const
+{
+	std::ostringstream out;
+	out << "hits=" << hits << " misses=" << misses << " hitRatio=" << GetHitRatio()
+		<< " evictions=" << evictions << " prefetchedPages=" << prefetchedPages << "\n"
+		<< "dirtyWritebacks=" << dirtyWritebacks << " cleanerWritebacks=" << cleanerWritebacks
+		<< " bytesRead=" << bytesRead << " bytesWritten=" << bytesWritten << " writeErrors=" << writeErrors << "\n"
+		<< "replacementRetries=" << replacementRetries << " notRequestedPages=" << notRequestedPages
+		<< " simulPageLoadTries=" << simulPageLoadTries << "\n"
+		<< "pageCount=" << pageCount << " fixedFrames=" << fixedFrames << " dirtyFrames=" << dirtyFrames << "\n"
+		<< "fixHit: " << fixHitLatency.ToString() << "\n"
+		<< "fixMiss: " << fixMissLatency.ToString() << "\n"
+		<< "load: " << loadLatency.ToString() << "\n"
+		<< "write: " << writeLatency.ToString() << "\n";
+	return out.str();
+}
+
+/// <summary>
+/// Fixes the page like FixPage, but misses are loaded into the ring buffer of the strategy.
+/// </summary>
+/// <param name="pageId">The page identifier.</param>
+/// <param name="exclusive">if set to <c>true</c> [exclusive].</param>
+/// <param name="strategy">The strategy.</param>
+/// <returns></returns>
+BufferFrame& BufferManager::FixPage( uint64_t pageId, bool exclusive, BufferAccessStrategy& strategy )
+{
+	std::chrono::steady_clock::time_point start = StartLatency();
+	BufferFrame* frame = LookupFrame( pageId );
+	if ( frame )
+	{
+		frame->Lock( exclusive );
+		BufferFrame* found = frame;
+		frame = CheckSamePage( pageId, exclusive, frame );
+		if ( frame == found ) // FixPage counted the fix otherwise
+		{
+			PageTablePartition& partition = GetPartition( pageId );
+			++partition.mHits;
+			RecordLatency( partition.mHitLatency, start );
+		}
+		return *frame;
+	}
+	frame = FixPageReplacement( pageId, exclusive, &strategy );
+	RecordLatency( mFixMissLatency, start );
+	return *frame;
+}
+
+/// <summary>
+/// Unfixes a page that was fixed through the strategy. Does not count as an access for the replacement policy.
+/// </summary>
+/// <param name="frame">The frame.</param>
+/// <param name="isDirty">if set to <c>true</c> [is dirty].</param>
+/// <param name="strategy">The strategy.</param>
+void BufferManager::UnfixPage( BufferFrame& frame, bool isDirty, BufferAccessStrategy& strategy )
+{
+	UNREFERENCED_PARAMETER( strategy );
+	assert( frame.mExclusive.load() || frame.mSharedBy > 0 );
+	assert( isDirty ? frame.mExclusive.load() : true ); // Iff dirty then exclusive
+	if ( isDirty )
+	{
+		frame.mDirty.store( true );
+	}
+	frame.Unlock();
+}
+
+/// <summary>
+/// Gets the number of frames in the pool.
+/// </summary>
+/// <returns></returns>
+uint32_t BufferManager::GetPageCount() const
+{
+	return mPageCount;
+}
+
+/// <summary>
+/// Gets the number of frames the pool can grow to.
+/// </summary>
+/// <returns></returns>
+uint32_t BufferManager::GetMaxPageCount() const
+{
+	return mMaxPageCount;
+}
+
+/// <summary>
+/// Grows or shrinks the pool to the page count, while the buffer manager is in use. See overview.
+/// Shrinking evicts unfixed frames, if there are not enough of them the pool stays bigger than requested.
+/// With explicit huge pages shrinking gives no memory back to the OS.
+/// Throws if the page count is 0 or above the maximum page count.
+/// </summary>
+/// <param name="pageCount">The page count.</param>
+/// <returns>The page count of the pool after resizing.</returns>
+uint32_t BufferManager::Resize( uint32_t pageCount )
+{
+	if ( pageCount == 0 || pageCount > mMaxPageCount )
+	{
+		throw std::runtime_error( "Error: Invalid buffer pool size" );
+	}
+	std::lock_guard<ProfiledMutex> lock( mResizeMutex );
+	uint32_t current = mPageCount.load();
+	// Grow, enable disabled frames. Their memory is faulted in on first use.
+	for ( uint32_t i = 0; i < mFrames.size() && current < pageCount; ++i )
+	{
+		BufferFrame& frame = mFrames[i];
+		if ( frame.mDisabled.load() )
+		{
+			frame.mDisabled.store( false );
+			mPolicy->OnEnable( frame );
+			++current;
+		}
+	}
+	// Shrink, the replacement policy chooses which frames are evicted and disabled
+	while ( current > pageCount )
+	{
+		BufferFrame* frame = AcquireReplacementFrame(); // <- Lock victim frame
+		if ( !frame )
+		{
+			break; // Everything else is fixed
+		}
+		if ( !EvictFrame( *frame ) )
+		{
+			frame->Unlock(); // <- Unlock victim frame
+			break;
+		}
+		frame->mDisabled.store( true );
+		mPolicy->OnDisable( *frame );
+		frame->Unlock(); // <- Unlock victim frame
+		// Give the memory back, it is zero if the frame is enabled again. Not possible for a part of an explicit huge page.
+		if ( mPoolMemoryMode != PoolMemoryMode::HugeTLB && madvise( frame->mData, DB_PAGE_SIZE, MADV_DONTNEED ) != 0 )
+		{
+			LogError( "Failed to give the memory of a disabled frame back, errno " + std::to_string( errno ) );
+		}
+		--current;
+	}
+	mPageCount.store( current );
+	LogDebug( "Buffer pool resized to " + std::to_string( current ) + " pages" );
+	return current;
+}
+
+/// <summary>
+/// Writes back and removes the page of the exclusively locked frame, the frame is empty afterwards.
+/// </summary>
+/// <param name="frame">The frame.</param>
+/// <returns>false if the page could not be written back, the frame is unchanged in that case.</returns>
+bool BufferManager::EvictFrame( BufferFrame& frame )
+{
+	if ( !frame.mLoaded.load() )
+	{
+		return true;
+	}
+	if ( frame.IsDirty() )
+	{
+		try
+		{
+			WritePage( frame );
+		}
+		catch ( std::runtime_error& e )
+		{
+			LogError( e.what() );
+			return false;
+		}
+	}
+	// Threads waiting for the page notice the frame is not loaded and retry
+	RemovePageTableEntry( frame.mPageId, &frame );
+	frame.mLoaded.store( false );
+	++mEvictions;
+	return true;
+}
+
+/// <summary>
+/// Requests asynchronous loading of pageCount consecutive pages starting with firstPageId.
+/// Returns immediately. The pages are loaded in the background without being fixed.
+/// </summary>
+/// <param name="firstPageId">The first page identifier (already containing the segment id).</param>
+/// <param name="pageCount">The number of pages.</param>
+/// <param name="strategy">Optional ring buffer strategy the pages are loaded into.</param>
+void BufferManager::Prefetch( uint64_t firstPageId, uint32_t pageCount, std::shared_ptr<BufferAccessStrategy> strategy )
+{
+	if ( pageCount == 0 )
+	{
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock( mPrefetchMutex );
+		if ( mPrefetchStop )
+		{
+			return;
+		}
+		for ( uint32_t i = 0; i < pageCount && mPrefetchQueue.size() < mPageCount / 2; ++i )
+		{
+			mPrefetchQueue.push_back( std::make_pair( firstPageId + i, strategy ) );
+		}
+		if ( !mPrefetchThread.joinable() )
+		{
+			mPrefetchThread = std::thread( &BufferManager::PrefetchLoop, this );
+		}
+	}
+	mPrefetchCondition.notify_one();
+}
+
+/// <summary>
+/// Gets the number of times a fixed page was not in the buffer.
+/// </summary>
+/// <returns></returns>
+uint64_t BufferManager::GetPageMisses() const
+{
+	return mPageMisses.load();
+}
+
+/// <summary>
+/// Gets the number of pages loaded by the prefetcher.
+/// </summary>
+/// <returns></returns>
+uint64_t BufferManager::GetPrefetchedPages() const
+{
+	return mPrefetchedPages.load();
+}
+
+/// <summary>
+/// Main loop of the prefetch thread.
+/// </summary>
+void BufferManager::PrefetchLoop()
+{
+	std::unique_lock<std::mutex> lock( mPrefetchMutex );
+	while ( true )
+	{
+		mPrefetchCondition.wait( lock, [this]() { return mPrefetchStop || !mPrefetchQueue.empty(); } );
+		if ( mPrefetchStop )
+		{
+			break;
+		}
+		// Take a batch of requests, they are loaded with one I/O submission
+		std::vector<std::pair<uint64_t, std::shared_ptr<BufferAccessStrategy>>> requests;
+		while ( !mPrefetchQueue.empty() && requests.size() < DB_IO_BATCH_PAGES )
+		{
+			requests.push_back( std::move( mPrefetchQueue.front() ) );
+			mPrefetchQueue.pop_front();
+		}
+		lock.unlock();
+		PrefetchPages( requests );
+		lock.lock();
+	}
+}
+
+/// <summary>
+/// Loads the pages into frames, if they are not in the buffer yet. Does not fix the pages.
+/// </summary>
+/// <param name="requests">The page ids with their ring buffer strategy or a nullpointer.</param>
+void BufferManager::PrefetchPages( std::vector<std::pair<uint64_t, std::shared_ptr<BufferAccessStrategy>>>& requests )
+{
+	// Reserve frames for all pages that are missing
+	std::vector<BufferFrame*> frames;
+	for ( std::pair<uint64_t, std::shared_ptr<BufferAccessStrategy>>& request : requests )
+	{
+		uint64_t pageId = request.first;
+		if ( LookupFrame( pageId ) )
+		{
+			continue;
+		}
+		BufferFrame* frame = request.second ? AcquireRingFrame( *request.second, pageId ) : AcquireReplacementFrame(); // <- Lock replacement frame
+		if ( !frame )
+		{
+			break; // Everything is fixed, prefetching is only a hint
+		}
+		try
+		{
+			if ( !ReservePage( pageId, *frame ) )
+			{
+				frames.push_back( frame );
+			}
+		}
+		catch ( std::runtime_error& e )
+		{
+			LogError( e.what() );
+			LogError( "Prefetching failed for page " + std::to_string( pageId ) );
+		}
+	}
+
+	// Load them together
+	std::vector<bool> loaded;
+	LoadReservedPages( frames, true, loaded );
+	for ( size_t i = 0; i < frames.size(); ++i )
+	{
+		if ( loaded[i] )
+		{
+			++mPrefetchedPages;
+			frames[i]->Unlock(); // <- Unlock replacement frame, page stays unfixed
+		}
+	}
+}
+
+/// <summary>
+/// Stops the prefetch thread and drops all pending requests.
+/// </summary>
+void BufferManager::StopPrefetcher()
+{
+	{
+		std::lock_guard<std::mutex> lock( mPrefetchMutex );
+		mPrefetchStop = true;
+		mPrefetchQueue.clear();
+	}
+	mPrefetchCondition.notify_all();
+	if ( mPrefetchThread.joinable() )
+	{
+		mPrefetchThread.join();
+	}
+}
+
+/// <summary>
+/// The page replacement part of fixing a page
+/// </summary>
+/// <param name="pageId">The page identifier.</param>
+/// <param name="exclusive">if set to <c>true</c> [exclusive].</param>
+/// <param name="strategy">The ring buffer strategy or a nullpointer.</param>
+/// <returns></returns>
+BufferFrame* BufferManager::FixPageReplacement( uint64_t pageId, bool exclusive, BufferAccessStrategy* strategy )
+{
+	++mPageMisses;
+	// We did not find the page, start replacement algorithm
+	BufferFrame* frame = strategy ? AcquireRingFrame( *strategy, pageId ) : AcquireReplacementFrame(); // <- Lock replacement frame
+	if ( !frame )
+	{
+		//LogError( "Could not find any free or unfixed pages!" );
+		throw std::runtime_error( "Error: BufferManager ran out of space" );
+	}
+
+	BufferFrame* altFrame = ReplacePage( pageId, *frame );
+	if ( altFrame )
+	{
+		// Some other thread already loaded the page for us
+		++mSimulPageLoadTries;
+		altFrame->Lock( exclusive ); // <- Lock frame loaded by other thread
+		return CheckSamePage( pageId, exclusive, altFrame );
+	}
+
+	// Check what kind of lock we need on our page
+	if ( !exclusive )
+	{
+		frame->Unlock(); // <- Swap lock replaced frame
+		frame->Lock( false ); // <- Swap lock replaced frame
+							  
+		// In the extremely extremely unlikely case that the replacement algorithm
+		// chose this page to be evicted before we locked again (alg would need to do full 2 circles,
+		// and by chance end up with this page and acquire the lock, all of this before we get our own lock)
+		// ... 
+		// well we basically have a problem, we could do a recursive FixPage call again:
+		return CheckSamePage( pageId, exclusive, frame );
+	}
+	return frame;
+}
+
+/// <summary>
+/// Finds a replacement frame with the replacement algorithm and locks it exclusively.
+/// </summary>
+/// <returns>The exclusively locked frame or a nullpointer if the buffer ran out of space.</returns>
+BufferFrame* BufferManager::AcquireReplacementFrame()
+{
+	BufferFrame* frame = nullptr;
+	uint32_t pageReplaceTries = 0;
+	while ( true )
+	{
+		frame = mPolicy->FindVictim();
+		if ( !frame )
+		{
+			return nullptr;
+		}
+		++pageReplaceTries;
+		// Try to lock, if that fails, we just start with a new page search, since
+		// we do not want to wait until the lock is free again.
+		if ( frame->TryLockWrite() ) // <- Lock replacement frame
+		{
+			if ( !frame->mDisabled.load() )
+			{
+				break;
+			}
+			frame->Unlock(); // <- Unlock replacement frame, Resize disabled it after the policy returned it
+		}
+	}
+	mPageReplacementRetries += pageReplaceTries - 1;
+	return frame;
+}
+
+/// <summary>
+/// Finds a replacement frame in the ring of the strategy and locks it exclusively. Takes a frame from the pool
+/// if the ring is not full yet, or if no ring frame can be reused. Remembers that pageId goes to this ring position.
+/// </summary>
+/// <param name="strategy">The strategy.</param>
+/// <param name="pageId">The page identifier that will be loaded into the frame.</param>
+/// <returns>The exclusively locked frame or a nullpointer if the buffer ran out of space.</returns>
+BufferFrame* BufferManager::AcquireRingFrame( BufferAccessStrategy& strategy, uint64_t pageId )
+{
+	std::lock_guard<ProfiledMutex> lock( strategy.mMutex );
+	if ( strategy.mRing.size() < strategy.mRingSize )
+	{
+		BufferFrame* frame = AcquireReplacementFrame(); // <- Lock replacement frame
+		if ( frame )
+		{
+			strategy.mRing.push_back( frame );
+			strategy.mRingPages.push_back( pageId );
+		}
+		return frame;
+	}
+
+	uint32_t pos = 0;
+	for ( uint32_t i = 0; i < strategy.mRingSize; ++i )
+	{
+		pos = strategy.mNext;
+		strategy.mNext = (strategy.mNext + 1) % strategy.mRingSize;
+		BufferFrame* frame = strategy.mRing[pos];
+		if ( frame->TryLockWrite() ) // <- Lock ring frame
+		{
+			if ( frame->mPageId == strategy.mRingPages[pos] && !frame->mDisabled.load() )
+			{
+				strategy.mRingPages[pos] = pageId;
+				return frame;
+			}
+			frame->Unlock(); // <- Unlock ring frame, the pool gave it to somebody else
+			break;
+		}
+	}
+
+	// Could not reuse a ring frame, replace the ring position with a frame from the pool
+	BufferFrame* frame = AcquireReplacementFrame(); // <- Lock replacement frame
+	if ( frame )
+	{
+		strategy.mRing[pos] = frame;
+		strategy.mRingPages[pos] = pageId;
+	}
+	return frame;
+}
+
+/// <summary>
+/// Replaces the content of the exclusively locked frame with the page. Writes back the old page if dirty.
+/// If another thread already loaded or is loading the page, the frame is unlocked and the other frame is
+/// returned (unlocked). Otherwise the page is loaded, the frame stays exclusively locked and a nullpointer is returned.
+/// Throws on I/O errors, the frame is unlocked in that case.
+/// </summary>
+/// <param name="pageId">The page identifier.</param>
+/// <param name="frame">The exclusively locked replacement frame.</param>
+/// <param name="prefetch">if set to <c>true</c> the page is loaded for the prefetcher and not fixed.</param>
+/// <returns>The frame of another thread or a nullpointer on success</returns>
+BufferFrame* BufferManager::ReplacePage( uint64_t pageId, BufferFrame& frame, bool prefetch )
+{
+	BufferFrame* altFrame = ReservePage( pageId, frame );
+	if ( altFrame )
+	{
+		return altFrame;
+	}
+	try
+	{
+		LoadPage( frame );
+	}
+	catch ( std::runtime_error& )
+	{
+		AbortReservation( frame );
+		throw;
+	}
+	mPolicy->OnLoad( frame, prefetch );
+	return nullptr;
+}
+
+/// <summary>
+/// First part of ReplacePage: Reserves the page table entry of the page for the exclusively locked frame,
+/// writes back and removes the old page. The frame stays exclusively locked, loading the page is up to the caller.
+/// If another thread already loaded or is loading the page, the frame is unlocked and the other frame is
+/// returned (unlocked). Throws on I/O errors, the frame is unlocked in that case.
+/// </summary>
+/// <param name="pageId">The page identifier.</param>
+/// <param name="frame">The exclusively locked replacement frame.</param>
+/// <returns>The frame of another thread or a nullpointer on success</returns>
+BufferFrame* BufferManager::ReservePage( uint64_t pageId, BufferFrame& frame )
+{
+	uint64_t oldId = frame.mPageId;
+	bool oldLoaded = frame.mLoaded.load();
+
+	// Now check if by chance some other thread else got to our page before us
+	// and either loaded it already or is currently loading it. If not, we reserve the entry.
+	// Check and insert happen under the same lock, this prevents simultaneous loading of a page.
+	PageTablePartition& newPartition = GetPartition( pageId );
+	newPartition.mLock.LockWrite(); // <- Lock Write new partition
+	auto it = newPartition.mFrames.find( pageId );
+	if ( it != newPartition.mFrames.end() )
+	{
+		BufferFrame* altFrame = it->second;
+		newPartition.mLock.UnlockWrite(); // <- Unlock Write new partition
+		frame.Unlock(); // <- Unlock replacement frame
+		return altFrame;
+	}
+	newPartition.mFrames.insert( std::make_pair( pageId, &frame ) );
+	newPartition.mLock.UnlockWrite(); // <- Unlock Write new partition
+
+	// Nobody loaded before us and we reserved the page entry, now we do all the actual replacement work.
+	// The old entry is only removed after the write back, see overview.
+	if ( frame.IsDirty() )
+	{
+		++mDirtyWritebacks;
+		try
+		{
+			WritePage( frame );
+		}
+		catch ( std::runtime_error& )
+		{
+			// Old page stays in the frame, just give up the reservation
+			RemovePageTableEntry( pageId, &frame );
+			frame.Unlock(); // <- Unlock replacement frame
+			throw;
+		}
+	}
+	// Frames that never held a page are not in the map.
+	if ( oldLoaded )
+	{
+		RemovePageTableEntry( oldId, &frame );
+		++mEvictions;
+	}
+
+	// Replace old id with new id in frame, the caller loads
+	frame.mPageId = pageId;
+	return nullptr;
+}
+
+/// <summary>
+/// Gives up the reservation of a frame whose page could not be loaded and unlocks the frame.
+/// </summary>
+/// <param name="frame">The exclusively locked, reserved frame.</param>
+void BufferManager::AbortReservation( BufferFrame& frame )
+{
+	// Frame is empty now. Threads waiting for our page notice the frame is not loaded and retry.
+	frame.mLoaded.store( false );
+	RemovePageTableEntry( frame.mPageId, &frame );
+	frame.Unlock(); // <- Unlock replacement frame
+}
+
+/// <summary>
+/// Loads the pages of reserved frames with one I/O batch. Frames that could not be loaded are
+/// given up and unlocked, all others stay exclusively locked.
+/// </summary>
+/// <param name="frames">The exclusively locked, reserved frames.</param>
+/// <param name="prefetch">if set to <c>true</c> the pages are loaded for the prefetcher and not fixed.</param>
+/// <param name="loaded">Set per frame, whether it was loaded.</param>
+void BufferManager::LoadReservedPages( const std::vector<BufferFrame*>& frames, bool prefetch, std::vector<bool>& loaded )
+{
+	LoadPages( frames, loaded );
+	for ( size_t i = 0; i < frames.size(); ++i )
+	{
+		if ( loaded[i] )
+		{
+			mPolicy->OnLoad( *frames[i], prefetch );
+		}
+		else
+		{
+			AbortReservation( *frames[i] );
+		}
+	}
+}
+
+/// <summary>
+/// Gets the index of the page table partition responsible for the page id.
+/// </summary>
+/// <param name="pageId">The page identifier.</param>
+/// <returns></returns>
+uint32_t BufferManager::GetPartitionIndex( uint64_t pageId ) const
+{
+	// Multiplicative hashing, so consecutive pages of one segment and equal pages
+	// of different segments get spread over all partitions
+	uint64_t hash = (pageId * 0x9E3779B97F4A7C15ull) >> 32;
+	return static_cast<uint32_t>(hash % mPartitionCount);
+}
+
+/// <summary>
+/// Gets the page table partition responsible for the page id.
+/// </summary>
+/// <param name="pageId">The page identifier.</param>
+/// <returns></returns>
+BufferManager::PageTablePartition& BufferManager::GetPartition( uint64_t pageId )
+{
+	return mPageTable[GetPartitionIndex( pageId )];
+}
+
+/// <summary>
+/// Looks up the frame currently registered for the page id. Only the partition of the page is read locked.
+/// The returned frame is not locked, so callers have to verify the page id after locking.
+/// </summary>
+/// <param name="pageId">The page identifier.</param>
+/// <returns>The frame or a nullpointer if the page is not in the page table.</returns>
+BufferFrame* BufferManager::LookupFrame( uint64_t pageId )
+{
+	BufferFrame* frame = nullptr;
+	PageTablePartition& partition = GetPartition( pageId );
+	// Compress the lock as much as possible, by releasing as soon as we get
+	// a pointer to our object (if that exists)
+	partition.mLock.LockRead(); // <- Lock Read partition
+	auto it = partition.mFrames.find( pageId );
+	if ( it != partition.mFrames.end() )
+	{
+		frame = it->second;
+	}
+	partition.mLock.UnlockRead(); // <- Unlock Read partition
+	return frame;
+}
+
+/// <summary>
+/// Looks up the frames of all page ids like LookupFrame. The page ids are grouped by partition,
+/// so every partition is read locked only once. Throws if a page id is contained more than once.
+/// </summary>
+/// <param name="pageIds">The page identifiers.</param>
+/// <param name="frames">The frames in request order, nullpointer for pages not in the page table.</param>
+void BufferManager::LookupFrames( const std::vector<uint64_t>& pageIds, std::vector<BufferFrame*>& frames )
+{
+	frames.assign( pageIds.size(), nullptr );
+	// (partition, page id, request index), equal page ids end up next to each other
+	std::vector<std::tuple<uint32_t, uint64_t, size_t>> order;
+	order.reserve( pageIds.size() );
+	for ( size_t i = 0; i < pageIds.size(); ++i )
+	{
+		order.push_back( std::make_tuple( GetPartitionIndex( pageIds[i] ), pageIds[i], i ) );
+	}
+	std::sort( order.begin(), order.end() );
+	bool duplicate = false;
+	size_t begin = 0;
+	while ( begin < order.size() )
+	{
+		uint32_t partitionIndex = std::get<0>( order[begin] );
+		PageTablePartition& partition = mPageTable[partitionIndex];
+		partition.mLock.LockRead(); // <- Lock Read partition
+		size_t end = begin;
+		for ( ; end < order.size() && std::get<0>( order[end] ) == partitionIndex; ++end )
+		{
+			uint64_t pageId = std::get<1>( order[end] );
+			if ( end > begin && std::get<1>( order[end - 1] ) == pageId )
+			{
+				duplicate = true;
+			}
+			auto it = partition.mFrames.find( pageId );
+			if ( it != partition.mFrames.end() )
+			{
+				frames[std::get<2>( order[end] )] = it->second;
+			}
+		}
+		partition.mLock.UnlockRead(); // <- Unlock Read partition
+		begin = end;
+	}
+	if ( duplicate )
+	{
+		throw std::runtime_error( "Error: Page requested more than once" );
+	}
+}
+
+/// <summary>
+/// Removes the page table entry of the page id, if it still belongs to the frame.
+/// </summary>
+/// <param name="pageId">The page identifier.</param>
+/// <param name="frame">The frame.</param>
+void BufferManager::RemovePageTableEntry( uint64_t pageId, BufferFrame* frame )
+{
+	PageTablePartition& partition = GetPartition( pageId );
+	partition.mLock.LockWrite(); // <- Lock Write partition
+	auto it = partition.mFrames.find( pageId );
+	if ( it != partition.mFrames.end() && it->second == frame )
+	{
+		partition.mFrames.erase( it );
+	}
+	partition.mLock.UnlockWrite(); // <- Unlock Write partition
+}
+
+/// <summary>
+/// Gets the file of a segment. Opens and creates the file if necessary.
+/// The returned file stays valid for the lifetime of the buffer manager.
+/// </summary>
+/// <param name="segmentId">The segment identifier.</param>
+/// <returns>The segment file</returns>
+BufferManager::SegmentFile& BufferManager::GetSegmentFile( uint64_t segmentId )
+{
+	// Fast path, file is already open
+	SegmentFile* file = nullptr;
+	mSegmentFilesLock.LockRead(); // <- Lock Read segment files
+	auto it = mSegmentFiles.find( segmentId );
+	if ( it != mSegmentFiles.end() )
+	{
+		file = it->second.get();
+	}
+	mSegmentFilesLock.UnlockRead(); // <- Unlock Read segment files
+	if ( file )
+	{
+		return *file;
+	}
+
+	mSegmentFilesLock.LockWrite(); // <- Lock Write segment files
+	// Somebody might have opened the file while we waited
+	it = mSegmentFiles.find( segmentId );
+	if ( it != mSegmentFiles.end() )
+	{
+		file = it->second.get();
+		mSegmentFilesLock.UnlockWrite(); // <- Unlock Write segment files
+		return *file;
+	}
+	// Open in read write mode, create the file if necessary
+	std::string name = std::to_string( segmentId );
+	int fd = -1;
+	bool direct = false;
+#ifdef O_DIRECT
+	if ( mDirectIO )
+	{
+		fd = open( name.c_str(), O_RDWR | O_CREAT | O_DIRECT, 0644 );
+		direct = fd >= 0;
+		if ( fd < 0 && errno == EINVAL )
+		{
+			LogDebug( "File system does not support direct I/O, using buffered I/O for segment file " + name );
+		}
+	}
+#endif
+	if ( fd < 0 )
+	{
+		fd = open( name.c_str(), O_RDWR | O_CREAT, 0644 );
+	}
+	struct stat fileStat;
+	if ( fd < 0 || fstat( fd, &fileStat ) != 0 )
+	{
+		if ( fd >= 0 )
+		{
+			close( fd );
+		}
+		mSegmentFilesLock.UnlockWrite(); // <- Unlock Write segment files
+		LogError( "Failed to open segment file " + name );
+		throw std::runtime_error( "Error: Opening File" );
+	}
+	file = new SegmentFile();
+	file->mFd = fd;
+	file->mDirect = direct;
+	file->mSize.store( static_cast<uint64_t>(fileStat.st_size) );
+	mSegmentFiles.insert( std::make_pair( segmentId, std::unique_ptr<SegmentFile>( file ) ) );
+	mSegmentFilesLock.UnlockWrite(); // <- Unlock Write segment files
+	return *file;
+}
+
+/// <summary>
+/// Loads a page from harddrive. Throws on errors.
+/// </summary>
+/// <param name="frame">The exclusively locked frame, the page id is already set.</param>
+void BufferManager::LoadPage( BufferFrame& frame )
+{
+	std::vector<BufferFrame*> frames( 1, &frame );
+	std::vector<bool> loaded;
+	LoadPages( frames, loaded );
+	if ( !loaded[0] )
+	{
+		throw std::runtime_error( "Error: Reading File" );
+	}
+}
+
+/// <summary>
+/// Writes a page to harddrive. Throws on errors.
+/// </summary>
+/// <param name="frame">The locked frame.</param>
+void BufferManager::WritePage( BufferFrame& frame )
+{
+	std::vector<BufferFrame*> frames( 1, &frame );
+	std::vector<bool> written;
+	WritePages( frames, written );
+	if ( !written[0] )
+	{
+		throw std::runtime_error( "Error: Writing File" );
+	}
+}
+
+/// <summary>
+/// Loads the pages of all frames from harddrive, the reads are submitted as one I/O batch.
+/// Errors are logged, the frames that could not be loaded are not marked as loaded.
+/// </summary>
+/// <param name="frames">The exclusively locked frames, the page ids are already set.</param>
+/// <param name="loaded">Set per frame, whether it was loaded.</param>
+void BufferManager::LoadPages( const std::vector<BufferFrame*>& frames, std::vector<bool>& loaded )
+{
+	loaded.assign( frames.size(), false );
+	std::vector<IORequest> requests;
+	std::vector<size_t> requestFrames;
+	std::vector<SegmentFile*> segments( frames.size(), nullptr );
+	for ( size_t i = 0; i < frames.size(); ++i )
+	{
+		BufferFrame& frame = *frames[i];
+		// Zero out memory
+		memset( frame.mData, 0, DB_PAGE_SIZE );
+
+		auto ids = SplitPageId( frame.GetPageId() );
+		try
+		{
+			segments[i] = &GetSegmentFile( ids.first );
+		}
+		catch ( std::runtime_error& e )
+		{
+			LogError( e.what() );
+			continue;
+		}
+		// If the searched position is bigger than the file, the page is just empty.
+		uint64_t pos = ids.second * DB_PAGE_SIZE;
+		if ( pos >= segments[i]->mSize.load() )
+		{
+			loaded[i] = true;
+			continue;
+		}
+		IORequest request;
+		request.mFd = segments[i]->mFd;
+		request.mData = reinterpret_cast<uint8_t*>(frame.mData);
+		request.mLength = DB_PAGE_SIZE;
+		request.mOffset = pos;
+		requests.push_back( request );
+		requestFrames.push_back( i );
+	}
+	if ( !requests.empty() )
+	{
+		std::chrono::steady_clock::time_point start = StartLatency();
+		mIOBackend->Execute( requests.data(), requests.size() );
+		RecordLatency( mLoadLatency, start );
+	}
+
+	for ( size_t r = 0; r < requests.size(); ++r )
+	{
+		size_t i = requestFrames[r];
+		SegmentFile& segment = *segments[i];
+		int64_t done = requests[r].mResult;
+		// Reading less than a full page is fine, the rest of the page was never written. Buffered reads can
+		// also be short before the end of file, read the rest synchronously. Short direct reads are at the end of file.
+		while ( done > 0 && done < DB_PAGE_SIZE && !segment.mDirect &&
+				requests[r].mOffset + done < segment.mSize.load() )
+		{
+			IORequest rest = requests[r];
+			rest.mData += done;
+			rest.mLength -= static_cast<uint32_t>(done);
+			rest.mOffset += done;
+			SyncIOBackend::ExecuteOne( rest );
+			if ( rest.mResult <= 0 )
+			{
+				done = rest.mResult < 0 ? rest.mResult : DB_PAGE_SIZE; // End of file
+				break;
+			}
+			done += rest.mResult;
+		}
+		if ( done < 0 )
+		{
+			auto ids = SplitPageId( frames[i]->GetPageId() );
+			LogError( "Read error in segment " + std::to_string( ids.first ) + " on page " +
+					  std::to_string( ids.second ) );
+			continue;
+		}
+		mBytesRead += static_cast<uint64_t>(done);
+		loaded[i] = true;
+	}
+
+	// Set loaded bit, the replacement policy is notified by the caller
+	for ( size_t i = 0; i < frames.size(); ++i )
+	{
+		if ( loaded[i] )
+		{
+			frames[i]->mLoaded.store( true );
+		}
+	}
+}
+
+/// <summary>
+/// Writes the pages of all frames to harddrive, the writes are submitted as one I/O batch.
+/// Errors are logged and counted, the frames that could not be written stay dirty.
+/// </summary>
+/// <param name="frames">The locked frames.</param>
+/// <param name="written">Set per frame, whether it was written.</param>
+void BufferManager::WritePages( const std::vector<BufferFrame*>& frames, std::vector<bool>& written )
+{
+	written.assign( frames.size(), false );
+	std::vector<IORequest> requests;
+	std::vector<size_t> requestFrames;
+	std::vector<SegmentFile*> segments( frames.size(), nullptr );
+	for ( size_t i = 0; i < frames.size(); ++i )
+	{
+		BufferFrame& frame = *frames[i];
+		auto ids = SplitPageId( frame.GetPageId() );
+		// Write at the position of the page in the output file
+		uint64_t pos = ids.second * DB_PAGE_SIZE;
+		try
+		{
+			segments[i] = &GetSegmentFile( ids.first );
+			if ( segments[i]->mDirect && pos + DB_PAGE_SIZE > segments[i]->mSize.load() )
+			{
+				ExtendSegmentFile( *segments[i], pos + DB_PAGE_SIZE );
+			}
+		}
+		catch ( std::runtime_error& e )
+		{
+			LogError( e.what() );
+			++mWriteErrors;
+			continue;
+		}
+		IORequest request;
+		request.mFd = segments[i]->mFd;
+		request.mData = reinterpret_cast<uint8_t*>(frame.mData);
+		request.mLength = DB_PAGE_SIZE;
+		request.mOffset = pos;
+		request.mWrite = true;
+		requests.push_back( request );
+		requestFrames.push_back( i );
+	}
+	if ( !requests.empty() )
+	{
+		std::chrono::steady_clock::time_point start = StartLatency();
+		mIOBackend->Execute( requests.data(), requests.size() );
+		RecordLatency( mWriteLatency, start );
+	}
+
+	for ( size_t r = 0; r < requests.size(); ++r )
+	{
+		size_t i = requestFrames[r];
+		SegmentFile& segment = *segments[i];
+		int64_t done = requests[r].mResult;
+		// Finish short writes synchronously
+		while ( done > 0 && done < DB_PAGE_SIZE )
+		{
+			IORequest rest = requests[r];
+			rest.mData += done;
+			rest.mLength -= static_cast<uint32_t>(done);
+			rest.mOffset += done;
+			SyncIOBackend::ExecuteOne( rest );
+			if ( rest.mResult <= 0 )
+			{
+				done = -1;
+				break;
+			}
+			done += rest.mResult;
+		}
+		if ( done != DB_PAGE_SIZE )
+		{
+			auto ids = SplitPageId( frames[i]->GetPageId() );
+			LogError( "Write error in segment " + std::to_string( ids.first ) + " on page " +
+					  std::to_string( ids.second ) );
+			++mWriteErrors;
+			continue;
+		}
+
+		// If our currently written position was bigger or equal set the new filesize.
+		// Other threads might grow the file at the same time, so only ever increase the size.
+		uint64_t newSize = requests[r].mOffset + DB_PAGE_SIZE;
+		uint64_t oldSize = segment.mSize.load();
+		while ( oldSize < newSize && !segment.mSize.compare_exchange_weak( oldSize, newSize ) )
+		{
+		}
+
+		// Remove dirty flag from frame
+		frames[i]->mDirty.store( false );
+		mBytesWritten += DB_PAGE_SIZE;
+		written[i] = true;
+	}
+}
+
+/// <summary>
+/// Extends a segment file to at least the given size, rounded up to whole extents. Throws on errors.
+/// </summary>
+/// <param name="segment">The segment file.</param>
+/// <param name="minSize">The minimum size in bytes.</param>
+void BufferManager::ExtendSegmentFile( SegmentFile& segment, uint64_t minSize )
+{
+	std::lock_guard<ProfiledMutex> lock( segment.mExtendMutex ); // <- Lock extend
+	uint64_t oldSize = segment.mSize.load();
+	if ( oldSize >= minSize )
+	{
+		return; // Somebody else extended the file while we waited
+	}
+	const uint64_t extentSize = static_cast<uint64_t>(DB_FILE_EXTENT_PAGES) * DB_PAGE_SIZE;
+	uint64_t newSize = (minSize + extentSize - 1) / extentSize * extentSize;
+	// Allocate the blocks, if the file system can not do that, at least set the size
+	if ( posix_fallocate( segment.mFd, static_cast<off_t>(oldSize), static_cast<off_t>(newSize - oldSize) ) != 0 &&
+		 ftruncate( segment.mFd, static_cast<off_t>(newSize) ) != 0 )
+	{
+		LogError( "Failed to extend segment file to " + std::to_string( newSize ) + " bytes" );
+		throw std::runtime_error( "Error: Extending File" );
+	}
+	segment.mSize.store( newSize );
+} // <- Unlock extend
+
 /// <summary>
 /// Checks if the page is still our requested page, if it is not, we retry.
 /// </summary>
@@ -520,7 +2085,7 @@ void BufferManager::WritePage( BufferFrame& frame )
 /// <returns></returns>
 BufferFrame* BufferManager::CheckSamePage( uint64_t pageId, bool exclusive, BufferFrame* frame )
 {
-	if ( frame->GetPageId() != pageId )
+	if ( frame->GetPageId() != pageId || !frame->mLoaded.load() )
 	{
 		++mNotRequestedPages;
 		frame->Unlock();
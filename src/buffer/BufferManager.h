@@ -3,13 +3,83 @@
 #define BUFFER_MANAGER_H
 
 #include "BufferFrame.h"
-#include "utility/RWLock.h"
+#include "ReplacementPolicy.h"
+#include "BufferAccessStrategy.h"
+#include "IOBackend.h"
+#include "utility/HybridLatch.h"
+#include "utility/LatencyHistogram.h"
+
+#include "utility/defines.h"
 
 #include <stdint.h>
+#include <memory>
 #include <utility>
 #include <vector>
 #include <unordered_map>
+#include <atomic>
+#include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <chrono>
+#include <string>
+
+/// <summary>
+/// How the memory of the buffer pool was mapped.
+/// </summary>
+enum class PoolMemoryMode
+{
+	Regular, // Regular pages
+	TransparentHugePages, // Regular mapping, advised to use transparent huge pages and they are enabled in the kernel
+	HugeTLB // Explicitly reserved huge pages
+};
+
+/// <summary>
+/// Construction options of the buffer manager.
+/// </summary>
+struct BufferManagerConfig
+{
+	uint32_t pageCount = 1000;
+	uint32_t maxPageCount = 0; // Upper limit for Resize, 0 for DB_POOL_MAX_GROWTH times pageCount
+	uint32_t partitionCount = DB_PAGE_TABLE_PARTITIONS;
+	ReplacementPolicyType policy = ReplacementPolicyType::Clock;
+	bool hugePages = true; // Try huge pages for the pool memory, falls back to regular pages
+	uint32_t prefaultThreads = 0; // Touch the pool memory with this many threads on startup, 0 faults lazily
+	bool directIO = false; // Open segment files with O_DIRECT, bypassing the OS page cache
+	IOBackendType ioBackend = IOBackendType::IoUring; // Falls back to sync if io_uring is not available
+	bool latencyStats = true; // Record latency histograms, costs two clock reads per fix
+};
+
+/// <summary>
+/// Snapshot of the buffer manager statistics. Counters are totals since construction.
+/// </summary>
+struct BufferManagerStats
+{
+	uint64_t hits = 0; // Fixes that found their page in the buffer
+	uint64_t misses = 0; // Fixes that had to load their page
+	uint64_t evictions = 0; // Pages replaced by other pages
+	uint64_t dirtyWritebacks = 0; // Evicted pages that had to be written back first
+	uint64_t cleanerWritebacks = 0;
+	uint64_t prefetchedPages = 0;
+	uint64_t replacementRetries = 0; // Victims that could not be locked
+	uint64_t notRequestedPages = 0; // Fixes that found another page after locking and retried
+	uint64_t simulPageLoadTries = 0; // Misses that found the page loaded by another thread
+	uint64_t bytesRead = 0;
+	uint64_t bytesWritten = 0;
+	uint64_t writeErrors = 0; // Pages that could not be written back, they stay dirty
+	// State at the time of the snapshot
+	uint32_t pageCount = 0;
+	uint32_t fixedFrames = 0;
+	uint32_t dirtyFrames = 0;
+	// Latencies, load and write are per I/O call, a batch counts as one call
+	LatencySnapshot fixHitLatency;
+	LatencySnapshot fixMissLatency;
+	LatencySnapshot loadLatency;
+	LatencySnapshot writeLatency;
+
+	double GetHitRatio() const;
+	std::string ToString() const;
+};
 
 /// <summary>
 /// Concurrent Buffer Manager, enabling loading from and flushing to disk.
@@ -17,23 +87,106 @@
 class BufferManager
 {
 public:
-	BufferManager( uint32_t pageCount );
+	BufferManager( uint32_t pageCount, uint32_t partitionCount = DB_PAGE_TABLE_PARTITIONS,
+				   ReplacementPolicyType policy = ReplacementPolicyType::Clock );
+	BufferManager( const BufferManagerConfig& config );
 	~BufferManager();
 
 	BufferFrame& FixPage( uint64_t pageId, bool exclusive );
 	void UnfixPage( BufferFrame& frame, bool isDirty );
+	bool UpgradePage( BufferFrame& frame );
+	void DowngradePage( BufferFrame& frame, bool isDirty );
+	void DiscardPage( BufferFrame& frame );
+	void TruncateSegmentFile( uint64_t segmentId, uint64_t pageCount );
+	uint32_t GetPageCount() const;
+	uint32_t GetMaxPageCount() const;
+	uint32_t Resize( uint32_t pageCount );
+	PoolMemoryMode GetPoolMemoryMode() const;
+	static const char* GetPoolMemoryModeName( PoolMemoryMode mode );
+	bool IsDirectIO( uint64_t segmentId );
+	IOBackendType GetIOBackendType() const;
+
+	// Statistics
+	BufferManagerStats GetStats() const;
+	void StartStatsDump( const std::string& path, uint32_t intervalMs );
+	void StopStatsDump();
+
+	// Fixes many pages at once, one page table pass and missing pages are loaded with one I/O batch
+	void FixPages( const std::vector<uint64_t>& pageIds, bool exclusive, std::vector<BufferFrame*>& frames );
+	void UnfixPages( const std::vector<BufferFrame*>& frames, bool isDirty );
+
+	// Access through a ring buffer strategy (large scans)
+	BufferFrame& FixPage( uint64_t pageId, bool exclusive, BufferAccessStrategy& strategy );
+	void UnfixPage( BufferFrame& frame, bool isDirty, BufferAccessStrategy& strategy );
+
+	// Optimistic reading
+	BufferFrame* FixPageOptimistic( uint64_t pageId, uint64_t& version, BufferFrame* hint = nullptr );
+	bool ValidatePage( const BufferFrame& frame, uint64_t version ) const;
+
+	// Background page cleaner
+	void StartPageCleaner( double targetDirtyRatio, uint32_t intervalMs );
+	void StopPageCleaner();
+	uint64_t GetDirtyWritebacks() const;
+	uint64_t GetCleanerWritebacks() const;
+
+	// Asynchronous prefetching
+	void Prefetch( uint64_t firstPageId, uint32_t pageCount, std::shared_ptr<BufferAccessStrategy> strategy = nullptr );
+	uint64_t GetPageMisses() const;
+	uint64_t GetPrefetchedPages() const;
 
 	static uint64_t MergePageId( uint64_t segmentId, uint64_t pageInSegment );
 	static std::pair<uint64_t, uint64_t> SplitPageId( uint64_t pageId );
 private:
-	uint32_t mPageCount;
+	/// <summary>
+	/// One independently latched part of the page table. The padding keeps the locks
+	/// of neighboring partitions on different cache lines. The latch is fair, so a stream of
+	/// hits can not starve a miss that has to insert into the partition.
+	/// </summary>
+	struct PageTablePartition
+	{
+		HybridLatch mLock;
+		std::unordered_map<uint64_t, BufferFrame*> mFrames;
+		// Hit statistics of the pages in this partition, kept here so hits do not share a counter
+		std::atomic<uint64_t> mHits;
+		LatencyHistogram mHitLatency;
+		uint8_t mPadding[64];
+
+		PageTablePartition() : mLock( true, "PageTablePartition::mLock" ), mHits( 0 )
+		{
+		}
+	};
+
+	/// <summary>
+	/// Open file of a segment. Accessed with positional I/O only, so it can be shared by all threads.
+	/// </summary>
+	struct SegmentFile
+	{
+		int mFd = -1;
+		bool mDirect = false; // Opened with O_DIRECT
+		std::atomic<uint64_t> mSize; // File size in bytes, only shrinks through TruncateSegmentFile
+		ProfiledMutex mExtendMutex; // Serializes extending direct I/O files and truncating
+
+		SegmentFile() : mSize( 0 ), mExtendMutex( "SegmentFile::mExtendMutex" )
+		{
+		}
+	};
+
+	std::atomic<uint32_t> mPageCount; // Frames in the pool, the others are disabled
+	uint32_t mMaxPageCount; // Frames that exist, the pool memory is reserved for all of them
+	ProfiledMutex mResizeMutex;
 	// Memory and Buffer related
 	uint8_t* mBufferMemory = nullptr;
+	void* mPoolMapping = nullptr; // Start of the mapping, mBufferMemory can be aligned inside of it
+	size_t mPoolMappingSize = 0;
+	PoolMemoryMode mPoolMemoryMode = PoolMemoryMode::Regular;
+	bool mDirectIO;
+	std::unique_ptr<IOBackend> mIOBackend;
 	std::vector<BufferFrame> mFrames;
-	RWLock mHashMapLock;
-	std::unordered_map<uint64_t, BufferFrame*> mLoadedFrames;
-	std::mutex mFileIOLock;
-	std::unordered_map<uint64_t, std::pair<std::fstream*, uint64_t>> mFileStreams; // Filestream per segment
+	std::unique_ptr<ReplacementPolicy> mPolicy; // Page replacement, owns its own state
+	uint32_t mPartitionCount;
+	std::unique_ptr<PageTablePartition[]> mPageTable; // Page table, split into partitions by page id
+	HybridLatch mSegmentFilesLock;
+	std::unordered_map<uint64_t, std::unique_ptr<SegmentFile>> mSegmentFiles; // Open file per segment
 
 	// Stats
 	std::atomic<uint64_t> mNotRequestedPages; // Number of times we received a not requested page
@@ -41,14 +194,73 @@ private:
 	std::atomic<uint64_t> mDirtyWritebacks; // Number of times we wrote back dirty pages during operation
 	std::atomic<uint64_t> mPageReplacementRetries; // Number of times we had to retry on page replacement
 	std::atomic<uint64_t> mSimulPageLoadTries; // Number of times somebody else loaded a page we were just requesting
+	std::atomic<uint64_t> mCleanerWritebacks; // Number of dirty pages written back by the page cleaner
+	std::atomic<uint64_t> mPrefetchedPages; // Number of pages loaded by the prefetcher
+	std::atomic<uint64_t> mEvictions; // Number of pages replaced by other pages
+	std::atomic<uint64_t> mBytesRead;
+	std::atomic<uint64_t> mBytesWritten;
+	std::atomic<uint64_t> mWriteErrors;
+	bool mLatencyStats;
+	LatencyHistogram mFixMissLatency;
+	LatencyHistogram mLoadLatency;
+	LatencyHistogram mWriteLatency;
+
+	// Statistics dump
+	std::thread mStatsDumpThread;
+	std::mutex mStatsDumpMutex;
+	std::condition_variable mStatsDumpCondition;
+	bool mStatsDumpStop = false;
+	std::string mStatsDumpPath;
+	uint32_t mStatsDumpIntervalMs = 0;
+
+	// Page cleaner
+	std::thread mCleanerThread;
+	std::mutex mCleanerMutex;
+	std::condition_variable mCleanerCondition;
+	bool mCleanerStop = false;
+	double mCleanerDirtyRatio = 0.0;
+	uint32_t mCleanerIntervalMs = 0;
+
+	// Prefetcher
+	std::thread mPrefetchThread;
+	std::mutex mPrefetchMutex;
+	std::condition_variable mPrefetchCondition;
+	std::deque<std::pair<uint64_t, std::shared_ptr<BufferAccessStrategy>>> mPrefetchQueue; // Page ids waiting to be prefetched
+	bool mPrefetchStop = false;
 
 	// Helpers
-	BufferFrame* FixPageReplacement( uint64_t pageId, bool exclusive );
-	BufferFrame* FindReplacementPage();
-	std::pair<std::fstream*, uint64_t>& CheckFilestreamCache( uint64_t segmentId );
-	void MbOpenCreateFile( std::string& name, std::fstream& stream );
+	uint32_t GetPartitionIndex( uint64_t pageId ) const;
+	PageTablePartition& GetPartition( uint64_t pageId );
+	BufferFrame* LookupFrame( uint64_t pageId );
+	void LookupFrames( const std::vector<uint64_t>& pageIds, std::vector<BufferFrame*>& frames );
+	void AllocatePoolMemory( bool hugePages );
+	static bool TransparentHugePagesEnabled();
+	void PrefaultPoolMemory( uint32_t threads );
+	void FreePoolMemory();
+	bool EvictFrame( BufferFrame& frame );
+	BufferFrame* FixPageReplacement( uint64_t pageId, bool exclusive, BufferAccessStrategy* strategy = nullptr );
+	BufferFrame* AcquireReplacementFrame();
+	BufferFrame* AcquireRingFrame( BufferAccessStrategy& strategy, uint64_t pageId );
+	BufferFrame* ReplacePage( uint64_t pageId, BufferFrame& frame, bool prefetch = false );
+	BufferFrame* ReservePage( uint64_t pageId, BufferFrame& frame );
+	void AbortReservation( BufferFrame& frame );
+	void LoadReservedPages( const std::vector<BufferFrame*>& frames, bool prefetch, std::vector<bool>& loaded );
+	void PageCleanerLoop();
+	void StatsDumpLoop();
+	void DumpStats();
+	std::chrono::steady_clock::time_point StartLatency() const;
+	void RecordLatency( LatencyHistogram& histogram, std::chrono::steady_clock::time_point start );
+	void CleanDirtyPages();
+	void PrefetchLoop();
+	void PrefetchPages( std::vector<std::pair<uint64_t, std::shared_ptr<BufferAccessStrategy>>>& requests );
+	void StopPrefetcher();
+	void RemovePageTableEntry( uint64_t pageId, BufferFrame* frame );
+	SegmentFile& GetSegmentFile( uint64_t segmentId );
+	void ExtendSegmentFile( SegmentFile& segment, uint64_t minSize );
 	void LoadPage( BufferFrame& frame );
 	void WritePage( BufferFrame& frame );
+	void LoadPages( const std::vector<BufferFrame*>& frames, std::vector<bool>& loaded );
+	void WritePages( const std::vector<BufferFrame*>& frames, std::vector<bool>& written );
 	inline BufferFrame* CheckSamePage( uint64_t pageId, bool exclusive, BufferFrame* frame );
 };
 
@@ -0,0 +1,149 @@
+#include "FreeSpaceInventory.h"
+
+#include "BufferManager.h"
+
+#include <algorithm>
+
+/// <summary>
+/// Initializes a new instance of the <see cref="FreeSpaceInventory"/> class.
+/// </summary>
+/// <param name="bm">The buffer manager.</param>
+/// <param name="segmentId">The segment of the inventory (not the segment of the data pages).</param>
+FreeSpaceInventory::FreeSpaceInventory( BufferManager& bm, uint64_t segmentId ) :
+	mBufferManager( bm ), mSegmentId( segmentId )
+{
+}
+
+/// <summary>
+/// Finalizes an instance of the <see cref="FreeSpaceInventory"/> class.
+/// </summary>
+FreeSpaceInventory::~FreeSpaceInventory()
+{
+}
+
+/// <summary>
+/// Finds a data page that has at least minSpace free bytes according to the inventory.
+/// Fixes the root and at most a few leaves, leaves whose bound in the root was too high are corrected on the way.
+/// </summary>
+/// <param name="minSpace">The minimum space, including the slot.</param>
+/// <param name="pageCount">The number of data pages.</param>
+/// <param name="firstPage">The first page to consider, e.g. to skip pages the caller does not want.</param>
+/// <returns>The page in the data segment, pageCount if no page has enough space.</returns>
+uint64_t FreeSpaceInventory::FindPage( uint32_t minSpace, uint64_t pageCount, uint64_t firstPage )
+{
+	uint32_t required = GetRequiredClass( minSpace );
+	if ( required > UINT8_MAX || firstPage >= pageCount )
+	{
+		return pageCount; // Only fits an empty page, or nothing left to search
+	}
+	uint64_t leafCount = std::min<uint64_t>( (pageCount + DB_PAGE_SIZE - 1) / DB_PAGE_SIZE, DB_PAGE_SIZE );
+	uint64_t rootId = BufferManager::MergePageId( mSegmentId, 0 );
+	uint64_t leaf = firstPage / DB_PAGE_SIZE;
+	while ( leaf < leafCount )
+	{
+		// Find the next leaf that might have a page with enough space
+		BufferFrame& rootFrame = mBufferManager.FixPage( rootId, false );
+		const uint8_t* bounds = reinterpret_cast<const uint8_t*>(rootFrame.GetData());
+		while ( leaf < leafCount && bounds[leaf] < required )
+		{
+			++leaf;
+		}
+		mBufferManager.UnfixPage( rootFrame, false );
+		if ( leaf == leafCount )
+		{
+			break;
+		}
+
+		uint64_t leafFirstPage = leaf * DB_PAGE_SIZE;
+		uint64_t begin = firstPage > leafFirstPage ? firstPage - leafFirstPage : 0;
+		uint64_t entries = std::min<uint64_t>( pageCount - leafFirstPage, DB_PAGE_SIZE );
+		BufferFrame& leafFrame = mBufferManager.FixPage( BufferManager::MergePageId( mSegmentId, leaf + 1 ), false );
+		const uint8_t* classes = reinterpret_cast<const uint8_t*>(leafFrame.GetData());
+		for ( uint64_t i = begin; i < entries; ++i )
+		{
+			if ( classes[i] >= required )
+			{
+				mBufferManager.UnfixPage( leafFrame, false );
+				return leafFirstPage + i;
+			}
+		}
+		if ( begin == 0 )
+		{
+			// The bound was too high, correct it. Nobody can change the leaf meanwhile, updates fix it exclusively.
+			uint8_t leafMax = GetLeafMax( classes, DB_PAGE_SIZE );
+			BufferFrame& rootWriteFrame = mBufferManager.FixPage( rootId, true );
+			reinterpret_cast<uint8_t*>(rootWriteFrame.GetData())[leaf] = leafMax;
+			mBufferManager.UnfixPage( rootWriteFrame, true );
+		}
+		mBufferManager.UnfixPage( leafFrame, false );
+		++leaf;
+	}
+	return pageCount;
+}
+
+/// <summary>
+/// Sets the free space of the data page. Call after every change of the free space of a page
+/// and whenever a page found by FindPage did not have the space. The caller can still hold the data page.
+/// </summary>
+/// <param name="pageId">The page in the data segment.</param>
+/// <param name="freeSpace">The free space of the page, continuous and fragmented.</param>
+void FreeSpaceInventory::Update( uint64_t pageId, uint32_t freeSpace )
+{
+	uint64_t leaf = pageId / DB_PAGE_SIZE;
+	if ( leaf >= DB_PAGE_SIZE )
+	{
+		return; // Not tracked, inserts append behind these pages
+	}
+	uint8_t spaceClass = GetSpaceClass( freeSpace );
+	BufferFrame& leafFrame = mBufferManager.FixPage( BufferManager::MergePageId( mSegmentId, leaf + 1 ), true );
+	uint8_t& entry = reinterpret_cast<uint8_t*>(leafFrame.GetData())[pageId % DB_PAGE_SIZE];
+	uint8_t oldClass = entry;
+	entry = spaceClass;
+	if ( spaceClass > oldClass )
+	{
+		// Raise the bound of the leaf if it is too low now, lower bounds are corrected by FindPage
+		uint64_t rootId = BufferManager::MergePageId( mSegmentId, 0 );
+		BufferFrame& rootFrame = mBufferManager.FixPage( rootId, false );
+		bool raise = reinterpret_cast<uint8_t*>(rootFrame.GetData())[leaf] < spaceClass;
+		mBufferManager.UnfixPage( rootFrame, false );
+		if ( raise )
+		{
+			BufferFrame& rootWriteFrame = mBufferManager.FixPage( rootId, true );
+			uint8_t& bound = reinterpret_cast<uint8_t*>(rootWriteFrame.GetData())[leaf];
+			bound = std::max( bound, spaceClass );
+			mBufferManager.UnfixPage( rootWriteFrame, true );
+		}
+	}
+	mBufferManager.UnfixPage( leafFrame, spaceClass != oldClass );
+}
+
+/// <summary>
+/// Gets the class of the free space, rounded down, so every page of a class has at least the space of the class.
+/// </summary>
+/// <param name="freeSpace">The free space.</param>
+/// <returns></returns>
+uint8_t FreeSpaceInventory::GetSpaceClass( uint32_t freeSpace )
+{
+	return static_cast<uint8_t>(std::min<uint32_t>( freeSpace / DB_FSI_CLASS_BYTES, UINT8_MAX ));
+}
+
+/// <summary>
+/// Gets the lowest class that guarantees minSpace, can be above the highest class.
+/// </summary>
+/// <param name="minSpace">The minimum space.</param>
+/// <returns></returns>
+uint32_t FreeSpaceInventory::GetRequiredClass( uint32_t minSpace )
+{
+	return (minSpace + DB_FSI_CLASS_BYTES - 1) / DB_FSI_CLASS_BYTES;
+}
+
+/// <summary>
+/// Gets the highest class in the leaf.
+/// </summary>
+/// <param name="leaf">The leaf.</param>
+/// <param name="entries">The number of entries.</param>
+/// <returns></returns>
+uint8_t FreeSpaceInventory::GetLeafMax( const uint8_t* leaf, uint64_t entries )
+{
+	return *std::max_element( leaf, leaf + entries );
+}
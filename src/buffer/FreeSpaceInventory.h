@@ -0,0 +1,38 @@
+#pragma once
+#ifndef FREE_SPACE_INVENTORY_H
+#define FREE_SPACE_INVENTORY_H
+
+#include "utility/defines.h"
+
+#include <stdint.h>
+
+// Forwards
+class BufferManager;
+
+/// <summary>
+/// Persistent map of the free space on the pages of a slotted pages segment, kept in a segment of its own.
+/// Every data page has one byte, its free space class (free bytes including fragmented ones / DB_FSI_CLASS_BYTES, rounded down).
+/// Page 0 is the root, it holds one byte per leaf, an upper bound of the highest class in the leaf.
+/// Leaf l (page l + 1) holds the classes of the data pages [l * DB_PAGE_SIZE, (l + 1) * DB_PAGE_SIZE).
+/// The inventory is only a hint, callers have to check the space on the page and report it back if it was wrong.
+/// Latch order is data page, leaf, root.
+/// </summary>
+class FreeSpaceInventory
+{
+public:
+	FreeSpaceInventory( BufferManager& bm, uint64_t segmentId );
+	~FreeSpaceInventory();
+
+	uint64_t FindPage( uint32_t minSpace, uint64_t pageCount, uint64_t firstPage = 0 );
+	void Update( uint64_t pageId, uint32_t freeSpace );
+
+	static uint8_t GetSpaceClass( uint32_t freeSpace );
+	static uint32_t GetRequiredClass( uint32_t minSpace );
+private:
+	BufferManager& mBufferManager;
+	uint64_t mSegmentId;
+
+	static uint8_t GetLeafMax( const uint8_t* leaf, uint64_t entries );
+};
+
+#endif
@@ -0,0 +1,432 @@
+#include "IOBackend.h"
+
+#include "utility/helpers.h"
+#include "utility/defines.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <cstring>
+#include <string>
+#include <algorithm>
+#include <vector>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define DB_HAS_IO_URING
+#endif
+
+/// <summary>
+/// Finalizes an instance of the <see cref="IOBackend"/> class.
+/// </summary>
+IOBackend::~IOBackend()
+{
+}
+
+/// <summary>
+/// Creates a backend of the requested type. If io_uring is not available (kernel older than 5.6, disabled or
+/// not Linux), the sync backend is returned.
+/// </summary>
+/// <param name="type">The type.</param>
+/// <param name="queueDepth">The maximum number of requests in flight per batch.</param>
+/// <returns></returns>
+std::unique_ptr<IOBackend> IOBackend::Create( IOBackendType type, uint32_t queueDepth )
+{
+	if ( type == IOBackendType::IoUring )
+	{
+		std::unique_ptr<IoUringBackend> backend( new IoUringBackend( queueDepth ) );
+		if ( backend->IsAvailable() )
+		{
+			return backend;
+		}
+		LogDebug( "io_uring is not available, using synchronous I/O" );
+	}
+	return std::unique_ptr<IOBackend>( new SyncIOBackend() );
+}
+
+/// <summary>
+/// Gets the name of the backend type, for reports.
+/// </summary>
+/// <param name="type">The type.</param>
+/// <returns></returns>
+const char* IOBackend::GetName( IOBackendType type )
+{
+	switch ( type )
+	{
+	case IOBackendType::IoUring:
+		return "io_uring";
+	case IOBackendType::Sync:
+	default:
+		return "sync";
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Sync backend
+
+/// <summary>
+/// Gets the type.
+/// </summary>
+/// <returns></returns>
+IOBackendType SyncIOBackend::GetType() const
+{
+	return IOBackendType::Sync;
+}
+
+/// <summary>
+/// Executes the requests one after the other.
+/// </summary>
+/// <param name="requests">The requests.</param>
+/// <param name="count">The count.</param>
+void SyncIOBackend::Execute( IORequest* requests, size_t count )
+{
+	for ( size_t i = 0; i < count; ++i )
+	{
+		ExecuteOne( requests[i] );
+	}
+}
+
+/// <summary>
+/// Executes one request with pread/pwrite.
+/// </summary>
+/// <param name="request">The request.</param>
+void SyncIOBackend::ExecuteOne( IORequest& request )
+{
+	ssize_t bytes;
+	do
+	{
+		bytes = request.mWrite ?
+			pwrite( request.mFd, request.mData, request.mLength, static_cast<off_t>(request.mOffset) ) :
+			pread( request.mFd, request.mData, request.mLength, static_cast<off_t>(request.mOffset) );
+	} while ( bytes < 0 && errno == EINTR );
+	request.mResult = bytes < 0 ? -errno : bytes;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// io_uring backend
+// We talk to the kernel directly instead of depending on liburing. A ring consists of the submission queue
+// (indices into the array of submission entries) and the completion queue, both are shared memory with the kernel.
+// We are the only producer of the submission queue and the only consumer of the completion queue of a ring,
+// because every ring is only used by one thread at a time.
+
+#ifdef DB_HAS_IO_URING
+
+struct IoUringBackend::Ring
+{
+	int mFd = -1;
+	uint32_t mEntries = 0;
+	// Submission queue
+	void* mSqMap = MAP_FAILED;
+	size_t mSqMapSize = 0;
+	unsigned* mSqTail = nullptr;
+	unsigned* mSqMask = nullptr;
+	unsigned* mSqArray = nullptr;
+	io_uring_sqe* mSqes = nullptr;
+	size_t mSqesSize = 0;
+	// Completion queue, might share the mapping with the submission queue
+	void* mCqMap = MAP_FAILED;
+	size_t mCqMapSize = 0;
+	unsigned* mCqHead = nullptr;
+	unsigned* mCqTail = nullptr;
+	unsigned* mCqMask = nullptr;
+	io_uring_cqe* mCqes = nullptr;
+
+	~Ring()
+	{
+		if ( mSqes )
+		{
+			munmap( mSqes, mSqesSize );
+		}
+		if ( mCqMap != MAP_FAILED && mCqMap != mSqMap )
+		{
+			munmap( mCqMap, mCqMapSize );
+		}
+		if ( mSqMap != MAP_FAILED )
+		{
+			munmap( mSqMap, mSqMapSize );
+		}
+		if ( mFd >= 0 )
+		{
+			close( mFd );
+		}
+	}
+
+	/// <summary>
+	/// Creates the ring and maps its queues. Returns false if io_uring can not be used.
+	/// </summary>
+	bool Setup( uint32_t entries )
+	{
+		io_uring_params params;
+		memset( &params, 0, sizeof( params ) );
+		mFd = static_cast<int>(syscall( __NR_io_uring_setup, entries, &params ));
+		if ( mFd < 0 )
+		{
+			return false;
+		}
+		mEntries = params.sq_entries;
+		mSqMapSize = params.sq_off.array + params.sq_entries * sizeof( unsigned );
+		mCqMapSize = params.cq_off.cqes + params.cq_entries * sizeof( io_uring_cqe );
+		bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+		if ( singleMap )
+		{
+			mSqMapSize = mCqMapSize = std::max( mSqMapSize, mCqMapSize );
+		}
+		mSqMap = mmap( nullptr, mSqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mFd, IORING_OFF_SQ_RING );
+		if ( mSqMap == MAP_FAILED )
+		{
+			return false;
+		}
+		mCqMap = singleMap ? mSqMap :
+			mmap( nullptr, mCqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mFd, IORING_OFF_CQ_RING );
+		if ( mCqMap == MAP_FAILED )
+		{
+			return false;
+		}
+		mSqesSize = params.sq_entries * sizeof( io_uring_sqe );
+		void* sqes = mmap( nullptr, mSqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mFd, IORING_OFF_SQES );
+		if ( sqes == MAP_FAILED )
+		{
+			return false;
+		}
+		mSqes = reinterpret_cast<io_uring_sqe*>(sqes);
+
+		uint8_t* sq = reinterpret_cast<uint8_t*>(mSqMap);
+		mSqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+		mSqMask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+		mSqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+		uint8_t* cq = reinterpret_cast<uint8_t*>(mCqMap);
+		mCqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+		mCqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+		mCqMask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+		mCqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+		return true;
+	}
+
+	/// <summary>
+	/// Asks the kernel whether it supports the read and write operations we submit. They came with Linux 5.6,
+	/// older kernels set up rings but fail every request. The probe came with 5.6 as well, so failing it means no.
+	/// </summary>
+	bool SupportsReadWrite()
+	{
+		const unsigned probeOps = 256;
+		std::vector<uint8_t> buffer( sizeof( io_uring_probe ) + probeOps * sizeof( io_uring_probe_op ), 0 );
+		io_uring_probe* probe = reinterpret_cast<io_uring_probe*>(buffer.data());
+		if ( syscall( __NR_io_uring_register, mFd, IORING_REGISTER_PROBE, probe, probeOps ) < 0 )
+		{
+			return false;
+		}
+		auto supported = [&]( unsigned op )
+		{
+			return op <= probe->last_op && op < probeOps && (probe->ops[op].flags & IO_URING_OP_SUPPORTED) != 0;
+		};
+		return supported( IORING_OP_READ ) && supported( IORING_OP_WRITE );
+	}
+};
+
+#else
+
+struct IoUringBackend::Ring
+{
+	bool Setup( uint32_t )
+	{
+		return false;
+	}
+
+	bool SupportsReadWrite()
+	{
+		return false;
+	}
+};
+
+#endif
+
+/// <summary>
+/// Initializes a new instance of the <see cref="IoUringBackend"/> class. Creates the first ring right away,
+/// to find out whether io_uring is available and supports the operations we need.
+/// </summary>
+/// <param name="queueDepth">The maximum number of requests in flight per batch.</param>
+IoUringBackend::IoUringBackend( uint32_t queueDepth ) : mQueueDepth( queueDepth ), mRingsMutex( "IoUringBackend::mRingsMutex" )
+{
+	assert( queueDepth > 0 );
+	Ring* ring = new Ring();
+	mAvailable = ring->Setup( mQueueDepth ) && ring->SupportsReadWrite();
+	if ( mAvailable )
+	{
+		mIdleRings.push_back( ring );
+	}
+	else
+	{
+		delete ring;
+	}
+}
+
+/// <summary>
+/// Finalizes an instance of the <see cref="IoUringBackend"/> class. No batch may be in flight anymore.
+/// </summary>
+IoUringBackend::~IoUringBackend()
+{
+	for ( Ring* ring : mIdleRings )
+	{
+		delete ring;
+	}
+	mIdleRings.clear();
+}
+
+/// <summary>
+/// Determines whether io_uring could be set up and supports reads and writes.
+/// </summary>
+/// <returns></returns>
+bool IoUringBackend::IsAvailable() const
+{
+	return mAvailable;
+}
+
+/// <summary>
+/// Gets the type.
+/// </summary>
+/// <returns></returns>
+IOBackendType IoUringBackend::GetType() const
+{
+	return IOBackendType::IoUring;
+}
+
+/// <summary>
+/// Executes the requests on a ring of our own. If no ring can be created (e.g. the locked memory limit is reached),
+/// or the ring fails, the remaining requests are executed synchronously.
+/// </summary>
+/// <param name="requests">The requests.</param>
+/// <param name="count">The count.</param>
+void IoUringBackend::Execute( IORequest* requests, size_t count )
+{
+	if ( count == 0 )
+	{
+		return;
+	}
+	Ring* ring = AcquireRing();
+	if ( !ring )
+	{
+		SyncIOBackend().Execute( requests, count );
+		return;
+	}
+	if ( ExecuteOnRing( *ring, requests, count ) )
+	{
+		ReleaseRing( ring );
+	}
+	else
+	{
+		delete ring; // Ring is in an unknown state
+	}
+}
+
+/// <summary>
+/// Takes an idle ring or creates a new one.
+/// </summary>
+/// <returns>The ring or a nullpointer if no ring could be created.</returns>
+IoUringBackend::Ring* IoUringBackend::AcquireRing()
+{
+	{
+		std::lock_guard<ProfiledMutex> lock( mRingsMutex );
+		if ( !mIdleRings.empty() )
+		{
+			Ring* ring = mIdleRings.back();
+			mIdleRings.pop_back();
+			return ring;
+		}
+	}
+	Ring* ring = new Ring();
+	if ( !ring->Setup( mQueueDepth ) )
+	{
+		delete ring;
+		return nullptr;
+	}
+	return ring;
+}
+
+/// <summary>
+/// Puts the ring back for reuse.
+/// </summary>
+/// <param name="ring">The ring.</param>
+void IoUringBackend::ReleaseRing( Ring* ring )
+{
+	std::lock_guard<ProfiledMutex> lock( mRingsMutex );
+	mIdleRings.push_back( ring );
+}
+
+/// <summary>
+/// Submits the requests in chunks of the ring size and waits for all of them.
+/// If the ring fails, the requests that did not complete are executed synchronously and false is returned.
+/// </summary>
+/// <param name="ring">The ring.</param>
+/// <param name="requests">The requests.</param>
+/// <param name="count">The count.</param>
+/// <returns>Whether the ring can be used again.</returns>
+bool IoUringBackend::ExecuteOnRing( Ring& ring, IORequest* requests, size_t count )
+{
+#ifdef DB_HAS_IO_URING
+	size_t next = 0;
+	while ( next < count )
+	{
+		// Fill the submission queue
+		uint32_t chunk = static_cast<uint32_t>(std::min<size_t>( count - next, ring.mEntries ));
+		unsigned tail = *ring.mSqTail;
+		for ( uint32_t i = 0; i < chunk; ++i )
+		{
+			IORequest& request = requests[next + i];
+			unsigned index = (tail + i) & *ring.mSqMask;
+			io_uring_sqe& sqe = ring.mSqes[index];
+			memset( &sqe, 0, sizeof( sqe ) );
+			sqe.opcode = request.mWrite ? IORING_OP_WRITE : IORING_OP_READ;
+			sqe.fd = request.mFd;
+			sqe.addr = reinterpret_cast<uint64_t>(request.mData);
+			sqe.len = request.mLength;
+			sqe.off = request.mOffset;
+			sqe.user_data = next + i;
+			ring.mSqArray[index] = index;
+			request.mResult = -EINPROGRESS;
+		}
+		__atomic_store_n( ring.mSqTail, tail + chunk, __ATOMIC_RELEASE );
+
+		// Submit and reap until the whole chunk is done
+		uint32_t toSubmit = chunk;
+		uint32_t toComplete = chunk;
+		while ( toComplete > 0 )
+		{
+			int submitted = static_cast<int>(syscall( __NR_io_uring_enter, ring.mFd, toSubmit, 1, IORING_ENTER_GETEVENTS, nullptr, 0 ));
+			if ( submitted < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY )
+			{
+				LogError( "io_uring_enter failed with errno " + std::to_string( errno ) );
+				for ( size_t i = 0; i < count; ++i )
+				{
+					if ( i >= next + chunk || requests[i].mResult == -EINPROGRESS )
+					{
+						SyncIOBackend::ExecuteOne( requests[i] );
+					}
+				}
+				return false;
+			}
+			if ( submitted > 0 )
+			{
+				toSubmit -= std::min<uint32_t>( toSubmit, static_cast<uint32_t>(submitted) );
+			}
+			unsigned head = *ring.mCqHead;
+			unsigned cqTail = __atomic_load_n( ring.mCqTail, __ATOMIC_ACQUIRE );
+			while ( head != cqTail )
+			{
+				io_uring_cqe& cqe = ring.mCqes[head & *ring.mCqMask];
+				requests[cqe.user_data].mResult = cqe.res;
+				++head;
+				--toComplete;
+			}
+			__atomic_store_n( ring.mCqHead, head, __ATOMIC_RELEASE );
+		}
+		next += chunk;
+	}
+	return true;
+#else
+	UNREFERENCED_PARAMETER( ring );
+	SyncIOBackend().Execute( requests, count );
+	return false;
+#endif
+}
@@ -0,0 +1,92 @@
+#pragma once
+#ifndef IO_BACKEND_H
+#define IO_BACKEND_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "utility/LatchProfiler.h"
+
+/// <summary>
+/// I/O backends the buffer manager can be constructed with.
+/// </summary>
+enum class IOBackendType
+{
+	Sync, // pread/pwrite, one request after the other
+	IoUring // Linux io_uring, all requests of a batch are in flight at the same time
+};
+
+/// <summary>
+/// One positional read or write.
+/// </summary>
+struct IORequest
+{
+	int mFd = -1;
+	uint8_t* mData = nullptr;
+	uint32_t mLength = 0;
+	uint64_t mOffset = 0;
+	bool mWrite = false;
+	int64_t mResult = 0; // Transferred bytes or negative errno, set by the backend
+};
+
+/// <summary>
+/// Interface for the disk I/O of the buffer manager. Backends are called concurrently.
+/// Requests can be transferred partially, like with pread/pwrite, callers have to handle short transfers.
+/// </summary>
+class IOBackend
+{
+public:
+	virtual ~IOBackend();
+
+	// Creates the backend, falls back to the sync backend if the type is not available
+	static std::unique_ptr<IOBackend> Create( IOBackendType type, uint32_t queueDepth );
+	static const char* GetName( IOBackendType type );
+
+	virtual IOBackendType GetType() const = 0;
+	// Executes all requests and blocks until all of them are done
+	virtual void Execute( IORequest* requests, size_t count ) = 0;
+};
+
+/// <summary>
+/// Executes the requests one after the other with pread/pwrite.
+/// </summary>
+class SyncIOBackend : public IOBackend
+{
+public:
+	IOBackendType GetType() const override;
+	void Execute( IORequest* requests, size_t count ) override;
+
+	static void ExecuteOne( IORequest& request );
+};
+
+/// <summary>
+/// Submits up to queue depth requests to io_uring at once and waits for all completions.
+/// Every thread executing a batch uses a ring of its own, rings are kept for reuse after the batch.
+/// </summary>
+class IoUringBackend : public IOBackend
+{
+public:
+	IoUringBackend( uint32_t queueDepth );
+	~IoUringBackend();
+
+	bool IsAvailable() const;
+	IOBackendType GetType() const override;
+	void Execute( IORequest* requests, size_t count ) override;
+
+private:
+	struct Ring;
+
+	uint32_t mQueueDepth;
+	bool mAvailable = false;
+	ProfiledMutex mRingsMutex; // Protects the idle rings
+	std::vector<Ring*> mIdleRings;
+
+	Ring* AcquireRing();
+	void ReleaseRing( Ring* ring );
+	bool ExecuteOnRing( Ring& ring, IORequest* requests, size_t count );
+};
+
+#endif
@@ -0,0 +1,860 @@
+#include "ReplacementPolicy.h"
+
+#include "BufferFrame.h"
+#include "utility/defines.h"
+
+#include <assert.h>
+#include <algorithm>
+#include <iterator>
+#include <tuple>
+
+/// <summary>
+/// Initializes a new instance of the <see cref="ReplacementPolicy"/> class.
+/// The frames have to stay at the same address for the lifetime of the policy.
+/// </summary>
+/// <param name="frames">The frames of the buffer manager.</param>
+ReplacementPolicy::ReplacementPolicy( std::vector<BufferFrame>& frames ) : mFrames( frames )
+{
+	assert( !mFrames.empty() );
+}
+
+/// <summary>
+/// Finalizes an instance of the <see cref="ReplacementPolicy"/> class.
+/// </summary>
+ReplacementPolicy::~ReplacementPolicy()
+{
+}
+
+/// <summary>
+/// Creates a policy of the requested type.
+/// </summary>
+/// <param name="type">The type.</param>
+/// <param name="frames">The frames of the buffer manager.</param>
+/// <returns></returns>
+std::unique_ptr<ReplacementPolicy> ReplacementPolicy::Create( ReplacementPolicyType type, std::vector<BufferFrame>& frames )
+{
+	switch ( type )
+	{
+	case ReplacementPolicyType::TwoQueue:
+		return std::unique_ptr<ReplacementPolicy>( new TwoQueuePolicy( frames ) );
+	case ReplacementPolicyType::LRUK:
+		return std::unique_ptr<ReplacementPolicy>( new LRUKPolicy( frames ) );
+	case ReplacementPolicyType::Clock:
+	default:
+		return std::unique_ptr<ReplacementPolicy>( new ClockPolicy( frames ) );
+	}
+}
+
+/// <summary>
+/// Gets the name of the policy type, for reports.
+/// </summary>
+/// <param name="type">The type.</param>
+/// <returns></returns>
+const char* ReplacementPolicy::GetName( ReplacementPolicyType type )
+{
+	switch ( type )
+	{
+	case ReplacementPolicyType::TwoQueue:
+		return "2Q";
+	case ReplacementPolicyType::LRUK:
+		return "LRU-2";
+	case ReplacementPolicyType::Clock:
+	default:
+		return "Clock";
+	}
+}
+
+/// <summary>
+/// Gets the index of the frame.
+/// </summary>
+/// <param name="frame">The frame.</param>
+/// <returns></returns>
+uint32_t ReplacementPolicy::GetIndex( const BufferFrame& frame ) const
+{
+	assert( &frame >= &mFrames[0] && &frame < &mFrames[0] + mFrames.size() );
+	return static_cast<uint32_t>(&frame - &mFrames[0]);
+}
+
+/// <summary>
+/// Determines whether the frame is fixed at the moment. Not reliable, victims are try-locked anyways.
+/// </summary>
+/// <param name="frame">The frame.</param>
+/// <returns></returns>
+bool ReplacementPolicy::IsFixed( BufferFrame& frame )
+{
+	return frame.IsFixedProbably();
+}
+
+/// <summary>
+/// Determines whether the frame contains a page.
+/// </summary>
+/// <param name="frame">The frame.</param>
+/// <returns></returns>
+bool ReplacementPolicy::IsLoaded( const BufferFrame& frame )
+{
+	return frame.mLoaded.load();
+}
+
+/// <summary>
+/// Determines whether the frame is disabled, i.e. not part of the pool at the moment.
+/// </summary>
+/// <param name="frame">The frame.</param>
+/// <returns></returns>
+bool ReplacementPolicy::IsDisabled( const BufferFrame& frame )
+{
+	return frame.mDisabled.load();
+}
+
+/// <summary>
+/// Gets the eviction score of the frame.
+/// </summary>
+/// <param name="frame">The frame.</param>
+/// <returns></returns>
+std::atomic<uint64_t>& ReplacementPolicy::GetEvictionScore( BufferFrame& frame )
+{
+	return frame.mEvictionScore;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Clock
+//////////////////////////////////////////////////////////////////////////
+
+/// <summary>
+/// Initializes a new instance of the <see cref="ClockPolicy"/> class.
+/// </summary>
+/// <param name="frames">The frames.</param>
+ClockPolicy::ClockPolicy( std::vector<BufferFrame>& frames ) : ReplacementPolicy( frames ), mClockHand( 0 )
+{
+}
+
+/// <summary>
+/// Resets the eviction score. Prefetched pages get one chance, so they survive until they are used.
+/// </summary>
+/// <param name="frame">The frame.</param>
+/// <param name="prefetched">if set to <c>true</c> [prefetched].</param>
+void ClockPolicy::OnLoad( BufferFrame& frame, bool prefetched )
+{
+	GetEvictionScore( frame ).store( prefetched ? 1 : DB_EVICTION_COUNTER_START );
+}
+
+/// <summary>
+/// Increments the eviction score, by 2 if the page got dirty.
+/// </summary>
+/// <param name="frame">The frame.</param>
+/// <param name="dirty">if set to <c>true</c> [dirty].</param>
+void ClockPolicy::OnUnfix( BufferFrame& frame, bool dirty )
+{
+	GetEvictionScore( frame ) += dirty ? 2 : 1;
+}
+
+/// <summary>
+/// Keeps the page alive, but only writes if the score dropped to 0.
+/// </summary>
+/// <param name="frame">The frame.</param>
+void ClockPolicy::OnOptimisticAccess( BufferFrame& frame )
+{
+	std::atomic<uint64_t>& score = GetEvictionScore( frame );
+	if ( score.load( std::memory_order_relaxed ) == 0 )
+	{
+		score.store( 1, std::memory_order_relaxed );
+	}
+}
+
+/// <summary>
+/// Finds a replacement/free page and returns it.
+/// </summary>
+/// <returns>The found buffer. This returns a nullpointer in case we could not find any free buffer.</returns>
+BufferFrame* ClockPolicy::FindVictim()
+{
+	const uint32_t frameCount = static_cast<uint32_t>(mFrames.size());
+	// Cyclic walk over at least 2*page count buffers until we find a buffer with 0 eviction score.
+	// If we could not find a single unfixed one we stop looking.
+	// If we found atleast one, we continue searching.
+	// If multiple pages are searched simultaneously,
+	// this can also mean we skip some pages and visit some multiple times.
+	bool unfixedPageExisted;
+	do
+	{
+		unfixedPageExisted = false;
+		for ( uint32_t i = 0; i < frameCount * 2; ++i )
+		{
+			uint32_t pos = (mClockHand++) % frameCount; // Atomic post increment, then mod page count
+			BufferFrame& frame = mFrames[pos];
+			if ( !IsFixed( frame ) && !IsDisabled( frame ) )
+			{
+				std::atomic<uint64_t>& score = GetEvictionScore( frame );
+				if ( score == 0 )
+				{
+					return &frame;
+				}
+
+				unfixedPageExisted = true;
+				// We are forced to do a division, which is a non atomic operation. This is not a real problem.
+				// In rare occasions, a buffer can receive some extra eviction score through this.
+				score.store( score.load() / 2 );
+			}
+		}
+	} while ( unfixedPageExisted );
+
+	// Returning a nullpointer, since we could not find any valid page
+	return nullptr;
+}
+
+/// <summary>
+/// Walks from the clock hand, the clock hand visits these frames next.
+/// </summary>
+/// <param name="victims">The victims.</param>
+/// <param name="maxCount">The maximum count.</param>
+void ClockPolicy::PeekVictims( std::vector<BufferFrame*>& victims, uint32_t maxCount )
+{
+	const uint32_t frameCount = static_cast<uint32_t>(mFrames.size());
+	uint64_t hand = mClockHand.load();
+	for ( uint32_t i = 0; i < frameCount && victims.size() < maxCount; ++i )
+	{
+		BufferFrame& frame = mFrames[(hand + i) % frameCount];
+		if ( !IsFixed( frame ) && !IsDisabled( frame ) )
+		{
+			victims.push_back( &frame );
+		}
+	}
+}
+
+/// <summary>
+/// Nothing to do, the clock hand skips disabled frames.
+/// </summary>
+/// <param name="frame">The frame.</param>
+void ClockPolicy::OnDisable( BufferFrame& frame )
+{
+	UNREFERENCED_PARAMETER( frame );
+}
+
+/// <summary>
+/// Resets the eviction score, so the empty frame is taken the next time the clock hand passes.
+/// </summary>
+/// <param name="frame">The frame.</param>
+void ClockPolicy::OnEnable( BufferFrame& frame )
+{
+	GetEvictionScore( frame ).store( 0 );
+}
+
+//////////////////////////////////////////////////////////////////////////
+// 2Q
+//////////////////////////////////////////////////////////////////////////
+
+/// <summary>
+/// Initializes a new instance of the <see cref="TwoQueuePolicy"/> class.
+/// A1in holds a quarter of the frames, A1out remembers half as many pages as there are frames (as proposed for 2Q).
+/// </summary>
+/// <param name="frames">The frames.</param>
+TwoQueuePolicy::TwoQueuePolicy( std::vector<BufferFrame>& frames ) : ReplacementPolicy( frames ),
+	mMutex( "TwoQueuePolicy::mMutex" ), mEntries( frames.size() ), mReferenced( new std::atomic<uint8_t>[frames.size()] ), mActive( 0 )
+{
+	for ( uint32_t i = 0; i < mFrames.size(); ++i )
+	{
+		mReferenced[i].store( 0 );
+		Queue queue = IsDisabled( mFrames[i] ) ? Queue::Disabled : Queue::Free;
+		std::list<uint32_t>& list = GetQueue( queue );
+		list.push_back( i );
+		mEntries[i].mQueue = queue;
+		mEntries[i].mPosition = std::prev( list.end() );
+		mActive += queue == Queue::Free ? 1 : 0;
+	}
+	UpdateLimits();
+}
+
+/// <summary>
+/// Puts the page into Am if it was remembered in A1out, else into A1in.
+/// If the frame held a page from A1in before, that page is remembered in A1out.
+/// </summary>
+/// <param name="frame">The frame.</param>
+/// <param name="prefetched">if set to <c>true</c> [prefetched].</param>
+void TwoQueuePolicy::OnLoad( BufferFrame& frame, bool prefetched )
+{
+	UNREFERENCED_PARAMETER( prefetched );
+	uint32_t index = GetIndex( frame );
+	std::lock_guard<ProfiledMutex> lock( mMutex );
+	Entry& entry = mEntries[index];
+	if ( entry.mHasPage && entry.mQueue == Queue::A1in )
+	{
+		RememberPage( entry.mPageId );
+	}
+	entry.mPageId = frame.GetPageId();
+	entry.mHasPage = true;
+	mReferenced[index].store( 0, std::memory_order_relaxed );
+	auto it = mA1outIndex.find( entry.mPageId );
+	if ( it != mA1outIndex.end() )
+	{
+		mA1out.erase( it->second );
+		mA1outIndex.erase( it );
+		MoveToFront( index, Queue::Am );
+	}
+	else
+	{
+		MoveToFront( index, Queue::A1in );
+	}
+}
+
+/// <summary>
+/// Sets the reference bit, the queue position is updated lazily by FindVictim.
+/// </summary>
+/// <param name="frame">The frame.</param>
+/// <param name="dirty">if set to <c>true</c> [dirty].</param>
+void TwoQueuePolicy::OnUnfix( BufferFrame& frame, bool dirty )
+{
+	UNREFERENCED_PARAMETER( dirty );
+	std::atomic<uint8_t>& referenced = mReferenced[GetIndex( frame )];
+	if ( !referenced.load( std::memory_order_relaxed ) )
+	{
+		referenced.store( 1, std::memory_order_relaxed );
+	}
+}
+
+/// <summary>
+/// Same as unfixing, the reference bit is only written if it is not set.
+/// </summary>
+/// <param name="frame">The frame.</param>
+void TwoQueuePolicy::OnOptimisticAccess( BufferFrame& frame )
+{
+	OnUnfix( frame, false );
+}
+
+/// <summary>
+/// Takes a free frame if there is one. Otherwise replaces from A1in if it is over its size, else from Am.
+/// </summary>
+/// <returns></returns>
+BufferFrame* TwoQueuePolicy::FindVictim()
+{
+	std::lock_guard<ProfiledMutex> lock( mMutex );
+	if ( !mFree.empty() )
+	{
+		// Frame is moved to A1in, so nobody else takes it. OnLoad puts it to the right place.
+		uint32_t index = mFree.front();
+		MoveToFront( index, Queue::A1in );
+		return &mFrames[index];
+	}
+	Queue first = mA1in.size() > mA1inMax ? Queue::A1in : Queue::Am;
+	Queue second = first == Queue::A1in ? Queue::Am : Queue::A1in;
+	BufferFrame* victim = FindVictimInQueue( first );
+	if ( !victim )
+	{
+		victim = FindVictimInQueue( second );
+	}
+	return victim;
+}
+
+/// <summary>
+/// Collects unfixed frames in the order FindVictim would take them (ignoring future accesses).
+/// </summary>
+/// <param name="victims">The victims.</param>
+/// <param name="maxCount">The maximum count.</param>
+void TwoQueuePolicy::PeekVictims( std::vector<BufferFrame*>& victims, uint32_t maxCount )
+{
+	std::lock_guard<ProfiledMutex> lock( mMutex );
+	Queue order[] = { Queue::Free, mA1in.size() > mA1inMax ? Queue::A1in : Queue::Am,
+		mA1in.size() > mA1inMax ? Queue::Am : Queue::A1in };
+	for ( Queue q : order )
+	{
+		std::list<uint32_t>& queue = GetQueue( q );
+		for ( auto it = queue.rbegin(); it != queue.rend() && victims.size() < maxCount; ++it )
+		{
+			BufferFrame& frame = mFrames[*it];
+			if ( !IsFixed( frame ) && !(q == Queue::Am && mReferenced[*it].load( std::memory_order_relaxed )) )
+			{
+				victims.push_back( &frame );
+			}
+		}
+	}
+}
+
+/// <summary>
+/// Gets the list of a queue.
+/// </summary>
+/// <param name="queue">The queue.</param>
+/// <returns></returns>
+std::list<uint32_t>& TwoQueuePolicy::GetQueue( Queue queue )
+{
+	switch ( queue )
+	{
+	case Queue::A1in:
+		return mA1in;
+	case Queue::Am:
+		return mAm;
+	case Queue::Disabled:
+		return mDisabled;
+	case Queue::Free:
+	default:
+		return mFree;
+	}
+}
+
+/// <summary>
+/// Moves the frame to the front of the queue. Needs the lock.
+/// </summary>
+/// <param name="index">The index.</param>
+/// <param name="queue">The queue.</param>
+void TwoQueuePolicy::MoveToFront( uint32_t index, Queue queue )
+{
+	Entry& entry = mEntries[index];
+	std::list<uint32_t>& target = GetQueue( queue );
+	target.splice( target.begin(), GetQueue( entry.mQueue ), entry.mPosition );
+	entry.mQueue = queue;
+	entry.mPosition = target.begin();
+}
+
+/// <summary>
+/// Walks the queue from the back and returns the first unfixed frame. In Am, referenced frames get a second chance
+/// and move to the front. In A1in references are ignored (2Q does not promote on correlated references).
+/// The returned frame moves to the front as well, so concurrent callers do not pick it again. Needs the lock.
+/// </summary>
+/// <param name="queue">The queue.</param>
+/// <returns></returns>
+BufferFrame* TwoQueuePolicy::FindVictimInQueue( Queue queue )
+{
+	std::list<uint32_t>& list = GetQueue( queue );
+	if ( list.empty() )
+	{
+		return nullptr;
+	}
+	auto it = std::prev( list.end() );
+	for ( size_t i = 0, n = list.size(); i < n; ++i )
+	{
+		// Splicing keeps iterators valid, so remember the next position before we move anything
+		auto next = it == list.begin() ? list.end() : std::prev( it );
+		uint32_t index = *it;
+		BufferFrame& frame = mFrames[index];
+		if ( !IsFixed( frame ) )
+		{
+			bool referenced = mReferenced[index].load( std::memory_order_relaxed ) != 0;
+			mReferenced[index].store( 0, std::memory_order_relaxed );
+			MoveToFront( index, queue );
+			if ( !referenced || queue == Queue::A1in )
+			{
+				return &frame;
+			}
+		}
+		if ( next == list.end() )
+		{
+			break;
+		}
+		it = next;
+	}
+	return nullptr;
+}
+
+/// <summary>
+/// Takes the frame out of the queues.
+/// </summary>
+/// <param name="frame">The frame.</param>
+void TwoQueuePolicy::OnDisable( BufferFrame& frame )
+{
+	uint32_t index = GetIndex( frame );
+	std::lock_guard<ProfiledMutex> lock( mMutex );
+	mEntries[index].mHasPage = false;
+	MoveToFront( index, Queue::Disabled );
+	--mActive;
+	UpdateLimits();
+}
+
+/// <summary>
+/// Puts the frame into the free list.
+/// </summary>
+/// <param name="frame">The frame.</param>
+void TwoQueuePolicy::OnEnable( BufferFrame& frame )
+{
+	uint32_t index = GetIndex( frame );
+	std::lock_guard<ProfiledMutex> lock( mMutex );
+	MoveToFront( index, Queue::Free );
+	++mActive;
+	UpdateLimits();
+}
+
+/// <summary>
+/// Sizes A1in and A1out after the number of frames in the pool. Needs the lock.
+/// </summary>
+void TwoQueuePolicy::UpdateLimits()
+{
+	mA1inMax = std::max<size_t>( 1, mActive / 4 );
+	mA1outMax = std::max<size_t>( 1, mActive / 2 );
+}
+
+/// <summary>
+/// Remembers the page id in A1out, forgets the oldest one if A1out is full. Needs the lock.
+/// </summary>
+/// <param name="pageId">The page identifier.</param>
+void TwoQueuePolicy::RememberPage( uint64_t pageId )
+{
+	if ( mA1outIndex.find( pageId ) != mA1outIndex.end() )
+	{
+		return;
+	}
+	mA1out.push_front( pageId );
+	mA1outIndex[pageId] = mA1out.begin();
+	if ( mA1out.size() > mA1outMax )
+	{
+		mA1outIndex.erase( mA1out.back() );
+		mA1out.pop_back();
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+// LRU-K
+//////////////////////////////////////////////////////////////////////////
+
+/// <summary>
+/// Initializes a new instance of the <see cref="LRUKPolicy"/> class.
+/// </summary>
+/// <param name="frames">The frames.</param>
+LRUKPolicy::LRUKPolicy( std::vector<BufferFrame>& frames ) : ReplacementPolicy( frames ),
+	mTime( 1 ), mCorrelationPeriod( frames.size() / 16 + 1 ), mHistory( new History[frames.size()] ),
+	mEnabled( new std::atomic<uint32_t>[frames.size()] ), mEnabledPosition( new uint32_t[frames.size()] ), mEnabledCount( 0 ),
+	mRetainedMutex( "LRUKPolicy::mRetainedMutex" ), mVictimMutex( "LRUKPolicy::mVictimMutex" ), mSamplePosition( 0 )
+{
+	for ( uint32_t i = 0; i < mFrames.size(); ++i )
+	{
+		mHistory[i].mLast.store( 0 );
+		mHistory[i].mPrevious.store( 0 );
+		mHistory[i].mPicked.store( false );
+		mEnabledPosition[i] = 0;
+		if ( !IsDisabled( mFrames[i] ) )
+		{
+			OnEnable( mFrames[i] );
+		}
+	}
+}
+
+/// <summary>
+/// Retains the history of the replaced page and starts the history of the new page.
+/// Loading counts as an access (the unfix after the load is correlated), if the page was
+/// replaced not long ago its retained last access becomes the previous access.
+/// </summary>
+/// <param name="frame">The frame.</param>
+/// <param name="prefetched">if set to <c>true</c> [prefetched].</param>
+void LRUKPolicy::OnLoad( BufferFrame& frame, bool prefetched )
+{
+	UNREFERENCED_PARAMETER( prefetched );
+	History& history = mHistory[GetIndex( frame )];
+	uint64_t previous = 0;
+	{
+		std::lock_guard<ProfiledMutex> lock( mRetainedMutex );
+		if ( history.mHasPage )
+		{
+			auto inserted = mRetained.insert( std::make_pair( history.mPageId, history.mLast.load() ) );
+			if ( inserted.second )
+			{
+				mRetainedOrder.push_back( history.mPageId );
+			}
+			else
+			{
+				inserted.first->second = history.mLast.load();
+			}
+			if ( mRetainedOrder.size() > mFrames.size() )
+			{
+				mRetained.erase( mRetainedOrder.front() );
+				mRetainedOrder.pop_front();
+			}
+		}
+		auto it = mRetained.find( frame.GetPageId() );
+		if ( it != mRetained.end() )
+		{
+			previous = it->second; // Entry stays until it is the oldest, so map and order match
+		}
+	}
+	history.mPageId = frame.GetPageId();
+	history.mHasPage = true;
+	history.mLast.store( ++mTime );
+	history.mPrevious.store( previous );
+	history.mPicked.store( false );
+	std::lock_guard<ProfiledMutex> lock( mVictimMutex ); // <- Lock victims
+	QueueChanged( GetIndex( frame ) );
+} // <- Unlock victims
+
+/// <summary>
+/// Records an access.
+/// </summary>
+/// <param name="frame">The frame.</param>
+/// <param name="dirty">if set to <c>true</c> [dirty].</param>
+void LRUKPolicy::OnUnfix( BufferFrame& frame, bool dirty )
+{
+	UNREFERENCED_PARAMETER( dirty );
+	Access( GetIndex( frame ) );
+}
+
+/// <summary>
+/// Records an access, but only if the last one is older than one load per frame.
+/// Pages read very often (inner B+ tree nodes) therefore write their history rarely.
+/// </summary>
+/// <param name="frame">The frame.</param>
+void LRUKPolicy::OnOptimisticAccess( BufferFrame& frame )
+{
+	uint32_t index = GetIndex( frame );
+	if ( mTime.load( std::memory_order_relaxed ) - mHistory[index].mLast.load( std::memory_order_relaxed ) > mFrames.size() )
+	{
+		Access( index );
+	}
+}
+
+/// <summary>
+/// Takes the unfixed frame with the oldest second to last access, ties (no second access) are broken by the last access.
+/// Only the candidates and the changed frames are considered. Candidates that were accessed since they were sampled
+/// and changed frames that were accessed since they were queued are queued again with their new history.
+/// The victim is marked as picked, so concurrent callers skip it until it is loaded or accessed again.
+/// </summary>
+/// <returns></returns>
+BufferFrame* LRUKPolicy::FindVictim()
+{
+	std::lock_guard<ProfiledMutex> lock( mVictimMutex ); // <- Lock victims
+	std::greater<std::tuple<uint64_t, uint64_t, uint32_t>> heapOrder; // Best changed frame at the front
+	uint32_t victim = UINT32_MAX;
+	while ( victim == UINT32_MAX )
+	{
+		if ( !mCandidates.empty() && !IsUnchanged( mCandidates.back() ) )
+		{
+			uint32_t i = std::get<2>( mCandidates.back() );
+			mCandidates.pop_back();
+			if ( !IsDisabled( mFrames[i] ) && !mHistory[i].mPicked.load( std::memory_order_relaxed ) )
+			{
+				QueueChanged( i );
+			}
+			continue;
+		}
+		if ( mCandidates.empty() )
+		{
+			// The sample starts over, it finds the changed frames as well
+			mChanged.clear();
+			mFixedChanged.clear();
+			return SampleCandidates();
+		}
+		if ( !mChanged.empty() )
+		{
+			std::pop_heap( mChanged.begin(), mChanged.end(), heapOrder );
+			uint32_t i = std::get<2>( mChanged.back() );
+			History& history = mHistory[i];
+			if ( IsDisabled( mFrames[i] ) || history.mPicked.load( std::memory_order_relaxed ) || history.mQueued != std::get<1>( mChanged.back() ) )
+			{
+				mChanged.pop_back(); // Replaced, or queued again and the newer entry is the valid one
+				continue;
+			}
+			if ( IsFixed( mFrames[i] ) )
+			{
+				// Usually still fixed by the thread that loaded it, it is put back afterwards
+				mFixedChanged.push_back( mChanged.back() );
+				mChanged.pop_back();
+				continue;
+			}
+			if ( !IsUnchanged( mChanged.back() ) )
+			{
+				mChanged.pop_back();
+				QueueChanged( i );
+				continue;
+			}
+			std::push_heap( mChanged.begin(), mChanged.end(), heapOrder );
+		}
+		if ( !mChanged.empty() && mChanged.front() < mCandidates.back() )
+		{
+			victim = std::get<2>( mChanged.front() );
+			std::pop_heap( mChanged.begin(), mChanged.end(), heapOrder );
+			mChanged.pop_back();
+		}
+		else
+		{
+			victim = std::get<2>( mCandidates.back() );
+			mCandidates.pop_back();
+		}
+	}
+	mHistory[victim].mPicked.store( true, std::memory_order_relaxed );
+	for ( const std::tuple<uint64_t, uint64_t, uint32_t>& changed : mFixedChanged )
+	{
+		mChanged.push_back( changed );
+		std::push_heap( mChanged.begin(), mChanged.end(), heapOrder );
+	}
+	mFixedChanged.clear();
+	return &mFrames[victim];
+} // <- Unlock victims
+
+/// <summary>
+/// Determines whether the frame of the entry is unfixed, part of the pool, not picked and was not accessed since the entry was taken.
+/// </summary>
+/// <param name="entry">Previous, last access and index of the frame.</param>
+/// <returns></returns>
+bool LRUKPolicy::IsUnchanged( const std::tuple<uint64_t, uint64_t, uint32_t>& entry )
+{
+	uint32_t i = std::get<2>( entry );
+	History& history = mHistory[i];
+	return !IsFixed( mFrames[i] ) && !IsDisabled( mFrames[i] ) && !history.mPicked.load( std::memory_order_relaxed ) &&
+		history.mPrevious.load( std::memory_order_relaxed ) == std::get<0>( entry ) &&
+		history.mLast.load( std::memory_order_relaxed ) == std::get<1>( entry );
+}
+
+/// <summary>
+/// Adds the frame with its current history to the changed frames, an older entry of the frame becomes invalid.
+/// If there are too many of them, they are dropped, the next sample finds them again. Call with the victim mutex held.
+/// </summary>
+/// <param name="index">The index.</param>
+void LRUKPolicy::QueueChanged( uint32_t index )
+{
+	if ( mChanged.size() >= DB_LRUK_SAMPLE_FRAMES )
+	{
+		mChanged.clear();
+	}
+	History& history = mHistory[index];
+	history.mQueued = history.mLast.load( std::memory_order_relaxed );
+	mChanged.push_back( std::make_tuple( history.mPrevious.load( std::memory_order_relaxed ), history.mQueued, index ) );
+	std::push_heap( mChanged.begin(), mChanged.end(), std::greater<std::tuple<uint64_t, uint64_t, uint32_t>>() );
+}
+
+/// <summary>
+/// Samples the next DB_LRUK_SAMPLE_FRAMES frames of the pool, until one of them is unfixed or every frame was looked at.
+/// The best unfixed frame is returned, the next best DB_LRUK_CANDIDATES stay candidates. Frames without a page are taken right away.
+/// If only picked frames are unfixed, one of them is returned again. Call with the victim mutex held.
+/// </summary>
+/// <returns>The victim, nullptr if all frames are fixed.</returns>
+BufferFrame* LRUKPolicy::SampleCandidates()
+{
+	uint32_t anyPicked = UINT32_MAX; // Fallback if every unfixed frame was picked
+	uint32_t enabledCount = mEnabledCount.load( std::memory_order_acquire );
+	uint32_t sampled = 0;
+	while ( mCandidates.empty() && sampled < enabledCount )
+	{
+		uint32_t window = std::min( DB_LRUK_SAMPLE_FRAMES, enabledCount - sampled );
+		sampled += window;
+		for ( uint32_t n = 0; n < window; ++n )
+		{
+			if ( mSamplePosition >= enabledCount )
+			{
+				mSamplePosition = 0;
+			}
+			uint32_t i = mEnabled[mSamplePosition++].load( std::memory_order_relaxed );
+			BufferFrame& frame = mFrames[i];
+			if ( IsFixed( frame ) || IsDisabled( frame ) )
+			{
+				continue;
+			}
+			if ( mHistory[i].mPicked.load( std::memory_order_relaxed ) )
+			{
+				anyPicked = i;
+				continue;
+			}
+			if ( !IsLoaded( frame ) )
+			{
+				mHistory[i].mPicked.store( true, std::memory_order_relaxed );
+				return &frame;
+			}
+			mCandidates.push_back( std::make_tuple( mHistory[i].mPrevious.load( std::memory_order_relaxed ),
+													mHistory[i].mLast.load( std::memory_order_relaxed ), i ) );
+		}
+		// Keep the best, sorted so the best one is at the back
+		size_t keep = std::min<size_t>( DB_LRUK_CANDIDATES + 1, mCandidates.size() );
+		std::partial_sort( mCandidates.begin(), mCandidates.begin() + keep, mCandidates.end() );
+		mCandidates.resize( keep );
+		std::reverse( mCandidates.begin(), mCandidates.end() );
+	}
+	uint32_t best = anyPicked;
+	if ( !mCandidates.empty() )
+	{
+		best = std::get<2>( mCandidates.back() );
+		mCandidates.pop_back();
+	}
+	if ( best == UINT32_MAX )
+	{
+		return nullptr;
+	}
+	mHistory[best].mPicked.store( true, std::memory_order_relaxed );
+	return &mFrames[best];
+}
+
+/// <summary>
+/// Sorts the unfixed frames by their replacement order.
+/// </summary>
+/// <param name="victims">The victims.</param>
+/// <param name="maxCount">The maximum count.</param>
+void LRUKPolicy::PeekVictims( std::vector<BufferFrame*>& victims, uint32_t maxCount )
+{
+	std::vector<std::tuple<uint64_t, uint64_t, uint32_t>> order;
+	uint32_t enabledCount = mEnabledCount.load( std::memory_order_acquire );
+	for ( uint32_t n = 0; n < enabledCount; ++n )
+	{
+		uint32_t i = mEnabled[n].load( std::memory_order_relaxed );
+		if ( !IsFixed( mFrames[i] ) && !IsDisabled( mFrames[i] ) )
+		{
+			order.push_back( std::make_tuple( mHistory[i].mPrevious.load( std::memory_order_relaxed ),
+											  mHistory[i].mLast.load( std::memory_order_relaxed ), i ) );
+		}
+	}
+	size_t count = std::min<size_t>( maxCount - std::min<size_t>( maxCount, victims.size() ), order.size() );
+	std::partial_sort( order.begin(), order.begin() + count, order.end() );
+	for ( size_t i = 0; i < count; ++i )
+	{
+		victims.push_back( &mFrames[std::get<2>( order[i] )] );
+	}
+}
+
+/// <summary>
+/// Forgets the history of the frame and removes it from the enabled frames. The page was replaced like in OnLoad,
+/// so its last access is retained.
+/// </summary>
+/// <param name="frame">The frame.</param>
+void LRUKPolicy::OnDisable( BufferFrame& frame )
+{
+	uint32_t index = GetIndex( frame );
+	// The last enabled frame takes the place, concurrent searches might see it twice or miss it once
+	uint32_t last = mEnabledCount.load() - 1;
+	uint32_t moved = mEnabled[last].load();
+	mEnabled[mEnabledPosition[index]].store( moved );
+	mEnabledPosition[moved] = mEnabledPosition[index];
+	mEnabledCount.store( last );
+	History& history = mHistory[index];
+	{
+		std::lock_guard<ProfiledMutex> lock( mRetainedMutex );
+		if ( history.mHasPage && mRetained.insert( std::make_pair( history.mPageId, history.mLast.load() ) ).second )
+		{
+			mRetainedOrder.push_back( history.mPageId );
+			if ( mRetainedOrder.size() > mFrames.size() )
+			{
+				mRetained.erase( mRetainedOrder.front() );
+				mRetainedOrder.pop_front();
+			}
+		}
+	}
+	history.mHasPage = false;
+	history.mLast.store( 0 );
+	history.mPrevious.store( 0 );
+	history.mPicked.store( false );
+}
+
+/// <summary>
+/// Adds the frame to the enabled frames, empty frames are taken first.
+/// </summary>
+/// <param name="frame">The frame.</param>
+void LRUKPolicy::OnEnable( BufferFrame& frame )
+{
+	uint32_t index = GetIndex( frame );
+	uint32_t count = mEnabledCount.load();
+	mEnabled[count].store( index );
+	mEnabledPosition[index] = count;
+	mEnabledCount.store( count + 1 );
+}
+
+/// <summary>
+/// Shifts the history of the frame and records the current time. A correlated access only updates the last access.
+/// Nothing is written if the frame was already accessed since the last load, apart from clearing its picked mark.
+/// </summary>
+/// <param name="index">The index.</param>
+void LRUKPolicy::Access( uint32_t index )
+{
+	History& history = mHistory[index];
+	if ( history.mPicked.load( std::memory_order_relaxed ) )
+	{
+		history.mPicked.store( false, std::memory_order_relaxed );
+	}
+	uint64_t now = mTime.load( std::memory_order_relaxed );
+	uint64_t last = history.mLast.load( std::memory_order_relaxed );
+	if ( now == last )
+	{
+		return;
+	}
+	if ( now - last > mCorrelationPeriod )
+	{
+		history.mPrevious.store( last, std::memory_order_relaxed );
+	}
+	history.mLast.store( now, std::memory_order_relaxed );
+}
@@ -0,0 +1,206 @@
+#pragma once
+#ifndef REPLACEMENT_POLICY_H
+#define REPLACEMENT_POLICY_H
+
+#include <stdint.h>
+#include <vector>
+#include <list>
+#include <deque>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <tuple>
+
+#include "utility/LatchProfiler.h"
+
+// Forwards
+class BufferFrame;
+
+/// <summary>
+/// Page replacement policies the buffer manager can be constructed with.
+/// </summary>
+enum class ReplacementPolicyType
+{
+	Clock, // Modified second chance with eviction scores
+	TwoQueue, // 2Q, FIFO for pages seen once, LRU (approximated) for pages seen again
+	LRUK // LRU-K with K = 2
+};
+
+/// <summary>
+/// Interface for page replacement policies. Every buffer manager owns one policy instance, which is called concurrently.
+/// Victims are only candidates: the buffer manager try-locks them and asks for a new victim if that fails,
+/// so a policy has to make sure it does not return the same frame again right away.
+/// Disabled frames (not part of the pool after a resize) must never be returned as victims.
+/// </summary>
+class ReplacementPolicy
+{
+public:
+	ReplacementPolicy( std::vector<BufferFrame>& frames );
+	virtual ~ReplacementPolicy();
+
+	static std::unique_ptr<ReplacementPolicy> Create( ReplacementPolicyType type, std::vector<BufferFrame>& frames );
+	static const char* GetName( ReplacementPolicyType type );
+
+	// Called with the frame exclusively locked, after a new page was loaded into it
+	virtual void OnLoad( BufferFrame& frame, bool prefetched ) = 0;
+	// Called by UnfixPage before the frame is unlocked
+	virtual void OnUnfix( BufferFrame& frame, bool dirty ) = 0;
+	// Called for optimistic reads, policies should avoid writing shared memory here
+	virtual void OnOptimisticAccess( BufferFrame& frame ) = 0;
+	// Returns an unfixed frame that should be replaced, nullptr if all frames are fixed
+	virtual BufferFrame* FindVictim() = 0;
+	// Collects up to maxCount unfixed frames in the order they will probably be replaced. Does not change any state.
+	virtual void PeekVictims( std::vector<BufferFrame*>& victims, uint32_t maxCount ) = 0;
+	// Called with the frame exclusively locked, after it was emptied and disabled
+	virtual void OnDisable( BufferFrame& frame ) = 0;
+	// Called after an empty frame was enabled again, the frame is not locked
+	virtual void OnEnable( BufferFrame& frame ) = 0;
+
+protected:
+	std::vector<BufferFrame>& mFrames;
+
+	uint32_t GetIndex( const BufferFrame& frame ) const;
+	static bool IsFixed( BufferFrame& frame );
+	static bool IsLoaded( const BufferFrame& frame );
+	static bool IsDisabled( const BufferFrame& frame );
+	static std::atomic<uint64_t>& GetEvictionScore( BufferFrame& frame );
+};
+
+/// <summary>
+/// Modified second chance. Every unfix increments the eviction score of the frame (dirty by 2),
+/// the clock hand halves the scores of the frames it passes and takes the first unfixed frame with score 0.
+/// </summary>
+class ClockPolicy : public ReplacementPolicy
+{
+public:
+	ClockPolicy( std::vector<BufferFrame>& frames );
+
+	void OnLoad( BufferFrame& frame, bool prefetched ) override;
+	void OnUnfix( BufferFrame& frame, bool dirty ) override;
+	void OnOptimisticAccess( BufferFrame& frame ) override;
+	BufferFrame* FindVictim() override;
+	void PeekVictims( std::vector<BufferFrame*>& victims, uint32_t maxCount ) override;
+	void OnDisable( BufferFrame& frame ) override;
+	void OnEnable( BufferFrame& frame ) override;
+
+private:
+	std::atomic<uint64_t> mClockHand; // Position of the replacement algorithm
+};
+
+/// <summary>
+/// 2Q replacement. New pages enter the FIFO queue A1in. Pages replaced from A1in are remembered (page id only) in A1out,
+/// a page that is loaded again while it is remembered is a hot page and enters the Am queue.
+/// Am is an LRU queue approximated with reference bits, so unfixing does not need the queue lock.
+/// </summary>
+class TwoQueuePolicy : public ReplacementPolicy
+{
+public:
+	TwoQueuePolicy( std::vector<BufferFrame>& frames );
+
+	void OnLoad( BufferFrame& frame, bool prefetched ) override;
+	void OnUnfix( BufferFrame& frame, bool dirty ) override;
+	void OnOptimisticAccess( BufferFrame& frame ) override;
+	BufferFrame* FindVictim() override;
+	void PeekVictims( std::vector<BufferFrame*>& victims, uint32_t maxCount ) override;
+	void OnDisable( BufferFrame& frame ) override;
+	void OnEnable( BufferFrame& frame ) override;
+
+private:
+	enum class Queue : uint8_t
+	{
+		Free,
+		A1in,
+		Am,
+		Disabled
+	};
+	struct Entry
+	{
+		Queue mQueue = Queue::Free;
+		std::list<uint32_t>::iterator mPosition;
+		uint64_t mPageId = 0;
+		bool mHasPage = false; // Page id is valid
+	};
+
+	ProfiledMutex mMutex; // Protects everything except the reference bits
+	std::vector<Entry> mEntries; // Per frame
+	std::unique_ptr<std::atomic<uint8_t>[]> mReferenced; // Per frame, set on access
+	std::list<uint32_t> mFree;
+	std::list<uint32_t> mA1in; // Front is newest
+	std::list<uint32_t> mAm; // Front is most recently used
+	std::list<uint32_t> mDisabled; // Frames that are not part of the pool
+	std::list<uint64_t> mA1out; // Front is newest
+	std::unordered_map<uint64_t, std::list<uint64_t>::iterator> mA1outIndex;
+	size_t mA1inMax;
+	size_t mA1outMax;
+	size_t mActive; // Frames that are not disabled
+
+	void UpdateLimits();
+
+	std::list<uint32_t>& GetQueue( Queue queue );
+	void MoveToFront( uint32_t index, Queue queue );
+	BufferFrame* FindVictimInQueue( Queue queue );
+	void RememberPage( uint64_t pageId );
+};
+
+/// <summary>
+/// LRU-2. Replaces the unfixed page with the largest backward distance to its second to last access.
+/// Pages that were only accessed once have an infinite distance and go first (least recently used among them),
+/// which keeps pages of a single scan from pushing out pages that are used repeatedly.
+/// Accesses shortly after each other (e.g. loading and unfixing, or fixing a page twice in one operation)
+/// are correlated and count as one access. The last access of replaced pages is retained for a while,
+/// so a page that comes back soon after it was replaced is recognized as used repeatedly.
+/// Time only advances when a page is loaded, hits on a page that was already accessed since the last load write nothing.
+/// Victims are taken from a short list of candidates, the best frames of a sample of the pool. The list is refilled
+/// from the next frames of the pool when it is empty, so finding a victim does not look at every frame.
+/// Accesses only make a frame a worse victim, only loads can make it a better one. So loaded frames and candidates
+/// that were accessed are kept in a heap in the same order, and the best of them competes with the best candidate.
+/// </summary>
+class LRUKPolicy : public ReplacementPolicy
+{
+public:
+	LRUKPolicy( std::vector<BufferFrame>& frames );
+
+	void OnLoad( BufferFrame& frame, bool prefetched ) override;
+	void OnUnfix( BufferFrame& frame, bool dirty ) override;
+	void OnOptimisticAccess( BufferFrame& frame ) override;
+	BufferFrame* FindVictim() override;
+	void PeekVictims( std::vector<BufferFrame*>& victims, uint32_t maxCount ) override;
+	void OnDisable( BufferFrame& frame ) override;
+	void OnEnable( BufferFrame& frame ) override;
+
+private:
+	struct History
+	{
+		std::atomic<uint64_t> mLast; // Time of the last access
+		std::atomic<uint64_t> mPrevious; // Time of the access before, 0 if there was none
+		std::atomic<bool> mPicked; // Returned as victim since the last load or access
+		uint64_t mPageId = 0; // Only changed in OnLoad
+		uint64_t mQueued = 0; // Last access of the entry of the frame in the changed frames, protected by the victim mutex
+		bool mHasPage = false;
+	};
+
+	std::atomic<uint64_t> mTime; // Logical time, incremented on every load
+	uint64_t mCorrelationPeriod; // Accesses closer than this (in logical time) are correlated
+	std::unique_ptr<History[]> mHistory; // Per frame
+	// Indices of the frames that are part of the pool, the first mEnabledCount are valid. Victim searches only walk
+	// these, the frames a big maximum pool size reserves are not looked at. Only changed by resizes, which are serialized.
+	std::unique_ptr<std::atomic<uint32_t>[]> mEnabled;
+	std::unique_ptr<uint32_t[]> mEnabledPosition; // Per frame, position in mEnabled
+	std::atomic<uint32_t> mEnabledCount;
+	ProfiledMutex mRetainedMutex; // Protects the retained history
+	std::unordered_map<uint64_t, uint64_t> mRetained; // Last access of replaced pages
+	std::deque<uint64_t> mRetainedOrder; // Oldest replaced page first
+	ProfiledMutex mVictimMutex; // Protects the candidates, the changed frames and the sample position
+	std::vector<std::tuple<uint64_t, uint64_t, uint32_t>> mCandidates; // Previous, last access and index, best at the back
+	std::vector<std::tuple<uint64_t, uint64_t, uint32_t>> mChanged; // Heap like the candidates, frames changed since the sample, best at the front
+	std::vector<std::tuple<uint64_t, uint64_t, uint32_t>> mFixedChanged; // Fixed changed frames a victim search set aside
+	uint32_t mSamplePosition; // Position in mEnabled the next sample starts at
+
+	void Access( uint32_t index );
+	bool IsUnchanged( const std::tuple<uint64_t, uint64_t, uint32_t>& entry );
+	void QueueChanged( uint32_t index );
+	BufferFrame* SampleCandidates();
+};
+
+#endif
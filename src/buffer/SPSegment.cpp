@@ -5,16 +5,28 @@
 #include "SlottedPage.h"
 #include "DBCore.h"
 
+#include <algorithm>
 #include <cassert>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+
+// Stripe without insert target page
+static const uint64_t gNoTarget = UINT64_MAX;
 
 /// <summary>
 /// Initializes a new instance of the <see cref="SPSegment"/> class.
 /// </summary>
-/// <param name="segmentId">The segment identifier.</param>
-/// <param name="pagecount">The pagecount.</param>
-SPSegment::SPSegment( DBCore& core, BufferManager& bm, uint64_t segmentId ) :
-	mCore(core), mBufferManager(bm), mSegmentId(segmentId)
+/// <param name="descriptor">The descriptor of the relation segment.</param>
+/// <param name="fsiSegmentId">The segment of the free space inventory.</param>
+SPSegment::SPSegment( DBCore& core, BufferManager& bm, SegmentDescriptor& descriptor, uint64_t fsiSegmentId ) :
+	mCore(core), mBufferManager(bm), mSegmentId(descriptor.segmentId), mDescriptor( descriptor ), mInventory( bm, fsiSegmentId ), mTruncations( descriptor.truncations.load() ),
+	mTargetsMutex( "SPSegment::mTargetsMutex" )
 {
+	for ( std::atomic<uint64_t>& target : mTargets )
+	{
+		target.store( gNoTarget );
+	}
 }
 
 /// <summary>
@@ -25,68 +37,78 @@ SPSegment::~SPSegment()
 }
 
 /// <summary>
-/// Searches through the segment's pages looking for a page with enough space to store r. 
+/// Stores r on the target page of the calling thread, a new target is looked up in the free space inventory if needed.
+/// Records bigger than DB_MAX_INLINE_RECORD are written to overflow pages first and only their stub is stored in the page.
 /// Returns the TID identifying the location where r was stored.
 /// </summary>
 /// <param name="r">The r.</param>
 /// <returns></returns>
 TID SPSegment::Insert( const Record& r )
 {
-	return Insert( r, false );
+	if ( r.GetLen() > DB_MAX_INLINE_RECORD )
+	{
+		std::vector<uint8_t> stub;
+		WriteOverflow( r, stub );
+		return Insert( stub.data(), static_cast<uint32_t>(stub.size()), nullptr, true );
+	}
+	return Insert( r.GetData(), r.GetLen(), nullptr, false );
 }
 
 /// <summary>
-/// Inserts the specified r. Sets the slot to from other page if bool is true. (Assumes 8 byte backlink tid is prepended to record)
+/// Inserts the data of a record. If backlink is set, the record was moved from the backlink tid, which is stored in front of it.
+/// The free space of the target page is reported to the inventory once the thread leaves the page, 
+/// until then the target is hidden from other threads through mTargets.
 /// </summary>
-/// <param name="r">The r.</param>
-/// <param name="setFromOtherPage">if set to <c>true</c> [set from other page].</param>
+/// <param name="data">The record, or the stub of a record on overflow pages.</param>
+/// <param name="length">The length of the data.</param>
+/// <param name="backlink">The tid the record was moved from, nullptr for new records.</param>
+/// <param name="overflow">if set to <c>true</c> the data is an overflow stub.</param>
 /// <returns></returns>
-TID SPSegment::Insert( const Record& r, bool setFromOtherPage )
+TID SPSegment::Insert( const uint8_t* data, uint32_t length, const TID* backlink, bool overflow )
 {
+	uint32_t dataLength = backlink ? length + 8 : length;
+	// Bigger records go to overflow pages, so everything fits into Pagesize - (header + 1 slot)
+	assert( dataLength <= DB_PAGE_SIZE - DB_SLOTTED_PAGE_HEADER - 8 );
+	std::atomic<uint64_t>& target = mTargets[GetThreadIndex() % DB_INSERT_TARGET_STRIPES];
 	// Loop until we find a free page
 	while ( true )
 	{
-		uint64_t pageId = FindFreePage( r.GetLen() );
+		// Read before the target, ResetTargets clears the targets before it moves on to a new truncation count
+		uint64_t truncations = mTruncations.load();
+		uint64_t pageId = target.load();
+		if ( pageId == gNoTarget )
+		{
+			pageId = TakeTargetPage( dataLength, target );
+		}
 		BufferFrame& frame = mBufferManager.FixPage( BufferManager::MergePageId( mSegmentId, pageId ), true );
+		// A vacuum releases a page while it has it fixed, so with the page fixed both checks are final.
+		// The page count catches released pages, the truncation count released pages that were added again in the meantime.
+		if ( pageId >= mDescriptor.pageCount.load() || mDescriptor.truncations.load() != truncations )
+		{
+			mBufferManager.UnfixPage( frame, false );
+			ResetTargets();
+			continue;
+		}
 		SlottedPage* page = reinterpret_cast<SlottedPage*>(frame.GetData());
 		// We could have an uninitialized page, we have to initialize that page first.
-		// Fresh pages will all pass the second if test, else we would have thrown in FindFreePage
+		// Fresh pages will all pass the second if test, TakeTargetPage already added them to the relation.
 		if ( !page->IsInitialized() )
 		{
 			page->Initialize();
-			mCore.AddPagesToRelation( mSegmentId, 1 );
 		}
-		if ( page->GetFreeContSpace() >= r.GetLen() + 8 )
+		page->Upgrade(); // Pages of an older format get their slot bitmaps when they are changed
+		if ( page->GetFreeSpace() >= dataLength + 8 )
 		{
 			// Everything worked we do our insert, release page and return our tid
-			TID newTID = MergeTID( pageId, page->GetFirstFreeSlotId() );
-			assert( page->GetDataStart() > page->GetFreeContSpace() );
-			assert( page->GetDataStart() >= r.GetLen() + 16 + 8 * (page->GetSlotCount() + 1) );
-			uint32_t insertDataBegin = page->GetDataStart() - r.GetLen();
-
-			// Find a slot and update slot
-			SlottedPage::Slot* slot = page->GetFirstFreeSlot();
-			if (setFromOtherPage)
-			{
-				slot->SetFromOtherPage();
-			}
-			else
-			{
-				slot->SetInPage();
-			}
-			slot->SetOffset( insertDataBegin );
-			slot->SetLength( r.GetLen() );
-
-			// Update page header
-			page->UsedFirstFreeSlot();
-			page->SetDataStart( insertDataBegin );
-			memcpy( page->GetDataPointer( insertDataBegin ), r.GetData(), r.GetLen() );
-
+			TID newTID = MergeTID( pageId, InsertIntoPage( *page, data, length, backlink, overflow ) );
 			mBufferManager.UnfixPage( frame, true );
 			return newTID;
 		}
 		else
 		{
+			// The target is full (or the inventory was wrong about it), give its space to the inventory and take the next one
+			mInventory.Update( pageId, page->GetFreeSpace() );
+			target.compare_exchange_strong( pageId, gNoTarget );
 			mBufferManager.UnfixPage( frame, false );
 		}
 	}
@@ -94,6 +116,72 @@ TID SPSegment::Insert( const Record& r, bool setFromOtherPage )
 	return 0;
 }
 
+/// <summary>
+/// Inserts the records in their order into new pages at the end of the relation. Pages are added in extents
+/// of up to DB_INSERT_EXTENT_PAGES pages, all pages of an extent are fixed together and filled one after another.
+/// Free space on existing pages is left to single inserts. Records on overflow pages get their overflow pages first.
+/// </summary>
+/// <param name="records">The records.</param>
+/// <returns>The tids in the order of the records.</returns>
+std::vector<TID> SPSegment::InsertBatch( const std::vector<Record>& records )
+{
+	// Stubs of the records on overflow pages, empty for the others
+	std::vector<std::vector<uint8_t>> stubs( records.size() );
+	for ( size_t i = 0; i < records.size(); ++i )
+	{
+		if ( records[i].GetLen() > DB_MAX_INLINE_RECORD )
+		{
+			WriteOverflow( records[i], stubs[i] );
+		}
+	}
+	auto storedLength = [&]( size_t i )
+	{
+		return stubs[i].empty() ? records[i].GetLen() : static_cast<uint32_t>(stubs[i].size());
+	};
+	std::vector<TID> tids;
+	tids.reserve( records.size() );
+	std::vector<uint64_t> pageIds;
+	std::vector<BufferFrame*> frames;
+	const uint64_t pageSpace = DB_PAGE_SIZE - DB_SLOTTED_PAGE_HEADER; // Space of an empty page for slots and data
+	size_t next = 0;
+	while ( next < records.size() )
+	{
+		// The remaining records need at least this many pages, so no page of the extent stays empty
+		uint64_t bytes = 0;
+		for ( size_t i = next; i < records.size() && bytes < DB_INSERT_EXTENT_PAGES * pageSpace; ++i )
+		{
+			bytes += storedLength( i ) + 8;
+		}
+		uint64_t extentPages = std::min<uint64_t>( (bytes + pageSpace - 1) / pageSpace, DB_INSERT_EXTENT_PAGES );
+		uint64_t firstPage = mDescriptor.AddPages( extentPages );
+		pageIds.clear();
+		for ( uint64_t i = 0; i < extentPages; ++i )
+		{
+			pageIds.push_back( BufferManager::MergePageId( mSegmentId, firstPage + i ) );
+		}
+		mBufferManager.FixPages( pageIds, true, frames );
+		for ( uint64_t i = 0; i < extentPages; ++i )
+		{
+			SlottedPage* page = reinterpret_cast<SlottedPage*>(frames[i]->GetData());
+			if ( !page->IsInitialized() )
+			{
+				page->Initialize();
+			}
+			while ( next < records.size() && page->GetFreeSpace() >= storedLength( next ) + 8 )
+			{
+				uint16_t slotId = stubs[next].empty() ?
+					InsertIntoPage( *page, records[next].GetData(), records[next].GetLen(), nullptr, false ) :
+					InsertIntoPage( *page, stubs[next].data(), storedLength( next ), nullptr, true );
+				tids.push_back( MergeTID( firstPage + i, slotId ) );
+				++next;
+			}
+			mInventory.Update( firstPage + i, page->GetFreeSpace() );
+			mBufferManager.UnfixPage( *frames[i], true );
+		}
+	}
+	return tids;
+}
+
 /// <summary>
 /// Removes the record specified by tid. Updates the page header accordingly.
 /// Will return false, if no record was found for this TID.
@@ -101,17 +189,36 @@ TID SPSegment::Insert( const Record& r, bool setFromOtherPage )
 /// <param name="tid">The tid.</param>
 /// <returns></returns>
 bool SPSegment::Remove( TID tid )
+{
+	return Remove( tid, nullptr );
+}
+
+/// <summary>
+/// Removes the record specified by tid. If home is set, tid is the record moved away from its home tid,
+/// which is freed already.
+/// </summary>
+/// <param name="tid">The tid.</param>
+/// <param name="home">The home tid of the record, nullptr if tid is its home tid.</param>
+/// <returns></returns>
+bool SPSegment::Remove( TID tid, const TID* home )
 {
 	std::pair<uint64_t, uint64_t> pIdsId = SplitTID( tid );
 	BufferFrame& frame = mBufferManager.FixPage( BufferManager::MergePageId( mSegmentId, pIdsId.first ), true );
 	SlottedPage* page = reinterpret_cast<SlottedPage*>(frame.GetData());
 
+	if ( home && !IsMovedRecord( *page, pIdsId.second, *home ) )
+	{
+		// A vacuum is moving the record home, it drops the record because the home slot is gone
+		mBufferManager.UnfixPage( frame, false );
+		return true;
+	}
 	// Checks if tid is valid
 	if ( !page->IsInitialized() )
 	{
 		mBufferManager.UnfixPage( frame, false );
 		return false;
 	}
+	page->Upgrade(); // Pages of an older format get their slot bitmaps when they are changed
 	SlottedPage::Slot* slot = page->GetSlot( pIdsId.second );
 	if ( !slot || slot->IsFree() )
 	{
@@ -125,13 +232,17 @@ bool SPSegment::Remove( TID tid )
 		TID newTid = slot->GetOtherRecordTID();
 		page->FreeSlot( pIdsId.second );
 		mBufferManager.UnfixPage( frame, true );
-		return Remove( newTid );
+		return Remove( newTid, &tid );
 	}
 	// Record is not on another page
 	uint32_t offset = slot->GetOffset();
 	uint32_t length = slot->GetLength();
+	if ( slot->IsOverflow() )
+	{
+		FreeOverflow( reinterpret_cast<uint8_t*>(page->GetDataPointer( slot->IsFromOtherPage() ? offset + 8 : offset )) );
+	}
 	page->FreeSlot( pIdsId.second );
-	page->FreeData( offset, length );
+	FreeData( *page, pIdsId.first, offset, length );
 	mBufferManager.UnfixPage( frame, true );
 	return true;
 }
@@ -142,40 +253,150 @@ bool SPSegment::Remove( TID tid )
 /// <param name="tid">The tid.</param>
 /// <returns></returns>
 Record SPSegment::Lookup( TID tid )
+{
+	return Lookup( tid, nullptr );
+}
+
+/// <summary>
+/// Retrieves the record specified by tid. If home is set, tid is the record moved away from its home tid,
+/// if it moved again in the meantime the lookup starts over at the home tid.
+/// </summary>
+/// <param name="tid">The tid.</param>
+/// <param name="home">The home tid of the record, nullptr if tid is its home tid.</param>
+/// <returns></returns>
+Record SPSegment::Lookup( TID tid, const TID* home )
 {
 	std::pair<uint64_t, uint64_t> pIdsId = SplitTID( tid );
 	BufferFrame& frame = mBufferManager.FixPage( BufferManager::MergePageId( mSegmentId, pIdsId.first ), false );
-	SlottedPage* page = reinterpret_cast<SlottedPage*>(frame.GetData());
-	
-	// Checks if tid is valid
-	if ( !page->IsInitialized() )
+	std::pair<bool, TID> otherTid;
+	Record r = ReadRecord( frame, pIdsId.second, otherTid, home );
+	mBufferManager.UnfixPage( frame, false );
+	if ( otherTid.first && home )
 	{
-		mBufferManager.UnfixPage( frame, false );
-		return Record( 0, nullptr );
+		std::this_thread::yield(); // Let whoever moves it finish
+		return Lookup( *home, nullptr );
 	}
-	SlottedPage::Slot* slot = page->GetSlot( pIdsId.second );
-	if ( !slot || slot->IsFree() )
+	if ( otherTid.first )
 	{
-		mBufferManager.UnfixPage( frame, false );
-		return Record( 0, nullptr );
+		return Lookup( otherTid.second, &tid ); // Recursive call to other page
 	}
-	// We found a page and a non-empty slot. Check the options in our slot
-	if ( slot->IsOtherRecordTID() )
+	return r;
+}
+
+/// <summary>
+/// Retrieves the record specified by tid without copying it. The view keeps the page fixed shared until it is destroyed.
+/// Records moved to another page are followed, records on overflow pages are copied. The view is empty if the tid is invalid.
+/// </summary>
+/// <param name="tid">The tid.</param>
+/// <returns></returns>
+RecordView SPSegment::LookupView( TID tid )
+{
+	return LookupView( tid, nullptr );
+}
+
+/// <summary>
+/// Retrieves the record specified by tid without copying it. If home is set, tid is the record moved away from its home tid,
+/// if it moved again in the meantime the lookup starts over at the home tid.
+/// </summary>
+/// <param name="tid">The tid.</param>
+/// <param name="home">The home tid of the record, nullptr if tid is its home tid.</param>
+/// <returns></returns>
+RecordView SPSegment::LookupView( TID tid, const TID* home )
+{
+	std::pair<uint64_t, uint64_t> pIdsId = SplitTID( tid );
+	BufferFrame& frame = mBufferManager.FixPage( BufferManager::MergePageId( mSegmentId, pIdsId.first ), false );
+	uint32_t offset = 0;
+	uint32_t length = 0;
+	bool overflow = false;
+	std::pair<bool, TID> otherTid;
+	if ( LocateRecord( frame, pIdsId.second, offset, length, overflow, otherTid, home ) )
 	{
-		mBufferManager.UnfixPage( frame, false );
-		return Lookup( slot->GetOtherRecordTID() ); // Recursive call to other page
+		const uint8_t* data = reinterpret_cast<const uint8_t*>(frame.GetData()) + offset;
+		if ( overflow )
+		{
+			RecordView view( ReadOverflow( mBufferManager, mSegmentId, data ) );
+			mBufferManager.UnfixPage( frame, false );
+			return view;
+		}
+		return RecordView( mBufferManager, frame, data, length );
 	}
-	uint32_t offset = slot->GetOffset();
-	uint32_t length = slot->GetLength();
-	// We want our entry without the backlink tid if that exists
-	if ( slot->IsFromOtherPage() )
+	mBufferManager.UnfixPage( frame, false );
+	if ( otherTid.first && home )
 	{
-		offset += 8;
-		length -= 8;
+		std::this_thread::yield(); // Let whoever moves it finish
+		return LookupView( *home, nullptr );
 	}
-	Record r = Record( length, reinterpret_cast<uint8_t*>(frame.GetData()) + offset );
-	mBufferManager.UnfixPage( frame, false );
-	return r;
+	if ( otherTid.first )
+	{
+		return LookupView( otherTid.second, &tid ); // Recursive call to other page
+	}
+	return RecordView();
+}
+
+/// <summary>
+/// Retrieves the records of all tids (e.g. a tid list from an index), same as calling Lookup for each of them.
+/// The pages are fixed together in batches, so pages that are not in the buffer are loaded with one I/O batch.
+/// Records that moved to another page are looked up one by one afterwards.
+/// </summary>
+/// <param name="tids">The tids.</param>
+/// <returns>Copies of the records in the order of the tids.</returns>
+std::vector<Record> SPSegment::Lookup( const std::vector<TID>& tids )
+{
+	std::vector<Record> records;
+	records.reserve( tids.size() );
+	std::vector<std::pair<bool, TID>> otherTids( tids.size() );
+	std::vector<uint64_t> pageIds;
+	std::vector<BufferFrame*> frames;
+	size_t first = 0;
+	while ( first < tids.size() )
+	{
+		// Take tids until the batch has enough distinct pages
+		pageIds.clear();
+		size_t last = first;
+		for ( ; last < tids.size(); ++last )
+		{
+			uint64_t pageId = BufferManager::MergePageId( mSegmentId, SplitTID( tids[last] ).first );
+			if ( std::find( pageIds.begin(), pageIds.end(), pageId ) == pageIds.end() )
+			{
+				if ( pageIds.size() == DB_IO_BATCH_PAGES )
+				{
+					break;
+				}
+				pageIds.push_back( pageId );
+			}
+		}
+		mBufferManager.FixPages( pageIds, false, frames );
+		for ( size_t i = first; i < last; ++i )
+		{
+			std::pair<uint64_t, uint64_t> pIdsId = SplitTID( tids[i] );
+			size_t index = std::find( pageIds.begin(), pageIds.end(),
+									  BufferManager::MergePageId( mSegmentId, pIdsId.first ) ) - pageIds.begin();
+			records.push_back( ReadRecord( *frames[index], pIdsId.second, otherTids[i] ) );
+		}
+		mBufferManager.UnfixPages( frames, false );
+		first = last;
+	}
+
+	// Follow the records on other pages, no page of ours is fixed anymore
+	if ( std::find_if( otherTids.begin(), otherTids.end(),
+					   []( const std::pair<bool, TID>& other ) { return other.first; } ) == otherTids.end() )
+	{
+		return records;
+	}
+	std::vector<Record> result;
+	result.reserve( tids.size() );
+	for ( size_t i = 0; i < tids.size(); ++i )
+	{
+		if ( otherTids[i].first )
+		{
+			result.push_back( Lookup( otherTids[i].second, &tids[i] ) );
+		}
+		else
+		{
+			result.push_back( std::move( records[i] ) );
+		}
+	}
+	return result;
 }
 
 /// <summary>
@@ -186,19 +407,41 @@ Record SPSegment::Lookup( TID tid )
 /// <param name="r">The r.</param>
 /// <returns></returns>
 bool SPSegment::Update( TID tid, const Record& r )
+{
+	return Update( tid, r, nullptr );
+}
+
+/// <summary>
+/// Updates the content of record specified by tid with content of record r. If home is set, tid is the record moved away
+/// from its home tid, if it moved again in the meantime the update starts over at the home tid.
+/// </summary>
+/// <param name="tid">The tid.</param>
+/// <param name="r">The r.</param>
+/// <param name="home">The home tid of the record, nullptr if tid is its home tid.</param>
+/// <returns></returns>
+bool SPSegment::Update( TID tid, const Record& r, const TID* home )
 {
 	// If the new record is smaller or equal to the old record we just reuse the current record slot
-	// If it is bigger we remove the old record and insert it again.
+	// If it is bigger but fits on the page after compaction, we move it inside the page.
+	// Otherwise we remove the old record and insert it again.
+	// Records on overflow pages get new overflow pages, only their stub is handled like a record.
 	std::pair<uint64_t, uint64_t> pIdsId = SplitTID( tid );
 	BufferFrame& frame = mBufferManager.FixPage( BufferManager::MergePageId( mSegmentId, pIdsId.first ), true );
 	SlottedPage* page = reinterpret_cast<SlottedPage*>(frame.GetData());
 
+	if ( home && !IsMovedRecord( *page, pIdsId.second, *home ) )
+	{
+		mBufferManager.UnfixPage( frame, false );
+		std::this_thread::yield(); // Let whoever moves it finish
+		return Update( *home, r, nullptr );
+	}
 	// Checks if tid is valid
 	if ( !page->IsInitialized() )
 	{
 		mBufferManager.UnfixPage( frame, false );
 		return false;
 	}
+	page->Upgrade(); // Pages of an older format get their slot bitmaps when they are changed
 	SlottedPage::Slot* slot = page->GetSlot( pIdsId.second );
 	if ( !slot || slot->IsFree() )
 	{
@@ -210,7 +453,7 @@ bool SPSegment::Update( TID tid, const Record& r )
 	{
 		TID newTid = slot->GetOtherRecordTID();
 		mBufferManager.UnfixPage( frame, true );
-		return Update( newTid, r );
+		return Update( newTid, r, &tid );
 	}
 	// Record is not on another page
 	uint32_t offset = slot->GetOffset();
@@ -221,19 +464,62 @@ bool SPSegment::Update( TID tid, const Record& r )
 		offset += 8;
 		length -= 8;
 	}
+	// The old overflow pages are not needed anymore, the new record gets its own
+	if ( slot->IsOverflow() )
+	{
+		FreeOverflow( reinterpret_cast<uint8_t*>(page->GetDataPointer( offset )) );
+	}
+	std::vector<uint8_t> stub;
+	bool overflow = r.GetLen() > DB_MAX_INLINE_RECORD;
+	if ( overflow )
+	{
+		WriteOverflow( r, stub );
+	}
+	const uint8_t* data = overflow ? stub.data() : r.GetData();
+	uint32_t dataLength = overflow ? static_cast<uint32_t>(stub.size()) : r.GetLen();
 
-	if ( r.GetLen() == length )
+	if ( dataLength == length )
 	{
 		// Same length entry, just overwrite no changes necessary
-		memcpy( page->GetDataPointer( offset ), r.GetData(), r.GetLen() );
+		memcpy( page->GetDataPointer( offset ), data, dataLength );
+		slot->SetOverflow( overflow );
 	}
-	else if ( r.GetLen() < length )
+	else if ( dataLength < length )
 	{
 		// Smaller length entry, overwrite and change length
-		memcpy( page->GetDataPointer( offset ), r.GetData(), r.GetLen() );
+		memcpy( page->GetDataPointer( offset ), data, dataLength );
 		// Length has to contain extra tid if that is present
-		uint32_t newlength = slot->IsFromOtherPage() ? r.GetLen() + 8 : r.GetLen();
+		uint32_t newlength = slot->IsFromOtherPage() ? dataLength + 8 : dataLength;
+		// The tail of the old entry is fragmented space now
+		FreeData( *page, pIdsId.first, slot->GetOffset() + newlength, slot->GetLength() - newlength );
 		slot->SetLength( newlength );
+		slot->SetOverflow( overflow );
+	}
+	else if ( page->GetFreeSpace() >= dataLength - length )
+	{
+		// Bigger entry, but fits on this page when we give the old data back. The tid stays the same.
+		uint32_t slotOffset = slot->GetOffset();
+		uint32_t slotLength = slot->GetLength();
+		uint32_t newLength = slotLength + (dataLength - length);
+		TID backlink = slot->IsFromOtherPage() ? page->GetBacklinkTID( slotOffset ) : 0;
+		page->FreeData( slotOffset, slotLength );
+		slot->SetLength( 0 ); // Compaction does not have to move the old data
+		if ( page->GetFreeContSpace() < newLength )
+		{
+			page->Compact();
+		}
+		uint32_t newOffset = page->GetDataStart() - newLength;
+		page->SetDataStart( newOffset );
+		slot->SetOffset( newOffset );
+		slot->SetLength( newLength );
+		if ( slot->IsFromOtherPage() )
+		{
+			memcpy( page->GetDataPointer( newOffset ), &backlink, 8 );
+			newOffset += 8;
+		}
+		memcpy( page->GetDataPointer( newOffset ), data, dataLength );
+		slot->SetOverflow( overflow );
+		mInventory.Update( pIdsId.first, page->GetFreeSpace() );
 	}
 	else if ( slot->IsFromOtherPage() )
 	{
@@ -241,74 +527,157 @@ bool SPSegment::Update( TID tid, const Record& r )
 		// Add back backlink values
 		TID backlink = page->GetBacklinkTID( offset - 8 );
 		page->FreeSlot( pIdsId.second );
-		page->FreeData( offset - 8, length + 8 );
+		FreeData( *page, pIdsId.first, offset - 8, length + 8 );
 		mBufferManager.UnfixPage( frame, true );
-		return InsertLinked( backlink, r );
+		return InsertLinked( backlink, data, dataLength, overflow );
 	}
 	else
 	{
 		// Not from another page but still too big, so the current slot is our new backlink
-		page->FreeData( offset, length );
+		FreeData( *page, pIdsId.first, offset, length );
+		slot->SetLength( 0 ); // Data is gone, compaction must not keep it until the slot is overwritten
+		slot->SetOverflow( false );
 		mBufferManager.UnfixPage( frame, true );
-		return InsertLinked( tid, r );
+		return InsertLinked( tid, data, dataLength, overflow );
 	}
 	mBufferManager.UnfixPage( frame, true );
 	return true;
 }
 
 /// <summary>
-/// Finds a page with at least minSpace free continuous memory.
+/// Finds a page with at least minSpace free memory through the free space inventory, that is not the target of another stripe,
+/// and makes it the new target. If no page has the space, a fresh page is added to the relation.
 /// </summary>
 /// <param name="minSpace">The minimum space.</param>
-/// <returns></returns>
-uint64_t SPSegment::FindFreePage( uint32_t minSpace )
+/// <param name="target">The target of the stripe of the calling thread.</param>
+/// <returns>The page in the segment, callers have to check the space and report it to the inventory if it was wrong.</returns>
+uint64_t SPSegment::TakeTargetPage( uint32_t minSpace, std::atomic<uint64_t>& target )
 {
-	// Check if the space is bigger than Pagesize - (header + 1 slot)
-	// If that is the case we throw, since we currently don't support records bigger than a single page.
-	if ( minSpace > DB_PAGE_SIZE - 24 )
+	std::lock_guard<ProfiledMutex> lock( mTargetsMutex );
+	uint64_t pageCount = mDescriptor.pageCount.load();
+	uint64_t pageId = mInventory.FindPage( minSpace + 8, pageCount );
+	while ( pageId < pageCount && IsTargetPage( pageId ) )
 	{
-		throw std::runtime_error( "Error: Don't support records bigger than a single page." );
+		pageId = mInventory.FindPage( minSpace + 8, pageCount, pageId + 1 );
 	}
-	// Linear search over pages
-	bool found = false;
-	uint64_t curPage = 0;
-	while ( !found )
+	if ( pageId == pageCount )
 	{
-		BufferFrame& frame = mBufferManager.FixPage( BufferManager::MergePageId( mSegmentId, curPage ), false );
-		SlottedPage* page = reinterpret_cast<SlottedPage*>(frame.GetData());
-		if ( !page->IsInitialized() || page->GetFreeContSpace() >= minSpace + 8 )
+		// Add the page before using it, batch inserts and overflow records take the pages behind the relation as well.
+		// Targets are not reported while they fill up, so the inventory only overestimates them, which FindPage corrects.
+		pageId = mDescriptor.AddPages( 1 );
+		mInventory.Update( pageId, DB_PAGE_SIZE - DB_SLOTTED_PAGE_HEADER );
+	}
+	target.store( pageId );
+	return pageId;
+}
+
+/// <summary>
+/// Determines whether the page is the insert target of a stripe.
+/// </summary>
+/// <param name="pageId">The page in the segment.</param>
+/// <returns></returns>
+bool SPSegment::IsTargetPage( uint64_t pageId )
+{
+	for ( std::atomic<uint64_t>& target : mTargets )
+	{
+		if ( target.load() == pageId )
 		{
-			// Page is either a fresh page, which of course means we dont yet have any values set
-			// this also means free space is not correct yet. But record has to fit, since
-			// else it would throw above.
-			mBufferManager.UnfixPage( frame, false );
-			return curPage;
+			return true;
 		}
-		mBufferManager.UnfixPage( frame, false );
-		++curPage;
 	}
-	assert( false );
-	return 0;
+	return false;
+}
+
+/// <summary>
+/// Copies the record in the slot of the fixed page, records on overflow pages are read from there. 
+/// If the slot only holds the tid of the record on another page,
+/// otherTid is set to (true, tid of the record on the other page) and the record is empty.
+/// </summary>
+/// <param name="frame">The fixed frame.</param>
+/// <param name="slotId">The slot identifier.</param>
+/// <param name="otherTid">The tid of the record on the other page, first is false if the record is here.</param>
+/// <param name="home">The home tid of a record moved to this page, see LocateRecord.</param>
+/// <returns>The record, empty if the slot is invalid.</returns>
+Record SPSegment::ReadRecord( BufferFrame& frame, uint64_t slotId, std::pair<bool, TID>& otherTid, const TID* home )
+{
+	uint32_t offset = 0;
+	uint32_t length = 0;
+	bool overflow = false;
+	if ( !LocateRecord( frame, slotId, offset, length, overflow, otherTid, home ) )
+	{
+		return Record( 0, nullptr );
+	}
+	const uint8_t* data = reinterpret_cast<uint8_t*>(frame.GetData()) + offset;
+	if ( overflow )
+	{
+		return ReadOverflow( mBufferManager, mSegmentId, data );
+	}
+	return Record( length, data );
+}
+
+/// <summary>
+/// Finds the record in the slot of the fixed page. If the slot only holds the tid of the record on another page,
+/// otherTid is set to (true, tid of the record on the other page).
+/// </summary>
+/// <param name="frame">The fixed frame.</param>
+/// <param name="slotId">The slot identifier.</param>
+/// <param name="offset">The offset of the record in the page, without backlink.</param>
+/// <param name="length">The length of the record, without backlink.</param>
+/// <param name="overflow">Set to true if the data is the stub of a record on overflow pages.</param>
+/// <param name="otherTid">The tid of the record on the other page, first is false if the record is here.</param>
+/// <param name="home">If set, the slot has to hold the record moved here from the home tid. Otherwise the record moved again
+/// after the home slot was read and otherTid is set to (true, home tid), the caller has to start over there.</param>
+/// <returns>True if the record is on this page.</returns>
+bool SPSegment::LocateRecord( BufferFrame& frame, uint64_t slotId, uint32_t& offset, uint32_t& length, bool& overflow,
+							  std::pair<bool, TID>& otherTid, const TID* home )
+{
+	otherTid = std::make_pair( false, 0 );
+	SlottedPage* page = reinterpret_cast<SlottedPage*>(frame.GetData());
+	if ( home && !IsMovedRecord( *page, slotId, *home ) )
+	{
+		otherTid = std::make_pair( true, *home );
+		return false;
+	}
+	// Checks if tid is valid
+	if ( !page->IsInitialized() )
+	{
+		return false;
+	}
+	SlottedPage::Slot* slot = page->GetSlot( slotId );
+	if ( !slot || slot->IsFree() )
+	{
+		return false;
+	}
+	// We found a page and a non-empty slot. Check the options in our slot
+	if ( slot->IsOtherRecordTID() )
+	{
+		otherTid = std::make_pair( true, slot->GetOtherRecordTID() );
+		return false;
+	}
+	offset = slot->GetOffset();
+	length = slot->GetLength();
+	overflow = slot->IsOverflow();
+	// We want our entry without the backlink tid if that exists
+	if ( slot->IsFromOtherPage() )
+	{
+		offset += 8;
+		length -= 8;
+	}
+	return true;
 }
 
 /// <summary>
 /// Inserts a record in an update step, where we have a backlink to a certain location, which also needs to be updated.
 /// </summary>
 /// <param name="backlink">The backlink.</param>
-/// <param name="r">The r.</param>
+/// <param name="data">The record, or the stub of a record on overflow pages.</param>
+/// <param name="length">The length of the data.</param>
+/// <param name="overflow">if set to <c>true</c> the data is an overflow stub.</param>
 /// <returns></returns>
-bool SPSegment::InsertLinked( TID backlink, const Record& r )
+bool SPSegment::InsertLinked( TID backlink, const uint8_t* data, uint32_t length, bool overflow )
 {
-	std::vector<uint8_t> data;
-	data.resize( r.GetLen() + 8 );
-	memcpy( &data[0], &backlink, 8 );
-	memcpy( &data[8], r.GetData(), r.GetLen() );
-
-	// Create copyrecord with backlink tid prepended
-	Record copyR = Record( static_cast<uint32_t>(data.size()), &data[0] );
-
-	// Insert this one with normal insert
-	TID newTID = Insert( copyR, true );
+	// Insert with the backlink tid prepended
+	TID newTID = Insert( data, length, &backlink, overflow );
 
 	// Write tid into backlink
 	std::pair<uint64_t, uint64_t> pIdsId = SplitTID( backlink );
@@ -321,13 +690,505 @@ bool SPSegment::InsertLinked( TID backlink, const Record& r )
 		mBufferManager.UnfixPage( frame, false );
 		return false;
 	}
-	SlottedPage::Slot* slot = page->GetSlot( pIdsId.second );
-	if ( !slot )
+	page->Upgrade();
+	if ( !page->GetSlot( pIdsId.second ) )
 	{
 		mBufferManager.UnfixPage( frame, false );
 		return false;
 	}
-	slot->Overwrite( ~newTID ); // Have to remember, tids are inverted
+	page->ForwardSlot( pIdsId.second, newTID );
 	mBufferManager.UnfixPage( frame, true );
 	return true;
 }
+
+/// <summary>
+/// Frees the data on the exclusively fixed page and tells the inventory about the new free space.
+/// </summary>
+/// <param name="page">The page.</param>
+/// <param name="pageId">The page in the segment.</param>
+/// <param name="offset">The offset.</param>
+/// <param name="length">The length.</param>
+void SPSegment::FreeData( SlottedPage& page, uint64_t pageId, uint32_t offset, uint32_t length )
+{
+	uint32_t oldSpace = page.GetFreeSpace();
+	page.FreeData( offset, length );
+	if ( page.GetFreeSpace() != oldSpace )
+	{
+		mInventory.Update( pageId, page.GetFreeSpace() );
+	}
+}
+
+/// <summary>
+/// Puts the record into the first free slot of the exclusively fixed page, the page must have the space.
+/// Compacts the page if the space is fragmented.
+/// </summary>
+/// <param name="page">The page.</param>
+/// <param name="data">The record, or the stub of a record on overflow pages.</param>
+/// <param name="length">The length of the data.</param>
+/// <param name="backlink">The tid the record was moved from, written in front of the record, nullptr for new records.</param>
+/// <param name="overflow">if set to <c>true</c> the data is an overflow stub.</param>
+/// <returns>The slot id.</returns>
+uint16_t SPSegment::InsertIntoPage( SlottedPage& page, const uint8_t* data, uint32_t length, const TID* backlink, bool overflow )
+{
+	uint32_t dataLength = backlink ? length + 8 : length;
+	// Free space is enough, but might be fragmented
+	if ( page.GetFreeContSpace() < dataLength + 8 )
+	{
+		page.Compact();
+	}
+	uint16_t slotId = page.GetFirstFreeSlotId();
+	assert( page.GetDataStart() > page.GetFreeContSpace() );
+	assert( page.GetFreeContSpace() >= dataLength + 8 );
+	uint32_t insertDataBegin = page.GetDataStart() - dataLength;
+
+	// Find a slot and update slot
+	SlottedPage::Slot* slot = page.GetFirstFreeSlot();
+	if ( backlink )
+	{
+		slot->SetFromOtherPage();
+	}
+	else
+	{
+		slot->SetInPage();
+	}
+	slot->SetOverflow( overflow );
+	slot->SetOffset( insertDataBegin );
+	slot->SetLength( dataLength );
+
+	// Update page header
+	page.UsedFirstFreeSlot();
+	page.SetDataStart( insertDataBegin );
+	if ( backlink )
+	{
+		memcpy( page.GetDataPointer( insertDataBegin ), backlink, 8 );
+		insertDataBegin += 8;
+	}
+	memcpy( page.GetDataPointer( insertDataBegin ), data, length );
+	return slotId;
+}
+
+/// <summary>
+/// Writes the part of r behind its inline prefix to a fresh extent of overflow pages, which is added to the relation.
+/// The pages are fixed and written in batches. Builds the stub that has to be stored in the slotted page.
+/// </summary>
+/// <param name="r">The r, bigger than DB_MAX_INLINE_RECORD.</param>
+/// <param name="stub">The stub.</param>
+void SPSegment::WriteOverflow( const Record& r, std::vector<uint8_t>& stub )
+{
+	const uint32_t pageSpace = DB_PAGE_SIZE - 16; // Overflow pages keep the slotted page header
+	assert( r.GetLen() > DB_OVERFLOW_INLINE_BYTES );
+	uint32_t remaining = r.GetLen() - DB_OVERFLOW_INLINE_BYTES;
+	OverflowStub header;
+	header.length = r.GetLen();
+	header.pageCount = (remaining + pageSpace - 1) / pageSpace;
+	header.firstPage = mDescriptor.AddPages( header.pageCount );
+
+	const uint8_t* data = r.GetData() + DB_OVERFLOW_INLINE_BYTES;
+	std::vector<uint64_t> pageIds;
+	std::vector<BufferFrame*> frames;
+	for ( uint64_t first = 0; first < header.pageCount; first += DB_IO_BATCH_PAGES )
+	{
+		pageIds.clear();
+		for ( uint64_t i = first; i < header.pageCount && i < first + DB_IO_BATCH_PAGES; ++i )
+		{
+			pageIds.push_back( BufferManager::MergePageId( mSegmentId, header.firstPage + i ) );
+		}
+		mBufferManager.FixPages( pageIds, true, frames );
+		for ( BufferFrame* frame : frames )
+		{
+			SlottedPage* page = reinterpret_cast<SlottedPage*>(frame->GetData());
+			page->InitializeOverflow();
+			uint32_t chunk = std::min( remaining, pageSpace );
+			memcpy( page->GetDataPointer( 16 ), data, chunk );
+			data += chunk;
+			remaining -= chunk;
+		}
+		mBufferManager.UnfixPages( frames, true );
+	}
+
+	stub.resize( sizeof( OverflowStub ) + DB_OVERFLOW_INLINE_BYTES );
+	memcpy( stub.data(), &header, sizeof( OverflowStub ) );
+	memcpy( stub.data() + sizeof( OverflowStub ), r.GetData(), DB_OVERFLOW_INLINE_BYTES );
+}
+
+/// <summary>
+/// Turns the overflow pages of the stub into empty slotted pages, which are given to the inventory for new records.
+/// The page of the stub has to be fixed exclusively.
+/// </summary>
+/// <param name="stub">The stub.</param>
+void SPSegment::FreeOverflow( const uint8_t* stub )
+{
+	OverflowStub header;
+	memcpy( &header, stub, sizeof( OverflowStub ) );
+	std::vector<uint64_t> pageIds;
+	std::vector<BufferFrame*> frames;
+	for ( uint64_t first = 0; first < header.pageCount; first += DB_IO_BATCH_PAGES )
+	{
+		pageIds.clear();
+		for ( uint64_t i = first; i < header.pageCount && i < first + DB_IO_BATCH_PAGES; ++i )
+		{
+			pageIds.push_back( BufferManager::MergePageId( mSegmentId, header.firstPage + i ) );
+		}
+		mBufferManager.FixPages( pageIds, true, frames );
+		for ( size_t i = 0; i < frames.size(); ++i )
+		{
+			SlottedPage* page = reinterpret_cast<SlottedPage*>(frames[i]->GetData());
+			page->Initialize();
+			mInventory.Update( header.firstPage + first + i, page->GetFreeSpace() );
+		}
+		mBufferManager.UnfixPages( frames, true );
+	}
+}
+
+/// <summary>
+/// Copies a record on overflow pages. The overflow pages are fixed shared in batches, so pages that are not
+/// in the buffer are read with one I/O batch. The page of the stub has to be fixed.
+/// </summary>
+/// <param name="bm">The buffer manager.</param>
+/// <param name="segmentId">The segment of the record.</param>
+/// <param name="stub">The stub in the slotted page.</param>
+/// <returns></returns>
+Record SPSegment::ReadOverflow( BufferManager& bm, uint64_t segmentId, const uint8_t* stub )
+{
+	const uint32_t pageSpace = DB_PAGE_SIZE - 16;
+	OverflowStub header;
+	memcpy( &header, stub, sizeof( OverflowStub ) );
+	Record r( header.length );
+	uint8_t* data = r.GetMutableData();
+	memcpy( data, stub + sizeof( OverflowStub ), DB_OVERFLOW_INLINE_BYTES );
+	data += DB_OVERFLOW_INLINE_BYTES;
+	uint32_t remaining = header.length - DB_OVERFLOW_INLINE_BYTES;
+
+	std::vector<uint64_t> pageIds;
+	std::vector<BufferFrame*> frames;
+	for ( uint64_t first = 0; first < header.pageCount; first += DB_IO_BATCH_PAGES )
+	{
+		pageIds.clear();
+		for ( uint64_t i = first; i < header.pageCount && i < first + DB_IO_BATCH_PAGES; ++i )
+		{
+			pageIds.push_back( BufferManager::MergePageId( segmentId, header.firstPage + i ) );
+		}
+		bm.FixPages( pageIds, false, frames );
+		for ( BufferFrame* frame : frames )
+		{
+			SlottedPage* page = reinterpret_cast<SlottedPage*>(frame->GetData());
+			assert( page->IsOverflowPage() );
+			uint32_t chunk = std::min( remaining, pageSpace );
+			memcpy( data, page->GetDataPointer( 16 ), chunk );
+			data += chunk;
+			remaining -= chunk;
+		}
+		bm.UnfixPages( frames, false );
+	}
+	return r;
+}
+
+/// <summary>
+/// Determines whether the slot of the fixed page holds the record that was moved here from the home tid.
+/// </summary>
+/// <param name="page">The page.</param>
+/// <param name="slotId">The slot identifier.</param>
+/// <param name="home">The home tid.</param>
+/// <returns></returns>
+bool SPSegment::IsMovedRecord( SlottedPage& page, uint64_t slotId, TID home )
+{
+	if ( !page.IsInitialized() )
+	{
+		return false;
+	}
+	SlottedPage::Slot* slot = page.GetSlot( slotId );
+	return slot && !slot->IsFree() && !slot->IsOtherRecordTID() && slot->IsFromOtherPage() &&
+		page.GetBacklinkTID( slot->GetOffset() ) == home;
+}
+
+/// <summary>
+/// Forgets all insert targets, after a vacuum released pages at the end of the segment they might not exist anymore.
+/// </summary>
+void SPSegment::ResetTargets()
+{
+	std::lock_guard<ProfiledMutex> lock( mTargetsMutex ); // <- Lock targets
+	uint64_t truncations = mDescriptor.truncations.load();
+	for ( std::atomic<uint64_t>& target : mTargets )
+	{
+		target.store( gNoTarget );
+	}
+	// Only afterwards, so inserts that read the new count never see an old target
+	mTruncations.store( truncations );
+} // <- Unlock targets
+
+/// <summary>
+/// Cleans the segment up while it is in use, every step only fixes the pages it works on like any other record operation.
+/// Records that updates moved to other pages are moved back to their home slot, if the home page has the space again.
+/// Free slots at the end of the slot directories are released and pages with fragmented space are compacted.
+/// Empty pages at the end of the segment are released, the segment file is truncated behind the remaining pages.
+/// Tids stay valid. Like updates that move records, a vacuum can make a concurrent table scan miss or repeat a moved record.
+/// </summary>
+/// <returns>What the vacuum did.</returns>
+VacuumStats SPSegment::Vacuum()
+{
+	std::lock_guard<ProfiledMutex> lock( mDescriptor.vacuumMutex ); // <- Lock vacuum
+	VacuumStats stats;
+	uint64_t pageCount = mDescriptor.pageCount.load();
+	for ( uint64_t pageId = 0; pageId < pageCount; ++pageId )
+	{
+		VacuumPage( pageId, stats );
+	}
+	stats.releasedPages = ReleaseEmptyPages();
+	return stats;
+} // <- Unlock vacuum
+
+/// <summary>
+/// Writes the free space of every data page into the free space inventory, for relations whose inventory is new and empty.
+/// </summary>
+void SPSegment::RebuildInventory()
+{
+	uint64_t pageCount = mDescriptor.pageCount.load();
+	for ( uint64_t pageId = 0; pageId < pageCount; ++pageId )
+	{
+		BufferFrame& frame = mBufferManager.FixPage( BufferManager::MergePageId( mSegmentId, pageId ), false );
+		SlottedPage* page = reinterpret_cast<SlottedPage*>(frame.GetData());
+		if ( page->IsInitialized() && !page->IsOverflowPage() )
+		{
+			mInventory.Update( pageId, page->GetFreeSpace() );
+		}
+		mBufferManager.UnfixPage( frame, false );
+	}
+}
+
+/// <summary>
+/// Moves the records of the forwarding slots of the page back home, then releases the free slots at the end
+/// of the slot directory and compacts the page.
+/// </summary>
+/// <param name="pageId">The page in the segment.</param>
+/// <param name="stats">The stats of the vacuum.</param>
+void SPSegment::VacuumPage( uint64_t pageId, VacuumStats& stats )
+{
+	// Collect the forwarding slots first, moving a record home fixes the page of the record before its home page
+	std::vector<std::pair<uint64_t, TID>> forwards;
+	BufferFrame& frame = mBufferManager.FixPage( BufferManager::MergePageId( mSegmentId, pageId ), false );
+	SlottedPage* page = reinterpret_cast<SlottedPage*>(frame.GetData());
+	if ( page->IsInitialized() && !page->IsOverflowPage() )
+	{
+		for ( uint64_t slotId = page->GetNextForwardSlot( 0 ); slotId < page->GetSlotCount();
+			  slotId = page->GetNextForwardSlot( slotId + 1 ) )
+		{
+			forwards.push_back( std::make_pair( slotId, page->GetSlot( slotId )->GetOtherRecordTID() ) );
+		}
+	}
+	mBufferManager.UnfixPage( frame, false );
+	for ( const std::pair<uint64_t, TID>& forward : forwards )
+	{
+		if ( MoveHome( MergeTID( pageId, forward.first ), forward.second ) )
+		{
+			++stats.movedRecords;
+		}
+	}
+
+	BufferFrame& exclusiveFrame = mBufferManager.FixPage( BufferManager::MergePageId( mSegmentId, pageId ), true );
+	page = reinterpret_cast<SlottedPage*>(exclusiveFrame.GetData());
+	if ( !page->IsInitialized() || page->IsOverflowPage() )
+	{
+		mBufferManager.UnfixPage( exclusiveFrame, false );
+		return;
+	}
+	bool changed = page->GetVersion() < DB_SLOTTED_PAGE_VERSION && page->Upgrade();
+	uint16_t releasedSlots = page->ReleaseFreeSlots();
+	stats.releasedSlots += releasedSlots;
+	changed = changed || releasedSlots > 0;
+	if ( page->GetFragmentedSpace() > 0 )
+	{
+		page->Compact();
+		++stats.compactedPages;
+		changed = true;
+	}
+	if ( changed )
+	{
+		mInventory.Update( pageId, page->GetFreeSpace() );
+	}
+	mBufferManager.UnfixPage( exclusiveFrame, changed );
+}
+
+/// <summary>
+/// Moves the record back to its home slot, which holds the tid of the record. Two data pages are never fixed at once,
+/// so the space of the home page is checked with shared fixes first, records that do not fit stay where they are.
+/// Then the record is copied and removed from its page. Operations that follow the home slot meanwhile start over
+/// at the home slot until the record is back. If the home page has no space anymore, the record is inserted on another page again.
+/// The old slot stays reserved until the move is done, pointing back to the home slot. Otherwise it could be reused by a record
+/// that took over the home slot in the meantime, and the home slot would match the tid again.
+/// </summary>
+/// <param name="home">The home tid of the record.</param>
+/// <param name="tid">The tid of the record on the other page.</param>
+/// <returns>True if the record is in its home slot now.</returns>
+bool SPSegment::MoveHome( TID home, TID tid )
+{
+	std::pair<uint64_t, uint64_t> homeIds = SplitTID( home );
+	std::pair<uint64_t, uint64_t> pIdsId = SplitTID( tid );
+	BufferFrame& checkFrame = mBufferManager.FixPage( BufferManager::MergePageId( mSegmentId, pIdsId.first ), false );
+	SlottedPage* page = reinterpret_cast<SlottedPage*>(checkFrame.GetData());
+	bool isMoved = IsMovedRecord( *page, pIdsId.second, home );
+	uint32_t checkLength = isMoved ? page->GetSlot( pIdsId.second )->GetLength() - 8 : 0;
+	mBufferManager.UnfixPage( checkFrame, false );
+	if ( !isMoved )
+	{
+		return false;
+	}
+	BufferFrame& checkHomeFrame = mBufferManager.FixPage( BufferManager::MergePageId( mSegmentId, homeIds.first ), false );
+	bool fits = reinterpret_cast<SlottedPage*>(checkHomeFrame.GetData())->GetFreeSpace() >= checkLength;
+	mBufferManager.UnfixPage( checkHomeFrame, false );
+	if ( !fits )
+	{
+		// Moving it would only free its space here and take the same space on another page
+		return false;
+	}
+
+	BufferFrame& frame = mBufferManager.FixPage( BufferManager::MergePageId( mSegmentId, pIdsId.first ), true );
+	page = reinterpret_cast<SlottedPage*>(frame.GetData());
+	if ( !IsMovedRecord( *page, pIdsId.second, home ) )
+	{
+		// Moved again or removed since we read the home slot
+		mBufferManager.UnfixPage( frame, false );
+		return false;
+	}
+	SlottedPage::Slot* slot = page->GetSlot( pIdsId.second );
+	uint32_t offset = slot->GetOffset();
+	uint32_t length = slot->GetLength() - 8; // Without backlink
+	bool overflow = slot->IsOverflow();
+	const uint8_t* data = reinterpret_cast<uint8_t*>(page->GetDataPointer( offset + 8 ));
+	std::vector<uint8_t> record( data, data + length );
+	page->ForwardSlot( pIdsId.second, home ); // Reserve the slot, scans skip it and operations on the record start over
+	FreeData( *page, pIdsId.first, offset, length + 8 );
+	mBufferManager.UnfixPage( frame, true );
+
+	bool movedHome = false;
+	TID moved = tid;
+	while ( true )
+	{
+		BufferFrame& homeFrame = mBufferManager.FixPage( BufferManager::MergePageId( mSegmentId, homeIds.first ), true );
+		SlottedPage* homePage = reinterpret_cast<SlottedPage*>(homeFrame.GetData());
+		bool upgraded = homePage->GetVersion() < DB_SLOTTED_PAGE_VERSION && homePage->Upgrade();
+		SlottedPage::Slot* homeSlot = homePage->GetSlot( homeIds.second );
+		if ( !homeSlot || !homeSlot->IsOtherRecordTID() || homeSlot->GetOtherRecordTID() != tid )
+		{
+			// The record was removed together with its home slot in the meantime
+			mBufferManager.UnfixPage( homeFrame, upgraded );
+			if ( moved != tid )
+			{
+				Remove( moved );
+			}
+			else if ( overflow )
+			{
+				FreeOverflow( record.data() );
+			}
+			break;
+		}
+		if ( moved != tid )
+		{
+			// Inserted on another page again
+			homePage->ForwardSlot( homeIds.second, moved );
+			mBufferManager.UnfixPage( homeFrame, true );
+			break;
+		}
+		if ( homePage->GetFreeSpace() >= length )
+		{
+			homePage->UnforwardSlot( homeIds.second );
+			if ( homePage->GetFreeContSpace() < length )
+			{
+				homePage->Compact();
+			}
+			uint32_t newOffset = homePage->GetDataStart() - length;
+			homePage->SetDataStart( newOffset );
+			memcpy( homePage->GetDataPointer( newOffset ), record.data(), length );
+			homeSlot->SetOffset( newOffset );
+			homeSlot->SetLength( length );
+			homeSlot->SetOverflow( overflow );
+			mInventory.Update( homeIds.first, homePage->GetFreeSpace() );
+			mBufferManager.UnfixPage( homeFrame, true );
+			movedHome = true;
+			break;
+		}
+		mBufferManager.UnfixPage( homeFrame, upgraded );
+		moved = Insert( record.data(), length, &home, overflow );
+	}
+
+	// Release the reserved slot
+	BufferFrame& oldFrame = mBufferManager.FixPage( BufferManager::MergePageId( mSegmentId, pIdsId.first ), true );
+	page = reinterpret_cast<SlottedPage*>(oldFrame.GetData());
+	page->FreeSlot( pIdsId.second );
+	mBufferManager.UnfixPage( oldFrame, true );
+	return movedHome;
+}
+
+/// <summary>
+/// Releases the empty pages at the end of the segment and truncates the segment file behind the remaining pages.
+/// Added pages that are not initialized yet are about to be used, the release stops at them.
+/// The pages are fixed one at a time from the end and only empty pages stay fixed. Fixing all tail pages at once could
+/// lock overflow pages before their stub page, readers and writers lock them the other way round.
+/// </summary>
+/// <returns>The number of released pages.</returns>
+uint64_t SPSegment::ReleaseEmptyPages()
+{
+	uint64_t released = 0;
+	std::vector<BufferFrame*> frames;
+	while ( true )
+	{
+		uint64_t pageCount = mDescriptor.pageCount.load();
+		frames.clear();
+		while ( frames.size() < DB_IO_BATCH_PAGES && frames.size() < pageCount )
+		{
+			uint64_t pageId = pageCount - 1 - frames.size();
+			BufferFrame& frame = mBufferManager.FixPage( BufferManager::MergePageId( mSegmentId, pageId ), true );
+			SlottedPage* page = reinterpret_cast<SlottedPage*>(frame.GetData());
+			if ( !page->IsInitialized() || page->IsOverflowPage() || page->GetSlotCount() > 0 )
+			{
+				mBufferManager.UnfixPage( frame, false );
+				break;
+			}
+			frames.push_back( &frame );
+		}
+		uint64_t empty = frames.size();
+		// Pages are added with the resize latch shared, so the page count can not change while we hold it.
+		// Nobody writes the empty pages while we have them fixed, so they can be discarded and the file truncated in front of them.
+		bool truncated = false;
+		if ( empty > 0 )
+		{
+			mDescriptor.resizeLatch.LockWrite(); // <- Lock Write resize
+			if ( mDescriptor.pageCount.load() == pageCount )
+			{
+				for ( BufferFrame* frame : frames )
+				{
+					mBufferManager.DiscardPage( *frame );
+				}
+				try
+				{
+					mBufferManager.TruncateSegmentFile( mSegmentId, pageCount - empty );
+				}
+				catch ( std::runtime_error& )
+				{
+					// The discarded pages are uninitialized, that is fine for pages of the segment
+					mDescriptor.resizeLatch.UnlockWrite(); // <- Unlock Write resize
+					mBufferManager.UnfixPages( frames, false );
+					throw;
+				}
+				// Before pages can be added again, so the inventory does not hide their space afterwards
+				for ( uint64_t pageId = pageCount - empty; pageId < pageCount; ++pageId )
+				{
+					mInventory.Update( pageId, 0 );
+				}
+				mDescriptor.pageCount.store( pageCount - empty );
+				++mDescriptor.truncations;
+				truncated = true;
+			}
+			mDescriptor.resizeLatch.UnlockWrite(); // <- Unlock Write resize
+		}
+		mBufferManager.UnfixPages( frames, false );
+		if ( !truncated )
+		{
+			return released;
+		}
+		released += empty;
+		if ( empty < DB_IO_BATCH_PAGES )
+		{
+			return released;
+		}
+	}
+}
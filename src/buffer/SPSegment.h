@@ -2,38 +2,104 @@
 #ifndef SPSEGMENT_H
 #define SPSEGMENT_H
 
+#include "FreeSpaceInventory.h"
 #include "relation/Record.h"
+#include "relation/RecordView.h"
 #include "utility/defines.h"
+#include "utility/LatchProfiler.h"
 
 #include <stdint.h>
+#include <atomic>
+#include <utility>
+#include <vector>
 
 // Forwards
 class DBCore;
 class BufferManager;
+class BufferFrame;
+class SlottedPage;
+struct SegmentDescriptor;
 
 /// <summary>
-/// Segment that operates on slotted pages.
+/// What a vacuum of a slotted pages segment did.
+/// </summary>
+struct VacuumStats
+{
+	uint64_t movedRecords = 0; // Records moved back to their home page, their forwarding slot is gone
+	uint64_t releasedSlots = 0; // Free slots at the end of slot directories
+	uint64_t compactedPages = 0; // Pages with fragmented space
+	uint64_t releasedPages = 0; // Empty pages at the end of the segment, the file is truncated behind the rest
+};
+
+/// <summary>
+/// Segment that operates on slotted pages. Inserts find a page with enough space through the free space inventory.
+/// Records bigger than DB_MAX_INLINE_RECORD are stored on an extent of overflow pages in the same segment, their slot
+/// only holds a stub with the first DB_OVERFLOW_INLINE_BYTES bytes. All record operations handle them transparently.
+/// Every thread inserts into its own target page (threads are spread over DB_INSERT_TARGET_STRIPES targets), so concurrent
+/// inserts do not queue on the latch of the same page. Only when its target is full, a thread takes the next one.
+/// A record moved to another page keeps its home slot, operations that follow it check its backlink and start over at the home tid
+/// if it moved again in between. Vacuum cleans the segment up while it is in use.
 /// </summary>
 class SPSegment
 {
 public:
-	SPSegment( DBCore& core, BufferManager& bm, uint64_t segmentId );
+	SPSegment( DBCore& core, BufferManager& bm, SegmentDescriptor& descriptor, uint64_t fsiSegmentId );
 	~SPSegment();
 	
 	// Record management
 	TID Insert( const Record& r );
+	std::vector<TID> InsertBatch( const std::vector<Record>& records );
 	bool Remove( TID tid );
 	Record Lookup( TID tid );
+	RecordView LookupView( TID tid );
+	std::vector<Record> Lookup( const std::vector<TID>& tids );
 	bool Update( TID tid, const Record& r );
 
+	// Maintenance
+	VacuumStats Vacuum();
+	void RebuildInventory();
+
+	static Record ReadOverflow( BufferManager& bm, uint64_t segmentId, const uint8_t* stub );
+
 private:
+	// Start of the stub of a record on overflow pages, followed by the first DB_OVERFLOW_INLINE_BYTES bytes of the record
+	struct OverflowStub
+	{
+		uint32_t length; // Length of the whole record
+		uint32_t pageCount; // Overflow pages, they are one extent
+		uint64_t firstPage; // First overflow page in the segment
+	};
+
+
 	DBCore& mCore;
 	BufferManager& mBufferManager;
 	uint64_t mSegmentId;
+	SegmentDescriptor& mDescriptor; // Page count of the relation
+	FreeSpaceInventory mInventory;
+	std::atomic<uint64_t> mTargets[DB_INSERT_TARGET_STRIPES]; // Insert page of the threads of each stripe
+	std::atomic<uint64_t> mTruncations; // Truncations of the segment the targets know of
+	ProfiledMutex mTargetsMutex; // Serializes choosing new targets, so stripes do not choose the same page
 
-	TID Insert( const Record& r, bool setFromOtherPage );
-	uint64_t FindFreePage( uint32_t minSpace );
-	bool InsertLinked( TID backlink, const Record& r );
+	TID Insert( const uint8_t* data, uint32_t length, const TID* backlink, bool overflow );
+	bool Remove( TID tid, const TID* home );
+	Record Lookup( TID tid, const TID* home );
+	RecordView LookupView( TID tid, const TID* home );
+	bool Update( TID tid, const Record& r, const TID* home );
+	uint64_t TakeTargetPage( uint32_t minSpace, std::atomic<uint64_t>& target );
+	bool IsTargetPage( uint64_t pageId );
+	void ResetTargets();
+	bool InsertLinked( TID backlink, const uint8_t* data, uint32_t length, bool overflow );
+	uint16_t InsertIntoPage( SlottedPage& page, const uint8_t* data, uint32_t length, const TID* backlink, bool overflow );
+	void FreeData( SlottedPage& page, uint64_t pageId, uint32_t offset, uint32_t length );
+	void WriteOverflow( const Record& r, std::vector<uint8_t>& stub );
+	void FreeOverflow( const uint8_t* stub );
+	Record ReadRecord( BufferFrame& frame, uint64_t slotId, std::pair<bool, TID>& otherTid, const TID* home = nullptr );
+	bool LocateRecord( BufferFrame& frame, uint64_t slotId, uint32_t& offset, uint32_t& length, bool& overflow,
+					   std::pair<bool, TID>& otherTid, const TID* home = nullptr );
+	static bool IsMovedRecord( SlottedPage& page, uint64_t slotId, TID home );
+	void VacuumPage( uint64_t pageId, VacuumStats& stats );
+	bool MoveHome( TID home, TID tid );
+	uint64_t ReleaseEmptyPages();
 };
 
 #endif
\ No newline at end of file
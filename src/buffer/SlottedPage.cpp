@@ -1,16 +1,44 @@
 #include "SlottedPage.h"
 
+#include "utility/helpers.h"
+
+#include <algorithm>
 #include <cassert>
+#include <cstring>
+#include <functional>
+#include <utility>
+#include <vector>
+
+static_assert( (DB_PAGE_SIZE - DB_SLOTTED_PAGE_HEADER) / 8 <= DB_SLOT_BITMAP_BYTES * 8, "Slot bitmaps have to cover all slots of a page" );
 
 /// <summary>
-/// Initializes this instance.
+/// Initializes this instance as an empty slotted page. Also used to turn freed overflow pages back into slotted pages.
 /// </summary>
 void SlottedPage::Initialize()
 {
-	mData[1] = 1; // Set initialized
+	mData[0] = 0;
+	mData[1] = DB_SLOTTED_PAGE_VERSION; // Set initialized
+	reinterpret_cast<uint16_t*>(mData)[1] = 0; // slot count
+	reinterpret_cast<uint16_t*>(mData)[2] = 0; // first slot id
+	SetFragmentedSpace( 0 );
+	memset( GetUsedBitmap(), 0, 2 * DB_SLOT_BITMAP_BYTES );
 	SetDataStart( DB_PAGE_SIZE ); // Update start and recalc space
 }
 
+/// <summary>
+/// Initializes this instance as an overflow page. It has no slots and no free space, 
+/// so lookups of its tids fail and inserts skip it. The data starts at GetDataPointer( 16 ).
+/// </summary>
+void SlottedPage::InitializeOverflow()
+{
+	mData[0] = 1; // Set overflow page
+	mData[1] = 0;
+	reinterpret_cast<uint16_t*>(mData)[1] = 0; // slot count
+	reinterpret_cast<uint16_t*>(mData)[2] = 0; // first slot id
+	SetFragmentedSpace( 0 );
+	SetDataStart( 16 );
+}
+
 /// <summary>
 /// We used the first free slot, find next free slot. If the last free slot was a slot at the end, we increment the slot count.
 /// Does not manipulate any data inside a slot (so slot has to be manually set to not free, e.g. with SetInPage() method)
@@ -25,6 +53,13 @@ void SlottedPage::UsedFirstFreeSlot()
 		++(reinterpret_cast<uint16_t*>(mData)[1]); // slot count
 	}
 
+	if ( HasSlotBitmaps() )
+	{
+		SetSlotBits( slotId, true, false );
+		reinterpret_cast<uint16_t*>(mData)[2] = static_cast<uint16_t>(FindSlot( slotId + 1, false, false )); // first slot id
+		return;
+	}
+	// Old pages walk the slots
 	bool foundFreeSlot = false;
 	do 
 	{
@@ -59,9 +94,9 @@ void SlottedPage::SetFirstFreeSlot( uint64_t slotId )
 /// <param name="newDataStart">The new data start.</param>
 void SlottedPage::SetDataStart( uint32_t newDataStart )
 {
-	assert( newDataStart >= static_cast<uint32_t>(16 + GetSlotCount() * 8) );
+	assert( newDataStart >= static_cast<uint32_t>(GetHeaderSize() + GetSlotCount() * 8) );
 	reinterpret_cast<uint32_t*>(mData)[2] = newDataStart;
-	uint32_t freeSpace = newDataStart - 16 - GetSlotCount() * 8;
+	uint32_t freeSpace = newDataStart - GetHeaderSize() - GetSlotCount() * 8;
 	reinterpret_cast<uint32_t*>(mData)[3] = freeSpace;
 }
 
@@ -75,12 +110,72 @@ void SlottedPage::FreeSlot( uint64_t slotId )
 	if ( !slot )
 		return;
 	slot->MakeFree();
+	if ( HasSlotBitmaps() )
+	{
+		SetSlotBits( slotId, false, false );
+	}
 	SetFirstFreeSlot( slotId );
 }
 
+/// <summary>
+/// Turns the slot into a forwarding slot, that holds the tid of its record on another page.
+/// </summary>
+/// <param name="slotId">The slot identifier.</param>
+/// <param name="tid">The tid of the record.</param>
+void SlottedPage::ForwardSlot( uint64_t slotId, TID tid )
+{
+	SlottedPage::Slot* slot = GetSlot( slotId );
+	if ( !slot )
+		return;
+	slot->Overwrite( ~tid ); // Have to remember, tids are inverted
+	if ( HasSlotBitmaps() )
+	{
+		SetSlotBits( slotId, true, true );
+	}
+}
+
+/// <summary>
+/// Turns a forwarding slot back into a slot for a record on this page. Offset and length are 0, they have to be set afterwards.
+/// </summary>
+/// <param name="slotId">The slot identifier.</param>
+void SlottedPage::UnforwardSlot( uint64_t slotId )
+{
+	SlottedPage::Slot* slot = GetSlot( slotId );
+	if ( !slot )
+		return;
+	slot->MakeFree();
+	slot->SetInPage();
+	if ( HasSlotBitmaps() )
+	{
+		SetSlotBits( slotId, true, false );
+	}
+}
+
+/// <summary>
+/// Releases the free slots at the end of the slot directory, their space becomes continuous free space.
+/// Their tids are invalid anyway, lookups of slots behind the slot count fail the same way.
+/// </summary>
+/// <returns>The number of released slots.</returns>
+uint16_t SlottedPage::ReleaseFreeSlots()
+{
+	uint16_t slotCount = GetSlotCount();
+	while ( slotCount > 0 && GetSlot( slotCount - 1 )->IsFree() )
+	{
+		--slotCount;
+	}
+	uint16_t released = GetSlotCount() - slotCount;
+	reinterpret_cast<uint16_t*>(mData)[1] = slotCount; // slot count
+	if ( GetFirstFreeSlotId() > slotCount )
+	{
+		reinterpret_cast<uint16_t*>(mData)[2] = slotCount; // first slot id
+	}
+	SetDataStart( GetDataStart() ); // Recalc space without the released slots
+	return released;
+}
+
 /// <summary>
 /// Frees the data at the spot. Length has to include the 8 bytes old tid, if the tuple was moved from another page.
-/// Will only manipulate the space if the data was at the end of our datablock.
+/// Data at the start of our datablock becomes continuous space, everything else is fragmented until the next compaction.
 /// </summary>
 /// <param name="offset">The offset.</param>
 /// <param name="length">The length.</param>
@@ -90,6 +185,84 @@ void SlottedPage::FreeData( uint32_t offset, uint32_t length )
 	{
 		SetDataStart( offset + length );
 	}
+	else
+	{
+		SetFragmentedSpace( static_cast<uint16_t>(GetFragmentedSpace() + length) );
+	}
+}
+
+/// <summary>
+/// Slides all records to the end of the page, so all free space is continuous. Slot ids and therefore tids stay the same,
+/// only the offsets in the slots change.
+/// </summary>
+void SlottedPage::Compact()
+{
+	// Records with data on this page, highest offset first
+	std::vector<std::pair<uint32_t, uint16_t>> records;
+	for ( uint16_t slotId = 0; slotId < GetSlotCount(); ++slotId )
+	{
+		SlottedPage::Slot* slot = GetSlot( slotId );
+		if ( !slot->IsFree() && !slot->IsOtherRecordTID() && slot->GetLength() > 0 )
+		{
+			records.push_back( std::make_pair( slot->GetOffset(), slotId ) );
+		}
+	}
+	std::sort( records.begin(), records.end(), std::greater<std::pair<uint32_t, uint16_t>>() );
+	// All records above the current one are already packed above its end, so moving it up never overwrites live data
+	uint32_t dataStart = DB_PAGE_SIZE;
+	for ( const std::pair<uint32_t, uint16_t>& record : records )
+	{
+		SlottedPage::Slot* slot = GetSlot( record.second );
+		uint32_t length = slot->GetLength();
+		dataStart -= length;
+		if ( dataStart != record.first )
+		{
+			memmove( &mData[dataStart], &mData[record.first], length );
+			slot->SetOffset( dataStart );
+		}
+	}
+	SetFragmentedSpace( 0 );
+	SetDataStart( dataStart );
+}
+
+/// <summary>
+/// Upgrades a page of an older format to the current one. The slots move behind the slot bitmaps,
+/// so the page needs space for them, it is compacted if necessary. Slot ids and therefore tids stay the same.
+/// </summary>
+/// <returns>True if the page has the current format now, false if it is no slotted page or too full for the upgrade.</returns>
+bool SlottedPage::Upgrade()
+{
+	if ( !IsInitialized() || IsOverflowPage() )
+	{
+		return false;
+	}
+	if ( GetVersion() >= DB_SLOTTED_PAGE_VERSION )
+	{
+		return true;
+	}
+	const uint32_t growth = DB_SLOTTED_PAGE_HEADER - 16;
+	if ( GetFreeContSpace() < growth )
+	{
+		if ( GetFreeSpace() < growth )
+		{
+			return false;
+		}
+		Compact();
+	}
+	uint16_t slotCount = GetSlotCount();
+	memmove( &mData[DB_SLOTTED_PAGE_HEADER], &mData[16], slotCount * 8 );
+	mData[1] = DB_SLOTTED_PAGE_VERSION;
+	memset( GetUsedBitmap(), 0, 2 * DB_SLOT_BITMAP_BYTES );
+	for ( uint16_t slotId = 0; slotId < slotCount; ++slotId )
+	{
+		SlottedPage::Slot* slot = GetSlot( slotId );
+		if ( !slot->IsFree() )
+		{
+			SetSlotBits( slotId, true, slot->IsOtherRecordTID() );
+		}
+	}
+	SetDataStart( GetDataStart() ); // Recalc space with the bigger header
+	return true;
 }
 
 /// <summary>
@@ -101,6 +274,33 @@ bool SlottedPage::IsInitialized()
 	return reinterpret_cast<uint16_t*>(mData)[0] > 0 ? true : false;
 }
 
+/// <summary>
+/// Determines whether this instance is an overflow page, these count as initialized.
+/// </summary>
+/// <returns></returns>
+bool SlottedPage::IsOverflowPage()
+{
+	return reinterpret_cast<uint16_t*>(mData)[0] == 1;
+}
+
+/// <summary>
+/// Gets the format version of a slotted page, 0 for uninitialized and overflow pages.
+/// </summary>
+/// <returns></returns>
+uint8_t SlottedPage::GetVersion()
+{
+	return mData[0] == 0 ? mData[1] : 0;
+}
+
+/// <summary>
+/// Determines whether this instance keeps the used and forwarding slot bitmaps. Older pages only have the slots.
+/// </summary>
+/// <returns></returns>
+bool SlottedPage::HasSlotBitmaps()
+{
+	return GetVersion() >= 2;
+}
+
 /// <summary>
 /// Gets the slot count.
 /// </summary>
@@ -110,6 +310,77 @@ uint16_t SlottedPage::GetSlotCount()
 	return reinterpret_cast<uint16_t*>(mData)[1];
 }
 
+/// <summary>
+/// Gets the number of records on this page, forwarding slots are not counted.
+/// </summary>
+/// <returns></returns>
+uint16_t SlottedPage::GetRecordCount()
+{
+	uint16_t count = 0;
+	if ( HasSlotBitmaps() )
+	{
+		uint64_t* used = GetUsedBitmap();
+		uint64_t* forward = GetForwardBitmap();
+		for ( uint32_t word = 0; word * 64 < GetSlotCount(); ++word )
+		{
+			count += static_cast<uint16_t>(CountSetBits( used[word] & ~forward[word] ));
+		}
+		return count;
+	}
+	for ( uint16_t slotId = 0; slotId < GetSlotCount(); ++slotId )
+	{
+		SlottedPage::Slot* slot = GetSlot( slotId );
+		if ( !slot->IsFree() && !slot->IsOtherRecordTID() )
+		{
+			++count;
+		}
+	}
+	return count;
+}
+
+/// <summary>
+/// Gets the first slot from slotId on that holds a record on this page, free and forwarding slots are skipped.
+/// </summary>
+/// <param name="slotId">The slot identifier to start at.</param>
+/// <returns>The slot identifier, or the slot count if there is no such slot.</returns>
+uint64_t SlottedPage::GetNextRecordSlot( uint64_t slotId )
+{
+	if ( HasSlotBitmaps() )
+	{
+		return FindSlot( slotId, true, false );
+	}
+	for ( ; slotId < GetSlotCount(); ++slotId )
+	{
+		SlottedPage::Slot* slot = GetSlot( slotId );
+		if ( !slot->IsFree() && !slot->IsOtherRecordTID() )
+		{
+			return slotId;
+		}
+	}
+	return GetSlotCount();
+}
+
+/// <summary>
+/// Gets the first slot from slotId on that holds the tid of a record on another page.
+/// </summary>
+/// <param name="slotId">The slot identifier to start at.</param>
+/// <returns>The slot identifier, or the slot count if there is no such slot.</returns>
+uint64_t SlottedPage::GetNextForwardSlot( uint64_t slotId )
+{
+	if ( HasSlotBitmaps() )
+	{
+		return FindSlot( slotId, true, true );
+	}
+	for ( ; slotId < GetSlotCount(); ++slotId )
+	{
+		if ( GetSlot( slotId )->IsOtherRecordTID() )
+		{
+			return slotId;
+		}
+	}
+	return GetSlotCount();
+}
+
 /// <summary>
 /// Gets the first free slot identifier. The slot will stay a free slot have to manually make not free afterwards.
 /// </summary>
@@ -126,7 +397,7 @@ uint16_t SlottedPage::GetFirstFreeSlotId()
 SlottedPage::Slot* SlottedPage::GetFirstFreeSlot()
 {
 	uint16_t slotId = reinterpret_cast<uint16_t*>(mData)[2];
-	return reinterpret_cast<SlottedPage::Slot*>(&mData[16 + slotId * 8]);
+	return reinterpret_cast<SlottedPage::Slot*>(&mData[GetHeaderSize() + slotId * 8]);
 }
 
 /// <summary>
@@ -147,6 +418,103 @@ uint32_t SlottedPage::GetFreeContSpace()
 	return reinterpret_cast<uint32_t*>(mData)[3];
 }
 
+/// <summary>
+/// Gets the free space, continuous and fragmented. Records of this size fit after compacting the page.
+/// </summary>
+/// <returns></returns>
+uint32_t SlottedPage::GetFreeSpace()
+{
+	return GetFreeContSpace() + GetFragmentedSpace();
+}
+
+/// <summary>
+/// Gets the fragmented space.
+/// </summary>
+/// <returns></returns>
+uint16_t SlottedPage::GetFragmentedSpace()
+{
+	return reinterpret_cast<uint16_t*>(mData)[3];
+}
+
+/// <summary>
+/// Sets the fragmented space.
+/// </summary>
+/// <param name="fragmented">The fragmented space.</param>
+void SlottedPage::SetFragmentedSpace( uint16_t fragmented )
+{
+	reinterpret_cast<uint16_t*>(mData)[3] = fragmented;
+}
+
+/// <summary>
+/// Gets the header size, the slots start behind it.
+/// </summary>
+/// <returns></returns>
+uint32_t SlottedPage::GetHeaderSize()
+{
+	return HasSlotBitmaps() ? DB_SLOTTED_PAGE_HEADER : 16;
+}
+
+/// <summary>
+/// Gets the used slots bitmap. Only valid for pages with slot bitmaps.
+/// </summary>
+/// <returns></returns>
+uint64_t* SlottedPage::GetUsedBitmap()
+{
+	return reinterpret_cast<uint64_t*>(&mData[16]);
+}
+
+/// <summary>
+/// Gets the forwarding slots bitmap. Only valid for pages with slot bitmaps.
+/// </summary>
+/// <returns></returns>
+uint64_t* SlottedPage::GetForwardBitmap()
+{
+	return reinterpret_cast<uint64_t*>(&mData[16 + DB_SLOT_BITMAP_BYTES]);
+}
+
+/// <summary>
+/// Sets the bits of the slot in the slot bitmaps.
+/// </summary>
+/// <param name="slotId">The slot identifier.</param>
+/// <param name="used">if set to <c>true</c> the slot is not free.</param>
+/// <param name="forward">if set to <c>true</c> the slot holds the tid of a record on another page.</param>
+void SlottedPage::SetSlotBits( uint64_t slotId, bool used, bool forward )
+{
+	uint64_t mask = 1ull << (slotId % 64);
+	uint64_t& usedWord = GetUsedBitmap()[slotId / 64];
+	uint64_t& forwardWord = GetForwardBitmap()[slotId / 64];
+	usedWord = used ? usedWord | mask : usedWord & ~mask;
+	forwardWord = forward ? forwardWord | mask : forwardWord & ~mask;
+}
+
+/// <summary>
+/// Finds the first slot from slotId on with the given bits, a word of the bitmaps at a time.
+/// Only valid for pages with slot bitmaps.
+/// </summary>
+/// <param name="slotId">The slot identifier to start at.</param>
+/// <param name="used">if set to <c>false</c> finds a free slot, the forward bit is ignored then.</param>
+/// <param name="forward">if set to <c>true</c> finds a forwarding slot, otherwise a slot with a record on this page.</param>
+/// <returns>The slot identifier, or the slot count if there is no such slot.</returns>
+uint64_t SlottedPage::FindSlot( uint64_t slotId, bool used, bool forward )
+{
+	uint64_t slotCount = GetSlotCount();
+	uint64_t* usedBits = GetUsedBitmap();
+	uint64_t* forwardBits = GetForwardBitmap();
+	for ( uint64_t word = slotId / 64; word * 64 < slotCount; ++word )
+	{
+		uint64_t bits = !used ? ~usedBits[word] : usedBits[word] & (forward ? forwardBits[word] : ~forwardBits[word]);
+		if ( word == slotId / 64 )
+		{
+			bits &= ~0ull << (slotId % 64); // Ignore the slots before slotId
+		}
+		if ( bits )
+		{
+			return std::min( word * 64 + CountTrailingZeros( bits ), slotCount );
+		}
+	}
+	return slotCount;
+}
+
 /// <summary>
 /// Gets the backlink tid at the offset specified.
 /// </summary>
@@ -166,7 +534,7 @@ SlottedPage::Slot* SlottedPage::GetSlot( uint64_t slotId )
 {
 	if (GetSlotCount() <= slotId)
 		return nullptr;
-	return reinterpret_cast<SlottedPage::Slot*>(&mData[16 + slotId * 8]);
+	return reinterpret_cast<SlottedPage::Slot*>(&mData[GetHeaderSize() + slotId * 8]);
 }
 
 /// <summary>
@@ -197,6 +565,23 @@ void SlottedPage::Slot::SetFromOtherPage()
 	mData[1] = 1;
 }
 
+/// <summary>
+/// Marks the slot data as the stub of a record on overflow pages, or as a normal record. Keeps the moved from other page status.
+/// </summary>
+/// <param name="overflow">if set to <c>true</c> the data is an overflow stub.</param>
+void SlottedPage::Slot::SetOverflow( bool overflow )
+{
+	bool fromOtherPage = IsFromOtherPage();
+	if ( overflow )
+	{
+		mData[1] = fromOtherPage ? 3 : 2;
+	}
+	else
+	{
+		mData[1] = fromOtherPage ? 1 : 0xFF;
+	}
+}
+
 /// <summary>
 /// Sets the offset.
 /// </summary>
@@ -272,7 +657,16 @@ bool SlottedPage::Slot::IsOtherRecordTID()
 /// <returns></returns>
 bool SlottedPage::Slot::IsFromOtherPage()
 {
-	return mData[1] == 1 ? true : false;
+	return mData[1] == 1 || mData[1] == 3 ? true : false;
+}
+
+/// <summary>
+/// Determines whether the slot data is the stub of a record on overflow pages. This is not valid if the slot contains another record's TID.
+/// </summary>
+/// <returns></returns>
+bool SlottedPage::Slot::IsOverflow()
+{
+	return mData[1] == 2 || mData[1] == 3 ? true : false;
 }
 
 /// <summary>
@@ -18,7 +18,8 @@ public:
 		uint8_t mData[8];
 		// Layout:
 		// 1 Byte other record marker (if == 00000000b, slot points to record on this page, and status byte is valid)
-		// 1 Byte status byte (0 = free slot, 1 = moved from other page, else = normal slot) 
+		// 1 Byte status byte (0 = free slot, 1 = moved from other page, 2 = overflow stub, 3 = overflow stub moved from other page,
+		//                     else = normal slot)
 		// 3 Byte offset in page (bytes)
 		// 3 Byte length in page (bytes)
 		// This performs some unaligned reads, well we just don't support platforms that can't do that
@@ -28,6 +29,7 @@ public:
 		// Setters
 		void SetInPage();
 		void SetFromOtherPage();
+		void SetOverflow( bool overflow );
 		void SetOffset( uint32_t newOffset );
 		void SetLength( uint32_t newLength );
 		void MakeFree();
@@ -37,6 +39,7 @@ public:
 		bool IsFree();
 		bool IsOtherRecordTID();
 		bool IsFromOtherPage();
+		bool IsOverflow();
 		TID GetOtherRecordTID();
 		uint32_t GetOffset();
 		uint32_t GetLength();
@@ -44,19 +47,33 @@ public:
 
 	// Setters etc
 	void Initialize();
+	void InitializeOverflow();
 	void UsedFirstFreeSlot();
 	void SetFirstFreeSlot(uint64_t slotId);
 	void SetDataStart( uint32_t newDataStart );
 	void FreeSlot( uint64_t slotId );
+	void ForwardSlot( uint64_t slotId, TID tid );
+	void UnforwardSlot( uint64_t slotId );
+	uint16_t ReleaseFreeSlots();
 	void FreeData( uint32_t offset, uint32_t length );
+	void Compact();
+	bool Upgrade();
 
 	// Getters
 	bool IsInitialized();
+	bool IsOverflowPage();
+	uint8_t GetVersion();
+	bool HasSlotBitmaps();
 	uint16_t GetSlotCount();
+	uint16_t GetRecordCount();
+	uint64_t GetNextRecordSlot( uint64_t slotId );
+	uint64_t GetNextForwardSlot( uint64_t slotId );
 	uint16_t GetFirstFreeSlotId();
 	SlottedPage::Slot* GetFirstFreeSlot();
 	uint32_t GetDataStart();
 	uint32_t GetFreeContSpace();
+	uint32_t GetFreeSpace();
+	uint16_t GetFragmentedSpace();
 	TID GetBacklinkTID( uint32_t offset );
 	SlottedPage::Slot* GetSlot( uint64_t slotId );
 	void* GetDataPointer( uint32_t offset );
@@ -64,14 +81,26 @@ public:
 private:
 	uint8_t mData[DB_PAGE_SIZE];
 	// Layout:
-	// 2 Byte status (currently is only 0=uninitialized, >1=initialized)
+	// 2 Byte status (0 = uninitialized, 1 = overflow page, 256 * version = slotted page)
 	// 2 Byte slot count (not decremented on removal, this shows all the slots potentially used)
 	// 2 Byte first free slot
-	// 2 Byte padding, so we get 8 byte aligned slots and aligned
+	// 2 Byte fragmented space (freed data below the data start, given back by compaction)
 	// 4 Byte data start
-	// 4 Byte free continuous space amt (currently we don't perform compactification, so storing compactified space is useless)
+	// 4 Byte free continuous space amt (between slots and data start)
+	// Version 2 and up:
+	// DB_SLOT_BITMAP_BYTES used slots bitmap (bit set = slot is not free)
+	// DB_SLOT_BITMAP_BYTES forwarding slots bitmap (bit set = slot holds the tid of a record on another page)
 	// X * 8 Byte Slots
 	// y Byte Data
+	// Version 1 pages have the slots directly after the first 16 header bytes.
+	// Overflow pages have the 16 byte header without slots and no free space, the rest of the page holds a part of a record.
+	void SetFragmentedSpace( uint16_t fragmented );
+	uint32_t GetHeaderSize();
+	uint64_t* GetUsedBitmap();
+	uint64_t* GetForwardBitmap();
+	void SetSlotBits( uint64_t slotId, bool used, bool forward );
+	uint64_t FindSlot( uint64_t slotId, bool used, bool forward );
+
 	SlottedPage();
 	~SlottedPage();
 };
@@ -8,7 +8,11 @@
 #include "index/BPTreeNode.h"
 
 #include <stdint.h>
+#include <algorithm>
 #include <utility>
+#include <atomic>
+#include <vector>
+#include <unordered_map>
 #include <cassert>
 
 /// <summary>
@@ -29,7 +33,16 @@ private:
 	DBCore& mCore;
 	BufferManager& mBufferManager;
 	uint64_t mSegmentId;
-
+	SegmentDescriptor& mDescriptor; // Page count and root of the index, resolved once
+	// Root of the last successful optimistic lookup, only a hint which is validated through the root marker
+	std::atomic<uint64_t> mRootIdHint;
+	std::atomic<BufferFrame*> mRootFrameHint;
+
+	uint64_t AddPages( uint64_t numPages );
+	bool LookupOptimistic( T key, std::pair<bool, TID>& result );
+	std::pair<bool, TID> LookupShared( T key );
+	void CollectLeaves( std::vector<uint64_t>& nodes );
+	static void GetChildren( BPTreeNode<T, CMP>* node, std::vector<uint64_t>& children );
 	void LeafSplit( T key, uint64_t value, BufferFrame* parent, BufferFrame* leftChild, BufferFrame* rightChild );
 	void InnerSplit( T key, BufferFrame** parent, BufferFrame** leftChild, BufferFrame** rightChild );
 };
@@ -39,7 +52,7 @@ private:
 /// </summary>
 template <class T, typename CMP>
 BPTree<T, CMP>::BPTree( DBCore& core, BufferManager& bm, uint64_t segmentId ) :
-	mCore(core), mBufferManager(bm), mSegmentId(segmentId)
+	mCore(core), mBufferManager(bm), mSegmentId(segmentId), mDescriptor( core.GetIndexDescriptor( segmentId ) ), mRootIdHint( 0 ), mRootFrameHint( nullptr )
 {
 }
 
@@ -54,14 +67,28 @@ BPTree<T, CMP>::~BPTree()
 
 
 /// <summary>
-/// Gets the size.
+/// Adds pages to the index segment without the schema lock.
+/// </summary>
+/// <param name="numPages">The number of pages.</param>
+/// <returns>The page id of the last added page (containing the segment id).</returns>
+template <class T, typename CMP>
+uint64_t BPTree<T, CMP>::AddPages( uint64_t numPages )
+{
+	return BufferManager::MergePageId( mSegmentId, mDescriptor.AddPages( numPages ) + numPages - 1 );
+}
+
+/// <summary>
+/// Gets the size. Walks the leaf chain with latch coupling, so every entry that is in the tree during the whole call
+/// is counted exactly once, entries inserted or erased meanwhile might be counted or not. The root is not held while counting.
+/// The leaves are fixed in batches with FixPages, while the last counted leaf stays fixed. Batches are taken from the leaves
+/// collected beforehand and are only counted as far as they match the chain, a leaf that was split since then ends the batch.
 /// </summary>
 /// <returns></returns>
 template <class T, typename CMP>
 uint32_t BPTree<T, CMP>::GetSize()
 {
 	// Acquire root
-	uint64_t rootId = mCore.GetRootOfIndex( mSegmentId );
+	uint64_t rootId = mDescriptor.rootId.load();
 	BufferFrame* frame = &mBufferManager.FixPage( rootId, false );
 	BPTreeNode<T, CMP>* curNode = reinterpret_cast<BPTreeNode<T, CMP>*>(frame->GetData());
 	// Make sure we are still in the root, if not, we retry
@@ -70,32 +97,110 @@ uint32_t BPTree<T, CMP>::GetSize()
 		mBufferManager.UnfixPage( *frame, false );
 		return GetSize();
 	}
+	if ( curNode->IsLeaf() )
+	{
+		uint32_t count = curNode->GetCount();
+		mBufferManager.UnfixPage( *frame, false );
+		return count;
+	}
 
-	// Traverse the tree until we are in the leftmost leaf
-	while ( !curNode->IsLeaf() )
+	// Collect the leaves, the nodes are fixed one at a time, so the leaves are only a hint for the batches
+	std::vector<uint64_t> hint;
+	GetChildren( curNode, hint );
+	mBufferManager.UnfixPage( *frame, false );
+	CollectLeaves( hint );
+	std::vector<uint64_t> leaves;
+	std::unordered_map<uint64_t, size_t> positions;
+	for ( uint64_t leaf : hint )
 	{
-		// Perform latch coupling
-		BufferFrame* oldFrame = frame;
-		frame = &mBufferManager.FixPage( curNode->GetValue( 0 ), false );
-		mBufferManager.UnfixPage( *oldFrame, false );
-		curNode = reinterpret_cast<BPTreeNode<T, CMP>*>(frame->GetData());
+		if ( positions.insert( std::make_pair( leaf, leaves.size() ) ).second )
+		{
+			leaves.push_back( leaf );
+		}
 	}
-	uint32_t sizesum = 0;
+
+	// Splits only add leaves to the right, so the leftmost leaf stays the start of the chain
+	frame = &mBufferManager.FixPage( leaves[0], false );
+	curNode = reinterpret_cast<BPTreeNode<T, CMP>*>(frame->GetData());
 	assert( curNode->IsLeaf() );
-	sizesum += curNode->GetCount();
+	uint32_t sizesum = curNode->GetCount();
+	std::vector<uint64_t> batch;
+	std::vector<BufferFrame*> frames;
 	while ( curNode->GetNextUpper() != 0 )
 	{
-		BufferFrame* oldFrame = frame;
-		frame = &mBufferManager.FixPage( curNode->GetNextUpper(), false );
-		mBufferManager.UnfixPage( *oldFrame, false );
-		curNode = reinterpret_cast<BPTreeNode<T, CMP>*>(frame->GetData());
-		assert( curNode->IsLeaf() );
-		sizesum += curNode->GetCount();
+		// The batch starts with the next leaf of the chain, continued by the leaves that followed it when they were collected
+		batch.assign( 1, curNode->GetNextUpper() );
+		auto it = positions.find( batch[0] );
+		if ( it != positions.end() )
+		{
+			size_t last = std::min( leaves.size(), it->second + DB_IO_BATCH_PAGES );
+			batch.assign( leaves.begin() + it->second, leaves.begin() + last );
+		}
+		mBufferManager.FixPages( batch, false, frames );
+		// Perform latch coupling along the batch, as long as it matches the chain
+		size_t matched = 0;
+		while ( matched < frames.size() && curNode->GetNextUpper() == batch[matched] )
+		{
+			mBufferManager.UnfixPage( *frame, false );
+			frame = frames[matched];
+			curNode = reinterpret_cast<BPTreeNode<T, CMP>*>(frame->GetData());
+			assert( curNode->IsLeaf() );
+			sizesum += curNode->GetCount();
+			++matched;
+		}
+		frames.erase( frames.begin(), frames.begin() + matched );
+		mBufferManager.UnfixPages( frames, false );
 	}
 	mBufferManager.UnfixPage( *frame, false );
 	return sizesum;
 }
 
+/// <summary>
+/// Replaces the inner nodes by the leaves below them, level by level. Only one node is fixed at a time.
+/// </summary>
+/// <param name="nodes">The nodes of one level, the leaves afterwards.</param>
+template <class T, typename CMP>
+void BPTree<T, CMP>::CollectLeaves( std::vector<uint64_t>& nodes )
+{
+	std::vector<uint64_t> children;
+	while ( true )
+	{
+		children.clear();
+		for ( uint64_t nodeId : nodes )
+		{
+			BufferFrame& frame = mBufferManager.FixPage( nodeId, false );
+			BPTreeNode<T, CMP>* node = reinterpret_cast<BPTreeNode<T, CMP>*>(frame.GetData());
+			if ( node->IsLeaf() )
+			{
+				// All nodes of a level are leaves or none is
+				mBufferManager.UnfixPage( frame, false );
+				return;
+			}
+			GetChildren( node, children );
+			mBufferManager.UnfixPage( frame, false );
+		}
+		nodes.swap( children );
+	}
+}
+
+/// <summary>
+/// Collects the children of the inner node, the values and the upper pointer, if that is set.
+/// </summary>
+/// <param name="node">The node.</param>
+/// <param name="children">The children.</param>
+template <class T, typename CMP>
+void BPTree<T, CMP>::GetChildren( BPTreeNode<T, CMP>* node, std::vector<uint64_t>& children )
+{
+	for ( uint32_t i = 0; i < node->GetCount(); ++i )
+	{
+		children.push_back( node->GetValue( i ) );
+	}
+	if ( node->GetNextUpper() != 0 )
+	{
+		children.push_back( node->GetNextUpper() );
+	}
+}
+
 /// <summary>
 /// Inserts the specified key, TID tuple.
 /// </summary>
@@ -106,7 +211,7 @@ template <class T, typename CMP>
 bool BPTree<T, CMP>::Insert( T key, TID tid )
 {
 	// Acquire root
-	uint64_t rootId = mCore.GetRootOfIndex( mSegmentId );
+	uint64_t rootId = mDescriptor.rootId.load();
 	BufferFrame* frame = &mBufferManager.FixPage( rootId, true );
 	BPTreeNode<T, CMP>* curNode = reinterpret_cast<BPTreeNode<T, CMP>*>(frame->GetData());
 	// Make sure we are still in the root, if not, we retry
@@ -130,7 +235,7 @@ bool BPTree<T, CMP>::Insert( T key, TID tid )
 		if ( curNode->GetFreeCount() < 1 )
 		{
 			// Create another frame
-			uint64_t nextPageId = mCore.AddPagesToIndex( mSegmentId, 1 );
+			uint64_t nextPageId = AddPages( 1 );
 			BufferFrame* rightSideFrame = &mBufferManager.FixPage( nextPageId, true );
 			parentFrameDirty = true;
 			frameDirty = true;
@@ -182,7 +287,7 @@ bool BPTree<T, CMP>::Insert( T key, TID tid )
 		assert( *parentFrame == *frame );
 		// Special case. Root == Leaf, but it is full.
 		// We create a new inner page and a new right page.
-		uint64_t nextPageId = mCore.AddPagesToIndex( mSegmentId, 2 );
+		uint64_t nextPageId = AddPages( 2 );
 		BufferFrame* rightSideFrame = &mBufferManager.FixPage( nextPageId - 1, true );
 		parentFrame = &mBufferManager.FixPage( nextPageId, true );
 
@@ -193,7 +298,7 @@ bool BPTree<T, CMP>::Insert( T key, TID tid )
 		BPTreeNode<T, CMP>* parentNode = reinterpret_cast<BPTreeNode<T, CMP>*>(parentFrame->GetData());
 		parentNode->MakeInner();
 		// Also tell our core we changed root.
-		mCore.SetRootOfIndex( mSegmentId, nextPageId );
+		mDescriptor.rootId.store( nextPageId );
 
 		// Perform the actual split and insertion
 		LeafSplit( key, tid, parentFrame, frame, rightSideFrame );
@@ -202,7 +307,7 @@ bool BPTree<T, CMP>::Insert( T key, TID tid )
 	else
 	{
 		// We split, so first we acquire an empty new page.
-		uint64_t nextPageId = mCore.AddPagesToIndex( mSegmentId, 1 );
+		uint64_t nextPageId = AddPages( 1 );
 		BufferFrame* rightSideFrame = &mBufferManager.FixPage( nextPageId, true );
 		LeafSplit( key, tid, parentFrame, frame, rightSideFrame );
 		return true;
@@ -221,7 +326,7 @@ bool BPTree<T, CMP>::Erase( T key )
 {
 	CMP comparer;
 	// Acquire root
-	uint64_t rootId = mCore.GetRootOfIndex( mSegmentId );
+	uint64_t rootId = mDescriptor.rootId.load();
 	BufferFrame* frame = &mBufferManager.FixPage( rootId, false );
 	BPTreeNode<T, CMP>* curNode = reinterpret_cast<BPTreeNode<T, CMP>*>(frame->GetData());
 	// Make sure we are still in the root, if not, we retry
@@ -248,7 +353,26 @@ bool BPTree<T, CMP>::Erase( T key )
 		curNode = reinterpret_cast<BPTreeNode<T, CMP>*>(frame->GetData());
 	}
 
-	// Once we are in the leaf, we promote our lock to write lock
+	// Once we are in the leaf, we try to upgrade our lock to a write lock. If we are the only reader, the leaf
+	// stays locked during the upgrade, nothing could have changed and none of the special cases below apply.
+	if ( mBufferManager.UpgradePage( *frame ) )
+	{
+		uint32_t index = curNode->BinarySearch( key );
+		T foundKey = curNode->GetKey( index );
+		bool found = !comparer( foundKey, key ) && !comparer( key, foundKey ); // Equality
+		if ( found )
+		{
+			curNode->Erase( index );
+		}
+		if ( oldFrame != frame )
+		{
+			mBufferManager.UnfixPage( *oldFrame, false );
+		}
+		mBufferManager.UnfixPage( *frame, found );
+		return found;
+	}
+
+	// Other readers are in the leaf, we release it and promote our lock to write lock
 	// Since we held onto the parent with a read lock, we know that
 	// the leaf could not have been split during the time we released our lock
 	// Special case 1: Our root is a leaf, we can detect this if both flags are set, in this case
@@ -313,17 +437,148 @@ bool BPTree<T, CMP>::Erase( T key )
 /// <returns></returns>
 template <class T, typename CMP>
 std::pair<bool, TID> BPTree<T, CMP>::Lookup( T key )
+{
+	std::pair<bool, TID> result;
+	for ( uint32_t i = 0; i < DB_OPTIMISTIC_READ_RETRIES; ++i )
+	{
+		if ( LookupOptimistic( key, result ) )
+		{
+			return result;
+		}
+	}
+	return LookupShared( key );
+}
+
+/// <summary>
+/// Lookup which reads inner nodes optimistically, without latching them. Only the leaf is fixed (shared).
+/// Every inner node is validated after the child pointer was read and the child version was taken.
+/// Returns false if a validation failed or a node was not buffered, the result is not set in this case.
+/// </summary>
+/// <param name="key">The key.</param>
+/// <param name="result">The result.</param>
+/// <returns></returns>
+template <class T, typename CMP>
+bool BPTree<T, CMP>::LookupOptimistic( T key, std::pair<bool, TID>& result )
+{
+	CMP comparer;
+	uint64_t rootId = mRootIdHint.load();
+	if ( rootId == 0 )
+	{
+		rootId = mDescriptor.rootId.load();
+	}
+	uint64_t version = 0;
+	BufferFrame* frame = mBufferManager.FixPageOptimistic( rootId, version, mRootFrameHint.load() );
+	if ( !frame )
+	{
+		return false;
+	}
+	BPTreeNode<T, CMP>* curNode = reinterpret_cast<BPTreeNode<T, CMP>*>(frame->GetData());
+	bool isRoot = curNode->IsRoot();
+	bool isLeaf = curNode->IsLeaf();
+	if ( !mBufferManager.ValidatePage( *frame, version ) )
+	{
+		return false;
+	}
+	if ( !isRoot )
+	{
+		// Root moved since we cached it
+		mRootIdHint.store( 0 );
+		return false;
+	}
+	// Only write the hints if they changed, they are read by every lookup
+	if ( mRootIdHint.load() != rootId )
+	{
+		mRootIdHint.store( rootId );
+	}
+	if ( mRootFrameHint.load() != frame )
+	{
+		mRootFrameHint.store( frame );
+	}
+
+	// Traverse the inner nodes until the next node is a leaf
+	uint64_t leafId = rootId;
+	BufferFrame* parentFrame = nullptr;
+	uint64_t parentVersion = 0;
+	while ( !isLeaf )
+	{
+		// The count is read once and bounded, so the search stays inside the node even if a writer changes it.
+		// The child id is only used after the node was validated.
+		uint32_t count = curNode->GetCount();
+		if ( count > BPTreeNode<T, CMP>::GetMaxCount() )
+		{
+			return false;
+		}
+		uint64_t childId = curNode->GetValue( curNode->BinarySearch( key, count ), count );
+		if ( !mBufferManager.ValidatePage( *frame, version ) )
+		{
+			return false;
+		}
+		uint64_t childVersion = 0;
+		BufferFrame* childFrame = mBufferManager.FixPageOptimistic( childId, childVersion );
+		// Parent has to be validated after taking the child version, otherwise the child could have been split in between
+		if ( !childFrame || !mBufferManager.ValidatePage( *frame, version ) )
+		{
+			return false;
+		}
+		BPTreeNode<T, CMP>* childNode = reinterpret_cast<BPTreeNode<T, CMP>*>(childFrame->GetData());
+		isLeaf = childNode->IsLeaf();
+		if ( !mBufferManager.ValidatePage( *childFrame, childVersion ) )
+		{
+			return false;
+		}
+		if ( isLeaf )
+		{
+			leafId = childId;
+			parentFrame = frame;
+			parentVersion = version;
+		}
+		else
+		{
+			frame = childFrame;
+			version = childVersion;
+			curNode = childNode;
+		}
+	}
+
+	// Fix the leaf and make sure it is still the leaf the parent points to
+	BufferFrame* leafFrame = &mBufferManager.FixPage( leafId, false );
+	BPTreeNode<T, CMP>* leafNode = reinterpret_cast<BPTreeNode<T, CMP>*>(leafFrame->GetData());
+	bool valid = leafNode->IsLeaf() && 
+		(parentFrame ? mBufferManager.ValidatePage( *parentFrame, parentVersion ) : leafNode->IsRoot());
+	if ( !valid )
+	{
+		mBufferManager.UnfixPage( *leafFrame, false );
+		return false;
+	}
+	uint32_t index = leafNode->BinarySearch( key );
+	T foundKey = leafNode->GetKey( index );
+	result = std::make_pair( false, 0 );
+	if ( !comparer( foundKey, key ) && !comparer( key, foundKey ) ) // Equality
+	{
+		result = std::make_pair( true, leafNode->GetValue( index ) );
+	}
+	mBufferManager.UnfixPage( *leafFrame, false );
+	return true;
+}
+
+/// <summary>
+/// Lookup with shared latch coupling, used if optimistic lookups keep failing.
+/// </summary>
+/// <param name="key">The key.</param>
+/// <returns></returns>
+template <class T, typename CMP>
+std::pair<bool, TID> BPTree<T, CMP>::LookupShared( T key )
 {
 	CMP comparer;
 	// Acquire root
-	uint64_t rootId = mCore.GetRootOfIndex( mSegmentId );
+	uint64_t rootId = mDescriptor.rootId.load();
 	BufferFrame* frame = &mBufferManager.FixPage( rootId, false );
 	BPTreeNode<T, CMP>* curNode = reinterpret_cast<BPTreeNode<T, CMP>*>(frame->GetData());
 	// Make sure we are still in the root, if not, we retry
 	if ( !curNode->IsRoot() )
 	{
 		mBufferManager.UnfixPage( *frame, false );
-		return Lookup( key );
+		return LookupShared( key );
 	}
 
 	// Traverse the tree until we are in a leaf
@@ -430,14 +685,14 @@ void BPTree<T, CMP>::InnerSplit( T key, BufferFrame** parent, BufferFrame** left
 	{
 		// Case where we are currently in the root, this means we need to create another parent and transfer root
 		assert( **parent == **leftChild );
-		uint64_t rootPageId = mCore.AddPagesToIndex( mSegmentId, 1 );
+		uint64_t rootPageId = AddPages( 1 );
 		*parent = &mBufferManager.FixPage( rootPageId, true );
 		BPTreeNode<T, CMP>* parentNode = reinterpret_cast<BPTreeNode<T, CMP>*>((*parent)->GetData());
 		leftNode->MakeNotRoot();
 		parentNode->MakeInner();
 		parentNode->InsertShift( leftMaxKey, (*leftChild)->GetPageId() );
 		parentNode->SetNextUpper( (*rightChild)->GetPageId() );
-		mCore.SetRootOfIndex( mSegmentId, rootPageId );
+		mDescriptor.rootId.store( rootPageId );
 	}
 	else
 	{
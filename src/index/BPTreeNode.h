@@ -17,12 +17,15 @@ class BPTreeNode
 public:
 	// Getter type methods
 	uint32_t BinarySearch( T key );
+	uint32_t BinarySearch( T key, uint32_t count );
 	bool IsRoot();
 	bool IsLeaf();
 	uint64_t GetNextUpper();
 	uint32_t GetCount();
+	static uint32_t GetMaxCount();
 	uint32_t GetFreeCount();
 	uint64_t GetValue( uint32_t index );
+	uint64_t GetValue( uint32_t index, uint32_t count );
 	T GetKey( uint32_t index );
 
 	// Setter type methods
@@ -80,6 +83,19 @@ uint32_t BPTreeNode<T, CMP>::GetCount()
 	return mCount;
 }
 
+/// <summary>
+/// Gets the number of entries that fit into a node. A locked node never has more, but optimistic readers
+/// can see an arbitrary count while a writer modifies the page.
+/// </summary>
+/// <returns></returns>
+template <class T, typename CMP>
+uint32_t BPTreeNode<T, CMP>::GetMaxCount()
+{
+	const uint32_t pagebytes = (DB_PAGE_SIZE - 16);
+	const uint32_t pairsize = sizeof( T ) + sizeof( uint64_t );
+	return pagebytes / pairsize;
+}
+
 /// <summary>
 /// Performs a split to the other node. Assumes other is an empty node. Returns the biggest key on the left side.
 /// </summary>
@@ -175,7 +191,20 @@ void BPTreeNode<T, CMP>::Erase( uint32_t index )
 template <class T, typename CMP>
 uint64_t BPTreeNode<T, CMP>::GetValue( uint32_t index )
 {
-	if ( index + 1 > mCount ) // prevent uint overflows, just shift the -1
+	return GetValue( index, mCount );
+}
+
+/// <summary>
+/// Gets the n-th value like GetValue, with a count the caller read before. Optimistic readers use the same
+/// count for the search and the value, so both stay inside the node.
+/// </summary>
+/// <param name="index">The index.</param>
+/// <param name="count">The count, at most GetMaxCount.</param>
+/// <returns></returns>
+template <class T, typename CMP>
+uint64_t BPTreeNode<T, CMP>::GetValue( uint32_t index, uint32_t count )
+{
+	if ( index + 1 > count ) // prevent uint overflows, just shift the -1
 	{
 		return mNextUpper;
 	}
@@ -206,10 +235,22 @@ T BPTreeNode<T, CMP>::GetKey( uint32_t index )
 /// <returns></returns>
 template <class T, typename CMP>
 uint32_t BPTreeNode<T, CMP>::BinarySearch( T key )
+{
+	return BinarySearch( key, mCount );
+}
+
+/// <summary>
+/// Perform a binary search over the first count key/x pairs, see BinarySearch.
+/// </summary>
+/// <param name="key">The key.</param>
+/// <param name="count">The count, at most GetMaxCount.</param>
+/// <returns></returns>
+template <class T, typename CMP>
+uint32_t BPTreeNode<T, CMP>::BinarySearch( T key, uint32_t count )
 {
 	CMP comparer;
 	uint32_t start = 0;
-	uint32_t end = mCount;
+	uint32_t end = count;
 	while (true)
 	{
 		if ( start == end )
@@ -5,20 +5,24 @@
 #include "DBCore.h"
 #include "buffer/BufferManager.h"
 #include "buffer/BufferFrame.h"
+#include "buffer/BufferAccessStrategy.h"
 #include "buffer/SlottedPage.h"
+#include "buffer/SPSegment.h"
 
 #include <cassert>
+#include <algorithm>
 
-TableScanOperator::TableScanOperator( const std::string& relationName, DBCore& core, BufferManager& bm ) : 
-	mCore(core), mBufferManager(bm)
+TableScanOperator::TableScanOperator( const std::string& relationName, DBCore& core, BufferManager& bm, uint32_t readahead ) : 
+	mReadahead( readahead ), mCore(core), mBufferManager(bm)
 {
 	mSegmentId = mCore.GetSegmentIdOfRelation(relationName);
+	mDescriptor = &mCore.GetRelationDescriptor( mSegmentId );
 }
 
-TableScanOperator::TableScanOperator( uint64_t segmentId, DBCore& core, BufferManager& bm ):
-	mCore( core ), mBufferManager( bm ), mSegmentId( segmentId )
+TableScanOperator::TableScanOperator( uint64_t segmentId, DBCore& core, BufferManager& bm, uint32_t readahead ):
+	mSegmentId( segmentId ), mReadahead( readahead ), mCore( core ), mBufferManager( bm )
 {
-
+	mDescriptor = &mCore.GetRelationDescriptor( mSegmentId );
 }
 
 TableScanOperator::~TableScanOperator()
@@ -26,6 +30,15 @@ TableScanOperator::~TableScanOperator()
 
 }
 
+/// <summary>
+/// Sets the number of pages that are prefetched ahead of the scan position. 0 disables readahead.
+/// </summary>
+/// <param name="readahead">The readahead in pages.</param>
+void TableScanOperator::SetReadahead( uint32_t readahead )
+{
+	mReadahead = readahead;
+}
+
 /// <summary>
 /// Opens this instance.
 /// </summary>
@@ -50,11 +63,24 @@ void TableScanOperator::Open()
 	// Other init work
 	if ( mCurFrame )
 	{
-		mBufferManager.UnfixPage( *mCurFrame, false );
+		UnfixScanPage( *mCurFrame );
+	}
+	// Big relations are scanned through a ring buffer, so they do not push everything else out of the pool.
+	// The ring has to hold the readahead window as well.
+	uint64_t pagecount = mDescriptor->pageCount.load();
+	if ( pagecount > DB_SCAN_RING_THRESHOLD * mBufferManager.GetPageCount() )
+	{
+		mStrategy = std::make_shared<BufferAccessStrategy>( std::max( DB_SCAN_RING_PAGES, 2 * mReadahead + 2 ) );
+	}
+	else
+	{
+		mStrategy.reset();
 	}
 	mCurPageId = 0;
 	mCurSlot = 0;
-	mCurFrame = &mBufferManager.FixPage( BufferManager::MergePageId( mSegmentId, mCurPageId ), false );
+	mPrefetchedUpTo = 1;
+	IssueReadahead( pagecount );
+	mCurFrame = FixScanPage( BufferManager::MergePageId( mSegmentId, mCurPageId ) );
 }
 
 /// <summary>
@@ -63,50 +89,54 @@ void TableScanOperator::Open()
 /// <returns></returns>
 bool TableScanOperator::Next()
 {
-	uint64_t pagecount = mCore.GetPagesOfRelation( mSegmentId );
+	// Overflow pages (and pages a concurrent insert did not initialize yet) have no slots, so they are skipped
 	SlottedPage* sp = reinterpret_cast<SlottedPage*>(mCurFrame->GetData());
-	assert( sp->IsInitialized() );
-	if ( mCurPageId + 1 < pagecount && mCurSlot >= sp->GetSlotCount() )
+	while ( true )
 	{
+		// Jump to the next slot with a record on this page. We skip all free slots and slots that contain a tid,
+		// the tid slots are not on this page, but we get them anyways, because we walk over all pages
+		mCurSlot = sp->GetNextRecordSlot( mCurSlot );
+		if ( mCurSlot < sp->GetSlotCount() )
+		{
+			break;
+		}
+		uint64_t pagecount = mDescriptor->pageCount.load();
+		if ( mCurPageId + 1 >= pagecount )
+		{
+			// on the last page and out of slots return false
+			return false;
+		}
 		// We are still inside the segment bounds but there are no more slots in our page
 		// so we grab the next page
-		mBufferManager.UnfixPage( *mCurFrame, false );
+		UnfixScanPage( *mCurFrame );
 		++mCurPageId;
 		mCurSlot = 0;
-		mCurFrame = &mBufferManager.FixPage( BufferManager::MergePageId( mSegmentId, mCurPageId ), false );
+		IssueReadahead( pagecount );
+		mCurFrame = FixScanPage( BufferManager::MergePageId( mSegmentId, mCurPageId ) );
 		sp = reinterpret_cast<SlottedPage*>(mCurFrame->GetData());
 	}
-	else if ( mCurPageId + 1 >= pagecount && mCurSlot >= sp->GetSlotCount() )
-	{
-		// on the last page and out of slots return false
-		return false;
-	}
-	
-	assert( sp->IsInitialized() );
-	// Walk over slots until we find a valid slot or are out of bounds
-	while ( mCurSlot < sp->GetSlotCount() )
-	{
-		SlottedPage::Slot* slot = sp->GetSlot( mCurSlot );
-		++mCurSlot; // Already increment here so we can use continue
 
-		// We skip all free slots and slots that contain a tid
-		// We skip the tid slots because they are not on this page, but we get them anyways, because we walk over all pages
-		if ( slot->IsFree() || slot->IsOtherRecordTID() )
-			continue;
+	SlottedPage::Slot* slot = sp->GetSlot( mCurSlot );
+	++mCurSlot;
 
-		uint32_t exOffset = 0;
-		if (slot->IsFromOtherPage())
-		{
-			exOffset = 8; // compensate backlink tid
-		}
+	uint32_t exOffset = 0;
+	if (slot->IsFromOtherPage())
+	{
+		exOffset = 8; // compensate backlink tid
+	}
 
-		// Got a valid slot, read values to register and return
-		TupleToRegisters( reinterpret_cast<uint8_t*>(sp->GetDataPointer( slot->GetOffset() + exOffset )), slot->GetLength() - exOffset );
+	if ( slot->IsOverflow() )
+	{
+		// Only the stub is on this page, copy the record from its overflow pages
+		Record r = SPSegment::ReadOverflow( mBufferManager, mSegmentId,
+											reinterpret_cast<uint8_t*>(sp->GetDataPointer( slot->GetOffset() + exOffset )) );
+		TupleToRegisters( r.GetMutableData(), r.GetLen() );
 		return true;
 	}
 
-	return Next(); // if we got here without returning it means we ran out of slots on our page, 
-				   // to not unnecessarily repeat logic for fetching new pages we restart.
+	// Got a valid slot, read values to register and return
+	TupleToRegisters( reinterpret_cast<uint8_t*>(sp->GetDataPointer( slot->GetOffset() + exOffset )), slot->GetLength() - exOffset );
+	return true;
 }
 
 /// <summary>
@@ -130,14 +160,68 @@ void TableScanOperator::Close()
 	mRegisters.clear();
 	if( mCurFrame )
 	{
-		mBufferManager.UnfixPage( *mCurFrame, false );
+		UnfixScanPage( *mCurFrame );
 		mCurFrame = nullptr;
 	}
+	mStrategy.reset();
 	mCurPageId = 0;
 	mCurSlot = 0;
+	mPrefetchedUpTo = 0;
 	// Delete registers
 }
 
+/// <summary>
+/// Requests the next pages of the relation from the buffer manager prefetcher. Requests are issued in batches
+/// once half of the readahead window was consumed, so the prefetcher gets sequential runs of pages.
+/// </summary>
+/// <param name="pagecount">The current number of pages of the relation.</param>
+void TableScanOperator::IssueReadahead( uint64_t pagecount )
+{
+	if ( mReadahead == 0 )
+	{
+		return;
+	}
+	uint64_t windowEnd = std::min<uint64_t>( pagecount, mCurPageId + 1 + mReadahead );
+	if ( mPrefetchedUpTo >= windowEnd || 
+		 ( mPrefetchedUpTo > mCurPageId && mPrefetchedUpTo - mCurPageId > mReadahead / 2 ) )
+	{
+		return;
+	}
+	uint64_t first = std::max( mPrefetchedUpTo, mCurPageId + 1 );
+	mBufferManager.Prefetch( BufferManager::MergePageId( mSegmentId, first ), static_cast<uint32_t>(windowEnd - first), mStrategy );
+	mPrefetchedUpTo = windowEnd;
+}
+
+/// <summary>
+/// Fixes a page of the relation for reading, through the ring buffer if the scan uses one.
+/// </summary>
+/// <param name="pageId">The page identifier.</param>
+/// <returns></returns>
+BufferFrame* TableScanOperator::FixScanPage( uint64_t pageId )
+{
+	if ( mStrategy )
+	{
+		return &mBufferManager.FixPage( pageId, false, *mStrategy );
+	}
+	return &mBufferManager.FixPage( pageId, false );
+}
+
+/// <summary>
+/// Unfixes a page fixed with FixScanPage.
+/// </summary>
+/// <param name="frame">The frame.</param>
+void TableScanOperator::UnfixScanPage( BufferFrame& frame )
+{
+	if ( mStrategy )
+	{
+		mBufferManager.UnfixPage( frame, false, *mStrategy );
+	}
+	else
+	{
+		mBufferManager.UnfixPage( frame, false );
+	}
+}
+
 /// <summary>
 /// Writes the tuples to registers
 /// </summary>
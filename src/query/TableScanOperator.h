@@ -3,20 +3,27 @@
 #define TABLE_SCAN_OPERATOR_H
 
 #include "query/QueryOperator.h"
+#include "utility/defines.h"
+
+#include <memory>
 
 // Forwards
 class Register;
 class BufferManager;
 class BufferFrame;
+class BufferAccessStrategy;
 class DBCore;
+struct SegmentDescriptor;
 
 // Scans a relation and produces all tuples as output.
 class TableScanOperator : public QueryOperator
 {
 public:
-	TableScanOperator( const std::string& relationName, DBCore& core, BufferManager& bm );
-	TableScanOperator( uint64_t segmentId, DBCore& core, BufferManager& bm );
+	TableScanOperator( const std::string& relationName, DBCore& core, BufferManager& bm, uint32_t readahead = DB_SCAN_READAHEAD_PAGES );
+	TableScanOperator( uint64_t segmentId, DBCore& core, BufferManager& bm, uint32_t readahead = DB_SCAN_READAHEAD_PAGES );
 	~TableScanOperator();
+
+	void SetReadahead( uint32_t readahead );
 	
 	void Open() override;
 	bool Next() override;
@@ -25,13 +32,20 @@ public:
 
 private:
 	uint64_t mSegmentId = 0;
+	SegmentDescriptor* mDescriptor = nullptr; // Page count of the relation, resolved once
 	uint64_t mCurPageId = 0; // page id without segment id merged
 	uint64_t mCurSlot = 0;
 	BufferFrame* mCurFrame = nullptr;
+	uint32_t mReadahead = DB_SCAN_READAHEAD_PAGES; // Number of pages prefetched ahead of the current page, 0 disables
+	uint64_t mPrefetchedUpTo = 0; // Pages below this id (without segment id) were already requested
+	std::shared_ptr<BufferAccessStrategy> mStrategy; // Ring buffer for relations that are big compared to the pool
 	DBCore& mCore;
 	BufferManager& mBufferManager;
 	std::vector<Register*> mRegisters;
 	
 	void TupleToRegisters( uint8_t* datastart, uint32_t size );
+	void IssueReadahead( uint64_t pagecount );
+	BufferFrame* FixScanPage( uint64_t pageId );
+	void UnfixScanPage( BufferFrame& frame );
 };
 #endif
\ No newline at end of file
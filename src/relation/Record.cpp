@@ -21,11 +21,21 @@ Record::Record( uint32_t len, const uint8_t* const ptr ) : len( len )
 	}
 }
 
+Record::Record( uint32_t len ) : len( len )
+{
+	data = static_cast<uint8_t*>(malloc( len ));
+}
+
 const uint8_t* Record::GetData() const
 {
 	return data;
 }
 
+uint8_t* Record::GetMutableData()
+{
+	return data;
+}
+
 uint32_t Record::GetLen() const
 {
 	return len;
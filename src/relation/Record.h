@@ -21,10 +21,14 @@ public:
 	Record( Record&& t );
 	// Constructor
 	Record( uint32_t len, const uint8_t* const ptr );
+	// Constructor, allocates uninitialized data to be filled through GetMutableData
+	explicit Record( uint32_t len );
 	// Destructor
 	~Record();
 	// Get pointer to data
 	const uint8_t* GetData() const;
+	// Get pointer to data for filling it
+	uint8_t* GetMutableData();
 	// Get data size in bytes
 	uint32_t GetLen() const;
 };
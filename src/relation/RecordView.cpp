@@ -0,0 +1,118 @@
+#include "RecordView.h"
+
+#include "buffer/BufferManager.h"
+
+/// <summary>
+/// Initializes a new empty instance of the <see cref="RecordView"/> class.
+/// </summary>
+RecordView::RecordView()
+{
+}
+
+/// <summary>
+/// Initializes a new instance of the <see cref="RecordView"/> class. Takes over the shared fix of the frame.
+/// </summary>
+/// <param name="bm">The buffer manager.</param>
+/// <param name="frame">The frame, fixed shared.</param>
+/// <param name="data">The record inside the frame.</param>
+/// <param name="len">The length.</param>
+RecordView::RecordView( BufferManager& bm, BufferFrame& frame, const uint8_t* data, uint32_t len ) :
+	mBufferManager( &bm ), mFrame( &frame ), mData( data ), mLen( len )
+{
+}
+
+/// <summary>
+/// Initializes a new instance of the <see cref="RecordView"/> class, that owns a copy of the record instead of fixing a page.
+/// </summary>
+/// <param name="copy">The copy.</param>
+RecordView::RecordView( Record&& copy ) :
+	mCopy( new Record( std::move( copy ) ) )
+{
+	mData = mCopy->GetData();
+	mLen = mCopy->GetLen();
+}
+
+/// <summary>
+/// Initializes a new instance of the <see cref="RecordView"/> class. Takes over the fix of the other view.
+/// </summary>
+/// <param name="other">The other.</param>
+RecordView::RecordView( RecordView&& other ) :
+	mBufferManager( other.mBufferManager ), mFrame( other.mFrame ), mData( other.mData ), mLen( other.mLen ),
+	mCopy( std::move( other.mCopy ) )
+{
+	other.mFrame = nullptr;
+	other.mData = nullptr;
+	other.mLen = 0;
+}
+
+/// <summary>
+/// Releases our fix and takes over the fix of the other view.
+/// </summary>
+/// <param name="other">The other.</param>
+/// <returns></returns>
+RecordView& RecordView::operator=( RecordView&& other )
+{
+	if ( this != &other )
+	{
+		Release();
+		mBufferManager = other.mBufferManager;
+		mFrame = other.mFrame;
+		mData = other.mData;
+		mLen = other.mLen;
+		mCopy = std::move( other.mCopy );
+		other.mFrame = nullptr;
+		other.mData = nullptr;
+		other.mLen = 0;
+	}
+	return *this;
+}
+
+/// <summary>
+/// Finalizes an instance of the <see cref="RecordView"/> class. Unfixes the page.
+/// </summary>
+RecordView::~RecordView()
+{
+	Release();
+}
+
+/// <summary>
+/// Gets the data, valid until the view is released.
+/// </summary>
+/// <returns></returns>
+const uint8_t* RecordView::GetData() const
+{
+	return mData;
+}
+
+/// <summary>
+/// Gets the length.
+/// </summary>
+/// <returns></returns>
+uint32_t RecordView::GetLen() const
+{
+	return mLen;
+}
+
+/// <summary>
+/// Determines whether the view points to a record.
+/// </summary>
+/// <returns></returns>
+bool RecordView::IsValid() const
+{
+	return mFrame != nullptr || mCopy != nullptr;
+}
+
+/// <summary>
+/// Unfixes the page (or frees the copy) early, the view is empty afterwards.
+/// </summary>
+void RecordView::Release()
+{
+	if ( mFrame )
+	{
+		mBufferManager->UnfixPage( *mFrame, false );
+		mFrame = nullptr;
+	}
+	mCopy.reset();
+	mData = nullptr;
+	mLen = 0;
+}
@@ -0,0 +1,44 @@
+#pragma once
+#ifndef RECORD_VIEW_H
+#define RECORD_VIEW_H
+
+#include "relation/Record.h"
+
+#include <stdint.h>
+#include <memory>
+
+// Forwards
+class BufferManager;
+class BufferFrame;
+
+/// <summary>
+/// Read only view of a record inside a buffer frame, without copying it. The page stays fixed shared
+/// as long as the view lives, so do not fix the same page exclusively while holding a view of it.
+/// Records on overflow pages do not fit into one frame, their view holds a copy instead of a fixed page.
+/// Move only, an empty view (invalid tid) has no data and no fixed page.
+/// </summary>
+class RecordView
+{
+public:
+	RecordView();
+	RecordView( BufferManager& bm, BufferFrame& frame, const uint8_t* data, uint32_t len );
+	explicit RecordView( Record&& copy );
+	RecordView( RecordView&& other );
+	RecordView& operator=( RecordView&& other );
+	RecordView( const RecordView& other ) = delete;
+	RecordView& operator=( const RecordView& other ) = delete;
+	~RecordView();
+
+	const uint8_t* GetData() const;
+	uint32_t GetLen() const;
+	bool IsValid() const;
+	void Release();
+private:
+	BufferManager* mBufferManager = nullptr;
+	BufferFrame* mFrame = nullptr;
+	const uint8_t* mData = nullptr;
+	uint32_t mLen = 0;
+	std::unique_ptr<Record> mCopy; // Set instead of the frame for records on overflow pages
+};
+
+#endif
@@ -9,6 +9,8 @@
 #include <unordered_map>
 #include <cassert>
 
+static const uint32_t gSchemaVersionMarker = UINT32_MAX; // In place of the relation count, followed by the version
+
 static std::string type(const Schema::Relation::Attribute& attr) {
    SchemaTypes::Tag type = attr.type;
    switch(type) {
@@ -34,6 +36,7 @@ std::string Schema::toString() const {
       out << rel.name << std::endl;
 	  out << "\tSegmentId:" << rel.segmentId;
 	  out << "\tPagecount:" << rel.pagecount;
+	  out << "\tFsiSegmentId:" << rel.fsiSegmentId;
       out << "\tPrimary Key:";
       for (unsigned keyId : rel.primaryKey)
          out << ' ' << rel.attributes[keyId].name;
@@ -62,6 +65,9 @@ void Schema::MergeSchema( Schema& other )
 		auto ins2 = usedSegments.insert( r.segmentId );
 		success = success && ins2.second;
 		assert( ins2.second ); // Make sure all used relation segments are unique
+		auto insFsi = usedSegments.insert( r.fsiSegmentId );
+		success = success && insFsi.second;
+		assert( insFsi.second ); // Make sure all used free space inventory segments are unique
 		// Make sure all used index segments are unique
 		for ( Relation::Index& i : r.indices )
 		{
@@ -133,6 +139,16 @@ void Schema::MergeSchema( Schema& other )
 							  // Do the actual merge
 		ro.segmentId = curUnused;
 
+		// Assign segment to the free space inventory
+		while ( usedSegments.find( curUnused ) != usedSegments.end() )
+		{
+			++curUnused;
+		}
+		auto insFsi = usedSegments.insert( curUnused );
+		success = success && insFsi.second;
+		assert( insFsi.second ); // Make sure all used segments are unique
+		ro.fsiSegmentId = curUnused;
+
 		// Assign segments to indices
 		for ( Relation::Index& io : ro.indices )
 		{
@@ -243,6 +259,9 @@ Schema::Relation::Index& Schema::GetIndexWithName( std::string relationname, std
 /// <returns>Success</returns>
 void Schema::Serialize( std::vector<uint8_t>& data )
 {
+	// Version 1 schemas start with the relation count, the marker is never a valid count
+	AppendToData( gSchemaVersionMarker, data );
+	AppendToData( static_cast<uint32_t>(DB_SCHEMA_VERSION), data );
 	AppendToData( static_cast<uint32_t>(relations.size()), data );
 	for (Relation& r : relations)
 	{
@@ -259,6 +278,7 @@ void Schema::SerializeRelation( Relation& r, std::vector<uint8_t>& data )
 {
 	AppendToData( r.segmentId, data );
 	AppendToData( r.pagecount, data );
+	AppendToData( r.fsiSegmentId, data );
 	AppendToData( r.name, data );
 	AppendToData( static_cast<uint32_t>(r.attributes.size()), data );
 	for ( Relation::Attribute& a : r.attributes )
@@ -375,6 +395,7 @@ void Schema::AppendToData( bool toappend, std::vector<uint8_t>& data )
 
 /// <summary>
 /// Deserializes the specified data into the schema. Discards all other data in the schema.
+/// Relations of version 1 schemas get no free space inventory segment, see AssignMissingInventories.
 /// </summary>
 /// <param name="data">The data.</param>
 /// <returns>Success</returns>
@@ -382,25 +403,77 @@ void Schema::Deserialize( const uint8_t* data )
 {
 	// Make sure schema is empty
 	relations.clear();
-	// Read relations
+	// Read version, version 1 schemas start with the relation count
+	uint32_t version = 1;
 	uint32_t numRelations = 0;
 	ReadFromData( numRelations, data );
+	if ( numRelations == gSchemaVersionMarker )
+	{
+		ReadFromData( version, data );
+		ReadFromData( numRelations, data );
+	}
+	if ( version > DB_SCHEMA_VERSION )
+	{
+		throw std::runtime_error( "Error: Unknown schema version " + std::to_string( version ) + "." );
+	}
+	// Read relations
 	for ( uint32_t i = 0; i < numRelations; ++i )
 	{
-		DeserializeRelation( data );
+		DeserializeRelation( data, version );
+	}
+}
+
+/// <summary>
+/// Assigns unused segments as free space inventories to the relations that have none, because they were stored by a version 1 schema.
+/// </summary>
+/// <returns>The segments of the relations, their inventories are empty and have to be rebuilt from the pages.</returns>
+std::vector<uint64_t> Schema::AssignMissingInventories()
+{
+	std::set<uint64_t> usedSegments;
+	for ( Relation& r : relations )
+	{
+		usedSegments.insert( r.segmentId );
+		usedSegments.insert( r.fsiSegmentId );
+		for ( Relation::Index& i : r.indices )
+		{
+			usedSegments.insert( i.segmentId );
+		}
+	}
+	std::vector<uint64_t> segments;
+	uint64_t curUnused = 1;
+	for ( Relation& r : relations )
+	{
+		if ( r.fsiSegmentId != 0 )
+		{
+			continue;
+		}
+		while ( usedSegments.find( curUnused ) != usedSegments.end() )
+		{
+			++curUnused;
+		}
+		usedSegments.insert( curUnused );
+		r.fsiSegmentId = curUnused;
+		segments.push_back( r.segmentId );
 	}
+	return segments;
 }
 
 /// <summary>
 /// Deserializes the next relation (starting at next data). Appends the relation to schema.
 /// </summary>
 /// <param name="data">The data.</param>
-void Schema::DeserializeRelation( const uint8_t*& data )
+/// <param name="version">The version of the schema.</param>
+void Schema::DeserializeRelation( const uint8_t*& data, uint32_t version )
 {
 	relations.push_back( Relation("") );
 	Relation& r = relations.back();
 	ReadFromData( r.segmentId, data );
 	ReadFromData( r.pagecount, data );
+	r.fsiSegmentId = 0;
+	if ( version >= 2 )
+	{
+		ReadFromData( r.fsiSegmentId, data );
+	}
 	ReadFromData( r.name, data );
 	// Read attributes
 	uint32_t numAttributes = 0;
@@ -540,6 +613,7 @@ bool Schema::Relation::operator==( const Schema::Relation& other ) const
 {
 	bool same = segmentId == other.segmentId && 
 		pagecount == other.pagecount && 
+		fsiSegmentId == other.fsiSegmentId &&
 		name == other.name;
 	if ( !same )
 		return false;
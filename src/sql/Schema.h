@@ -34,6 +34,7 @@ struct Schema {
 	  };
 	  uint64_t segmentId = DB_TEST_SEGMENT; // If schema will be inserted to db, segment id will be set correctly
 	  uint64_t pagecount = 0;
+	  uint64_t fsiSegmentId = DB_TEST_SEGMENT; // Free space inventory of the pages, set together with the segment id, 0 if not assigned yet
       std::string name;
       std::vector<Schema::Relation::Attribute> attributes;
 	  std::vector<Schema::Relation::Index> indices;
@@ -49,6 +50,7 @@ struct Schema {
    void Serialize( std::vector<uint8_t>& data );
    void Deserialize( const uint8_t* data );
    void MergeSchema( Schema& other );
+   std::vector<uint64_t> AssignMissingInventories();
    Schema::Relation& GetRelationWithSegmentId( uint64_t segmentId ); // non-const, because we would have to return const relation
    Schema::Relation& GetRelationWithName( std::string name); // non-const, because we would have to return const relation
    Schema::Relation::Index& GetIndexWithSegmentId( uint64_t segmentId ); // non-const, because we would have to return const index
@@ -70,7 +72,7 @@ private:
 	void AppendToData( const std::string& toappend, std::vector<uint8_t>& data );
 
 	// Deserialization
-	void DeserializeRelation( const uint8_t*& data );
+	void DeserializeRelation( const uint8_t*& data, uint32_t version );
 	void DeserializeAttribute( Relation& r, const uint8_t*& data );
 	void DeserializeIndex( Relation& r, const uint8_t*& data );
 
@@ -0,0 +1,341 @@
+#include "HybridLatch.h"
+
+#include <assert.h>
+#include <climits>
+#include <thread>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Layout of the latch word
+static const uint64_t LATCH_READER = 1ull;
+static const uint64_t LATCH_READERS = 0xFFFFull;
+static const uint64_t LATCH_WRITER = 1ull << 16;
+static const uint64_t LATCH_WAITING_WRITER = 1ull << 17;
+static const uint64_t LATCH_WAITING_WRITERS = 0x1FFFull << 17;
+static const uint64_t LATCH_SLEEPERS = 1ull << 30;
+static const uint64_t LATCH_FAIR = 1ull << 31;
+static const uint64_t LATCH_VERSION = 1ull << 32;
+
+/// <summary>
+/// Tells the CPU we are spinning.
+/// </summary>
+static void CpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#else
+	std::this_thread::yield();
+#endif
+}
+
+#ifdef __linux__
+/// <summary>
+/// Gets the low half of the latch word, which the futex operates on.
+/// </summary>
+static int* GetFutexWord( std::atomic<uint64_t>& word )
+{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	return reinterpret_cast<int*>(&word) + 1;
+#else
+	return reinterpret_cast<int*>(&word);
+#endif
+}
+#endif
+
+/// <summary>
+/// Initializes a new instance of the <see cref="HybridLatch"/> class.
+/// </summary>
+/// <param name="fair">if set to <c>true</c> waiting writers block new readers.</param>
+/// <param name="site">The name of the lock site for profiling.</param>
+HybridLatch::HybridLatch( bool fair, const char* site ) : mWord( fair ? LATCH_FAIR : 0 )
+#ifdef DB_LATCH_PROFILING
+	, mSite( LatchProfiler::GetSite( site ) )
+#endif
+{
+	UNREFERENCED_PARAMETER( site );
+}
+
+/// <summary>
+/// Finalizes an instance of the <see cref="HybridLatch"/> class.
+/// </summary>
+HybridLatch::~HybridLatch()
+{
+}
+
+/// <summary>
+/// Tries to acquire write lock (now). Returns true if succeeded, false if failed.
+/// </summary>
+/// <returns></returns>
+bool HybridLatch::TryLockWrite()
+{
+	uint64_t state = mWord.load( std::memory_order_relaxed );
+	while ( (state & (LATCH_WRITER | LATCH_READERS)) == 0 )
+	{
+		if ( mWord.compare_exchange_weak( state, state | LATCH_WRITER, std::memory_order_acquire, std::memory_order_relaxed ) )
+		{
+#ifdef DB_LATCH_PROFILING
+			mSite->RecordAcquisition();
+#endif
+			return true;
+		}
+	}
+	return false;
+}
+
+/// <summary>
+/// Tries to acquire read lock (now). Returns true if succeeded, false if failed.
+/// Fails on fair latches while writers wait.
+/// </summary>
+/// <returns></returns>
+bool HybridLatch::TryLockRead()
+{
+	uint64_t state = mWord.load( std::memory_order_relaxed );
+	while ( CanRead( state ) )
+	{
+		if ( mWord.compare_exchange_weak( state, state + LATCH_READER, std::memory_order_acquire, std::memory_order_relaxed ) )
+		{
+#ifdef DB_LATCH_PROFILING
+			mSite->RecordAcquisition();
+#endif
+			return true;
+		}
+	}
+	return false;
+}
+
+/// <summary>
+/// Locks for writing.
+/// </summary>
+void HybridLatch::LockWrite()
+{
+	if ( TryLockWrite() )
+	{
+		return;
+	}
+#ifdef DB_LATCH_PROFILING
+	std::chrono::steady_clock::time_point waitStart = std::chrono::steady_clock::now();
+#endif
+	// Register as waiting writer, fair latches keep new readers out from now on
+	mWord.fetch_add( LATCH_WAITING_WRITER, std::memory_order_relaxed );
+	uint32_t spins = 0;
+	while ( true )
+	{
+		uint64_t state = mWord.load( std::memory_order_relaxed );
+		if ( (state & (LATCH_WRITER | LATCH_READERS)) == 0 )
+		{
+			if ( mWord.compare_exchange_weak( state, (state - LATCH_WAITING_WRITER) | LATCH_WRITER,
+											  std::memory_order_acquire, std::memory_order_relaxed ) )
+			{
+#ifdef DB_LATCH_PROFILING
+				mSite->RecordContended( waitStart );
+#endif
+				return;
+			}
+			continue;
+		}
+		if ( spins < DB_LATCH_SPIN_COUNT )
+		{
+			++spins;
+			CpuRelax();
+			continue;
+		}
+		Wait( state );
+	}
+}
+
+/// <summary>
+/// Locks for reading (shared access among readers).
+/// </summary>
+void HybridLatch::LockRead()
+{
+	if ( TryLockRead() )
+	{
+		return;
+	}
+#ifdef DB_LATCH_PROFILING
+	std::chrono::steady_clock::time_point waitStart = std::chrono::steady_clock::now();
+#endif
+	uint32_t spins = 0;
+	while ( true )
+	{
+		uint64_t state = mWord.load( std::memory_order_relaxed );
+		if ( CanRead( state ) )
+		{
+			if ( mWord.compare_exchange_weak( state, state + LATCH_READER, std::memory_order_acquire, std::memory_order_relaxed ) )
+			{
+#ifdef DB_LATCH_PROFILING
+				mSite->RecordContended( waitStart );
+#endif
+				return;
+			}
+			continue;
+		}
+		if ( spins < DB_LATCH_SPIN_COUNT )
+		{
+			++spins;
+			CpuRelax();
+			continue;
+		}
+		Wait( state );
+	}
+}
+
+/// <summary>
+/// Unlocks for writing (Call if thread acquired a write lock). Increments the version.
+/// </summary>
+void HybridLatch::UnlockWrite()
+{
+	uint64_t state = mWord.load( std::memory_order_relaxed );
+	assert( state & LATCH_WRITER );
+	while ( !mWord.compare_exchange_weak( state, ((state & ~(LATCH_WRITER | LATCH_SLEEPERS)) + LATCH_VERSION),
+										  std::memory_order_release, std::memory_order_relaxed ) )
+	{
+	}
+	if ( state & LATCH_SLEEPERS )
+	{
+		Wake();
+	}
+}
+
+/// <summary>
+/// Unlocks for reading (Call if thread acquired a read lock).
+/// </summary>
+void HybridLatch::UnlockRead()
+{
+	uint64_t state = mWord.fetch_sub( LATCH_READER, std::memory_order_release );
+	assert( (state & LATCH_READERS) > 0 );
+	// Sleeping threads can only continue once the last reader is gone. Clearing the flag changes the low half,
+	// so threads that set it again meanwhile do not fall asleep, the others are woken.
+	if ( (state & LATCH_READERS) == LATCH_READER && (state & LATCH_SLEEPERS) )
+	{
+		mWord.fetch_and( ~LATCH_SLEEPERS, std::memory_order_relaxed );
+		Wake();
+	}
+}
+
+/// <summary>
+/// Turns the read lock of the calling thread into a write lock, if it is the only reader.
+/// Returns false otherwise, the read lock is still held in that case.
+/// </summary>
+/// <returns></returns>
+bool HybridLatch::TryUpgrade()
+{
+	uint64_t state = mWord.load( std::memory_order_relaxed );
+	while ( (state & LATCH_READERS) == LATCH_READER )
+	{
+		assert( (state & LATCH_WRITER) == 0 );
+		if ( mWord.compare_exchange_weak( state, (state - LATCH_READER) | LATCH_WRITER,
+										  std::memory_order_acquire, std::memory_order_relaxed ) )
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+/// <summary>
+/// Turns the write lock of the calling thread into a read lock, without letting any writer in between.
+/// Increments the version like UnlockWrite.
+/// </summary>
+void HybridLatch::Downgrade()
+{
+	uint64_t state = mWord.load( std::memory_order_relaxed );
+	assert( state & LATCH_WRITER );
+	while ( !mWord.compare_exchange_weak( state, ((state & ~(LATCH_WRITER | LATCH_SLEEPERS)) + LATCH_VERSION + LATCH_READER),
+										  std::memory_order_release, std::memory_order_relaxed ) )
+	{
+	}
+	// Sleeping readers can join us
+	if ( state & LATCH_SLEEPERS )
+	{
+		Wake();
+	}
+}
+
+/// <summary>
+/// Reads the version for an optimistic read. Returns false if a writer currently holds the latch.
+/// </summary>
+/// <param name="version">The version.</param>
+/// <returns></returns>
+bool HybridLatch::ReadVersion( uint64_t& version ) const
+{
+	uint64_t state = mWord.load( std::memory_order_acquire );
+	version = state >> 32;
+	return (state & LATCH_WRITER) == 0;
+}
+
+/// <summary>
+/// Checks if no writer held the latch since the version was read. All reads of the protected data
+/// before this call are ordered before the check.
+/// </summary>
+/// <param name="version">The version.</param>
+/// <returns></returns>
+bool HybridLatch::ValidateVersion( uint64_t version ) const
+{
+	std::atomic_thread_fence( std::memory_order_acquire );
+	uint64_t state = mWord.load( std::memory_order_relaxed );
+	return (state & LATCH_WRITER) == 0 && (state >> 32) == version;
+}
+
+/// <summary>
+/// Determines whether waiting writers block new readers.
+/// </summary>
+/// <returns></returns>
+bool HybridLatch::IsFair() const
+{
+	return (mWord.load( std::memory_order_relaxed ) & LATCH_FAIR) != 0;
+}
+
+/// <summary>
+/// Determines whether a reader can enter in the state.
+/// </summary>
+/// <param name="state">The state.</param>
+/// <returns></returns>
+bool HybridLatch::CanRead( uint64_t state ) const
+{
+	if ( (state & LATCH_WRITER) || (state & LATCH_READERS) == LATCH_READERS )
+	{
+		return false;
+	}
+	return !(state & LATCH_FAIR) || (state & LATCH_WAITING_WRITERS) == 0;
+}
+
+/// <summary>
+/// Sleeps until the latch word changes from the state. Sets the sleeper flag first, so the next unlock wakes us.
+/// Can return early, callers check the state again.
+/// </summary>
+/// <param name="state">The state.</param>
+void HybridLatch::Wait( uint64_t state )
+{
+#ifndef __linux__
+	// No futex, just give up the time slice
+	UNREFERENCED_PARAMETER( state );
+	std::this_thread::yield();
+#else
+	if ( !(state & LATCH_SLEEPERS) )
+	{
+		if ( !mWord.compare_exchange_strong( state, state | LATCH_SLEEPERS, std::memory_order_relaxed ) )
+		{
+			return; // Changed meanwhile, retry
+		}
+		state |= LATCH_SLEEPERS;
+	}
+	// Returns immediately if the low half changed after we set the flag, so no unlock can be missed
+	syscall( SYS_futex, GetFutexWord( mWord ), FUTEX_WAIT_PRIVATE, static_cast<int>(static_cast<uint32_t>(state)),
+			 nullptr, nullptr, 0 );
+#endif
+}
+
+/// <summary>
+/// Wakes all sleeping threads, they compete for the latch again.
+/// </summary>
+void HybridLatch::Wake()
+{
+#ifdef __linux__
+	syscall( SYS_futex, GetFutexWord( mWord ), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0 );
+#endif
+}
@@ -0,0 +1,54 @@
+#pragma once
+#ifndef HYBRID_LATCH_H
+#define HYBRID_LATCH_H
+
+#include "utility/defines.h"
+#include "utility/LatchProfiler.h"
+
+#include <stdint.h>
+#include <atomic>
+
+/// <summary>
+/// Read write latch in a single 64 bit word, drop-in for RWLock.
+/// Low half: reader count (16 bit), writer flag, waiting writers (13 bit), sleeper flag, fairness flag.
+/// High half: version, incremented whenever a writer releases the latch, used for optimistic reading.
+/// Uncontended operations are one compare and swap without any library call. Waiting threads spin for
+/// DB_LATCH_SPIN_COUNT rounds and then sleep on a futex on the low half, which changes with every unlock.
+/// Fair latches let no new reader in while a writer waits, unfair latches (default) prefer readers like
+/// pthread rwlocks do. Fair latches must not be read locked recursively.
+/// With DB_LATCH_PROFILING the latch reports its acquisitions and waits to the named site.
+/// </summary>
+class HybridLatch
+{
+public:
+	HybridLatch( bool fair = false, const char* site = "HybridLatch" );
+	~HybridLatch();
+
+	bool TryLockWrite();
+	bool TryLockRead();
+	void LockWrite();
+	void LockRead();
+	void UnlockWrite();
+	void UnlockRead();
+
+	// Mode changes of a held latch
+	bool TryUpgrade();
+	void Downgrade();
+
+	// Optimistic reading
+	bool ReadVersion( uint64_t& version ) const;
+	bool ValidateVersion( uint64_t version ) const;
+
+	bool IsFair() const;
+private:
+	std::atomic<uint64_t> mWord;
+#ifdef DB_LATCH_PROFILING
+	LatchSite* mSite;
+#endif
+
+	bool CanRead( uint64_t state ) const;
+	void Wait( uint64_t state );
+	void Wake();
+};
+
+#endif
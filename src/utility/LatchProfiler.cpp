@@ -0,0 +1,238 @@
+#include "LatchProfiler.h"
+
+#include "utility/helpers.h"
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <sstream>
+
+// Registered sites, never removed, so site pointers stay valid for the lifetime of the program
+static std::mutex gSitesMutex;
+static std::vector<std::unique_ptr<LatchSite>> gSites;
+
+/// <summary>
+/// Gets the fraction of acquisitions that had to wait.
+/// </summary>
+/// <returns></returns>
+double LatchSiteStats::GetContentionRatio() const
+{
+	return acquisitions == 0 ? 0.0 : static_cast<double>(wait.count) / acquisitions;
+}
+
+/// <summary>
+/// Formats the statistics in one line.
+/// </summary>
+/// <returns></returns>
+std::string LatchSiteStats::ToString() const
+{
+	std::ostringstream out;
+	out << name << ": acquisitions=" << acquisitions
+		<< " contended=" << wait.count
+		<< " contentionRatio=" << GetContentionRatio()
+		<< " totalWait=" << wait.totalNs << "ns"
+		<< " wait: " << wait.ToString();
+	return out.str();
+}
+
+/// <summary>
+/// Initializes a new instance of the <see cref="LatchSite"/> class.
+/// </summary>
+/// <param name="name">The name.</param>
+LatchSite::LatchSite( const std::string& name ) : mName( name )
+{
+	Reset();
+}
+
+/// <summary>
+/// Gets the name.
+/// </summary>
+/// <returns></returns>
+const std::string& LatchSite::GetName() const
+{
+	return mName;
+}
+
+/// <summary>
+/// Counts an acquisition without waiting.
+/// </summary>
+void LatchSite::RecordAcquisition()
+{
+	mStripes[GetThreadIndex() % DB_LATCH_SITE_STRIPES].mAcquisitions.fetch_add( 1, std::memory_order_relaxed );
+}
+
+/// <summary>
+/// Counts an acquisition that had to wait and records the wait.
+/// </summary>
+/// <param name="waitStart">The time the acquiring thread started to wait.</param>
+void LatchSite::RecordContended( std::chrono::steady_clock::time_point waitStart )
+{
+	RecordAcquisition();
+	mWait.Record( waitStart );
+}
+
+/// <summary>
+/// Gets a snapshot of the statistics.
+/// </summary>
+/// <returns></returns>
+LatchSiteStats LatchSite::GetStats() const
+{
+	LatchSiteStats stats;
+	stats.name = mName;
+	for ( const Stripe& stripe : mStripes )
+	{
+		stats.acquisitions += stripe.mAcquisitions.load( std::memory_order_relaxed );
+	}
+	stats.wait = mWait.GetSnapshot();
+	return stats;
+}
+
+/// <summary>
+/// Sets all counts back to zero.
+/// </summary>
+void LatchSite::Reset()
+{
+	for ( Stripe& stripe : mStripes )
+	{
+		stripe.mAcquisitions.store( 0, std::memory_order_relaxed );
+	}
+	mWait.Reset();
+}
+
+/// <summary>
+/// Determines whether the locks report to the profiler (compiled with DB_LATCH_PROFILING).
+/// </summary>
+/// <returns></returns>
+bool LatchProfiler::IsEnabled()
+{
+#ifdef DB_LATCH_PROFILING
+	return true;
+#else
+	return false;
+#endif
+}
+
+/// <summary>
+/// Gets the site with the name, registers it on first use. Meant to be called when a lock is constructed.
+/// </summary>
+/// <param name="name">The name.</param>
+/// <returns>The site, valid for the lifetime of the program.</returns>
+LatchSite* LatchProfiler::GetSite( const char* name )
+{
+	std::lock_guard<std::mutex> lock( gSitesMutex );
+	for ( std::unique_ptr<LatchSite>& site : gSites )
+	{
+		if ( site->GetName() == name )
+		{
+			return site.get();
+		}
+	}
+	gSites.push_back( std::unique_ptr<LatchSite>( new LatchSite( name ) ) );
+	return gSites.back().get();
+}
+
+/// <summary>
+/// Gets the statistics of all sites that were acquired at least once, ordered by total wait time, highest first.
+/// </summary>
+/// <returns></returns>
+std::vector<LatchSiteStats> LatchProfiler::GetReport()
+{
+	std::vector<LatchSiteStats> report;
+	{
+		std::lock_guard<std::mutex> lock( gSitesMutex );
+		for ( std::unique_ptr<LatchSite>& site : gSites )
+		{
+			LatchSiteStats stats = site->GetStats();
+			if ( stats.acquisitions > 0 )
+			{
+				report.push_back( stats );
+			}
+		}
+	}
+	std::sort( report.begin(), report.end(), []( const LatchSiteStats& a, const LatchSiteStats& b )
+	{
+		return a.wait.totalNs > b.wait.totalNs;
+	} );
+	return report;
+}
+
+/// <summary>
+/// Formats the report, one site per line.
+/// </summary>
+/// <returns></returns>
+std::string LatchProfiler::GetReportString()
+{
+	std::ostringstream out;
+	for ( const LatchSiteStats& stats : GetReport() )
+	{
+		out << stats.ToString() << std::endl;
+	}
+	return out.str();
+}
+
+/// <summary>
+/// Sets the statistics of all sites back to zero.
+/// </summary>
+void LatchProfiler::Reset()
+{
+	std::lock_guard<std::mutex> lock( gSitesMutex );
+	for ( std::unique_ptr<LatchSite>& site : gSites )
+	{
+		site->Reset();
+	}
+}
+
+/// <summary>
+/// Initializes a new instance of the <see cref="ProfiledMutex"/> class.
+/// </summary>
+/// <param name="site">The name of the lock site.</param>
+ProfiledMutex::ProfiledMutex( const char* site )
+#ifdef DB_LATCH_PROFILING
+	: mSite( LatchProfiler::GetSite( site ) )
+#endif
+{
+	UNREFERENCED_PARAMETER( site );
+}
+
+/// <summary>
+/// Locks the mutex.
+/// </summary>
+void ProfiledMutex::lock()
+{
+#ifdef DB_LATCH_PROFILING
+	if ( mMutex.try_lock() )
+	{
+		mSite->RecordAcquisition();
+		return;
+	}
+	std::chrono::steady_clock::time_point waitStart = std::chrono::steady_clock::now();
+	mMutex.lock();
+	mSite->RecordContended( waitStart );
+#else
+	mMutex.lock();
+#endif
+}
+
+/// <summary>
+/// Tries to lock the mutex (now). Returns true if succeeded, false if failed.
+/// </summary>
+/// <returns></returns>
+bool ProfiledMutex::try_lock()
+{
+	bool success = mMutex.try_lock();
+#ifdef DB_LATCH_PROFILING
+	if ( success )
+	{
+		mSite->RecordAcquisition();
+	}
+#endif
+	return success;
+}
+
+/// <summary>
+/// Unlocks the mutex.
+/// </summary>
+void ProfiledMutex::unlock()
+{
+	mMutex.unlock();
+}
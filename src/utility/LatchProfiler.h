@@ -0,0 +1,89 @@
+#pragma once
+#ifndef LATCH_PROFILER_H
+#define LATCH_PROFILER_H
+
+#include "utility/defines.h"
+#include "utility/LatencyHistogram.h"
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/// <summary>
+/// Statistics of one lock site.
+/// </summary>
+struct LatchSiteStats
+{
+	std::string name;
+	uint64_t acquisitions = 0;
+	LatencySnapshot wait; // Waits of contended acquisitions, count is the number of contended acquisitions
+
+	double GetContentionRatio() const;
+	std::string ToString() const;
+};
+
+/// <summary>
+/// Named place where locks are acquired, e.g. all frame latches share one site. Acquisitions are counted in
+/// per thread stripes, so threads acquiring different locks of the same site do not write the same cache line.
+/// Waits are only recorded for contended acquisitions.
+/// </summary>
+class LatchSite
+{
+public:
+	LatchSite( const std::string& name );
+
+	const std::string& GetName() const;
+	void RecordAcquisition();
+	void RecordContended( std::chrono::steady_clock::time_point waitStart );
+	LatchSiteStats GetStats() const;
+	void Reset();
+private:
+	struct Stripe
+	{
+		std::atomic<uint64_t> mAcquisitions;
+		uint8_t mPadding[56];
+	};
+
+	std::string mName;
+	Stripe mStripes[DB_LATCH_SITE_STRIPES];
+	LatencyHistogram mWait;
+};
+
+/// <summary>
+/// Registry of all lock sites. Locks only report to it if the project is compiled with DB_LATCH_PROFILING
+/// (cmake -DLATCH_PROFILING=ON), otherwise the report is empty and the locks carry no site.
+/// </summary>
+class LatchProfiler
+{
+public:
+	static bool IsEnabled();
+	static LatchSite* GetSite( const char* name );
+	// Sites ordered by total wait time, highest first
+	static std::vector<LatchSiteStats> GetReport();
+	static std::string GetReportString();
+	static void Reset();
+};
+
+/// <summary>
+/// std::mutex with a lock site for profiling. Method names follow the standard, so it works with std::lock_guard.
+/// Mutexes used with condition variables stay std::mutex.
+/// </summary>
+class ProfiledMutex
+{
+public:
+	ProfiledMutex( const char* site );
+
+	void lock();
+	bool try_lock();
+	void unlock();
+private:
+	std::mutex mMutex;
+#ifdef DB_LATCH_PROFILING
+	LatchSite* mSite;
+#endif
+};
+
+#endif
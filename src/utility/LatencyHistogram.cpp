@@ -0,0 +1,136 @@
+#include "LatencyHistogram.h"
+
+#include <sstream>
+
+/// <summary>
+/// Adds the recordings of another snapshot.
+/// </summary>
+/// <param name="other">The other snapshot.</param>
+void LatencySnapshot::Merge( const LatencySnapshot& other )
+{
+	for ( uint32_t i = 0; i < DB_LATENCY_BUCKETS; ++i )
+	{
+		buckets[i] += other.buckets[i];
+	}
+	count += other.count;
+	totalNs += other.totalNs;
+	maxNs = maxNs > other.maxNs ? maxNs : other.maxNs;
+}
+
+/// <summary>
+/// Gets the mean latency.
+/// </summary>
+/// <returns></returns>
+double LatencySnapshot::GetMeanNs() const
+{
+	return count == 0 ? 0.0 : static_cast<double>(totalNs) / count;
+}
+
+/// <summary>
+/// Gets an upper bound of the latency percentile, precise to the bucket.
+/// </summary>
+/// <param name="percentile">The percentile, between 0 and 1.</param>
+/// <returns>The upper end of the bucket that contains the percentile, 0 if nothing was recorded.</returns>
+uint64_t LatencySnapshot::GetPercentileNs( double percentile ) const
+{
+	if ( count == 0 )
+	{
+		return 0;
+	}
+	uint64_t rank = static_cast<uint64_t>(percentile * count);
+	uint64_t seen = 0;
+	for ( uint32_t i = 0; i < DB_LATENCY_BUCKETS; ++i )
+	{
+		seen += buckets[i];
+		if ( seen > rank )
+		{
+			uint64_t upper = (2ull << i) - 1;
+			return upper < maxNs ? upper : maxNs;
+		}
+	}
+	return maxNs;
+}
+
+/// <summary>
+/// Formats count, mean, percentiles and maximum in one line.
+/// </summary>
+/// <returns></returns>
+std::string LatencySnapshot::ToString() const
+{
+	std::ostringstream out;
+	out << "count=" << count
+		<< " mean=" << static_cast<uint64_t>(GetMeanNs()) << "ns"
+		<< " p50=" << GetPercentileNs( 0.5 ) << "ns"
+		<< " p99=" << GetPercentileNs( 0.99 ) << "ns"
+		<< " max=" << maxNs << "ns";
+	return out.str();
+}
+
+/// <summary>
+/// Initializes a new instance of the <see cref="LatencyHistogram"/> class.
+/// </summary>
+LatencyHistogram::LatencyHistogram()
+{
+	Reset();
+}
+
+/// <summary>
+/// Records one latency.
+/// </summary>
+/// <param name="ns">The latency in nanoseconds.</param>
+void LatencyHistogram::Record( uint64_t ns )
+{
+	uint32_t bucket = ns == 0 ? 0 : 63 - __builtin_clzll( ns );
+	if ( bucket >= DB_LATENCY_BUCKETS )
+	{
+		bucket = DB_LATENCY_BUCKETS - 1;
+	}
+	mBuckets[bucket].fetch_add( 1, std::memory_order_relaxed );
+	mCount.fetch_add( 1, std::memory_order_relaxed );
+	mTotalNs.fetch_add( ns, std::memory_order_relaxed );
+	uint64_t max = mMaxNs.load( std::memory_order_relaxed );
+	while ( ns > max && !mMaxNs.compare_exchange_weak( max, ns, std::memory_order_relaxed ) )
+	{
+	}
+}
+
+/// <summary>
+/// Records the time passed since start.
+/// </summary>
+/// <param name="start">The start of the measured operation.</param>
+void LatencyHistogram::Record( std::chrono::steady_clock::time_point start )
+{
+	std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - start;
+	Record( static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()) );
+}
+
+/// <summary>
+/// Copies the histogram. Concurrent recordings might be partially contained.
+/// </summary>
+/// <returns></returns>
+LatencySnapshot LatencyHistogram::GetSnapshot() const
+{
+	LatencySnapshot snapshot;
+	for ( uint32_t i = 0; i < DB_LATENCY_BUCKETS; ++i )
+	{
+		snapshot.buckets[i] = mBuckets[i].load( std::memory_order_relaxed );
+	}
+	snapshot.count = mCount.load( std::memory_order_relaxed );
+	snapshot.totalNs = mTotalNs.load( std::memory_order_relaxed );
+	snapshot.maxNs = mMaxNs.load( std::memory_order_relaxed );
+	return snapshot;
+}
+
+/// <summary>
+/// Sets all counts back to zero.
+/// </summary>
+void LatencyHistogram::Reset()
+{
+	for ( uint32_t i = 0; i < DB_LATENCY_BUCKETS; ++i )
+	{
+		mBuckets[i].store( 0, std::memory_order_relaxed );
+	}
+	mCount.store( 0, std::memory_order_relaxed );
+	mTotalNs.store( 0, std::memory_order_relaxed );
+	mMaxNs.store( 0, std::memory_order_relaxed );
+}
@@ -0,0 +1,49 @@
+#pragma once
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include "utility/defines.h"
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+
+/// <summary>
+/// Copy of a latency histogram at one point in time. Bucket i counts latencies in [2^i, 2^(i+1)) nanoseconds,
+/// the first bucket also counts 0, the last one everything above.
+/// </summary>
+struct LatencySnapshot
+{
+	uint64_t buckets[DB_LATENCY_BUCKETS] = {};
+	uint64_t count = 0;
+	uint64_t totalNs = 0;
+	uint64_t maxNs = 0;
+
+	void Merge( const LatencySnapshot& other );
+	double GetMeanNs() const;
+	uint64_t GetPercentileNs( double percentile ) const;
+	std::string ToString() const;
+};
+
+/// <summary>
+/// Lock free histogram of latencies with power of two buckets. Recording is a few relaxed atomic increments,
+/// so it can be used on hot paths by many threads.
+/// </summary>
+class LatencyHistogram
+{
+public:
+	LatencyHistogram();
+
+	void Record( uint64_t ns );
+	void Record( std::chrono::steady_clock::time_point start );
+	LatencySnapshot GetSnapshot() const;
+	void Reset();
+private:
+	std::atomic<uint64_t> mBuckets[DB_LATENCY_BUCKETS];
+	std::atomic<uint64_t> mCount;
+	std::atomic<uint64_t> mTotalNs;
+	std::atomic<uint64_t> mMaxNs;
+};
+
+#endif
@@ -31,6 +31,19 @@ bool RWLock::TryLockWrite()
 #endif
 }
 
+/// <summary>
+/// Tries to acquire read lock (now). Returns true if succeeded, false if failed.
+/// </summary>
+/// <returns></returns>
+bool RWLock::TryLockRead()
+{
+#ifdef PLATFORM_WIN
+	return (TryAcquireSRWLockShared( &mRwlock ) > 0);
+#else
+	return (pthread_rwlock_tryrdlock( &mRwlock ) == 0);
+#endif
+}
+
 /// <summary>
 /// Locks for writing.
 /// </summary>
@@ -20,6 +20,7 @@ public:
 	~RWLock();
 
 	bool TryLockWrite();
+	bool TryLockRead();
 	void LockWrite();
 	void LockRead();
 	void UnlockWrite();
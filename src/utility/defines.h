@@ -20,8 +20,34 @@
 #endif // Platform ifdef
 
 #define DB_PAGE_SIZE 16384u
+#define DB_HUGE_PAGE_SIZE 2097152u
+#define DB_DIRECT_IO_ALIGNMENT 4096u
+#define DB_FILE_EXTENT_PAGES 64u
+#define DB_IO_QUEUE_DEPTH 256u
+#define DB_IO_BATCH_PAGES 64u
+#define DB_LATENCY_BUCKETS 40u
+#define DB_BUFFER_PAGES 5000u
+#define DB_POOL_MAX_GROWTH 4u
 #define DB_EVICTION_COUNTER_START 0u
 #define DB_TEST_SEGMENT UINT16_MAX
+#define DB_PAGE_TABLE_PARTITIONS 64u
+#define DB_SCAN_READAHEAD_PAGES 8u
+#define DB_SCAN_RING_PAGES 32u
+#define DB_SCAN_RING_THRESHOLD 0.25 // Scans of relations bigger than this fraction of the pool use a ring buffer
+#define DB_OPTIMISTIC_READ_RETRIES 4u
+#define DB_LATCH_SPIN_COUNT 64u
+#define DB_INSERT_EXTENT_PAGES 16u // Pages added to a relation at once by batch inserts
+#define DB_INSERT_TARGET_STRIPES 16u // Insert target pages of a slotted pages segment, threads are spread over them
+#define DB_LRUK_SAMPLE_FRAMES 256u // Frames LRU-K looks at to refill its victim candidates
+#define DB_LRUK_CANDIDATES 32u // Best frames of a sample LRU-K keeps as victim candidates
+#define DB_SLOTTED_PAGE_VERSION 2u // Format of new slotted pages, older pages are upgraded when they are changed
+#define DB_SLOT_BITMAP_BYTES 256u // One bit per slot, enough for every slot a page can hold
+#define DB_SLOTTED_PAGE_HEADER (16u + 2u * DB_SLOT_BITMAP_BYTES) // Header with used and forwarding slot bitmaps
+#define DB_MAX_INLINE_RECORD (DB_PAGE_SIZE - DB_SLOTTED_PAGE_HEADER - 16u) // Bigger records are stored on overflow pages, smaller ones fit a page with backlink
+#define DB_OVERFLOW_INLINE_BYTES 256u // Prefix of a record on overflow pages that is kept in its slotted page
+#define DB_SCHEMA_VERSION 2u // Format of the serialized schema, relations of version 1 schemas have no free space inventory
+#define DB_FSI_CLASS_BYTES (DB_PAGE_SIZE / 256u) // Free space classes of the free space inventory, one byte per page
+#define DB_LATCH_SITE_STRIPES 16u // Per thread acquisition counters of a latch profiling site
 #include <stdint.h>
 #define TID uint64_t // 48 bit page id/ 16 bit slot id
 
@@ -8,6 +8,7 @@
 #include <vector>
 #include <queue>
 #include <algorithm>
+#include <atomic>
 #include <assert.h>
 
 #ifdef PLATFORM_UNIX      
@@ -16,6 +17,7 @@
 #include <unistd.h>
 #elif defined(PLATFORM_WIN)
 #include <windows.h>
+#include <intrin.h>
 #endif
 
 
@@ -468,3 +470,46 @@ TID MergeTID( uint64_t pageId, uint64_t slotId )
 	slotId = slotId & 0x000000000000FFFFul;
 	return pageId | slotId;
 }
+
+/// <summary>
+/// Gets the index of the calling thread, threads are numbered in the order of their first call.
+/// Used to spread threads over stripes, e.g. GetThreadIndex() % stripes.
+/// </summary>
+/// <returns></returns>
+uint32_t GetThreadIndex()
+{
+	static std::atomic<uint32_t> nextIndex( 0 );
+	thread_local uint32_t index = nextIndex.fetch_add( 1, std::memory_order_relaxed );
+	return index;
+}
+
+/// <summary>
+/// Counts the zero bits below the lowest set bit. The value must not be 0.
+/// </summary>
+/// <param name="value">The value.</param>
+/// <returns>Index of the lowest set bit.</returns>
+uint32_t CountTrailingZeros( uint64_t value )
+{
+	assert( value != 0 );
+#ifdef PLATFORM_WIN
+	unsigned long index;
+	_BitScanForward64( &index, value );
+	return static_cast<uint32_t>(index);
+#else
+	return static_cast<uint32_t>(__builtin_ctzll( value ));
+#endif
+}
+
+/// <summary>
+/// Counts the set bits of the value.
+/// </summary>
+/// <param name="value">The value.</param>
+/// <returns></returns>
+uint32_t CountSetBits( uint64_t value )
+{
+#ifdef PLATFORM_WIN
+	return static_cast<uint32_t>(__popcnt64( value ));
+#else
+	return static_cast<uint32_t>(__builtin_popcountll( value ));
+#endif
+}
@@ -22,6 +22,13 @@ void FileDelete( const std::string& filename );
 std::pair<uint64_t, uint64_t> SplitTID( TID toSplit );
 TID MergeTID( uint64_t pageId, uint64_t slotId );
 
+// Threads
+uint32_t GetThreadIndex();
+
+// Bit operations
+uint32_t CountTrailingZeros( uint64_t value );
+uint32_t CountSetBits( uint64_t value );
+
 // Old
 void ExternalSort( const char* inputFilename, uint64_t size, const char* outputFilename, uint64_t memsize );
 void AssertCorrectOrderSort( const char* outputFilename );
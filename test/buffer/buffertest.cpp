@@ -1,10 +1,15 @@
 #include "buffer/BufferManager.h"
 #include "utility/macros.h"
 #include "utility/defines.h"
+#include "utility/helpers.h"
 
 #include "gtest/gtest.h"
 
+#include <atomic>
+#include <chrono>
+#include <fstream>
 #include <future>
+#include <iostream>
 #include <thread>
 #include <vector>
 #include <random>
@@ -15,13 +20,15 @@ struct BufferTestInitState
 	uint32_t pagesOnDisk;
 	uint32_t pagesInMemory;
 	uint32_t threads;
+	uint32_t partitions;
 
 	friend std::ostream& operator<<( std::ostream& os, const BufferTestInitState& obj )
 	{
 		return os
 			<< "Pages on Disk: " << obj.pagesOnDisk
 			<< " Pages in Memory: " << obj.pagesInMemory
-			<< " Threads: " << obj.threads;
+			<< " Threads: " << obj.threads
+			<< " Partitions: " << obj.partitions;
 	}
 };
 
@@ -38,7 +45,7 @@ public:
 	}
 	virtual void SetUp() override
 	{
-		mgr = new BufferManager( GetParam().pagesInMemory );
+		mgr = new BufferManager( GetParam().pagesInMemory, GetParam().partitions );
 		// set all counters to 0
 		for ( uint32_t i = 0; i < GetParam().pagesOnDisk; i++ )
 		{
@@ -57,10 +64,11 @@ public:
 
 INSTANTIATE_TEST_CASE_P( Default, BufferTest,
 						 testing::Values(
-							 BufferTestInitState{ 50,20,5 },
-							 BufferTestInitState{ 100,50,20 },
-							 BufferTestInitState{ 20,30,10 },
-							 BufferTestInitState{ 4000, 400, 20 } // Bigger test, probably will remove this once we have more tests to save time
+							 BufferTestInitState{ 50,20,5,DB_PAGE_TABLE_PARTITIONS },
+							 BufferTestInitState{ 100,50,20,DB_PAGE_TABLE_PARTITIONS },
+							 BufferTestInitState{ 20,30,10,DB_PAGE_TABLE_PARTITIONS },
+							 BufferTestInitState{ 100,50,20,1 }, // Single partition, behaves like one global page table
+							 BufferTestInitState{ 4000, 400, 20,DB_PAGE_TABLE_PARTITIONS } // Bigger test, probably will remove this once we have more tests to save time
 ) );
 
 // Thread methods
@@ -122,6 +130,20 @@ uint32_t ReadWrite( BufferManager* bm, uint32_t threadNum, uint32_t threadCount,
 	return count;
 }
 
+uint64_t ReadHits( BufferManager* bm, uint32_t residentPages, uint32_t fixes )
+{
+	std::random_device rd;
+	std::minstd_rand randGen( rd() );
+	uint64_t sum = 0;
+	for ( uint32_t i = 0; i < fixes; i++ )
+	{
+		BufferFrame& bf = bm->FixPage( BufferManager::MergePageId( DB_TEST_SEGMENT, randGen() % residentPages ), false );
+		sum += reinterpret_cast<uint32_t*>(bf.GetData())[0];
+		bm->UnfixPage( bf, false );
+	}
+	return sum;
+}
+
 // Test if we can read and write from multiple threads without failures
 TEST_P(BufferTest, MultiThreadScanAndWrite)
 {
@@ -152,7 +174,7 @@ TEST_P(BufferTest, MultiThreadScanAndWrite)
 
 	// Restart buffer manager
 	SDELETE(mgr);
-	mgr = new BufferManager( GetParam().pagesInMemory );
+	mgr = new BufferManager( GetParam().pagesInMemory, GetParam().partitions );
 
 	// Verify results
 	uint32_t totalCountOnDisk = 0;
@@ -165,6 +187,33 @@ TEST_P(BufferTest, MultiThreadScanAndWrite)
 	EXPECT_EQ( totalCount, totalCountOnDisk );
 }
 
+// Measures shared fix throughput on pages that are all resident, so only the page table
+// and the frame latches are exercised. Prints the throughput for a doubling number of threads.
+TEST_P( BufferTest, HitThroughputScaling )
+{
+	uint32_t residentPages = std::min( GetParam().pagesOnDisk, GetParam().pagesInMemory );
+	const uint32_t totalFixes = 200000;
+	for ( uint32_t threads = 1; threads <= GetParam().threads; threads *= 2 )
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		std::vector<std::future<uint64_t>> futures;
+		for ( uint32_t i = 0; i < threads; i++ )
+		{
+			futures.push_back( std::async( std::launch::async, ReadHits, mgr, residentPages, totalFixes / threads ) );
+		}
+		for ( std::future<uint64_t>& f : futures )
+		{
+			f.get();
+		}
+		auto end = std::chrono::high_resolution_clock::now();
+		std::chrono::duration<double> elapsed = end - start;
+		double fixesPerSecond = (totalFixes / threads) * threads / elapsed.count();
+		std::cout << "[ PERF     ] Partitions: " << GetParam().partitions << " Threads: " << threads
+			<< " Hit fixes/s: " << static_cast<uint64_t>(fixesPerSecond) << std::endl;
+		EXPECT_LT( 0.0, fixesPerSecond );
+	}
+}
+
 // Tests for expected exception when we lock more than memory pages
 TEST_P( BufferTest, CreatePageOverload )
 {
@@ -209,4 +258,546 @@ TEST( BufferTest, MergeSplitPageId )
 	split = BufferManager::SplitPageId( id );
 	EXPECT_EQ( 0xFFFFul, split.first );
 	EXPECT_EQ( 0x0000FFFFFFFFFFFFul, split.second );
-}
\ No newline at end of file
+}
+
+// Tests that the page cleaner writes back dirty pages, so replacements find clean victims
+TEST( BufferTest, PageCleanerWritesBackDirtyPages )
+{
+	const uint32_t pagesInMemory = 50;
+	BufferManager* bm = new BufferManager( pagesInMemory );
+	bm->StartPageCleaner( 0.0, 5 );
+	for ( uint32_t i = 0; i < pagesInMemory; i++ )
+	{
+		BufferFrame& bf = bm->FixPage( BufferManager::MergePageId( DB_TEST_SEGMENT, i ), true );
+		reinterpret_cast<uint32_t*>(bf.GetData())[0] = i + 1;
+		bm->UnfixPage( bf, true );
+	}
+	// Give the cleaner some time to catch up
+	for ( uint32_t tries = 0; tries < 400 && bm->GetCleanerWritebacks() < pagesInMemory; tries++ )
+	{
+		std::this_thread::sleep_for( std::chrono::milliseconds( 5 ) );
+	}
+	bm->StopPageCleaner();
+	EXPECT_EQ( pagesInMemory, bm->GetCleanerWritebacks() );
+
+	// Replace every frame, none of the victims should need a write back
+	for ( uint32_t i = pagesInMemory; i < 2 * pagesInMemory; i++ )
+	{
+		BufferFrame& bf = bm->FixPage( BufferManager::MergePageId( DB_TEST_SEGMENT, i ), false );
+		bm->UnfixPage( bf, false );
+	}
+	EXPECT_EQ( 0u, bm->GetDirtyWritebacks() );
+
+	// Written data has to be on disk
+	SDELETE( bm );
+	bm = new BufferManager( pagesInMemory );
+	for ( uint32_t i = 0; i < pagesInMemory; i++ )
+	{
+		BufferFrame& bf = bm->FixPage( BufferManager::MergePageId( DB_TEST_SEGMENT, i ), false );
+		EXPECT_EQ( i + 1, reinterpret_cast<uint32_t*>(bf.GetData())[0] );
+		bm->UnfixPage( bf, false );
+	}
+	SDELETE( bm );
+}
+
+TEST( BufferTest, PrefetchedPagesAreHits )
+{
+	const uint32_t pagesInMemory = 50;
+	const uint32_t prefetchPages = 20;
+	BufferManager* bm = new BufferManager( pagesInMemory );
+	bm->Prefetch( BufferManager::MergePageId( DB_TEST_SEGMENT, 0 ), prefetchPages );
+	// Wait for the prefetcher
+	for ( uint32_t tries = 0; tries < 400 && bm->GetPrefetchedPages() < prefetchPages; tries++ )
+	{
+		std::this_thread::sleep_for( std::chrono::milliseconds( 5 ) );
+	}
+	EXPECT_EQ( prefetchPages, bm->GetPrefetchedPages() );
+	EXPECT_EQ( 0u, bm->GetPageMisses() );
+
+	// Prefetching pages again does not load them twice
+	bm->Prefetch( BufferManager::MergePageId( DB_TEST_SEGMENT, 0 ), prefetchPages );
+	for ( uint32_t i = 0; i < prefetchPages; i++ )
+	{
+		BufferFrame& bf = bm->FixPage( BufferManager::MergePageId( DB_TEST_SEGMENT, i ), false );
+		bm->UnfixPage( bf, false );
+	}
+	EXPECT_EQ( 0u, bm->GetPageMisses() );
+	EXPECT_EQ( prefetchPages, bm->GetPrefetchedPages() );
+	SDELETE( bm );
+}
+
+TEST( BufferTest, RingStrategyKeepsHotPages )
+{
+	const uint32_t pagesInMemory = 50;
+	const uint32_t hotPages = 20;
+	const uint32_t scanPages = 10 * pagesInMemory;
+	BufferManager* bm = new BufferManager( pagesInMemory );
+	for ( uint32_t round = 0; round < 3; round++ )
+	{
+		for ( uint32_t i = 0; i < hotPages; i++ )
+		{
+			BufferFrame& bf = bm->FixPage( BufferManager::MergePageId( DB_TEST_SEGMENT, i ), false );
+			bm->UnfixPage( bf, false );
+		}
+	}
+
+	// Scan a lot more pages than the pool holds through a small ring
+	BufferAccessStrategy strategy( 8 );
+	uint64_t missesBefore = bm->GetPageMisses();
+	for ( uint32_t i = 0; i < scanPages; i++ )
+	{
+		BufferFrame& bf = bm->FixPage( BufferManager::MergePageId( DB_TEST_SEGMENT, 1000 + i ), false, strategy );
+		bm->UnfixPage( bf, false, strategy );
+	}
+	EXPECT_EQ( scanPages, bm->GetPageMisses() - missesBefore );
+
+	// The hot pages are all still there
+	missesBefore = bm->GetPageMisses();
+	for ( uint32_t i = 0; i < hotPages; i++ )
+	{
+		BufferFrame& bf = bm->FixPage( BufferManager::MergePageId( DB_TEST_SEGMENT, i ), false );
+		bm->UnfixPage( bf, false );
+	}
+	EXPECT_EQ( 0u, bm->GetPageMisses() - missesBefore );
+	SDELETE( bm );
+}
+
+TEST( BufferTest, RingStrategyWithPrefetch )
+{
+	const uint32_t pagesInMemory = 50;
+	const uint32_t scanPages = 10 * pagesInMemory;
+	const uint32_t readahead = 4;
+	BufferManager* bm = new BufferManager( pagesInMemory );
+	std::shared_ptr<BufferAccessStrategy> strategy = std::make_shared<BufferAccessStrategy>( 4 * readahead );
+	for ( uint32_t i = 0; i < scanPages; i++ )
+	{
+		if ( i % readahead == 0 )
+		{
+			bm->Prefetch( BufferManager::MergePageId( DB_TEST_SEGMENT, 1000 + i + readahead ), readahead, strategy );
+		}
+		BufferFrame& bf = bm->FixPage( BufferManager::MergePageId( DB_TEST_SEGMENT, 1000 + i ), true, *strategy );
+		reinterpret_cast<uint32_t*>(bf.GetData())[0] = i;
+		bm->UnfixPage( bf, true, *strategy );
+	}
+	SDELETE( bm );
+
+	// Everything was written back
+	bm = new BufferManager( pagesInMemory );
+	for ( uint32_t i = 0; i < scanPages; i++ )
+	{
+		BufferFrame& bf = bm->FixPage( BufferManager::MergePageId( DB_TEST_SEGMENT, 1000 + i ), false );
+		EXPECT_EQ( i, reinterpret_cast<uint32_t*>(bf.GetData())[0] );
+		bm->UnfixPage( bf, false );
+	}
+	SDELETE( bm );
+}
+
+// Pool memory with and without huge pages (and prefaulting), reports the mapping that was chosen and the hit throughput
+TEST( BufferTest, PoolMemoryModes )
+{
+	const uint32_t pagesInMemory = 1000;
+	const uint32_t totalFixes = 200000;
+	for ( bool hugePages : { false, true } )
+	{
+		BufferManagerConfig config;
+		config.pageCount = pagesInMemory;
+		config.hugePages = hugePages;
+		config.prefaultThreads = 2;
+		BufferManager* bm = new BufferManager( config );
+		if ( !hugePages )
+		{
+			EXPECT_EQ( PoolMemoryMode::Regular, bm->GetPoolMemoryMode() );
+		}
+		for ( uint32_t i = 0; i < pagesInMemory; i++ )
+		{
+			BufferFrame& bf = bm->FixPage( BufferManager::MergePageId( DB_TEST_SEGMENT, i ), true );
+			reinterpret_cast<uint32_t*>(bf.GetData())[0] = i;
+			bm->UnfixPage( bf, true );
+		}
+		auto start = std::chrono::high_resolution_clock::now();
+		ReadHits( bm, pagesInMemory, totalFixes );
+		std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+		std::cout << "[ PERF     ] Pool memory: " << BufferManager::GetPoolMemoryModeName( bm->GetPoolMemoryMode() )
+			<< " Hit fixes/s: " << static_cast<uint64_t>(totalFixes / elapsed.count()) << std::endl;
+		for ( uint32_t i = 0; i < pagesInMemory; i++ )
+		{
+			BufferFrame& bf = bm->FixPage( BufferManager::MergePageId( DB_TEST_SEGMENT, i ), false );
+			EXPECT_EQ( i, reinterpret_cast<uint32_t*>(bf.GetData())[0] );
+			bm->UnfixPage( bf, false );
+		}
+		SDELETE( bm );
+	}
+}
+
+// Random reads on a working set four times the pool size, with buffered and direct I/O.
+// Buffered reads are mostly served from the OS page cache, direct reads always hit the device.
+TEST( BufferTest, BufferedVsDirectIO )
+{
+	const uint32_t pagesInMemory = 100;
+	const uint32_t pagesOnDisk = 4 * pagesInMemory;
+	const uint32_t fixes = 20000;
+	for ( bool direct : { false, true } )
+	{
+		BufferManagerConfig config;
+		config.pageCount = pagesInMemory;
+		config.directIO = direct;
+		BufferManager* bm = new BufferManager( config );
+		if ( !direct )
+		{
+			EXPECT_FALSE( bm->IsDirectIO( DB_TEST_SEGMENT ) );
+		}
+		for ( uint32_t i = 0; i < pagesOnDisk; i++ )
+		{
+			BufferFrame& bf = bm->FixPage( BufferManager::MergePageId( DB_TEST_SEGMENT, i ), true );
+			reinterpret_cast<uint32_t*>(bf.GetData())[0] = i;
+			bm->UnfixPage( bf, true );
+		}
+
+		unsigned seed = 1234;
+		uint64_t missesBefore = bm->GetPageMisses();
+		auto start = std::chrono::high_resolution_clock::now();
+		for ( uint32_t i = 0; i < fixes; i++ )
+		{
+			uint32_t page = rand_r( &seed ) % pagesOnDisk;
+			BufferFrame& bf = bm->FixPage( BufferManager::MergePageId( DB_TEST_SEGMENT, page ), false );
+			EXPECT_EQ( page, reinterpret_cast<uint32_t*>(bf.GetData())[0] );
+			bm->UnfixPage( bf, false );
+		}
+		std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+		std::cout << "[ PERF     ] " << (bm->IsDirectIO( DB_TEST_SEGMENT ) ? "Direct" : "Buffered") << " I/O"
+			<< " Misses: " << bm->GetPageMisses() - missesBefore
+			<< " Fixes/s: " << static_cast<uint64_t>(fixes / elapsed.count()) << std::endl;
+		SDELETE( bm );
+	}
+}
+
+// Loads cold pages with batched fixes (one I/O submission per batch) on both I/O backends, with direct I/O so
+// every read reaches the device. Reports the backend that was actually used, io_uring might not be available.
+TEST( BufferTest, BatchedFixIOBackends )
+{
+	const uint32_t pagesInMemory = 300;
+	const uint32_t pagesOnDisk = 1200;
+	const uint32_t batchSize = 64;
+	BufferManager* bm = new BufferManager( pagesInMemory );
+	for ( uint32_t i = 0; i < pagesOnDisk; i++ )
+	{
+		BufferFrame& bf = bm->FixPage( BufferManager::MergePageId( DB_TEST_SEGMENT, i ), true );
+		reinterpret_cast<uint32_t*>(bf.GetData())[0] = i;
+		bm->UnfixPage( bf, true );
+	}
+	SDELETE( bm );
+
+	for ( IOBackendType backend : { IOBackendType::Sync, IOBackendType::IoUring } )
+	{
+		BufferManagerConfig config;
+		config.pageCount = pagesInMemory;
+		config.directIO = true;
+		config.ioBackend = backend;
+		bm = new BufferManager( config );
+		if ( backend == IOBackendType::Sync )
+		{
+			EXPECT_EQ( IOBackendType::Sync, bm->GetIOBackendType() );
+		}
+		auto start = std::chrono::high_resolution_clock::now();
+		for ( uint32_t first = 0; first < pagesOnDisk; first += batchSize )
+		{
+			std::vector<uint64_t> pageIds;
+			for ( uint32_t i = first; i < std::min( pagesOnDisk, first + batchSize ); i++ )
+			{
+				pageIds.push_back( BufferManager::MergePageId( DB_TEST_SEGMENT, i ) );
+			}
+			std::vector<BufferFrame*> frames;
+			bm->FixPages( pageIds, false, frames );
+			ASSERT_EQ( pageIds.size(), frames.size() );
+			for ( uint32_t i = 0; i < frames.size(); i++ )
+			{
+				EXPECT_EQ( pageIds[i], frames[i]->GetPageId() );
+				EXPECT_EQ( first + i, reinterpret_cast<uint32_t*>(frames[i]->GetData())[0] );
+				bm->UnfixPage( *frames[i], false );
+			}
+		}
+		std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+		std::cout << "[ PERF     ] I/O backend: " << IOBackend::GetName( bm->GetIOBackendType() )
+			<< " Cold pages/s: " << static_cast<uint64_t>(pagesOnDisk / elapsed.count()) << std::endl;
+		EXPECT_EQ( pagesOnDisk, bm->GetPageMisses() );
+		SDELETE( bm );
+	}
+}
+
+// Statistics snapshot after a known sequence of fixes, and the periodic dump
+TEST( BufferTest, StatsSnapshotAndDump )
+{
+	const uint32_t pagesInMemory = 10;
+	BufferManager* bm = new BufferManager( pagesInMemory );
+	// Misses, the second half evicts the first half, which is dirty
+	for ( uint32_t i = 0; i < 2 * pagesInMemory; i++ )
+	{
+		BufferFrame& bf = bm->FixPage( BufferManager::MergePageId( DB_TEST_SEGMENT, i ), true );
+		reinterpret_cast<uint32_t*>(bf.GetData())[0] = i;
+		bm->UnfixPage( bf, true );
+	}
+	// Hits
+	for ( uint32_t i = pagesInMemory; i < 2 * pagesInMemory; i++ )
+	{
+		BufferFrame& bf = bm->FixPage( BufferManager::MergePageId( DB_TEST_SEGMENT, i ), false );
+		bm->UnfixPage( bf, false );
+	}
+	BufferFrame& fixed = bm->FixPage( BufferManager::MergePageId( DB_TEST_SEGMENT, pagesInMemory ), false );
+	BufferManagerStats stats = bm->GetStats();
+	bm->UnfixPage( fixed, false );
+
+	EXPECT_EQ( 2 * pagesInMemory, stats.misses );
+	EXPECT_EQ( pagesInMemory + 1, stats.hits );
+	EXPECT_EQ( pagesInMemory, stats.evictions );
+	EXPECT_EQ( pagesInMemory, stats.dirtyWritebacks );
+	EXPECT_EQ( pagesInMemory * static_cast<uint64_t>(DB_PAGE_SIZE), stats.bytesWritten );
+	EXPECT_EQ( 0u, stats.writeErrors );
+	EXPECT_EQ( pagesInMemory, stats.pageCount );
+	EXPECT_EQ( 1u, stats.fixedFrames );
+	EXPECT_EQ( pagesInMemory, stats.dirtyFrames );
+	EXPECT_EQ( stats.hits, stats.fixHitLatency.count );
+	EXPECT_EQ( stats.misses, stats.fixMissLatency.count );
+	EXPECT_EQ( pagesInMemory, stats.writeLatency.count );
+	EXPECT_LE( stats.fixHitLatency.GetPercentileNs( 0.5 ), stats.fixHitLatency.maxNs );
+
+	// Dump
+	const std::string dumpFile = "bufferstats.txt";
+	FileDelete( dumpFile );
+	bm->StartStatsDump( dumpFile, 5 );
+	std::this_thread::sleep_for( std::chrono::milliseconds( 50 ) );
+	bm->StopStatsDump();
+	std::ifstream in( dumpFile );
+	std::string content( (std::istreambuf_iterator<char>( in )), std::istreambuf_iterator<char>() );
+	EXPECT_NE( std::string::npos, content.find( "hits=" ) );
+	EXPECT_NE( std::string::npos, content.find( "fixMiss:" ) );
+	in.close();
+	FileDelete( dumpFile );
+	SDELETE( bm );
+}
+
+TEST( BufferTest, OnlineResize )
+{
+	const uint32_t pagesOnDisk = 400;
+	BufferManagerConfig config;
+	config.pageCount = 100;
+	config.maxPageCount = 300;
+	BufferManager* bm = new BufferManager( config );
+	ASSERT_EQ( 300u, bm->GetMaxPageCount() );
+	EXPECT_THROW( bm->Resize( 301 ), std::runtime_error );
+	EXPECT_THROW( bm->Resize( 0 ), std::runtime_error );
+
+	for ( uint32_t i = 0; i < pagesOnDisk; i++ )
+	{
+		BufferFrame& bf = bm->FixPage( BufferManager::MergePageId( DB_TEST_SEGMENT, i ), true );
+		reinterpret_cast<uint32_t*>(bf.GetData())[0] = i;
+		bm->UnfixPage( bf, true );
+	}
+	// Grow, the last pages stay resident and new pages do not evict
+	EXPECT_EQ( 300u, bm->Resize( 300 ) );
+	uint64_t evictions = bm->GetStats().evictions;
+	for ( uint32_t i = 0; i < 200; i++ )
+	{
+		BufferFrame& bf = bm->FixPage( BufferManager::MergePageId( DB_TEST_SEGMENT, i ), false );
+		EXPECT_EQ( i, reinterpret_cast<uint32_t*>(bf.GetData())[0] );
+		bm->UnfixPage( bf, false );
+	}
+	EXPECT_EQ( evictions, bm->GetStats().evictions );
+	EXPECT_EQ( 300u, bm->GetStats().pageCount );
+
+	// Shrink with dirty and fixed pages, fixed pages are never evicted
+	std::vector<BufferFrame*> fixed;
+	for ( uint32_t i = 0; i < 20; i++ )
+	{
+		fixed.push_back( &bm->FixPage( BufferManager::MergePageId( DB_TEST_SEGMENT, i ), true ) );
+		reinterpret_cast<uint32_t*>(fixed.back()->GetData())[1] = i;
+	}
+	EXPECT_EQ( 50u, bm->Resize( 50 ) );
+	EXPECT_EQ( 50u, bm->GetStats().pageCount );
+	for ( uint32_t i = 0; i < 20; i++ )
+	{
+		EXPECT_EQ( i, reinterpret_cast<uint32_t*>(fixed[i]->GetData())[1] );
+		bm->UnfixPage( *fixed[i], true );
+	}
+	// Cannot shrink below the fixed pages
+	std::vector<BufferFrame*> fixedAll;
+	for ( uint32_t i = 0; i < 50; i++ )
+	{
+		fixedAll.push_back( &bm->FixPage( BufferManager::MergePageId( DB_TEST_SEGMENT, i ), false ) );
+	}
+	EXPECT_EQ( 50u, bm->Resize( 10 ) );
+	for ( BufferFrame* frame : fixedAll )
+	{
+		bm->UnfixPage( *frame, false );
+	}
+	// No write was lost while shrinking
+	for ( uint32_t i = 0; i < pagesOnDisk; i++ )
+	{
+		BufferFrame& bf = bm->FixPage( BufferManager::MergePageId( DB_TEST_SEGMENT, i ), false );
+		EXPECT_EQ( i, reinterpret_cast<uint32_t*>(bf.GetData())[0] );
+		if ( i < 20 )
+		{
+			EXPECT_EQ( i, reinterpret_cast<uint32_t*>(bf.GetData())[1] );
+		}
+		bm->UnfixPage( bf, false );
+	}
+	EXPECT_EQ( 50u, bm->GetStats().pageCount );
+	SDELETE( bm );
+}
+
+TEST( BufferTest, FixPagesUnfixPages )
+{
+	const uint32_t pagesInMemory = 100;
+	BufferManager* bm = new BufferManager( pagesInMemory );
+	for ( uint32_t i = 0; i < 50; i++ )
+	{
+		BufferFrame& bf = bm->FixPage( BufferManager::MergePageId( DB_TEST_SEGMENT, i ), true );
+		reinterpret_cast<uint32_t*>(bf.GetData())[0] = i;
+		bm->UnfixPage( bf, true );
+	}
+	// Hits and misses mixed, in an order that is not sorted by page or partition
+	std::vector<uint64_t> pageIds;
+	for ( uint32_t i = 0; i < 80; i++ )
+	{
+		pageIds.push_back( BufferManager::MergePageId( DB_TEST_SEGMENT, (i * 37) % 80 ) );
+	}
+	BufferManagerStats before = bm->GetStats();
+	std::vector<BufferFrame*> frames;
+	bm->FixPages( pageIds, true, frames );
+	ASSERT_EQ( pageIds.size(), frames.size() );
+	for ( size_t i = 0; i < pageIds.size(); i++ )
+	{
+		ASSERT_EQ( pageIds[i], frames[i]->GetPageId() );
+		uint32_t page = static_cast<uint32_t>(BufferManager::SplitPageId( pageIds[i] ).second);
+		if ( page < 50 )
+		{
+			EXPECT_EQ( page, reinterpret_cast<uint32_t*>(frames[i]->GetData())[0] );
+		}
+		reinterpret_cast<uint32_t*>(frames[i]->GetData())[1] = page;
+	}
+	BufferManagerStats stats = bm->GetStats();
+	EXPECT_EQ( 50u, stats.hits - before.hits );
+	EXPECT_EQ( 30u, stats.misses - before.misses );
+	EXPECT_EQ( 80u, stats.fixedFrames );
+	bm->UnfixPages( frames, true );
+	EXPECT_EQ( 0u, bm->GetStats().fixedFrames );
+
+	// Duplicates are rejected without fixing anything
+	pageIds.push_back( pageIds.front() );
+	EXPECT_THROW( bm->FixPages( pageIds, false, frames ), std::runtime_error );
+	EXPECT_EQ( 0u, bm->GetStats().fixedFrames );
+	pageIds.pop_back();
+
+	bm->FixPages( pageIds, false, frames );
+	for ( size_t i = 0; i < pageIds.size(); i++ )
+	{
+		EXPECT_EQ( BufferManager::SplitPageId( pageIds[i] ).second, reinterpret_cast<uint32_t*>(frames[i]->GetData())[1] );
+	}
+	bm->UnfixPages( frames, false );
+	SDELETE( bm );
+}
+
+// A batch in a pool that is too small to keep its hits, the misses evict the frames of the hits of the same batch
+TEST( BufferTest, FixPagesSmallPool )
+{
+	BufferManager* bm = new BufferManager( 3 );
+	for ( uint32_t i = 0; i < 9; i++ )
+	{
+		BufferFrame& bf = bm->FixPage( BufferManager::MergePageId( DB_TEST_SEGMENT, i ), true );
+		reinterpret_cast<uint32_t*>(bf.GetData())[0] = i;
+		bm->UnfixPage( bf, true );
+	}
+	for ( bool exclusive : { true, false } )
+	{
+		for ( uint32_t hit = 0; hit < 9; hit++ )
+		{
+			// The hit is the oldest of the three pages in the buffer, then fix it together with two misses
+			for ( uint32_t i : { hit, (hit + 1) % 9, (hit + 2) % 9 } )
+			{
+				bm->UnfixPage( bm->FixPage( BufferManager::MergePageId( DB_TEST_SEGMENT, i ), false ), false );
+			}
+			std::vector<uint64_t> pageIds;
+			for ( uint32_t i : { hit, (hit + 5) % 9, (hit + 6) % 9 } )
+			{
+				pageIds.push_back( BufferManager::MergePageId( DB_TEST_SEGMENT, i ) );
+			}
+			std::vector<BufferFrame*> frames;
+			bm->FixPages( pageIds, exclusive, frames );
+			ASSERT_EQ( pageIds.size(), frames.size() );
+			for ( size_t i = 0; i < pageIds.size(); i++ )
+			{
+				ASSERT_EQ( pageIds[i], frames[i]->GetPageId() );
+				EXPECT_EQ( BufferManager::SplitPageId( pageIds[i] ).second, reinterpret_cast<uint32_t*>(frames[i]->GetData())[0] );
+			}
+			EXPECT_EQ( 3u, bm->GetStats().fixedFrames );
+			bm->UnfixPages( frames, false );
+		}
+	}
+	EXPECT_EQ( 0u, bm->GetStats().fixedFrames );
+	SDELETE( bm );
+}
+
+TEST( BufferTest, UpgradeDowngrade )
+{
+	BufferManager* bm = new BufferManager( 10 );
+	uint64_t pageId = BufferManager::MergePageId( DB_TEST_SEGMENT, 0 );
+	BufferFrame& bf = bm->FixPage( pageId, true );
+	reinterpret_cast<uint32_t*>(bf.GetData())[0] = 0;
+	bm->UnfixPage( bf, true );
+
+	// Only reader, upgrade works and the frame stays the same
+	BufferFrame& reader = bm->FixPage( pageId, false );
+	ASSERT_TRUE( bm->UpgradePage( reader ) );
+	reinterpret_cast<uint32_t*>(reader.GetData())[0] = 1;
+	// Downgrade lets other readers in, but no writer
+	bm->DowngradePage( reader, true );
+	BufferFrame& second = bm->FixPage( pageId, false );
+	EXPECT_EQ( &reader, &second );
+	EXPECT_EQ( 1u, reinterpret_cast<uint32_t*>(second.GetData())[0] );
+	// Two readers, upgrade fails and both still hold the page
+	EXPECT_FALSE( bm->UpgradePage( reader ) );
+	bm->UnfixPage( second, false );
+	ASSERT_TRUE( bm->UpgradePage( reader ) );
+	bm->UnfixPage( reader, false );
+	EXPECT_EQ( 0u, bm->GetStats().fixedFrames );
+	EXPECT_EQ( 1u, bm->GetStats().dirtyFrames );
+
+	// Read, upgrade if possible and increment, fall back to an exclusive fix otherwise. No increment may be lost.
+	const uint32_t threads = 4;
+	const uint32_t increments = 20000;
+	std::atomic<uint32_t> upgrades( 0 );
+	std::vector<std::thread> workers;
+	for ( uint32_t t = 0; t < threads; t++ )
+	{
+		workers.push_back( std::thread( [&]()
+		{
+			for ( uint32_t i = 0; i < increments; i++ )
+			{
+				BufferFrame* frame = &bm->FixPage( pageId, false );
+				uint32_t seen = reinterpret_cast<uint32_t*>(frame->GetData())[0];
+				if ( bm->UpgradePage( *frame ) )
+				{
+					// Nobody could write in between
+					EXPECT_EQ( seen, reinterpret_cast<uint32_t*>(frame->GetData())[0] );
+					++upgrades;
+				}
+				else
+				{
+					bm->UnfixPage( *frame, false );
+					frame = &bm->FixPage( pageId, true );
+				}
+				++reinterpret_cast<uint32_t*>(frame->GetData())[0];
+				bm->UnfixPage( *frame, true );
+			}
+		} ) );
+	}
+	for ( std::thread& worker : workers )
+	{
+		worker.join();
+	}
+	BufferFrame& result = bm->FixPage( pageId, false );
+	EXPECT_EQ( 1 + threads * increments, reinterpret_cast<uint32_t*>(result.GetData())[0] );
+	bm->UnfixPage( result, false );
+	std::cout << "[ INFO     ] Upgraded: " << upgrades.load() << "/" << threads * increments << std::endl;
+	EXPECT_LT( 0u, upgrades.load() );
+	SDELETE( bm );
+}
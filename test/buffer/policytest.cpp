@@ -0,0 +1,251 @@
+#include "buffer/BufferManager.h"
+#include "buffer/ReplacementPolicy.h"
+#include "utility/macros.h"
+#include "utility/defines.h"
+
+#include "gtest/gtest.h"
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <stdlib.h>
+
+class PolicyTest : public ::testing::TestWithParam<ReplacementPolicyType>
+{
+public:
+	virtual void TearDown() override
+	{
+		SDELETE( mgr );
+	}
+
+	BufferManager* mgr = nullptr;
+};
+
+/// <summary>
+/// Pseudo gaussian page, causes skewed access pattern (same as ext/assignment2/buffertest.cpp)
+/// </summary>
+static uint32_t RandomPage( uint32_t pagesOnDisk, unsigned* seed )
+{
+	uint32_t page = 0;
+	for ( uint32_t i = 0; i < 20; i++ )
+	{
+		page += rand_r( seed ) % pagesOnDisk;
+	}
+	return page / 20;
+}
+
+// Replays the skewed read/write pattern of the assignment 2 buffer test (including the scanning thread)
+// and reports hit ratio and throughput of the policy. Also checks that no write was lost.
+// The scanning thread does a fixed number of scans, so the hit ratio does not depend on the speed of the policy.
+TEST_P( PolicyTest, SkewedAccessBenchmark )
+{
+	const uint32_t pagesOnDisk = 2000;
+	const uint32_t pagesInMemory = 200;
+	const uint32_t threads = 2;
+	const uint32_t fixesPerThread = 25000;
+
+	mgr = new BufferManager( pagesInMemory, DB_PAGE_TABLE_PARTITIONS, GetParam() );
+	for ( uint32_t i = 0; i < pagesOnDisk; i++ )
+	{
+		BufferFrame& bf = mgr->FixPage( BufferManager::MergePageId( DB_TEST_SEGMENT, i ), true );
+		reinterpret_cast<uint32_t*>(bf.GetData())[0] = 0;
+		mgr->UnfixPage( bf, true );
+	}
+	uint64_t missesBefore = mgr->GetPageMisses();
+
+	const uint32_t scanFixes = fixesPerThread;
+	std::thread scanThread( [&]()
+	{
+		unsigned seed = 4711;
+		for ( uint32_t i = 0; i < scanFixes; i += 10 )
+		{
+			uint32_t start = rand_r( &seed ) % (pagesOnDisk - 10);
+			for ( uint32_t page = start; page < start + 10; page++ )
+			{
+				BufferFrame& bf = mgr->FixPage( BufferManager::MergePageId( DB_TEST_SEGMENT, page ), false );
+				mgr->UnfixPage( bf, false );
+			}
+		}
+	} );
+
+	std::vector<uint32_t> writes( threads, 0 );
+	std::vector<std::thread> workers;
+	auto start = std::chrono::high_resolution_clock::now();
+	for ( uint32_t t = 0; t < threads; t++ )
+	{
+		workers.push_back( std::thread( [&, t]()
+		{
+			unsigned seed = t * 97134;
+			for ( uint32_t i = 0; i < fixesPerThread; i++ )
+			{
+				bool isWrite = rand_r( &seed ) % 128 < 10;
+				BufferFrame& bf = mgr->FixPage( BufferManager::MergePageId( DB_TEST_SEGMENT, RandomPage( pagesOnDisk, &seed ) ), isWrite );
+				if ( isWrite )
+				{
+					++writes[t];
+					++reinterpret_cast<uint32_t*>(bf.GetData())[0];
+				}
+				mgr->UnfixPage( bf, isWrite );
+			}
+		} ) );
+	}
+	for ( std::thread& t : workers )
+	{
+		t.join();
+	}
+	std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+	scanThread.join();
+
+	uint64_t fixes = threads * fixesPerThread + scanFixes;
+	uint64_t misses = mgr->GetPageMisses() - missesBefore;
+	double hitRatio = 1.0 - static_cast<double>(misses) / fixes;
+	std::cout << "[ PERF     ] Policy: " << ReplacementPolicy::GetName( GetParam() )
+		<< " Hit ratio: " << hitRatio
+		<< " Fixes/s: " << static_cast<uint64_t>(threads * fixesPerThread / elapsed.count()) << std::endl;
+	EXPECT_LT( 0.0, hitRatio );
+
+	// Check that every write made it to disk
+	SDELETE( mgr );
+	mgr = new BufferManager( pagesInMemory, DB_PAGE_TABLE_PARTITIONS, GetParam() );
+	uint32_t totalWrites = 0;
+	uint32_t totalOnDisk = 0;
+	for ( uint32_t w : writes )
+	{
+		totalWrites += w;
+	}
+	for ( uint32_t i = 0; i < pagesOnDisk; i++ )
+	{
+		BufferFrame& bf = mgr->FixPage( BufferManager::MergePageId( DB_TEST_SEGMENT, i ), false );
+		totalOnDisk += reinterpret_cast<uint32_t*>(bf.GetData())[0];
+		mgr->UnfixPage( bf, false );
+	}
+	EXPECT_EQ( totalWrites, totalOnDisk );
+}
+
+// A small hot set is used over and over, then a scan bigger than the buffer runs once.
+// Reports how many of the hot pages survived the scan.
+TEST_P( PolicyTest, HotPagesSurviveScan )
+{
+	const uint32_t pagesInMemory = 100;
+	const uint32_t hotPages = 20;
+	const uint32_t scanPages = 4 * pagesInMemory;
+	mgr = new BufferManager( pagesInMemory, DB_PAGE_TABLE_PARTITIONS, GetParam() );
+
+	// Use the hot pages a few times, with other pages in between so they are loaded twice under 2Q
+	for ( uint32_t round = 0; round < 4; round++ )
+	{
+		for ( uint32_t i = 0; i < hotPages; i++ )
+		{
+			BufferFrame& bf = mgr->FixPage( BufferManager::MergePageId( DB_TEST_SEGMENT, i ), false );
+			mgr->UnfixPage( bf, false );
+		}
+		for ( uint32_t i = 0; i < pagesInMemory; i++ )
+		{
+			BufferFrame& bf = mgr->FixPage( BufferManager::MergePageId( DB_TEST_SEGMENT, 1000 + round * pagesInMemory + i ), false );
+			mgr->UnfixPage( bf, false );
+		}
+	}
+	for ( uint32_t i = 0; i < hotPages; i++ )
+	{
+		BufferFrame& bf = mgr->FixPage( BufferManager::MergePageId( DB_TEST_SEGMENT, i ), false );
+		mgr->UnfixPage( bf, false );
+	}
+
+	// Scan
+	for ( uint32_t i = 0; i < scanPages; i++ )
+	{
+		BufferFrame& bf = mgr->FixPage( BufferManager::MergePageId( DB_TEST_SEGMENT, 2000 + i ), false );
+		mgr->UnfixPage( bf, false );
+	}
+
+	// Hot pages again
+	uint64_t missesBefore = mgr->GetPageMisses();
+	for ( uint32_t i = 0; i < hotPages; i++ )
+	{
+		BufferFrame& bf = mgr->FixPage( BufferManager::MergePageId( DB_TEST_SEGMENT, i ), false );
+		mgr->UnfixPage( bf, false );
+	}
+	uint64_t hotMisses = mgr->GetPageMisses() - missesBefore;
+	std::cout << "[ PERF     ] Policy: " << ReplacementPolicy::GetName( GetParam() )
+		<< " Hot pages lost to scan: " << hotMisses << "/" << hotPages << std::endl;
+	if ( GetParam() != ReplacementPolicyType::Clock )
+	{
+		EXPECT_EQ( 0u, hotMisses );
+	}
+}
+
+// Grows and shrinks the pool while worker threads fix pages. Checks that no write was lost
+// and that the pool ends up with the requested size.
+TEST_P( PolicyTest, ResizeUnderLoad )
+{
+	const uint32_t pagesOnDisk = 1000;
+	const uint32_t threads = 2;
+	BufferManagerConfig config;
+	config.pageCount = 100;
+	config.maxPageCount = 400;
+	config.policy = GetParam();
+	mgr = new BufferManager( config );
+	for ( uint32_t i = 0; i < pagesOnDisk; i++ )
+	{
+		BufferFrame& bf = mgr->FixPage( BufferManager::MergePageId( DB_TEST_SEGMENT, i ), true );
+		reinterpret_cast<uint32_t*>(bf.GetData())[0] = 0;
+		mgr->UnfixPage( bf, true );
+	}
+
+	std::atomic<bool> stop( false );
+	std::vector<uint32_t> writes( threads, 0 );
+	std::vector<std::thread> workers;
+	for ( uint32_t t = 0; t < threads; t++ )
+	{
+		workers.push_back( std::thread( [&, t]()
+		{
+			unsigned seed = t;
+			while ( !stop )
+			{
+				bool isWrite = rand_r( &seed ) % 2 == 0;
+				BufferFrame& bf = mgr->FixPage( BufferManager::MergePageId( DB_TEST_SEGMENT, RandomPage( pagesOnDisk, &seed ) ), isWrite );
+				if ( isWrite )
+				{
+					++reinterpret_cast<uint32_t*>(bf.GetData())[0];
+					++writes[t];
+				}
+				mgr->UnfixPage( bf, isWrite );
+			}
+		} ) );
+	}
+	const uint32_t sizes[] = { 400, 50, 250, 20, 400, 100 };
+	for ( uint32_t size : sizes )
+	{
+		std::this_thread::sleep_for( std::chrono::milliseconds( 20 ) );
+		EXPECT_EQ( size, mgr->Resize( size ) );
+	}
+	stop = true;
+	for ( std::thread& worker : workers )
+	{
+		worker.join();
+	}
+	EXPECT_EQ( 100u, mgr->GetStats().pageCount );
+
+	uint32_t totalWrites = 0;
+	uint32_t totalOnDisk = 0;
+	for ( uint32_t w : writes )
+	{
+		totalWrites += w;
+	}
+	SDELETE( mgr );
+	mgr = new BufferManager( 100, DB_PAGE_TABLE_PARTITIONS, GetParam() );
+	for ( uint32_t i = 0; i < pagesOnDisk; i++ )
+	{
+		BufferFrame& bf = mgr->FixPage( BufferManager::MergePageId( DB_TEST_SEGMENT, i ), false );
+		totalOnDisk += reinterpret_cast<uint32_t*>(bf.GetData())[0];
+		mgr->UnfixPage( bf, false );
+	}
+	EXPECT_EQ( totalWrites, totalOnDisk );
+}
+
+INSTANTIATE_TEST_CASE_P( ReplacementPolicies, PolicyTest, ::testing::Values(
+	ReplacementPolicyType::Clock,
+	ReplacementPolicyType::TwoQueue,
+	ReplacementPolicyType::LRUK ) );
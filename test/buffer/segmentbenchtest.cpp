@@ -0,0 +1,81 @@
+#include "DBCore.h"
+#include "buffer/SPSegment.h"
+#include "utility/macros.h"
+#include "utility/helpers.h"
+
+#include "gtest/gtest.h"
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Inserts from several threads into one slotted pages segment
+class SegmentBenchTest : public ::testing::TestWithParam<uint32_t>
+{
+public:
+	virtual void SetUp() override
+	{
+		core = new DBCore();
+		core->WipeDatabase();
+		std::string sql = "create table dbtest ( strentry char(5000), primary key (strentry));";
+		core->AddRelationsFromString( sql );
+		segment = core->GetSPSegment( "dbtest" );
+	}
+	virtual void TearDown() override
+	{
+		segment.reset();
+		SDELETE( core );
+	}
+	DBCore* core;
+	std::unique_ptr<SPSegment> segment;
+};
+
+// Every thread inserts into its own target page, reports the insert throughput for the number of threads.
+// Checks that all records are there and that no page was shared between threads.
+TEST_P( SegmentBenchTest, ParallelInsertBenchmark )
+{
+	const uint32_t threads = GetParam();
+	const uint32_t insertsPerThread = 20000;
+	std::vector<std::vector<TID>> tids( threads );
+	std::vector<std::thread> workers;
+	auto start = std::chrono::high_resolution_clock::now();
+	for ( uint32_t t = 0; t < threads; ++t )
+	{
+		workers.push_back( std::thread( [&, t]()
+		{
+			std::string s = "Record of thread " + std::to_string( t ) + " with some padding to fill the page";
+			Record record( static_cast<uint32_t>(s.size()), reinterpret_cast<const uint8_t*>(s.c_str()) );
+			tids[t].reserve( insertsPerThread );
+			for ( uint32_t i = 0; i < insertsPerThread; ++i )
+			{
+				tids[t].push_back( segment->Insert( record ) );
+			}
+		} ) );
+	}
+	for ( std::thread& worker : workers )
+	{
+		worker.join();
+	}
+	std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+	std::cout << "[ PERF     ] Threads: " << threads
+		<< " Inserts/s: " << static_cast<uint64_t>(threads * insertsPerThread / elapsed.count()) << std::endl;
+
+	std::unordered_map<uint64_t, uint32_t> pageOwners;
+	for ( uint32_t t = 0; t < threads; ++t )
+	{
+		std::string s = "Record of thread " + std::to_string( t ) + " with some padding to fill the page";
+		for ( TID tid : tids[t] )
+		{
+			auto owner = pageOwners.insert( std::make_pair( SplitTID( tid ).first, t ) );
+			EXPECT_EQ( t, owner.first->second );
+		}
+		Record r = segment->Lookup( tids[t].back() );
+		ASSERT_EQ( s.size(), r.GetLen() );
+		EXPECT_EQ( 0, memcmp( r.GetData(), s.c_str(), r.GetLen() ) );
+	}
+}
+
+INSTANTIATE_TEST_CASE_P( Threads, SegmentBenchTest, ::testing::Values( 1u, 2u, 4u, 8u ) );
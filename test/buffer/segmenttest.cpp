@@ -1,12 +1,19 @@
 #include "DBCore.h"
 #include "buffer/SPSegment.h"
+#include "buffer/BufferManager.h"
+#include "buffer/SlottedPage.h"
+#include "query/TableScanOperator.h"
+#include "query/Register.h"
 #include "utility/macros.h"
 #include "utility/helpers.h"
 
 #include "gtest/gtest.h"
 
+#include <atomic>
+#include <thread>
 #include <vector>
 #include <unordered_map>
+#include <sys/stat.h>
 
 
 const std::vector<std::string> testData = {
@@ -166,6 +173,45 @@ TEST_F( SegmentTest, Update )
 	}
 };
 
+TEST_F( SegmentTest, LookupBatch )
+{
+	std::vector<TID> tids;
+	std::vector<uint32_t> entries;
+	for ( uint32_t i = 0; i < 500; ++i )
+	{
+		uint32_t r = rand() % testData.size();
+		const std::string& s = testData[r];
+		tids.push_back( segment->Insert( Record( static_cast<uint32_t>(s.size()),
+												 reinterpret_cast<const uint8_t*>(s.c_str()) ) ) );
+		entries.push_back( r );
+	}
+	// Grow some records, so they move to other pages
+	const std::string& longest = testData.back();
+	for ( uint32_t i = 0; i < tids.size(); i += 7 )
+	{
+		EXPECT_TRUE( segment->Update( tids[i], Record( static_cast<uint32_t>(longest.size()),
+													  reinterpret_cast<const uint8_t*>(longest.c_str()) ) ) );
+		entries[i] = static_cast<uint32_t>(testData.size() - 1);
+	}
+	// Reverse order and a repeated tid, records have to come back in request order
+	std::vector<TID> request( tids.rbegin(), tids.rend() );
+	request.push_back( tids[0] );
+	std::vector<Record> records = segment->Lookup( request );
+	ASSERT_EQ( request.size(), records.size() );
+	for ( size_t i = 0; i < request.size(); ++i )
+	{
+		size_t index = i < tids.size() ? tids.size() - 1 - i : 0;
+		const std::string& value = testData[entries[index]];
+		EXPECT_EQ( value.size(), records[i].GetLen() );
+		EXPECT_EQ( 0, memcmp( records[i].GetData(), value.c_str(), value.size() ) );
+	}
+	// Removed records are empty, like with single lookups
+	EXPECT_TRUE( segment->Remove( tids[1] ) );
+	std::vector<Record> removed = segment->Lookup( std::vector<TID>( { tids[1], tids[2] } ) );
+	EXPECT_EQ( 0u, removed[0].GetLen() );
+	EXPECT_EQ( testData[entries[2]].size(), removed[1].GetLen() );
+}
+
 TEST_F( SegmentTest, RandomOperations )
 {
 	// Random interspersed operations
@@ -245,4 +291,735 @@ TEST_F( SegmentTest, RandomOperations )
 		EXPECT_EQ( len, rec.GetLen() );
 		EXPECT_EQ( 0, memcmp( rec.GetData(), value.c_str(), len ) );
 	}
-};
\ No newline at end of file
+};
+
+// Buffer statistics are reachable through the core
+TEST_F( SegmentTest, BufferStatsFromCore )
+{
+	const std::string& s = testData[0];
+	segment->Insert( Record( static_cast<uint32_t>(s.size()), reinterpret_cast<const uint8_t*>(s.c_str()) ) );
+	BufferManagerStats stats = core->GetBufferStats();
+	EXPECT_EQ( core->GetBufferManager()->GetPageCount(), stats.pageCount );
+	EXPECT_LT( 0u, stats.hits + stats.misses );
+	EXPECT_LT( 0u, stats.dirtyFrames );
+}
+
+// Inserts find pages with space through the free space inventory, which survives a restart
+TEST_F( SegmentTest, FreeSpaceInventory )
+{
+	const std::string s( 5000, 'x' ); // Three records per page
+	Record record( static_cast<uint32_t>(s.size()), reinterpret_cast<const uint8_t*>(s.c_str()) );
+	uint64_t segmentId = core->GetSegmentIdOfRelation( "dbtest" );
+	std::vector<TID> tids;
+	for ( uint32_t i = 0; i < 300; ++i )
+	{
+		tids.push_back( segment->Insert( record ) );
+	}
+	EXPECT_EQ( 100u, core->GetPagesOfRelation( segmentId ) );
+
+	// A few fixes per insert, no matter how many pages are full. Taking a new target costs a few, 
+	// inserting into the target only fixes the page.
+	BufferManagerStats before = core->GetBufferStats();
+	tids.push_back( segment->Insert( record ) );
+	BufferManagerStats after = core->GetBufferStats();
+	EXPECT_GE( 9u, (after.hits + after.misses) - (before.hits + before.misses) );
+	EXPECT_EQ( 100u, SplitTID( tids.back() ).first );
+	before = core->GetBufferStats();
+	tids.push_back( segment->Insert( record ) );
+	after = core->GetBufferStats();
+	EXPECT_EQ( 1u, (after.hits + after.misses) - (before.hits + before.misses) );
+	EXPECT_EQ( 100u, SplitTID( tids.back() ).first );
+
+	// Freed space at the start of the data is reused, the relation does not grow.
+	// The target page of this thread still has space, a new segment takes its first target from the inventory.
+	segment = core->GetSPSegment( "dbtest" );
+	for ( uint64_t pageId : { 3u, 42u } )
+	{
+		EXPECT_TRUE( segment->Remove( tids[pageId * 3 + 2] ) ); // Last record on the page
+		TID tid = segment->Insert( record );
+		EXPECT_EQ( pageId, SplitTID( tid ).first );
+		EXPECT_EQ( 101u, core->GetPagesOfRelation( segmentId ) );
+		if ( pageId == 3u )
+		{
+			// Reopen the database, the inventory is persistent
+			EXPECT_TRUE( segment->Remove( tid ) );
+			segment.reset();
+			SDELETE( core );
+			core = new DBCore();
+			segment = core->GetSPSegment( "dbtest" );
+			EXPECT_EQ( 3u, SplitTID( segment->Insert( record ) ).first );
+		}
+	}
+}
+
+// Fragmented space is compacted when an insert or a growing update needs it, tids stay the same
+TEST_F( SegmentTest, Compaction )
+{
+	uint64_t segmentId = core->GetSegmentIdOfRelation( "dbtest" );
+	std::vector<std::string> values = { std::string( 5000, 'a' ), std::string( 5000, 'b' ), std::string( 5000, 'c' ) };
+	std::vector<TID> tids;
+	for ( const std::string& value : values )
+	{
+		tids.push_back( segment->Insert( Record( static_cast<uint32_t>(value.size()), reinterpret_cast<const uint8_t*>(value.c_str()) ) ) );
+	}
+	auto checkValues = [&]()
+	{
+		for ( size_t i = 0; i < tids.size(); ++i )
+		{
+			Record rec = segment->Lookup( tids[i] );
+			ASSERT_EQ( values[i].size(), rec.GetLen() );
+			EXPECT_EQ( 0, memcmp( rec.GetData(), values[i].c_str(), rec.GetLen() ) );
+		}
+	};
+
+	// Shrink the first record, the second grows into the freed space on the same page
+	values[0] = std::string( 1000, 'd' );
+	EXPECT_TRUE( segment->Update( tids[0], Record( 1000, reinterpret_cast<const uint8_t*>(values[0].c_str()) ) ) );
+	values[1] = std::string( 6000, 'e' );
+	EXPECT_TRUE( segment->Update( tids[1], Record( 6000, reinterpret_cast<const uint8_t*>(values[1].c_str()) ) ) );
+	checkValues();
+	EXPECT_EQ( 1u, core->GetPagesOfRelation( segmentId ) );
+
+	// Removing a record in the middle of the data leaves a hole, the next insert compacts the page
+	EXPECT_TRUE( segment->Remove( tids[1] ) );
+	values[1] = std::string( 5500, 'f' );
+	tids[1] = segment->Insert( Record( 5500, reinterpret_cast<const uint8_t*>(values[1].c_str()) ) );
+	EXPECT_EQ( 0u, SplitTID( tids[1] ).first );
+	checkValues();
+	EXPECT_EQ( 1u, core->GetPagesOfRelation( segmentId ) );
+
+	// Many updates with changing sizes do not make the relation grow
+	for ( uint32_t i = 0; i < 300; ++i )
+	{
+		size_t index = rand() % tids.size();
+		values[index] = std::string( 1000 + rand() % 4000, static_cast<char>('g' + i % 10) );
+		EXPECT_TRUE( segment->Update( tids[index], Record( static_cast<uint32_t>(values[index].size()),
+														   reinterpret_cast<const uint8_t*>(values[index].c_str()) ) ) );
+	}
+	checkValues();
+	EXPECT_GE( 2u, core->GetPagesOfRelation( segmentId ) );
+}
+
+// Batch inserts fill new pages one after another and return the tids in order
+TEST_F( SegmentTest, InsertBatch )
+{
+	uint64_t segmentId = core->GetSegmentIdOfRelation( "dbtest" );
+	EXPECT_TRUE( segment->InsertBatch( std::vector<Record>() ).empty() );
+	std::vector<Record> records;
+	std::vector<uint32_t> values;
+	uint64_t bytes = 0;
+	for ( uint32_t i = 0; i < 2000; ++i )
+	{
+		uint32_t r = rand() % testData.size();
+		records.push_back( Record( static_cast<uint32_t>(testData[r].size()), reinterpret_cast<const uint8_t*>(testData[r].c_str()) ) );
+		values.push_back( r );
+		bytes += testData[r].size() + 8;
+	}
+	BufferManagerStats before = core->GetBufferStats();
+	std::vector<TID> tids = segment->InsertBatch( records );
+	BufferManagerStats after = core->GetBufferStats();
+	ASSERT_EQ( records.size(), tids.size() );
+	uint64_t pages = core->GetPagesOfRelation( segmentId );
+	EXPECT_GE( pages, bytes / (DB_PAGE_SIZE - 16) );
+	// One fix per page and the inventory, instead of several per record
+	EXPECT_GT( pages * 4, (after.hits + after.misses) - (before.hits + before.misses) );
+	for ( size_t i = 0; i < tids.size(); ++i )
+	{
+		Record rec = segment->Lookup( tids[i] );
+		ASSERT_EQ( testData[values[i]].size(), rec.GetLen() );
+		EXPECT_EQ( 0, memcmp( rec.GetData(), testData[values[i]].c_str(), rec.GetLen() ) );
+		if ( i > 0 )
+		{
+			EXPECT_LT( tids[i - 1], tids[i] ); // Pages are filled in order
+		}
+	}
+	// Single inserts use the space the batch left, the relation does not grow
+	const std::string& s = testData[0];
+	TID tid = segment->Insert( Record( static_cast<uint32_t>(s.size()), reinterpret_cast<const uint8_t*>(s.c_str()) ) );
+	EXPECT_GT( pages, SplitTID( tid ).first );
+	EXPECT_EQ( pages, core->GetPagesOfRelation( segmentId ) );
+}
+
+// Views point into the frame, follow moved records and unfix their page when destroyed
+TEST_F( SegmentTest, LookupView )
+{
+	uint32_t fixedFrames = core->GetBufferStats().fixedFrames; // The core keeps its schema pages fixed
+	std::vector<std::string> values = { std::string( 5000, 'a' ), std::string( 5000, 'b' ), std::string( 5000, 'c' ) };
+	std::vector<TID> tids;
+	for ( const std::string& value : values )
+	{
+		tids.push_back( segment->Insert( Record( static_cast<uint32_t>(value.size()), reinterpret_cast<const uint8_t*>(value.c_str()) ) ) );
+	}
+	{
+		RecordView first = segment->LookupView( tids[0] );
+		RecordView again = segment->LookupView( tids[0] );
+		ASSERT_TRUE( first.IsValid() );
+		EXPECT_EQ( values[0].size(), first.GetLen() );
+		EXPECT_EQ( 0, memcmp( first.GetData(), values[0].c_str(), first.GetLen() ) );
+		EXPECT_EQ( first.GetData(), again.GetData() ); // No copies
+
+		RecordView moved( std::move( first ) );
+		EXPECT_FALSE( first.IsValid() );
+		EXPECT_TRUE( moved.IsValid() );
+		moved = segment->LookupView( tids[1] );
+		EXPECT_EQ( 0, memcmp( moved.GetData(), values[1].c_str(), moved.GetLen() ) );
+	}
+	// No view holds the page anymore, so it can be changed. The first record does not fit anymore and moves.
+	values[0] = std::string( 8000, 'd' );
+	EXPECT_TRUE( segment->Update( tids[0], Record( 8000, reinterpret_cast<const uint8_t*>(values[0].c_str()) ) ) );
+	for ( size_t i = 0; i < tids.size(); ++i )
+	{
+		RecordView view = segment->LookupView( tids[i] );
+		ASSERT_EQ( values[i].size(), view.GetLen() );
+		EXPECT_EQ( 0, memcmp( view.GetData(), values[i].c_str(), view.GetLen() ) );
+	}
+	EXPECT_TRUE( segment->Remove( tids[2] ) );
+	EXPECT_FALSE( segment->LookupView( tids[2] ).IsValid() );
+	EXPECT_EQ( fixedFrames, core->GetBufferStats().fixedFrames );
+}
+
+// Records bigger than a page are stored on overflow pages and work with every operation
+TEST_F( SegmentTest, OverflowRecords )
+{
+	uint32_t fixedFrames = core->GetBufferStats().fixedFrames;
+	uint64_t segmentId = core->GetSegmentIdOfRelation( "dbtest" );
+	// Values in the format of the table scan, 4 byte length and the string. The pattern does not repeat with the page size.
+	auto makeValue = []( uint32_t length, uint32_t seed )
+	{
+		std::string value( 4 + length, '\0' );
+		memcpy( &value[0], &length, 4 );
+		for ( uint32_t i = 0; i < length; ++i )
+		{
+			value[4 + i] = static_cast<char>('a' + (i + seed) % 26);
+		}
+		return value;
+	};
+	auto makeRecord = []( const std::string& value )
+	{
+		return Record( static_cast<uint32_t>(value.size()), reinterpret_cast<const uint8_t*>(value.c_str()) );
+	};
+	auto check = [&]( const std::vector<std::string>& values, const std::vector<TID>& tids )
+	{
+		std::vector<Record> records = segment->Lookup( tids );
+		for ( size_t i = 0; i < tids.size(); ++i )
+		{
+			Record r = segment->Lookup( tids[i] );
+			ASSERT_EQ( values[i].size(), r.GetLen() );
+			EXPECT_EQ( 0, memcmp( r.GetData(), values[i].c_str(), r.GetLen() ) );
+			ASSERT_EQ( values[i].size(), records[i].GetLen() );
+			EXPECT_EQ( 0, memcmp( records[i].GetData(), values[i].c_str(), records[i].GetLen() ) );
+			RecordView view = segment->LookupView( tids[i] );
+			ASSERT_EQ( values[i].size(), view.GetLen() );
+			EXPECT_EQ( 0, memcmp( view.GetData(), values[i].c_str(), view.GetLen() ) );
+		}
+	};
+
+	std::vector<std::string> values = { makeValue( 100, 0 ), makeValue( 3 * DB_PAGE_SIZE, 1 ), makeValue( 100 * DB_PAGE_SIZE, 2 ) };
+	std::vector<TID> tids;
+	for ( const std::string& value : values )
+	{
+		tids.push_back( segment->Insert( makeRecord( value ) ) );
+	}
+	EXPECT_LE( 100u + 3u, core->GetPagesOfRelation( segmentId ) );
+	check( values, tids );
+
+	// Updates from inline to overflow records and back, and between overflow records of different sizes
+	values[0] = makeValue( 2 * DB_PAGE_SIZE, 3 );
+	values[1] = makeValue( 50, 4 );
+	values[2] = makeValue( 10 * DB_PAGE_SIZE, 5 );
+	for ( size_t i = 0; i < tids.size(); ++i )
+	{
+		EXPECT_TRUE( segment->Update( tids[i], makeRecord( values[i] ) ) );
+	}
+	check( values, tids );
+
+	// Batch inserts with overflow records in between
+	std::vector<Record> batch;
+	batch.push_back( makeRecord( values[1] ) );
+	batch.push_back( makeRecord( values[0] ) );
+	batch.push_back( makeRecord( values[1] ) );
+	std::vector<TID> batchTids = segment->InsertBatch( batch );
+	check( { values[1], values[0], values[1] }, batchTids );
+
+	// The table scan skips overflow pages and reads the records from them
+	std::unordered_map<std::string, uint32_t> expected;
+	for ( const std::string& value : { values[0], values[1], values[2], values[1], values[0], values[1] } )
+	{
+		++expected[value.substr( 4 )];
+	}
+	TableScanOperator op( "dbtest", *core, *core->GetBufferManager() );
+	op.Open();
+	std::vector<Register*> registers = op.GetOutput();
+	while ( op.Next() )
+	{
+		auto it = expected.find( registers[0]->GetString() );
+		ASSERT_NE( expected.end(), it );
+		ASSERT_LT( 0u, it->second );
+		--it->second;
+	}
+	op.Close();
+	for ( const std::pair<const std::string, uint32_t>& entry : expected )
+	{
+		EXPECT_EQ( 0u, entry.second );
+	}
+
+	// Removed overflow records give their pages back, new records use them
+	uint64_t pages = core->GetPagesOfRelation( segmentId );
+	EXPECT_TRUE( segment->Remove( tids[2] ) );
+	EXPECT_FALSE( segment->LookupView( tids[2] ).IsValid() );
+	const std::string& s = testData[4];
+	for ( uint32_t i = 0; i < 20; ++i )
+	{
+		segment->Insert( Record( static_cast<uint32_t>(s.size()), reinterpret_cast<const uint8_t*>(s.c_str()) ) );
+	}
+	EXPECT_EQ( pages, core->GetPagesOfRelation( segmentId ) );
+	EXPECT_EQ( fixedFrames, core->GetBufferStats().fixedFrames );
+}
+
+// Pages of the old format are read and upgraded, the slot bitmaps agree with the slot directory afterwards
+TEST_F( SegmentTest, SlotBitmaps )
+{
+	uint64_t segmentId = core->GetSegmentIdOfRelation( "dbtest" );
+	BufferManager& bm = *core->GetBufferManager();
+	std::vector<std::string> values = { std::string( "\x05\0\0\0first", 9 ), std::string( "\x06\0\0\0second", 10 ) };
+
+	// Write a page of the old format by hand: record, free slot, record
+	uint64_t pageId = BufferManager::SplitPageId( core->AddPagesToRelation( segmentId, 1 ) ).second;
+	BufferFrame& frame = bm.FixPage( BufferManager::MergePageId( segmentId, pageId ), true );
+	uint8_t* data = reinterpret_cast<uint8_t*>(frame.GetData());
+	uint32_t dataStart = DB_PAGE_SIZE;
+	for ( size_t i = 0; i < values.size(); ++i )
+	{
+		uint32_t length = static_cast<uint32_t>(values[i].size());
+		dataStart -= length;
+		memcpy( &data[dataStart], values[i].c_str(), length );
+		uint8_t* slot = &data[16 + i * 2 * 8];
+		slot[0] = 0;
+		slot[1] = 0xFF;
+		memcpy( &slot[2], &dataStart, 3 );
+		memcpy( &slot[5], &length, 3 );
+	}
+	reinterpret_cast<uint16_t*>(data)[0] = 256; // Version 1 slotted page
+	reinterpret_cast<uint16_t*>(data)[1] = 3; // slot count
+	reinterpret_cast<uint16_t*>(data)[2] = 1; // first free slot
+	reinterpret_cast<uint32_t*>(data)[2] = dataStart;
+	reinterpret_cast<uint32_t*>(data)[3] = dataStart - 16 - 3 * 8;
+	SlottedPage* page = reinterpret_cast<SlottedPage*>(frame.GetData());
+	EXPECT_EQ( 1, page->GetVersion() );
+	EXPECT_EQ( 2, page->GetRecordCount() );
+	EXPECT_EQ( 2u, page->GetNextRecordSlot( 1 ) );
+	bm.UnfixPage( frame, true );
+
+	// Old pages can be read, the first change upgrades them
+	std::vector<TID> tids = { MergeTID( pageId, 0 ), MergeTID( pageId, 2 ) };
+	for ( size_t i = 0; i < tids.size(); ++i )
+	{
+		Record r = segment->Lookup( tids[i] );
+		ASSERT_EQ( values[i].size(), r.GetLen() );
+		EXPECT_EQ( 0, memcmp( r.GetData(), values[i].c_str(), r.GetLen() ) );
+	}
+	EXPECT_TRUE( segment->Remove( tids[1] ) );
+	BufferFrame& upgraded = bm.FixPage( BufferManager::MergePageId( segmentId, pageId ), false );
+	page = reinterpret_cast<SlottedPage*>(upgraded.GetData());
+	EXPECT_EQ( DB_SLOTTED_PAGE_VERSION, page->GetVersion() );
+	EXPECT_EQ( 1, page->GetRecordCount() );
+	EXPECT_EQ( 0u, page->GetNextRecordSlot( 0 ) );
+	EXPECT_EQ( page->GetSlotCount(), page->GetNextRecordSlot( 1 ) );
+	EXPECT_EQ( 1, page->GetFirstFreeSlotId() );
+	bm.UnfixPage( upgraded, false );
+	Record r = segment->Lookup( tids[0] );
+	ASSERT_EQ( values[0].size(), r.GetLen() );
+	EXPECT_EQ( 0, memcmp( r.GetData(), values[0].c_str(), r.GetLen() ) );
+
+	// Bitmaps over several words agree with the slots after removes and updates that forward records
+	std::vector<TID> small;
+	for ( uint32_t i = 0; i < 300; ++i )
+	{
+		small.push_back( segment->Insert( Record( static_cast<uint32_t>(values[1].size()),
+												  reinterpret_cast<const uint8_t*>(values[1].c_str()) ) ) );
+	}
+	for ( uint32_t i = 0; i < small.size(); i += 3 )
+	{
+		EXPECT_TRUE( segment->Remove( small[i] ) );
+	}
+	const std::string& big = testData[4];
+	for ( uint32_t i = 1; i < small.size(); i += 7 )
+	{
+		EXPECT_EQ( i % 3 != 0, segment->Update( small[i], Record( static_cast<uint32_t>(big.size()),
+																  reinterpret_cast<const uint8_t*>(big.c_str()) ) ) );
+	}
+	for ( uint64_t p = 0; p < core->GetPagesOfRelation( segmentId ); ++p )
+	{
+		BufferFrame& f = bm.FixPage( BufferManager::MergePageId( segmentId, p ), false );
+		SlottedPage* sp = reinterpret_cast<SlottedPage*>(f.GetData());
+		uint16_t records = 0;
+		uint64_t next = sp->GetNextRecordSlot( 0 );
+		for ( uint16_t slotId = 0; slotId < sp->GetSlotCount(); ++slotId )
+		{
+			SlottedPage::Slot* slot = sp->GetSlot( slotId );
+			if ( !slot->IsFree() && !slot->IsOtherRecordTID() )
+			{
+				EXPECT_EQ( slotId, next );
+				next = sp->GetNextRecordSlot( slotId + 1 );
+				++records;
+			}
+			else if ( slot->IsFree() && slotId < sp->GetFirstFreeSlotId() )
+			{
+				ADD_FAILURE() << "Free slot " << slotId << " before the first free slot";
+			}
+		}
+		EXPECT_EQ( sp->GetSlotCount(), next );
+		EXPECT_EQ( records, sp->GetRecordCount() );
+		bm.UnfixPage( f, false );
+	}
+
+	// All pages, including the hand written one, can be written back. Shrinking the pool writes back every page
+	// and stops at the first one that can not be written.
+	uint32_t poolPages = core->GetBufferStats().pageCount;
+	EXPECT_EQ( 1u, core->ResizeBuffer( 1 ) );
+	core->ResizeBuffer( poolPages );
+	Record reread = segment->Lookup( tids[0] );
+	ASSERT_EQ( values[0].size(), reread.GetLen() );
+	EXPECT_EQ( 0, memcmp( reread.GetData(), values[0].c_str(), reread.GetLen() ) );
+}
+
+// Vacuums a segment with forwarded records, free slots and an empty tail while a reader looks records up.
+// Records are moved home, the tail pages are released and the segment file is truncated.
+TEST_F( SegmentTest, Vacuum )
+{
+	uint32_t fixedFrames = core->GetBufferStats().fixedFrames;
+	uint64_t segmentId = core->GetSegmentIdOfRelation( "dbtest" );
+	BufferManager& bm = *core->GetBufferManager();
+	auto makeRecord = []( const std::string& s )
+	{
+		return Record( static_cast<uint32_t>(s.size()), reinterpret_cast<const uint8_t*>(s.c_str()) );
+	};
+	auto makeValue = []( const std::string& s ) // Length prefixed, so the table scan can read it
+	{
+		uint32_t length = static_cast<uint32_t>(s.size());
+		return std::string( reinterpret_cast<const char*>(&length), 4 ) + s;
+	};
+	const std::string small = makeValue( testData[1] );
+	const std::string grown = makeValue( std::string( 1000, 'g' ) );
+	const std::string big = makeValue( testData[4] );
+
+	// Fill the first pages with small records, grow some of them so they get forwarded to other pages
+	std::vector<TID> tids;
+	std::vector<std::string> values;
+	for ( uint32_t i = 0; i < 300; ++i )
+	{
+		tids.push_back( segment->Insert( makeRecord( small ) ) );
+		values.push_back( small );
+	}
+	for ( uint32_t i = 0; i < tids.size(); i += 20 )
+	{
+		EXPECT_TRUE( segment->Update( tids[i], makeRecord( grown ) ) );
+		values[i] = grown;
+	}
+
+	// Big records at the end of the segment, all of them are removed again
+	std::vector<TID> tail;
+	for ( uint32_t i = 0; i < 100; ++i )
+	{
+		tail.push_back( segment->Insert( makeRecord( big ) ) );
+	}
+	for ( TID tid : tail )
+	{
+		EXPECT_TRUE( segment->Remove( tid ) );
+	}
+
+	// Only every fifth small record stays, the home pages have space for the forwarded ones again
+	std::vector<TID> kept;
+	std::vector<std::string> keptValues;
+	for ( uint32_t i = 0; i < tids.size(); ++i )
+	{
+		if ( i % 5 == 0 )
+		{
+			kept.push_back( tids[i] );
+			keptValues.push_back( values[i] );
+		}
+		else
+		{
+			EXPECT_TRUE( segment->Remove( tids[i] ) );
+		}
+	}
+	uint64_t pages = core->GetPagesOfRelation( segmentId );
+	uint64_t forwards = 0;
+	for ( uint64_t p = 0; p < pages; ++p )
+	{
+		BufferFrame& f = bm.FixPage( BufferManager::MergePageId( segmentId, p ), false );
+		SlottedPage* sp = reinterpret_cast<SlottedPage*>(f.GetData());
+		for ( uint64_t slotId = sp->GetNextForwardSlot( 0 ); slotId < sp->GetSlotCount(); slotId = sp->GetNextForwardSlot( slotId + 1 ) )
+		{
+			++forwards;
+		}
+		bm.UnfixPage( f, false );
+	}
+	EXPECT_LT( 0u, forwards );
+	// Write the pages back, so the file covers the tail before the vacuum
+	uint32_t poolPages = core->GetBufferStats().pageCount;
+	core->ResizeBuffer( 1 );
+	core->ResizeBuffer( poolPages );
+	struct stat fileStat;
+	ASSERT_EQ( 0, stat( std::to_string( segmentId ).c_str(), &fileStat ) );
+	uint64_t fileSize = static_cast<uint64_t>(fileStat.st_size);
+
+	// Readers keep finding all records while the vacuum runs
+	std::atomic<bool> done( false );
+	std::atomic<uint64_t> mismatches( 0 );
+	std::thread reader( [&]()
+	{
+		while ( !done )
+		{
+			for ( size_t i = 0; i < kept.size(); ++i )
+			{
+				Record r = segment->Lookup( kept[i] );
+				if ( r.GetLen() != keptValues[i].size() || memcmp( r.GetData(), keptValues[i].c_str(), r.GetLen() ) != 0 )
+				{
+					++mismatches;
+				}
+			}
+		}
+	} );
+	VacuumStats stats = segment->Vacuum();
+	done = true;
+	reader.join();
+	EXPECT_EQ( 0u, mismatches );
+	EXPECT_EQ( forwards, stats.movedRecords );
+	EXPECT_LT( 0u, stats.releasedSlots );
+	EXPECT_LT( 0u, stats.compactedPages );
+	EXPECT_EQ( pages - core->GetPagesOfRelation( segmentId ), stats.releasedPages );
+	EXPECT_GE( 2u, core->GetPagesOfRelation( segmentId ) );
+	ASSERT_EQ( 0, stat( std::to_string( segmentId ).c_str(), &fileStat ) );
+	EXPECT_GT( fileSize, static_cast<uint64_t>(fileStat.st_size) );
+	EXPECT_GE( core->GetPagesOfRelation( segmentId ) * DB_PAGE_SIZE, static_cast<uint64_t>(fileStat.st_size) );
+
+	// No forwarding slots are left, all records are found at their tids and by the table scan
+	for ( uint64_t p = 0; p < core->GetPagesOfRelation( segmentId ); ++p )
+	{
+		BufferFrame& f = bm.FixPage( BufferManager::MergePageId( segmentId, p ), false );
+		SlottedPage* sp = reinterpret_cast<SlottedPage*>(f.GetData());
+		EXPECT_EQ( sp->GetSlotCount(), sp->GetNextForwardSlot( 0 ) );
+		bm.UnfixPage( f, false );
+	}
+	for ( size_t i = 0; i < kept.size(); ++i )
+	{
+		Record r = segment->Lookup( kept[i] );
+		ASSERT_EQ( keptValues[i].size(), r.GetLen() );
+		EXPECT_EQ( 0, memcmp( r.GetData(), keptValues[i].c_str(), r.GetLen() ) );
+	}
+	TableScanOperator op( "dbtest", *core, *core->GetBufferManager() );
+	op.Open();
+	uint64_t scanned = 0;
+	while ( op.Next() )
+	{
+		++scanned;
+	}
+	op.Close();
+	EXPECT_EQ( kept.size(), scanned );
+
+	// Inserts continue on the remaining pages after the truncation, a second vacuum has nothing to do
+	pages = core->GetPagesOfRelation( segmentId );
+	TID tid = segment->Insert( makeRecord( small ) );
+	EXPECT_GT( pages, SplitTID( tid ).first );
+	EXPECT_EQ( pages, core->GetPagesOfRelation( segmentId ) );
+	EXPECT_TRUE( segment->Remove( tid ) );
+	stats = segment->Vacuum();
+	EXPECT_EQ( 0u, stats.movedRecords );
+	EXPECT_EQ( 0u, stats.releasedPages );
+	EXPECT_EQ( fixedFrames, core->GetBufferStats().fixedFrames );
+}
+
+// Batch inserts in a pool that is smaller than the relation. The extent pages of the second batch are still in the
+// buffer after a vacuum released them, so the misses of the extent can evict the frames of its hits. FixPages
+// must not wait for the frames it fixed itself.
+TEST_F( SegmentTest, InsertBatchSmallPool )
+{
+	segment.reset();
+	SDELETE( core );
+	core = new DBCore( 40 ); // The relation of the fixture is still there
+	segment = core->GetSPSegment( "dbtest" );
+	uint64_t segmentId = core->GetSegmentIdOfRelation( "dbtest" );
+	uint32_t fixedFrames = core->GetBufferStats().fixedFrames;
+	const std::string& s = testData[4];
+	std::vector<Record> records;
+	for ( uint32_t i = 0; i < 16 * DB_INSERT_EXTENT_PAGES; ++i )
+	{
+		records.push_back( Record( static_cast<uint32_t>(s.size()), reinterpret_cast<const uint8_t*>(s.c_str()) ) );
+	}
+	std::vector<TID> tids = segment->InsertBatch( records );
+	uint64_t pages = core->GetPagesOfRelation( segmentId );
+	EXPECT_LT( 40u, pages );
+
+	// Empty the second half of the relation and release it
+	std::vector<TID> kept;
+	for ( TID tid : tids )
+	{
+		if ( SplitTID( tid ).first < pages / 2 )
+		{
+			kept.push_back( tid );
+		}
+		else
+		{
+			EXPECT_TRUE( segment->Remove( tid ) );
+		}
+	}
+	EXPECT_LT( 0u, segment->Vacuum().releasedPages );
+	EXPECT_GT( pages, core->GetPagesOfRelation( segmentId ) );
+	// Reading the first half evicts most, but not all of the released pages
+	for ( TID tid : kept )
+	{
+		EXPECT_EQ( s.size(), segment->Lookup( tid ).GetLen() );
+	}
+
+	std::vector<TID> added = segment->InsertBatch( records );
+	kept.insert( kept.end(), added.begin(), added.end() );
+	for ( TID tid : kept )
+	{
+		Record r = segment->Lookup( tid );
+		ASSERT_EQ( s.size(), r.GetLen() );
+		EXPECT_EQ( 0, memcmp( r.GetData(), s.c_str(), r.GetLen() ) );
+	}
+	EXPECT_EQ( fixedFrames, core->GetBufferStats().fixedFrames );
+}
+
+// Inserts and removes records from several threads while vacuums release the pages at the end of the segment.
+// No insert may land on a released page, every record has to be found until it is removed.
+TEST_F( SegmentTest, InsertDuringVacuum )
+{
+	uint32_t fixedFrames = core->GetBufferStats().fixedFrames;
+	uint64_t segmentId = core->GetSegmentIdOfRelation( "dbtest" );
+	auto makeValue = []( uint32_t thread, uint32_t round, uint32_t i )
+	{
+		return std::to_string( thread ) + "-" + std::to_string( round ) + "-" + std::to_string( i ) + std::string( 400, 'v' );
+	};
+	auto makeRecord = []( const std::string& s )
+	{
+		return Record( static_cast<uint32_t>(s.size()), reinterpret_cast<const uint8_t*>(s.c_str()) );
+	};
+	// The kept records fill the first pages, everything behind them runs empty again and again
+	std::vector<TID> kept;
+	std::vector<std::string> keptValues;
+	for ( uint32_t i = 0; i < 100; ++i )
+	{
+		keptValues.push_back( makeValue( 0, 0, i ) );
+		kept.push_back( segment->Insert( makeRecord( keptValues.back() ) ) );
+	}
+
+	const uint32_t threadCount = 4;
+	std::atomic<uint32_t> running( threadCount );
+	std::atomic<uint64_t> mismatches( 0 );
+	std::vector<std::thread> threads;
+	for ( uint32_t t = 1; t <= threadCount; ++t )
+	{
+		threads.push_back( std::thread( [&, t]()
+		{
+			// Half of the threads use their own segment instance, they only learn about truncations through the descriptor
+			std::unique_ptr<SPSegment> own = t % 2 ? core->GetSPSegment( "dbtest" ) : nullptr;
+			SPSegment& s = own ? *own : *segment;
+			std::vector<TID> tids;
+			for ( uint32_t round = 0; round < 100; ++round )
+			{
+				tids.clear();
+				for ( uint32_t i = 0; i < 50; ++i )
+				{
+					tids.push_back( s.Insert( makeRecord( makeValue( t, round, i ) ) ) );
+					// The page can not be released while it holds the record
+					if ( SplitTID( tids.back() ).first >= core->GetPagesOfRelation( segmentId ) )
+					{
+						++mismatches;
+					}
+				}
+				for ( uint32_t i = 0; i < tids.size(); ++i )
+				{
+					std::string value = makeValue( t, round, i );
+					Record r = s.Lookup( tids[i] );
+					if ( r.GetLen() != value.size() || memcmp( r.GetData(), value.c_str(), r.GetLen() ) != 0 || !s.Remove( tids[i] ) )
+					{
+						++mismatches;
+					}
+				}
+			}
+			--running;
+		} ) );
+	}
+	uint64_t releasedPages = 0;
+	while ( running > 0 )
+	{
+		releasedPages += segment->Vacuum().releasedPages;
+	}
+	for ( std::thread& thread : threads )
+	{
+		thread.join();
+	}
+	releasedPages += segment->Vacuum().releasedPages;
+	EXPECT_EQ( 0u, mismatches );
+	EXPECT_LT( 0u, releasedPages );
+
+	// Only the pages of the kept records are left
+	uint64_t pages = core->GetPagesOfRelation( segmentId );
+	uint64_t records = 0;
+	for ( uint64_t p = 0; p < pages; ++p )
+	{
+		BufferFrame& f = core->GetBufferManager()->FixPage( BufferManager::MergePageId( segmentId, p ), false );
+		SlottedPage* sp = reinterpret_cast<SlottedPage*>(f.GetData());
+		EXPECT_TRUE( sp->IsInitialized() );
+		records += sp->GetRecordCount();
+		core->GetBufferManager()->UnfixPage( f, false );
+	}
+	EXPECT_EQ( kept.size(), records );
+	for ( size_t i = 0; i < kept.size(); ++i )
+	{
+		EXPECT_GT( pages, SplitTID( kept[i] ).first );
+		Record r = segment->Lookup( kept[i] );
+		ASSERT_EQ( keptValues[i].size(), r.GetLen() );
+		EXPECT_EQ( 0, memcmp( r.GetData(), keptValues[i].c_str(), r.GetLen() ) );
+	}
+	EXPECT_EQ( fixedFrames, core->GetBufferStats().fixedFrames );
+}
+
+// A record whose home page is full stays on its page during a vacuum, it is moved home once the page has the space.
+TEST_F( SegmentTest, VacuumFullHomePage )
+{
+	uint64_t segmentId = core->GetSegmentIdOfRelation( "dbtest" );
+	BufferManager& bm = *core->GetBufferManager();
+	const std::string small( 100, 's' );
+	const std::string grown( 3000, 'g' );
+	std::vector<TID> tids;
+	while ( tids.empty() || SplitTID( tids.back() ).first == 0 )
+	{
+		tids.push_back( segment->Insert( Record( static_cast<uint32_t>(small.size()), reinterpret_cast<const uint8_t*>(small.c_str()) ) ) );
+	}
+	tids.pop_back();
+	ASSERT_LT( 30u, tids.size() );
+	EXPECT_TRUE( segment->Update( tids[0], Record( static_cast<uint32_t>(grown.size()), reinterpret_cast<const uint8_t*>(grown.c_str()) ) ) );
+	auto forwardedTo = [&]()
+	{
+		BufferFrame& f = bm.FixPage( BufferManager::MergePageId( segmentId, 0 ), false );
+		SlottedPage::Slot* slot = reinterpret_cast<SlottedPage*>(f.GetData())->GetSlot( SplitTID( tids[0] ).second );
+		TID other = slot->IsOtherRecordTID() ? slot->GetOtherRecordTID() : tids[0];
+		bm.UnfixPage( f, false );
+		return other;
+	};
+	TID forwarded = forwardedTo();
+	ASSERT_NE( tids[0], forwarded );
+
+	// The home page has no space for the grown record, it is not touched
+	VacuumStats stats = segment->Vacuum();
+	EXPECT_EQ( 0u, stats.movedRecords );
+	EXPECT_EQ( forwarded, forwardedTo() );
+	Record r = segment->Lookup( tids[0] );
+	ASSERT_EQ( grown.size(), r.GetLen() );
+	EXPECT_EQ( 0, memcmp( r.GetData(), grown.c_str(), r.GetLen() ) );
+
+	for ( uint32_t i = 1; i <= 30; ++i )
+	{
+		EXPECT_TRUE( segment->Remove( tids[i] ) );
+	}
+	stats = segment->Vacuum();
+	EXPECT_EQ( 1u, stats.movedRecords );
+	EXPECT_EQ( tids[0], forwardedTo() );
+	Record home = segment->Lookup( tids[0] );
+	ASSERT_EQ( grown.size(), home.GetLen() );
+	EXPECT_EQ( 0, memcmp( home.GetData(), grown.c_str(), home.GetLen() ) );
+}
@@ -4,6 +4,10 @@
 
 #include "gtest/gtest.h"
 
+#include <vector>
+#include <thread>
+#include <atomic>
+
 /* Comparator functor for uint64_t*/
 struct MyCustomUInt64Cmp
 {
@@ -154,4 +158,94 @@ TYPED_TEST( BPTreeTest, BPTreeFull )
 	for ( uint64_t i = 0; i < n; ++i )
 		this->bTree->Erase( getKey<typename TypeParam::T>( i ) );
 	EXPECT_EQ( this->bTree->GetSize(), 0 );
-}
\ No newline at end of file
+}
+
+TYPED_TEST( BPTreeTest, ConcurrentLookupDuringInsert )
+{
+	typedef typename TypeParam::T T;
+	const uint64_t n = 20000;
+	const uint32_t readers = 3;
+	// Keys are generated up front, the key generators are not thread safe
+	std::vector<T> keys;
+	for ( uint64_t i = 0; i < 2 * n; ++i )
+	{
+		keys.push_back( getKey<T>( i ) );
+	}
+	for ( uint64_t i = 0; i < n; ++i )
+	{
+		this->bTree->Insert( keys[i], static_cast<TID>(i) );
+	}
+
+	// Readers look up the first half while the writer splits nodes by inserting the second half
+	std::atomic<uint64_t> failures( 0 );
+	std::vector<std::thread> threads;
+	for ( uint32_t r = 0; r < readers; ++r )
+	{
+		threads.push_back( std::thread( [this, &keys, &failures, n, r]()
+		{
+			for ( uint64_t i = r; i < n; i += 2 )
+			{
+				std::pair<bool, TID> foundTID = this->bTree->Lookup( keys[i] );
+				if ( !foundTID.first || foundTID.second != i )
+				{
+					++failures;
+				}
+			}
+		} ) );
+	}
+	for ( uint64_t i = n; i < 2 * n; ++i )
+	{
+		this->bTree->Insert( keys[i], static_cast<TID>(i) );
+	}
+	for ( std::thread& t : threads )
+	{
+		t.join();
+	}
+	EXPECT_EQ( 0u, failures.load() );
+	EXPECT_EQ( 2 * n, this->bTree->GetSize() );
+}
+
+// Counts while another thread inserts between the existing keys, so leaves split everywhere during the count.
+// Every count has to include all entries inserted before it started and nothing that was not inserted after it ended.
+TYPED_TEST( BPTreeTest, ConcurrentGetSizeDuringInsert )
+{
+	typedef typename TypeParam::T T;
+	const uint64_t n = 20000;
+	std::vector<T> keys;
+	for ( uint64_t i = 0; i < 2 * n; ++i )
+	{
+		keys.push_back( getKey<T>( i ) );
+	}
+	for ( uint64_t i = 0; i < 2 * n; i += 2 )
+	{
+		this->bTree->Insert( keys[i], static_cast<TID>(i) );
+	}
+
+	std::atomic<uint64_t> inserted( n );
+	std::thread writer( [this, &keys, &inserted, n]()
+	{
+		// Spread over all leaves, so they fill up and split at about the same time
+		for ( uint64_t j = 0; j < n; ++j )
+		{
+			uint64_t i = 2 * ((j * 7919) % n) + 1;
+			this->bTree->Insert( keys[i], static_cast<TID>(i) );
+			++inserted;
+		}
+	} );
+	uint32_t counts = 0;
+	uint32_t wrongCounts = 0;
+	while ( inserted < 2 * n )
+	{
+		uint64_t before = inserted;
+		uint64_t size = this->bTree->GetSize();
+		if ( size < before || size > inserted + 1 ) // The writer might not have counted its last insert yet
+		{
+			++wrongCounts;
+		}
+		++counts;
+	}
+	writer.join();
+	EXPECT_LT( 0u, counts );
+	EXPECT_EQ( 0u, wrongCounts );
+	EXPECT_EQ( 2 * n, this->bTree->GetSize() );
+}
@@ -1,6 +1,7 @@
 #include "sql/Schema.h"
 #include "sql/SchemaParser.h"
 #include "DBCore.h"
+#include "buffer/BufferManager.h"
 #include "utility/macros.h"
 #include "utility/helpers.h"
 
@@ -117,4 +118,68 @@ TEST_F( SchemaTest, SerializationDeserializationMultipages )
 	SDELETE( core );
 	core = new DBCore();
 	EXPECT_EQ( olds, *core->GetSchema() );
-}
\ No newline at end of file
+}
+
+// Version 1 schemas start with the relation count and have no free space inventory segments, loading assigns new ones
+TEST_F( SchemaTest, DeserializationVersion1 )
+{
+	std::vector<uint8_t> data;
+	auto append = [&data]( const void* value, size_t size )
+	{
+		const uint8_t* bytes = reinterpret_cast<const uint8_t*>(value);
+		data.insert( data.end(), bytes, bytes + size );
+	};
+	uint32_t numRelations = 1;
+	uint64_t segmentId = 1;
+	uint64_t pageCount = 3;
+	std::string name = "country";
+	uint32_t nameLength = static_cast<uint32_t>(name.size());
+	uint32_t empty = 0;
+	append( &numRelations, 4 );
+	append( &segmentId, 8 );
+	append( &pageCount, 8 );
+	append( &nameLength, 4 );
+	append( name.data(), name.size() );
+	append( &empty, 4 ); // Attributes
+	append( &empty, 4 ); // Indices
+	append( &empty, 4 ); // Primary key
+
+	Schema deserialized;
+	deserialized.Deserialize( &data[0] );
+	ASSERT_EQ( 1u, deserialized.relations.size() );
+	EXPECT_EQ( "country", deserialized.relations[0].name );
+	EXPECT_EQ( 3u, deserialized.relations[0].pagecount );
+	EXPECT_EQ( 0u, deserialized.relations[0].fsiSegmentId );
+	EXPECT_EQ( std::vector<uint64_t>( { segmentId } ), deserialized.AssignMissingInventories() );
+	EXPECT_EQ( 2u, deserialized.relations[0].fsiSegmentId );
+	EXPECT_TRUE( deserialized.AssignMissingInventories().empty() );
+}
+
+// Page counts and roots live in the segment descriptors, the schema gets them when it is read or written
+TEST_F( SchemaTest, SegmentDescriptors )
+{
+	core->AddRelationsFromString( "create table country(country_id char( 2 ), short_name char( 20 ), primary key( country_id ));" );
+	uint64_t segmentId = core->GetSegmentIdOfRelation( "country" );
+	uint64_t indexId = core->GetSegmentOfIndex( "country", "country_id" );
+	SegmentDescriptor& relation = core->GetRelationDescriptor( segmentId );
+	EXPECT_EQ( &relation, &core->GetRelationDescriptor( segmentId ) ); // Resolved once, stays the same
+	EXPECT_EQ( segmentId, relation.segmentId );
+	EXPECT_THROW( core->GetRelationDescriptor( indexId ), std::runtime_error );
+	EXPECT_THROW( core->GetIndexDescriptor( segmentId ), std::runtime_error );
+
+	EXPECT_EQ( BufferManager::MergePageId( segmentId, 2 ), core->AddPagesToRelation( segmentId, 3 ) );
+	EXPECT_EQ( 3u, relation.pageCount.load() );
+	uint64_t indexPages = core->GetPagesOfIndex( indexId );
+	EXPECT_EQ( BufferManager::MergePageId( indexId, indexPages ), core->AddPagesToIndex( indexId, 1 ) );
+	core->SetRootOfIndex( indexId, BufferManager::MergePageId( indexId, indexPages ) );
+	EXPECT_EQ( 3u, core->GetSchema()->relations[0].pagecount );
+
+	// Adding relations keeps the counts, reopening reads them from the schema
+	core->AddRelationsFromString( "create table department(id integer, primary key( id ), name char( 25 ));" );
+	EXPECT_EQ( 3u, core->GetPagesOfRelation( segmentId ) );
+	SDELETE( core );
+	core = new DBCore();
+	EXPECT_EQ( 3u, core->GetPagesOfRelation( segmentId ) );
+	EXPECT_EQ( indexPages + 1, core->GetPagesOfIndex( indexId ) );
+	EXPECT_EQ( BufferManager::MergePageId( indexId, indexPages ), core->GetRootOfIndex( indexId ) );
+}
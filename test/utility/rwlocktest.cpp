@@ -1,53 +1,63 @@
 #include "utility/RWLock.h"
+#include "utility/HybridLatch.h"
+#include "utility/LatchProfiler.h"
 #include "utility/macros.h"
 
 #include "gtest/gtest.h"
 
+#include <atomic>
 #include <chrono>
+#include <iostream>
 #include <thread>
+#include <vector>
 
-// Test that our implementation correctly wraps the platform dependent rwlocks
+// Test that our implementations correctly wrap the platform dependent rwlocks and that the hybrid latch
+// behaves the same way
+template <class T>
 class RWLockTest : public ::testing::Test
 {
 public:
 	virtual void SetUp() override
 	{
-		lock = new RWLock();
+		lock = new T();
 	}
 	virtual void TearDown() override
 	{
 		SDELETE( lock );
 	}
-	RWLock* lock;
+	T* lock;
 };
 
-TEST_F(RWLockTest, NoReadWhenWriting)
+typedef ::testing::Types<RWLock, HybridLatch> LockTypes;
+TYPED_TEST_CASE( RWLockTest, LockTypes );
+
+TYPED_TEST( RWLockTest, NoReadWhenWriting)
 {
 	uint32_t x = 0;
 	std::thread t1( [&]()
 	{
-		lock->LockWrite();
+		this->lock->LockWrite();
 		std::this_thread::sleep_for( std::chrono::milliseconds(1000) );
 		for ( uint32_t i = 0; i < 100000; ++i)
 		{
 			++x;
 		}
-		lock->UnlockWrite();
+		this->lock->UnlockWrite();
 	} );
 	uint32_t num = 0;
 	std::this_thread::sleep_for( std::chrono::milliseconds( 500 ) );
 	std::thread t2( [&]()
 	{
-		lock->LockRead();
+		this->lock->LockRead();
 		num = x;
-		lock->UnlockRead();
+		this->lock->UnlockRead();
 	} );
 	t1.join();
 	t2.join();
 	EXPECT_EQ( x, num );
 }
 
-TEST_F(RWLockTest, NoWriteWhenReading)
+TYPED_TEST( RWLockTest, NoWriteWhenReading)
 {
 	uint32_t inc = 0;
 	uint32_t x = 0;
@@ -56,35 +66,35 @@ TEST_F(RWLockTest, NoWriteWhenReading)
 	// Readers
 	std::thread tx( [&]()
 	{
-		lock->LockRead();
+		this->lock->LockRead();
 		std::this_thread::sleep_for( std::chrono::milliseconds( 1000 ) );
 		x = inc;
-		lock->UnlockRead();
+		this->lock->UnlockRead();
 	} );
 	std::thread ty( [&]()
 	{
-		lock->LockRead();
+		this->lock->LockRead();
 		std::this_thread::sleep_for( std::chrono::milliseconds( 1000 ) );
 		y = inc;
-		lock->UnlockRead();
+		this->lock->UnlockRead();
 	} );
 	std::thread tz( [&]()
 	{
-		lock->LockRead();
+		this->lock->LockRead();
 		std::this_thread::sleep_for( std::chrono::milliseconds( 1000 ) );
 		y = inc;
-		lock->UnlockRead();
+		this->lock->UnlockRead();
 	} );
 	// Writer
 	std::this_thread::sleep_for( std::chrono::milliseconds( 500 ) );
 	std::thread tw( [&]()
 	{
-		lock->LockWrite();
+		this->lock->LockWrite();
 		for ( uint32_t i = 0; i < 100000; ++i )
 		{
 			++inc;
 		}
-		lock->UnlockWrite();
+		this->lock->UnlockWrite();
 	} );
 	tx.join();
 	ty.join();
@@ -97,22 +107,22 @@ TEST_F(RWLockTest, NoWriteWhenReading)
 	EXPECT_EQ( 100000u, inc );
 }
 
-TEST_F( RWLockTest, TryWriteFails )
+TYPED_TEST( RWLockTest, TryWriteFails )
 {
 	std::thread t1( [&]()
 	{
-		lock->LockRead();
+		this->lock->LockRead();
 		std::this_thread::sleep_for( std::chrono::milliseconds( 1000 ) );
-		lock->UnlockRead();
+		this->lock->UnlockRead();
 	} );
 	bool failedLock = false;
 	std::this_thread::sleep_for( std::chrono::milliseconds( 500 ) );
 	std::thread t2( [&]()
 	{
-		failedLock = !lock->TryLockWrite();
+		failedLock = !this->lock->TryLockWrite();
 		if ( !failedLock )
 		{
-			lock->UnlockWrite();
+			this->lock->UnlockWrite();
 		}
 	} );
 	t1.join();
@@ -120,7 +130,7 @@ TEST_F( RWLockTest, TryWriteFails )
 	EXPECT_EQ( true, failedLock );
 }
 
-TEST_F(RWLockTest, SimultaneousReaders)
+TYPED_TEST( RWLockTest, SimultaneousReaders)
 {
 
 	auto start = std::chrono::high_resolution_clock::now();
@@ -129,9 +139,9 @@ TEST_F(RWLockTest, SimultaneousReaders)
 	{
 		ts.push_back(new std::thread( [&]()
 		{
-			lock->LockRead();
+			this->lock->LockRead();
 			std::this_thread::sleep_for( std::chrono::milliseconds( 1000 ) );
-			lock->UnlockRead();
+			this->lock->UnlockRead();
 		} ) );
 	}
 	for (std::thread* t : ts)
@@ -143,4 +153,263 @@ TEST_F(RWLockTest, SimultaneousReaders)
 	std::chrono::duration<double, std::milli> elapsed = end - start;
 	double elapsedMs = elapsed.count();
 	EXPECT_GT( 1500.0, elapsedMs );
-}
\ No newline at end of file
+}
+
+TEST( HybridLatchTest, UpgradeDowngrade )
+{
+	HybridLatch latch;
+	// One word, plus the site pointer when profiling
+	EXPECT_EQ( LatchProfiler::IsEnabled() ? 16u : 8u, sizeof( HybridLatch ) );
+	latch.LockRead();
+	latch.LockRead();
+	EXPECT_FALSE( latch.TryUpgrade() ); // Two readers
+	latch.UnlockRead();
+	ASSERT_TRUE( latch.TryUpgrade() );
+	EXPECT_FALSE( latch.TryLockRead() );
+	latch.Downgrade();
+	EXPECT_TRUE( latch.TryLockRead() ); // Readers can join after downgrading
+	EXPECT_FALSE( latch.TryLockWrite() );
+	latch.UnlockRead();
+	latch.UnlockRead();
+	EXPECT_TRUE( latch.TryLockWrite() );
+	latch.UnlockWrite();
+}
+
+TEST( HybridLatchTest, OptimisticVersions )
+{
+	HybridLatch latch;
+	uint64_t version = 0;
+	ASSERT_TRUE( latch.ReadVersion( version ) );
+	latch.LockRead();
+	latch.UnlockRead();
+	EXPECT_TRUE( latch.ValidateVersion( version ) ); // Readers do not change the version
+	latch.LockWrite();
+	uint64_t locked = 0;
+	EXPECT_FALSE( latch.ReadVersion( locked ) );
+	EXPECT_FALSE( latch.ValidateVersion( version ) );
+	latch.UnlockWrite();
+	EXPECT_FALSE( latch.ValidateVersion( version ) );
+	ASSERT_TRUE( latch.ReadVersion( version ) );
+	EXPECT_TRUE( latch.ValidateVersion( version ) );
+}
+
+TEST( HybridLatchTest, FairLatchBlocksReadersBehindWriter )
+{
+	for ( bool fair : { false, true } )
+	{
+		HybridLatch latch( fair );
+		EXPECT_EQ( fair, latch.IsFair() );
+		latch.LockRead();
+		std::atomic<bool> written( false );
+		std::thread writer( [&]()
+		{
+			latch.LockWrite();
+			written = true;
+			latch.UnlockWrite();
+		} );
+		std::this_thread::sleep_for( std::chrono::milliseconds( 100 ) );
+		// Writer is waiting now, only unfair latches let another reader in
+		bool readerGotIn = latch.TryLockRead();
+		EXPECT_EQ( !fair, readerGotIn );
+		if ( readerGotIn )
+		{
+			latch.UnlockRead();
+		}
+		EXPECT_FALSE( written.load() );
+		latch.UnlockRead();
+		writer.join();
+		EXPECT_TRUE( written.load() );
+	}
+}
+
+TEST( HybridLatchTest, NoLostUpdates )
+{
+	HybridLatch latch;
+	const uint32_t threads = 4;
+	const uint32_t iterations = 50000;
+	uint64_t counter = 0;
+	std::vector<std::thread> workers;
+	for ( uint32_t t = 0; t < threads; ++t )
+	{
+		workers.push_back( std::thread( [&, t]()
+		{
+			for ( uint32_t i = 0; i < iterations; ++i )
+			{
+				if ( (i + t) % 3 == 0 )
+				{
+					// Read, then upgrade or take the write lock
+					latch.LockRead();
+					if ( !latch.TryUpgrade() )
+					{
+						latch.UnlockRead();
+						latch.LockWrite();
+					}
+				}
+				else
+				{
+					latch.LockWrite();
+				}
+				++counter;
+				latch.UnlockWrite();
+			}
+		} ) );
+	}
+	for ( std::thread& worker : workers )
+	{
+		worker.join();
+	}
+	EXPECT_EQ( threads * iterations, counter );
+}
+
+/// <summary>
+/// Runs threads that lock and unlock the same lock, writePercent of the operations as writers.
+/// </summary>
+/// <returns>Operations per second.</returns>
+template <class T>
+static double RunLockBenchmark( uint32_t threads, uint32_t opsPerThread, uint32_t writePercent )
+{
+	T lock;
+	uint64_t shared = 0;
+	std::atomic<uint64_t> sink( 0 );
+	std::vector<std::thread> workers;
+	auto start = std::chrono::high_resolution_clock::now();
+	for ( uint32_t t = 0; t < threads; ++t )
+	{
+		workers.push_back( std::thread( [&, t]()
+		{
+			uint64_t local = 0;
+			for ( uint32_t i = 0; i < opsPerThread; ++i )
+			{
+				if ( (i * 7 + t) % 100 < writePercent )
+				{
+					lock.LockWrite();
+					++shared;
+					lock.UnlockWrite();
+				}
+				else
+				{
+					lock.LockRead();
+					local += shared;
+					lock.UnlockRead();
+				}
+			}
+			sink += local;
+		} ) );
+	}
+	for ( std::thread& worker : workers )
+	{
+		worker.join();
+	}
+	std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+	return threads * opsPerThread / elapsed.count();
+}
+
+// Compares pthread based RWLock and HybridLatch throughput for different write ratios
+TEST( HybridLatchTest, ThroughputBenchmark )
+{
+	const uint32_t threads = 4;
+	const uint32_t opsPerThread = 200000;
+	for ( uint32_t writePercent : { 0u, 10u, 50u } )
+	{
+		double rwlock = RunLockBenchmark<RWLock>( threads, opsPerThread, writePercent );
+		double latch = RunLockBenchmark<HybridLatch>( threads, opsPerThread, writePercent );
+		std::cout << "[ PERF     ] Writes: " << writePercent << "%"
+			<< " RWLock ops/s: " << static_cast<uint64_t>(rwlock)
+			<< " HybridLatch ops/s: " << static_cast<uint64_t>(latch) << std::endl;
+		EXPECT_LT( 0.0, latch );
+	}
+	std::cout << "[ PERF     ] Size RWLock: " << sizeof( RWLock ) << " HybridLatch: " << sizeof( HybridLatch ) << std::endl;
+}
+
+/// <summary>
+/// Gets the report entry of the site, nullptr if the site is not in the report.
+/// </summary>
+static const LatchSiteStats* FindInReport( const std::vector<LatchSiteStats>& report, const std::string& name )
+{
+	for ( const LatchSiteStats& stats : report )
+	{
+		if ( stats.name == name )
+		{
+			return &stats;
+		}
+	}
+	return nullptr;
+}
+
+TEST( LatchProfilerTest, SitesRankedByWait )
+{
+	LatchSite* calm = LatchProfiler::GetSite( "LatchProfilerTest::calm" );
+	LatchSite* busy = LatchProfiler::GetSite( "LatchProfilerTest::busy" );
+	EXPECT_EQ( calm, LatchProfiler::GetSite( "LatchProfilerTest::calm" ) );
+	EXPECT_NE( calm, busy );
+
+	auto start = std::chrono::steady_clock::now();
+	for ( uint32_t i = 0; i < 100; ++i )
+	{
+		calm->RecordAcquisition();
+	}
+	busy->RecordAcquisition();
+	busy->RecordContended( start - std::chrono::milliseconds( 5 ) );
+
+	LatchSiteStats calmStats = calm->GetStats();
+	EXPECT_EQ( 100u, calmStats.acquisitions );
+	EXPECT_EQ( 0u, calmStats.wait.count );
+	LatchSiteStats busyStats = busy->GetStats();
+	EXPECT_EQ( 2u, busyStats.acquisitions );
+	EXPECT_EQ( 1u, busyStats.wait.count );
+	EXPECT_LE( 5000000u, busyStats.wait.totalNs );
+	EXPECT_DOUBLE_EQ( 0.5, busyStats.GetContentionRatio() );
+
+	// The site that waited comes first, although it was acquired less often
+	std::vector<LatchSiteStats> report = LatchProfiler::GetReport();
+	const LatchSiteStats* calmEntry = FindInReport( report, "LatchProfilerTest::calm" );
+	const LatchSiteStats* busyEntry = FindInReport( report, "LatchProfilerTest::busy" );
+	ASSERT_NE( nullptr, calmEntry );
+	ASSERT_NE( nullptr, busyEntry );
+	EXPECT_LT( busyEntry, calmEntry );
+	for ( size_t i = 1; i < report.size(); ++i )
+	{
+		EXPECT_GE( report[i - 1].wait.totalNs, report[i].wait.totalNs );
+	}
+	EXPECT_NE( std::string::npos, LatchProfiler::GetReportString().find( "LatchProfilerTest::busy" ) );
+
+	calm->Reset();
+	busy->Reset();
+	EXPECT_EQ( 0u, calm->GetStats().acquisitions );
+	EXPECT_EQ( nullptr, FindInReport( LatchProfiler::GetReport(), "LatchProfilerTest::busy" ) );
+}
+
+TEST( LatchProfilerTest, LocksReportContention )
+{
+	HybridLatch latch( false, "LatchProfilerTest::latch" );
+	ProfiledMutex mutex( "LatchProfilerTest::mutex" );
+	latch.LockWrite();
+	mutex.lock();
+	std::thread waiter( [&]()
+	{
+		latch.LockWrite();
+		latch.UnlockWrite();
+		std::lock_guard<ProfiledMutex> lock( mutex );
+	} );
+	std::this_thread::sleep_for( std::chrono::milliseconds( 50 ) );
+	latch.UnlockWrite();
+	std::this_thread::sleep_for( std::chrono::milliseconds( 50 ) );
+	mutex.unlock();
+	waiter.join();
+
+	LatchSiteStats latchStats = LatchProfiler::GetSite( "LatchProfilerTest::latch" )->GetStats();
+	LatchSiteStats mutexStats = LatchProfiler::GetSite( "LatchProfilerTest::mutex" )->GetStats();
+	if ( !LatchProfiler::IsEnabled() )
+	{
+		// Locks do not report without DB_LATCH_PROFILING
+		EXPECT_EQ( 0u, latchStats.acquisitions );
+		EXPECT_EQ( 0u, mutexStats.acquisitions );
+		return;
+	}
+	EXPECT_EQ( 2u, latchStats.acquisitions );
+	EXPECT_EQ( 1u, latchStats.wait.count );
+	EXPECT_LE( 10000000u, latchStats.wait.totalNs );
+	EXPECT_EQ( 2u, mutexStats.acquisitions );
+	EXPECT_EQ( 1u, mutexStats.wait.count );
+	EXPECT_LE( 10000000u, mutexStats.wait.totalNs );
+}